@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "concurrent_gc.h"
+#include "copy_collector.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+#include "mark_compact_collector.h"
+#include "region_collector.h"
+
+/*
+Compares the footprint and throughput of the copying, mark-compact and
+region collectors on the same workload: a fixed number of live objects of random
+sizes, each randomly replaced by a new object until `iterations` objects have
+been allocated.
+
+Footprint is the smallest heap reservation with which the workload completes.
+Throughput is measured with each collector given the same reservation.
+
+Usage: collector_bench [live objects] [iterations]
+*/
+
+namespace
+{
+struct Workload {
+    size_t live_objects;
+    size_t iterations;
+    size_t max_size;
+};
+
+/**
+ * @brief Table of roots which are visible to every collection
+ */
+class RootTable
+{
+  private:
+    std::vector<FatPtr> m_slots;
+    size_t m_source;
+
+  public:
+    explicit RootTable(size_t size) : m_slots(size, FatPtr{0})
+    {
+        m_source = gcpp::GCRoots::get_instance().add_root_source(
+            [this](std::vector<FatPtr*>& out) {
+                for (auto& slot : m_slots) {
+                    out.push_back(&slot);
+                }
+            });
+    }
+
+    ~RootTable() { gcpp::GCRoots::get_instance().remove_root_source(m_source); }
+    RootTable(const RootTable&) = delete;
+    RootTable& operator=(const RootTable&) = delete;
+    RootTable(RootTable&&) = delete;
+    RootTable& operator=(RootTable&&) = delete;
+
+    FatPtr& operator[](size_t index) { return m_slots[index]; }
+};
+
+using CopyingGC =
+    gcpp::CopyingCollector<gcpp::SerialGCPolicy, gcpp::FinalGenerationPolicy>;
+using CompactingGC = gcpp::MarkCompactCollector<gcpp::SerialGCPolicy,
+                                                gcpp::FinalGenerationPolicy>;
+using RegionGC =
+    gcpp::RegionCollector<gcpp::SerialGCPolicy, gcpp::FinalGenerationPolicy>;
+
+/** Bytes reserved by a collector with the given heap size */
+template <typename Collector>
+size_t reserved_bytes(size_t heap_size)
+{
+    if constexpr (std::is_same_v<Collector, CopyingGC>) {
+        return 2 * heap_size;
+    } else if constexpr (std::is_same_v<Collector, RegionGC>) {
+        // the heap is a whole number of regions
+        const auto region = RegionGC::default_region_size;
+        return std::max((heap_size + region - 1) / region, size_t{1}) * region;
+    } else {
+        return heap_size;
+    }
+}
+
+/** Heap size of a collector which reserves the given number of bytes */
+template <typename Collector>
+size_t heap_size_for(size_t reserved)
+{
+    if constexpr (std::is_same_v<Collector, CopyingGC>) {
+        return reserved / 2;
+    } else {
+        return reserved;
+    }
+}
+
+/**
+ * @brief Runs the workload
+ *
+ * @return the duration of the workload in seconds, or nullopt if the heap
+ * was exhausted
+ */
+template <typename Collector>
+std::optional<double> run_workload(size_t heap_size, const Workload& workload)
+{
+    Collector collector(heap_size);
+    RootTable roots(workload.live_objects);
+    // same seed for every run so that every run does the same work
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<size_t> sizes(16, workload.max_size);
+    std::uniform_int_distribution<size_t> slots(0, workload.live_objects - 1);
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        for (size_t i = 0; i < workload.iterations; ++i) {
+            const auto size = sizes(rng);
+            auto ptr = collector.alloc(size, std::align_val_t{16});
+            memset(ptr.as_ptr(), static_cast<int>(i & 0xFF), size);
+            roots[slots(rng)] = ptr;
+        }
+    } catch (const std::bad_alloc&) {
+        return {};
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+/**
+ * @brief Finds the smallest reservation, in pages, with which the workload
+ * completes
+ */
+template <typename Collector>
+size_t min_reserved(const Workload& workload)
+{
+    const auto page = gcpp::page_size_ceil(1);
+    size_t lo = 1;
+    size_t hi = 1;
+    while (!run_workload<Collector>(heap_size_for<Collector>(hi * page),
+                                    workload)) {
+        lo = hi;
+        hi *= 2;
+    }
+    while (lo + 1 < hi) {
+        const auto mid = lo + (hi - lo) / 2;
+        if (run_workload<Collector>(heap_size_for<Collector>(mid * page),
+                                    workload)) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    return reserved_bytes<Collector>(heap_size_for<Collector>(hi * page));
+}
+
+template <typename Collector>
+void report(const std::string& name, size_t min_reserved, size_t reserved,
+            const Workload& workload)
+{
+    const auto time =
+        run_workload<Collector>(heap_size_for<Collector>(reserved), workload);
+    std::cout << std::setw(14) << name << std::setw(16) << min_reserved / 1024;
+    if (time) {
+        std::cout << std::setw(16) << std::fixed << std::setprecision(0)
+                  << static_cast<double>(workload.iterations) / *time;
+    } else {
+        std::cout << std::setw(16) << "out of memory";
+    }
+    std::cout << "\n";
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    GC_UPDATE_STACK_RANGE();
+    const auto workload = Workload{
+        argc > 1 ? std::stoul(argv[1]) : 500,
+        argc > 2 ? std::stoul(argv[2]) : 20000,
+        256,
+    };
+    const auto copying_min = min_reserved<CopyingGC>(workload);
+    const auto compacting_min = min_reserved<CompactingGC>(workload);
+    const auto region_min = min_reserved<RegionGC>(workload);
+    // enough for every collector to run without collecting constantly
+    const auto reserved =
+        2 * std::max({copying_min, compacting_min, region_min});
+    std::cout << "live objects: " << workload.live_objects
+              << ", allocations: " << workload.iterations
+              << ", throughput reservation: " << reserved / 1024 << " KiB\n";
+    std::cout << std::setw(14) << "collector" << std::setw(16)
+              << "min heap (KiB)" << std::setw(16) << "allocs/s"
+              << "\n";
+    report<CopyingGC>("copying", copying_min, reserved, workload);
+    report<CompactingGC>("mark-compact", compacting_min, reserved, workload);
+    report<RegionGC>("region", region_min, reserved, workload);
+    return 0;
+}
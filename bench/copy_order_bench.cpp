@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "concurrent_gc.h"
+#include "copy_collector.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+
+/*
+Measures how fast the mutator traverses a binary tree after it is copied by
+a collection in each copy order of the copying collector.
+
+The nodes of the tree are first allocated in a random order, so the first
+row is the traversal of a scattered tree. The tree is then collected in each
+order and traversed again, both in full depth first, and by descending from
+the root to random leaves as a search would.
+
+Usage: copy_order_bench [depth] [passes]
+*/
+
+namespace
+{
+struct Node {
+    FatPtr left;
+    FatPtr right;
+    int64_t value;
+};
+
+using Collector =
+    gcpp::CopyingCollector<gcpp::SerialGCPolicy, gcpp::FinalGenerationPolicy>;
+
+/**
+ * @brief Allocates a complete binary tree of `nodes` nodes, placing the
+ * nodes at random addresses
+ *
+ * @return the root of the tree
+ */
+FatPtr make_tree(Collector& collector, size_t nodes)
+{
+    const auto ptrs = collector.alloc_batch(nodes, sizeof(Node),
+                                            std::align_val_t{alignof(Node)});
+    // position i of the tree, in level order, is node order[i]
+    std::vector<size_t> order(nodes);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), std::mt19937{0});
+    const auto child = [&](size_t idx) {
+        return idx < nodes ? ptrs[order[idx]] : FatPtr{0};
+    };
+    for (size_t i = 0; i < nodes; ++i) {
+        new (ptrs[order[i]].as_ptr())
+            Node{child(2 * i + 1), child(2 * i + 2), static_cast<int64_t>(i)};
+    }
+    return ptrs[order.front()];
+}
+
+const Node* as_node(const FatPtr& ptr)
+{
+    return reinterpret_cast<const Node*>(ptr.as_ptr());
+}
+
+/** Traverses the tree depth first `passes` times, returning ns per node */
+double traverse(const FatPtr& root, size_t nodes, size_t passes)
+{
+    int64_t sum = 0;
+    std::vector<const Node*> stack;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; ++pass) {
+        stack.push_back(as_node(root));
+        while (!stack.empty()) {
+            const auto* node = stack.back();
+            stack.pop_back();
+            sum += node->value;
+            if (node->right != FatPtr{0}) {
+                stack.push_back(as_node(node->right));
+            }
+            if (node->left != FatPtr{0}) {
+                stack.push_back(as_node(node->left));
+            }
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    // keep the traversal from being optimized out
+    if (sum == -1) {
+        std::cout << sum;
+    }
+    return std::chrono::duration<double, std::nano>(end - start).count() /
+           static_cast<double>(nodes * passes);
+}
+
+/**
+ * @brief Descends from the root to `nodes * passes / depth` random leaves,
+ * returning ns per level
+ */
+double descend(const FatPtr& root, size_t nodes, size_t depth, size_t passes)
+{
+    const auto descents = std::max<size_t>(nodes * passes / depth, 1);
+    auto rng = std::mt19937_64{1};
+    int64_t sum = 0;
+    size_t levels = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < descents; ++i) {
+        auto path = rng();
+        for (const auto* node = as_node(root);;) {
+            sum += node->value;
+            ++levels;
+            const auto& next = (path & 1) != 0 ? node->right : node->left;
+            path >>= 1;
+            if (next == FatPtr{0}) {
+                break;
+            }
+            node = as_node(next);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    if (sum == -1) {
+        std::cout << sum;
+    }
+    return std::chrono::duration<double, std::nano>(end - start).count() /
+           static_cast<double>(levels);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    GC_UPDATE_STACK_RANGE();
+    const size_t depth = argc > 1 ? std::stoul(argv[1]) : 16;
+    const size_t passes = argc > 2 ? std::stoul(argv[2]) : 20;
+    const size_t nodes = (size_t{1} << depth) - 1;
+    // only half of the heap can be allocated between collections
+    Collector collector(4 * nodes * sizeof(Node) + gcpp::page_size_ceil(1));
+    auto root = make_tree(collector, nodes);
+
+    std::cout << "nodes: " << nodes << ", node: " << sizeof(Node)
+              << " bytes, passes: " << passes << "\n";
+    std::cout << std::setw(14) << "order" << std::setw(16) << "ns/node"
+              << std::setw(16) << "ns/level\n";
+    std::cout << std::fixed << std::setprecision(2);
+    const auto report = [&](const char* name) {
+        std::cout << std::setw(14) << name << std::setw(15)
+                  << traverse(root, nodes, passes) << std::setw(15)
+                  << descend(root, nodes, depth, passes) << "\n";
+    };
+    report("allocation");
+    for (const auto& [order, name] :
+         {std::pair{gcpp::CopyOrder::DepthFirst, "depth first"},
+          std::pair{gcpp::CopyOrder::Hierarchical, "hierarchical"}}) {
+        collector.set_copy_order(order);
+        (void)collector.async_collect({&root}).get();
+        report(name);
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gc_scan.h"
+#include "safe_alloc.h"
+#include "safe_ptr.h"
+
+/*
+Compares churning standard containers, which are filled and then destroyed
+over and over, with `GCAllocator` and with `std::allocator`.
+
+A local container's storage is pinned until it is deallocated, while the
+storage of a container held by a GC object is attached to the object and
+freed with it.
+
+Usage: gc_allocator_bench [elements] [rounds]
+*/
+
+namespace
+{
+template <template <typename> typename Alloc>
+struct Containers {
+    std::vector<int64_t, Alloc<int64_t>> vec;
+    std::map<int64_t, int64_t, std::less<>,
+             Alloc<std::pair<const int64_t, int64_t>>>
+        map;
+};
+
+/** Fills `c` with `elements` elements, then frees its storage */
+template <typename C>
+void churn(C& c, size_t elements)
+{
+    for (size_t i = 0; i < elements; ++i) {
+        const auto val = static_cast<int64_t>(i);
+        c.vec.push_back(val);
+        c.map.emplace(val, val);
+    }
+    // the vector keeps its capacity unless it is swapped out
+    decltype(c.vec)().swap(c.vec);
+    c.map.clear();
+}
+
+/** Runs `round` `rounds` times, returning ns per element */
+template <typename Fn>
+double time_per_element(size_t elements, size_t rounds, Fn round)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        round();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() /
+           static_cast<double>(elements * rounds);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    GC_UPDATE_STACK_RANGE();
+    const size_t elements = argc > 1 ? std::stoul(argv[1]) : 64;
+    const size_t rounds = argc > 2 ? std::stoul(argv[2]) : 2000;
+    std::cout << "elements: " << elements << ", rounds: " << rounds << "\n";
+    std::cout << std::fixed << std::setprecision(2);
+    const auto standard = time_per_element(elements, rounds, [elements]() {
+        Containers<std::allocator> c;
+        churn(c, elements);
+    });
+    const auto local = time_per_element(elements, rounds, [elements]() {
+        Containers<gcpp::GCAllocator> c;
+        churn(c, elements);
+    });
+    const auto held = time_per_element(elements, rounds, [elements]() {
+        auto c = gcpp::make_safe<Containers<gcpp::GCAllocator>>();
+        churn(*c, elements);
+    });
+    std::cout << std::setw(16) << "std::allocator" << std::setw(12)
+              << standard << " ns/element\n";
+    std::cout << std::setw(16) << "local" << std::setw(12) << local
+              << " ns/element\n";
+    std::cout << std::setw(16) << "held by object" << std::setw(12) << held
+              << " ns/element\n";
+    return 0;
+}
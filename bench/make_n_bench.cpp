@@ -0,0 +1,77 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "gc_scan.h"
+#include "safe_alloc.h"
+#include "safe_ptr.h"
+
+/*
+Compares making a batch of objects with `make_safe_n` against making each of
+them with `make_safe`.
+
+`Point` can be constructed without throwing, so its batches are constructed
+without pinning. `Node` holds a GC pointer whose copy may allocate, so each of
+its objects is pinned while it is constructed.
+
+Usage: make_n_bench [batch size] [batches]
+*/
+
+namespace
+{
+struct Point {
+    int64_t x;
+    int64_t y;
+};
+
+struct Node {
+    int64_t val;
+    gcpp::SafePtr<Node> next;
+};
+
+/** Runs `make` `batches` times, returning ns per object */
+template <typename Fn>
+double time_per_object(size_t batch, size_t batches, Fn make)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < batches; ++i) {
+        make();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() /
+           static_cast<double>(batch * batches);
+}
+
+template <typename T>
+void compare(const std::string& name, size_t batch, size_t batches,
+             const T& val)
+{
+    const auto batched = time_per_object(batch, batches, [batch, &val]() {
+        (void)gcpp::make_safe_n<T>(batch, val);
+    });
+    const auto single = time_per_object(batch, batches, [batch, &val]() {
+        // like the pointers `make_safe_n` returns
+        auto res = gcpp::make_safe<gcpp::SafePtr<T>[]>(batch);
+        for (size_t i = 0; i < batch; ++i) {
+            res[i] = gcpp::make_safe<T>(val);
+        }
+    });
+    std::cout << std::setw(8) << name << std::setw(14) << batched
+              << std::setw(14) << single << "\n";
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    GC_UPDATE_STACK_RANGE();
+    const size_t batch = argc > 1 ? std::stoul(argv[1]) : 64;
+    const size_t batches = argc > 2 ? std::stoul(argv[2]) : 20000;
+    std::cout << "batch: " << batch << ", batches: " << batches << "\n";
+    std::cout << std::setw(8) << "type" << std::setw(14) << "make_safe_n"
+              << std::setw(14) << "make_safe" << "  (ns/object)\n";
+    std::cout << std::fixed << std::setprecision(2);
+    compare("Point", batch, batches, Point{1, 2});
+    compare("Node", batch, batches, Node{1, nullptr});
+    return 0;
+}
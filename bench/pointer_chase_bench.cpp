@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "concurrent_gc.h"
+#include "copy_collector.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+
+/*
+Measures the speed of following GC pointers through linked lists, to compare
+the default two word GC pointers with the single word pointers of
+`GCPP_COMPACT_PTR`. Build once in each mode and compare the output.
+
+Each list is traversed `passes` times. The nodes of the sequential list are
+linked in allocation order, while those of the shuffled list are linked in a
+random order so most hops miss the cache once the list outgrows it.
+
+Usage: pointer_chase_bench [nodes] [passes]
+*/
+
+namespace
+{
+struct Node {
+    FatPtr next;
+    int64_t value;
+};
+
+using Collector =
+    gcpp::CopyingCollector<gcpp::SerialGCPolicy, gcpp::FinalGenerationPolicy>;
+
+/**
+ * @brief Allocates a node for each element of `order` and links them in the
+ * order given by `order`
+ *
+ * @return the head of the list
+ */
+FatPtr make_list(Collector& collector, const std::vector<size_t>& order)
+{
+    // nodes are contiguous in allocation order
+    const auto nodes = collector.alloc_batch(order.size(), sizeof(Node),
+                                             std::align_val_t{alignof(Node)});
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        new (nodes[i].as_ptr()) Node{FatPtr{0}, static_cast<int64_t>(i)};
+    }
+    for (size_t i = 0; i + 1 < order.size(); ++i) {
+        reinterpret_cast<Node*>(nodes[order[i]].as_ptr())->next =
+            nodes[order[i + 1]];
+    }
+    return nodes[order.front()];
+}
+
+/** Follows the list from `head` `passes` times, returning ns per hop */
+double chase(FatPtr head, size_t nodes, size_t passes)
+{
+    int64_t sum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t pass = 0; pass < passes; ++pass) {
+        for (auto* node = reinterpret_cast<const Node*>(head.as_ptr());
+             node != nullptr;
+             node = reinterpret_cast<const Node*>(node->next.as_ptr())) {
+            sum += node->value;
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    // keep the traversal from being optimized out
+    if (sum == -1) {
+        std::cout << sum;
+    }
+    return std::chrono::duration<double, std::nano>(end - start).count() /
+           static_cast<double>(nodes * passes);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    GC_UPDATE_STACK_RANGE();
+    const size_t nodes = argc > 1 ? std::stoul(argv[1]) : 1 << 18;
+    const size_t passes = argc > 2 ? std::stoul(argv[2]) : 20;
+#ifdef GCPP_COMPACT_PTR
+    const auto mode = "compact";
+#else
+    const auto mode = "default";
+#endif
+    // large enough that building both lists never collects. Only half of
+    // the heap can be allocated between collections
+    Collector collector(4 * nodes * sizeof(Node) + gcpp::page_size_ceil(1));
+    std::vector<size_t> order(nodes);
+    std::iota(order.begin(), order.end(), 0);
+    const auto sequential = make_list(collector, order);
+    std::shuffle(order.begin(), order.end(), std::mt19937{0});
+    const auto shuffled = make_list(collector, order);
+
+    std::cout << "pointers: " << mode << " (" << sizeof(FatPtr)
+              << " bytes), node: " << sizeof(Node) << " bytes, nodes: "
+              << nodes << ", passes: " << passes << "\n";
+    std::cout << std::setw(12) << "list" << std::setw(16) << "ns/hop\n";
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::setw(12) << "sequential" << std::setw(15)
+              << chase(sequential, nodes, passes) << "\n";
+    std::cout << std::setw(12) << "shuffled" << std::setw(15)
+              << chase(shuffled, nodes, passes) << "\n";
+    return 0;
+}
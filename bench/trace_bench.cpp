@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "concurrent_gc.h"
+#include "copy_collector.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+
+/*
+Measures the time of collections of the copying collector on a randomly
+linked graph, for several prefetch distances of its trace.
+
+Every node is reachable through a chain linking the nodes in a random order,
+and has another edge to a random node, so the trace misses the cache on most
+objects once the graph outgrows it.
+
+Usage: trace_bench [nodes] [collections]
+*/
+
+namespace
+{
+struct Node {
+    FatPtr chain;
+    FatPtr edge;
+    /** Pads the node to a cache line */
+    std::array<int64_t, (64 - 2 * sizeof(FatPtr)) / sizeof(int64_t)> payload;
+};
+
+using Collector =
+    gcpp::CopyingCollector<gcpp::SerialGCPolicy, gcpp::FinalGenerationPolicy>;
+
+/** Allocates a randomly linked graph, returning the start of its chain */
+FatPtr make_graph(Collector& collector, size_t nodes)
+{
+    const auto ptrs = collector.alloc_batch(nodes, sizeof(Node),
+                                            std::align_val_t{alignof(Node)});
+    std::vector<size_t> order(nodes);
+    std::iota(order.begin(), order.end(), 0);
+    auto rng = std::mt19937{0};
+    std::shuffle(order.begin(), order.end(), rng);
+    auto dist = std::uniform_int_distribution<size_t>{0, nodes - 1};
+    for (size_t i = 0; i < nodes; ++i) {
+        const auto next = i + 1 < nodes ? ptrs[order[i + 1]] : FatPtr{0};
+        new (ptrs[order[i]].as_ptr()) Node{next, ptrs[dist(rng)], {}};
+    }
+    return ptrs[order.front()];
+}
+
+/** Runs `collections` collections, returning ms per collection */
+double time_collections(Collector& collector, FatPtr& root,
+                        size_t collections)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < collections; ++i) {
+        (void)collector.async_collect({&root}).get();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() /
+           static_cast<double>(collections);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    GC_UPDATE_STACK_RANGE();
+    const size_t nodes = argc > 1 ? std::stoul(argv[1]) : 1 << 14;
+    const size_t collections = argc > 2 ? std::stoul(argv[2]) : 10;
+    // only half of the heap can be allocated between collections
+    Collector collector(4 * nodes * sizeof(Node) + gcpp::page_size_ceil(1));
+    auto root = make_graph(collector, nodes);
+    // the first collection moves the graph into its own space
+    (void)collector.async_collect({&root}).get();
+
+    std::cout << "nodes: " << nodes << ", node: " << sizeof(Node)
+              << " bytes, collections: " << collections << "\n";
+    std::cout << std::setw(10) << "distance" << std::setw(16)
+              << "ms/collection\n";
+    std::cout << std::fixed << std::setprecision(2);
+    for (const size_t distance : {0, 4, 8, 16, 32}) {
+        collector.set_prefetch_distance(distance);
+        std::cout << std::setw(10) << distance << std::setw(15)
+                  << time_collections(collector, root, collections) << "\n";
+    }
+    return 0;
+}
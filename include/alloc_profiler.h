@@ -0,0 +1,114 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+namespace gcpp
+{
+/**
+ * @brief Singleton sampling profiler of GC allocations.
+ *
+ * Like tcmalloc, allocations are sampled with a Poisson process so that on
+ * average one sample is taken every `sample_interval` bytes, and larger
+ * objects are more likely to be sampled. The call stack of each sampled
+ * allocation is recorded, and collections report which sampled objects
+ * survived, so the profile has both the allocated and the live bytes of each
+ * call site.
+ */
+class AllocProfiler
+{
+  private:
+    /** Sampled allocations of a call stack */
+    struct Site {
+        std::vector<void*> stack;
+        size_t alloc_count = 0;
+        size_t alloc_bytes = 0;
+        size_t live_count = 0;
+        size_t live_bytes = 0;
+    };
+
+    /** A sampled object which hasn't been collected */
+    struct Sample {
+        size_t size;
+        size_t site;
+    };
+
+    std::atomic<bool> m_enabled = false;
+    std::atomic<size_t> m_sample_interval = 0;
+    /** Incremented by `start` so threads restart their sampling countdown */
+    std::atomic<uint64_t> m_epoch = 0;
+    std::vector<Site> m_sites;
+    /** Index in `m_sites` of each call stack */
+    std::map<std::vector<void*>, size_t> m_site_index;
+    /** Sampled objects, keyed by their untagged address */
+    std::unordered_map<uintptr_t, Sample> m_live;
+    /** Mutex for access to `m_sites`, `m_site_index` and `m_live` */
+    mutable std::mutex m_mutex;
+    // NOLINTNEXTLINE(cppcoreguidelines-*)
+    inline static std::unique_ptr<AllocProfiler> g_instance;
+    inline static std::once_flag g_instance_flag;
+    AllocProfiler() = default;
+
+    /** Counts an allocation towards the next sample of the calling thread */
+    void count_alloc(const void* ptr, size_t size);
+
+  public:
+    /** Default mean number of bytes between samples */
+    static constexpr size_t default_sample_interval = 512 * 1024;
+
+    /** Gets the singleton instance of the AllocProfiler object */
+    static AllocProfiler& get_instance();
+
+    /**
+     * @brief Starts sampling allocations, discarding any previous samples
+     *
+     * @param sample_interval mean number of bytes allocated between samples
+     */
+    void start(size_t sample_interval = default_sample_interval);
+
+    /** Stops sampling allocations. The samples taken so far are kept */
+    void stop() noexcept;
+
+    /** Determines if allocations are being sampled */
+    [[nodiscard]] bool enabled() const noexcept
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Records an allocation. Called by the collectors for every new
+     * object, only the sampled ones are recorded.
+     *
+     * @param ptr the new object
+     * @param size size of the object in bytes
+     */
+    void record_alloc(const void* ptr, size_t size)
+    {
+        if (enabled()) {
+            count_alloc(ptr, size);
+        }
+    }
+
+    /**
+     * @brief Updates the addresses of the sampled objects after a collection
+     *
+     * @param update callable which returns the new address of the given
+     * object, or 0 if the object was collected
+     */
+    void update_live(const std::function<uintptr_t(uintptr_t)>& update);
+
+    /**
+     * @brief Writes the samples as a heap profile in the legacy text format
+     * understood by pprof. Use `-inuse_space` for the live bytes and
+     * `-alloc_space` for the allocated bytes of each call site.
+     */
+    void write_profile(std::ostream& out) const;
+};
+}  // namespace gcpp
@@ -0,0 +1,178 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "gc_base.h"
+
+namespace gcpp
+{
+/**
+ * @brief RAII type which makes the allocations of `GC` on the calling thread
+ * bump allocate from an arena for its lifetime, and frees the whole arena at
+ * once when it is destroyed.
+ *
+ * Arena objects are not collected while the scope is alive, and pointers in
+ * them to objects on the heaps of `GC` are roots. Stores of `SafePtr`s are
+ * checked by a barrier which records a pointer to an arena object stored
+ * anywhere other than the arena and the stack frames called from the
+ * function which created the scope. If nothing was recorded, the finalizers
+ * of the arena objects are run and the arena is reset. Otherwise the
+ * recorded objects and the arena objects reachable from them are promoted:
+ * they are copied to the heaps of `GC`, and the roots, heap objects and
+ * recorded stack slots pointing to them are updated to the copies.
+ *
+ * Stores the barrier doesn't see, such as copies of raw `FatPtr`s, must not
+ * make an arena object outlive the scope.
+ * Pointers held in memory which is not a root, such as standard containers,
+ * are not updated by a promotion. Copies into the locals of the function
+ * which created the scope can't be told apart from copies into locals which
+ * outlive it and count as escapes, so the work of a scope should be done in
+ * functions it calls.
+ *
+ * Scopes nest, and the innermost scope of a thread allocates. Objects with
+ * compressed references, and objects which don't fit the rest of the arena,
+ * are allocated from the heaps of `GC`. Must be destroyed on the thread that
+ * created it. Terminates the program if the heaps of `GC` are too full to
+ * promote escaped objects.
+ */
+class ArenaScope
+{
+    using MemStore = std::unique_ptr<std::byte[]>;
+
+    /**
+     * @brief State of an arena shared with its root source, which may still
+     * run on a collecting thread after the scope has removed it
+     */
+    struct Chunk {
+        /** Start of the arena, or 0 once the scope is destroyed */
+        uintptr_t base = 0;
+        /** Address of the next free byte */
+        std::atomic<uintptr_t> top = 0;
+        /** Mutex for access to `base` and the memory of the arena */
+        std::mutex mutex;
+    };
+
+  private:
+    // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+    inline static thread_local ArenaScope* g_current = nullptr;
+    ArenaScope* m_parent;
+    MemStore m_mem;
+    size_t m_size;
+    std::shared_ptr<Chunk> m_chunk;
+    size_t m_root_source;
+    /** Start and metadata of each object, ordered by address */
+    std::vector<std::pair<uintptr_t, MetaData>> m_objects;
+    /** Slot and target of each recorded store of an arena pointer */
+    std::vector<std::pair<uintptr_t, uintptr_t>> m_escapes;
+    /** Lowest address of the stack of the thread */
+    uintptr_t m_stack_low;
+    /** Highest address of the stack of the thread */
+    uintptr_t m_stack_high;
+    /**
+     * Frame of the constructor: slots of the stack below it are in frames
+     * called by the creator of the scope, which end before the scope does
+     */
+    uintptr_t m_frame;
+    /** True if a weak reference was made to an arena object */
+    bool m_weak_refs = false;
+
+  public:
+    /** Arena size used unless another is given */
+    static constexpr size_t default_arena_size = 1024 * 1024;
+
+    explicit ArenaScope(size_t size = default_arena_size);
+    ~ArenaScope();
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+    ArenaScope(ArenaScope&&) = delete;
+    ArenaScope& operator=(ArenaScope&&) = delete;
+
+    /** Gets the innermost scope of the calling thread, or `nullptr` */
+    static ArenaScope* current() noexcept { return g_current; }
+
+    /**
+     * @brief RAII type which makes the calling thread allocate from the heaps
+     * of `GC` for its lifetime, as if it had no scope. Stores made meanwhile
+     * are not checked by the barrier.
+     */
+    class Suspension
+    {
+      private:
+        ArenaScope* m_scope;
+
+      public:
+        Suspension() noexcept : m_scope(g_current) { g_current = nullptr; }
+        ~Suspension() { g_current = m_scope; }
+        Suspension(const Suspension&) = delete;
+        Suspension& operator=(const Suspension&) = delete;
+        Suspension(Suspension&&) = delete;
+        Suspension& operator=(Suspension&&) = delete;
+    };
+
+    /**
+     * @brief Bump allocates an object in the arena
+     * @return pointer to the object, or `std::nullopt` if it doesn't fit
+     */
+    [[nodiscard]] std::optional<FatPtr> alloc(size_t size,
+                                              std::align_val_t alignment,
+                                              FinalizerFn finalizer);
+
+    /** Determines if `ptr` is in the arena */
+    [[nodiscard]] bool contains(const void* ptr) const noexcept;
+
+    /** Determines if `ptr` is in the arena of a scope of the calling thread */
+    [[nodiscard]] static bool owns(const void* ptr) noexcept;
+
+    /** Gets the number of bytes allocated in the arena */
+    [[nodiscard]] size_t used() const noexcept;
+
+    /** Gets the number of stores recorded as escapes */
+    [[nodiscard]] size_t escapes() const noexcept { return m_escapes.size(); }
+
+    /**
+     * @brief Write barrier run when `val` is stored to `slot`. Records the
+     * store if `val` is an object of an arena of the calling thread and the
+     * store may let it outlive the scope of the arena.
+     */
+    static void note_store(const void* slot, const FatPtr& val)
+    {
+        if (g_current != nullptr) [[unlikely]] {
+            record_store(reinterpret_cast<uintptr_t>(slot),
+                         static_cast<uintptr_t>(val));
+        }
+    }
+
+    /** Notes that a weak reference was made to `target` */
+    static void note_weak_ref(uintptr_t target) noexcept;
+
+  private:
+    static void record_store(uintptr_t slot, uintptr_t target);
+
+    /** Gets the object starting at `addr`, or `m_objects.end()` */
+    [[nodiscard]] auto find_object(uintptr_t addr) const
+        -> std::vector<std::pair<uintptr_t, MetaData>>::const_iterator;
+
+    /**
+     * @brief Copies the recorded objects, and the arena objects reachable
+     * from them, to the heaps of `GC` and updates the pointers to them
+     *
+     * @return map from the address of each promoted object to its copy
+     */
+    std::unordered_map<uintptr_t, FatPtr> promote();
+
+    /**
+     * @brief Runs the finalizers of the objects which weren't promoted
+     *
+     * @param moved map from the address of each promoted object to its copy
+     */
+    void finalize(const std::unordered_map<uintptr_t, FatPtr>& moved) const;
+};
+}  // namespace gcpp
@@ -0,0 +1,132 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+
+#include "gc_base.h"
+
+namespace gcpp
+{
+/**
+ * A compressed reference is a 32-bit offset from the address of the reference
+ * itself, rounded down to the scale of the offset, to its target. The scale is
+ * the alignment of the target, up to 8 bytes, so a reference reaches targets
+ * within 16 GB of it.
+ *
+ * Offsets are relative to the reference rather than to a heap base since the
+ * global GC has a heap per NUMA node, each made of two separate spaces.
+ */
+
+/** Value of a null compressed reference */
+constexpr int32_t compressed_null = std::numeric_limits<int32_t>::min();
+
+/** Largest scale of a compressed reference, as a power of 2 */
+constexpr uint8_t max_compressed_shift = 3;
+
+/** A compressed reference in an object */
+struct CompressedField {
+    /** Offset of the reference from the start of the object */
+    size_t offset;
+    /** Log2 of the scale of the reference */
+    uint8_t shift;
+};
+
+/**
+ * @brief The compressed references of a type, which the collector traces
+ * since they can't be found by scanning
+ */
+struct CompressedLayout {
+    const CompressedField* fields;
+    size_t count;
+    /** Size of the type, since arrays repeat the layout for each element */
+    size_t stride;
+};
+
+/**
+ * @brief Trait listing the compressed references of `T`. Specialize it with
+ * a static constexpr `fields` array of `GCPP_COMPRESSED_FIELD`s for every
+ * type with `CompressedSafePtr` members, otherwise their targets may be
+ * collected.
+ */
+template <typename T>
+struct CompressedFields {
+    static constexpr std::array<CompressedField, 0> fields{};
+};
+
+/**
+ * @def GCPP_COMPRESSED_FIELD(type, member)
+ * @brief Describes the `CompressedSafePtr` `member` of `type`
+ */
+// NOLINTNEXTLINE(cppcoreguidelines-macro-usage)
+#define GCPP_COMPRESSED_FIELD(type, member) \
+    gcpp::CompressedField { offsetof(type, member), decltype(type::member)::shift }
+
+template <typename T>
+inline constexpr CompressedLayout compressed_layout_v{
+    CompressedFields<T>::fields.data(), CompressedFields<T>::fields.size(),
+    sizeof(T)};
+
+/**
+ * @brief Gets the layout of the compressed references of an object or array
+ * of objects of type `T`, or `nullptr` if `T` has none
+ */
+template <typename T>
+constexpr const CompressedLayout* compressed_layout_of()
+{
+    if constexpr (CompressedFields<T>::fields.empty()) {
+        return nullptr;
+    } else {
+        return &compressed_layout_v<T>;
+    }
+}
+
+/** Address the offset of the reference at `field` is relative to */
+constexpr uintptr_t compressed_base(uintptr_t field, uint8_t shift)
+{
+    return field & ~((static_cast<uintptr_t>(1) << shift) - 1);
+}
+
+/**
+ * @brief Gets the target of the reference at `field` with value `val`
+ * @return the untagged address of the target, or 0 if null
+ */
+constexpr uintptr_t decode_compressed(uintptr_t field, int32_t val,
+                                      uint8_t shift)
+{
+    if (val == compressed_null) {
+        return 0;
+    }
+    return compressed_base(field, shift) +
+           static_cast<uintptr_t>(static_cast<intptr_t>(val)
+                                  << static_cast<intptr_t>(shift));
+}
+
+/**
+ * @brief Gets the value of a reference at `field` to `target`
+ *
+ * @param target untagged address of the target, or 0 for null
+ * @return the value, or `std::nullopt` if `target` is out of range or isn't
+ * aligned to the scale
+ */
+constexpr std::optional<int32_t> encode_compressed(uintptr_t field,
+                                                   uintptr_t target,
+                                                   uint8_t shift)
+{
+    if (target == 0) {
+        return compressed_null;
+    }
+    const auto diff = static_cast<intptr_t>(target) -
+                      static_cast<intptr_t>(compressed_base(field, shift));
+    const auto scale = static_cast<intptr_t>(1) << shift;
+    if (diff % scale != 0) {
+        return std::nullopt;
+    }
+    const auto val = diff / scale;
+    if (val <= compressed_null || val > std::numeric_limits<int32_t>::max()) {
+        return std::nullopt;
+    }
+    return static_cast<int32_t>(val);
+}
+}  // namespace gcpp
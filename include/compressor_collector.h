@@ -0,0 +1,253 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "collector.h"
+#include "concurrent_gc.h"
+#include "finalizer.h"
+#include "gc_base.h"
+#include "generational_gc.h"
+#include "mem_prot.h"
+#include "userfault.h"
+
+namespace gcpp
+{
+/**
+ * @brief How a `CompressorCollector` intercepts accesses to pages which have
+ * not been evacuated yet
+ */
+enum class FaultMode : uint8_t {
+    /** `UserFault` if userfaultfd is available, otherwise `Protect` */
+    Auto,
+    /** Pages are missing and faults are reported through a userfaultfd */
+    UserFault,
+    /** Pages are protected with `mprotect` and faults raise SIGSEGV */
+    Protect,
+};
+
+/**
+ * @brief A compacting collector which evacuates objects concurrently with
+ * the mutators, in the style of the Compressor.
+ *
+ * During a short pause, the collector marks the live objects, plans where
+ * each one will be moved to in the empty space, makes the pages of the
+ * planned objects inaccessible, and updates the roots to the new addresses.
+ * After the pause the mutators only ever see the new addresses, so it is the
+ * space being evacuated into that is inaccessible: the first access to one
+ * of its pages faults and is resolved by filling the page with its objects
+ * (and updating the pointers in them) on demand. A background pass fills the
+ * remaining pages.
+ *
+ * Both spaces are as large as the heap since the live objects are compacted.
+ * The space which was evacuated is released once evacuation finishes.
+ */
+template <CollectorLockingPolicy LockPolicy, GCGenerationPolicy GenPolicy>
+class CompressorCollector
+{
+  private:
+    /** An object moved by the current evacuation */
+    struct Relocation {
+        uintptr_t from;
+        uintptr_t to;
+        size_t size;
+    };
+
+    static constexpr uint8_t page_done = 0;
+    static constexpr uint8_t page_pending = 1;
+    static constexpr uint8_t page_filling = 2;
+    /** Maximum number of pages the background pass fills before making them
+     * accessible */
+    static constexpr size_t max_batch_pages = 64;
+
+    size_t m_heap_size;
+    std::array<std::unique_ptr<AliasedRegion>, 2> m_spaces;
+    /** Index of the space in which we allocate new objects */
+    typename LockPolicy::gc_uint8_t m_space_num = 0;
+    /** Next index to allocate an object */
+    typename LockPolicy::gc_size_t m_next = 0;
+    /** Metadata of each object, ordered by address */
+    std::map<uintptr_t, MetaData> m_metadata;
+    std::shared_future<CollectionResultT> m_collect_result;
+    mutable LockPolicy m_lock;
+    GenPolicy m_gen_policy;
+    /** Result of finalizing the objects freed by the last collection */
+    std::future<void> m_finalized;
+    /** Callback run on the collecting thread before evacuating in the
+     * background */
+    std::function<void()> m_evacuation_hook;
+
+    /** Userfaultfd reporting the faults, or `nullptr` in protect mode */
+    std::unique_ptr<UserFaultFd> m_uffd;
+    /** Ids of the fault handlers of the spaces in protect mode */
+    std::array<size_t, 2> m_fault_handlers = {0, 0};
+    /** Protection of the pages of each space in protect mode */
+    std::array<std::unique_ptr<PageProtection>, 2> m_protection;
+    /** Relocations of the current evacuation, ordered by destination */
+    std::vector<Relocation> m_relocations;
+    /** Maps the old address of each relocated object to its new address */
+    std::unordered_map<uintptr_t, uintptr_t> m_forwarding;
+    /** State of each page of the space being evacuated into */
+    std::unique_ptr<std::atomic<uint8_t>[]> m_page_states;
+    /** Number of pages being evacuated into */
+    size_t m_evacuated_pages = 0;
+    /** Space being evacuated into, or `nullptr` outside of evacuations */
+    std::atomic<std::byte*> m_evacuating = nullptr;
+    /** Buffer to fill pages in before copying them into place */
+    std::unique_ptr<std::byte[]> m_fill_buffer;
+    /** Thread resolving userfaultfd faults */
+    std::jthread m_fault_thread;
+
+  public:
+    /**
+     * @brief Collector static interface
+     * @see Collector
+     * @{
+     */
+    explicit CompressorCollector(size_t size)
+        : CompressorCollector(size, FaultMode::Auto)
+    {
+    }
+
+    ~CompressorCollector();
+    CompressorCollector(const CompressorCollector&) = delete;
+    CompressorCollector& operator=(const CompressorCollector&) = delete;
+    CompressorCollector(CompressorCollector&&) = delete;
+    CompressorCollector& operator=(CompressorCollector&&) = delete;
+
+    /**
+     * @param finalizer function to run on the object after it is collected
+     */
+    [[nodiscard]] FatPtr alloc(size_t size,
+                               std::align_val_t alignment = std::align_val_t{1},
+                               FinalizerFn finalizer = nullptr);
+
+    std::future<std::vector<FatPtr>> async_collect(
+        const std::vector<FatPtr*>& extra_roots) noexcept;
+
+    [[nodiscard]] bool contains(void* ptr) const noexcept;
+
+    [[nodiscard]] size_t free_space() const noexcept;
+    /** @} */
+
+    /**
+     * @brief Construct a new Compressor Collector object
+     *
+     * @param size size of the heap
+     * @param mode how to intercept accesses to pages which haven't been
+     * evacuated. Throws `std::runtime_error` if `mode` is `UserFault` and
+     * userfaultfd is unavailable
+     */
+    CompressorCollector(size_t size, FaultMode mode);
+
+    /**
+     * @brief Dispatches an async collection task
+     * Waits for the current collection to finish before starting a new one
+     * if one is already in progress
+     *
+     * @param needed_space amount of space needed to be free. Avoids collection
+     * if there is already enough space. Any sufficiently large value will
+     * always trigger a collection
+     */
+    void collect(
+        size_t needed_space = std::numeric_limits<size_t>::max()) noexcept;
+
+    /** Gets the mode used to intercept accesses to unevacuated pages */
+    [[nodiscard]] FaultMode fault_mode() const noexcept
+    {
+        return m_uffd ? FaultMode::UserFault : FaultMode::Protect;
+    }
+
+    /**
+     * @brief Sets a callback which is run on the collecting thread after the
+     * pause of each collection, before the remaining pages are evacuated.
+     * With a serial lock policy the callback must not access the heap.
+     */
+    void set_evacuation_hook(std::function<void()> hook) noexcept;
+
+  private:
+    /**
+     * @brief Attempts to allocate a new object on the heap.
+     * If allocation fails, invokes a collection and tries again.
+     * If the retry fails, throws `std::bad_alloc`.
+     */
+    [[nodiscard]] FatPtr alloc_attempt(const MetaData& meta_data,
+                                       uint8_t attempts = 0);
+
+    /**
+     * @brief Marks every object reachable from `roots`.
+     * Requires having a lock.
+     */
+    void mark(std::vector<uintptr_t> roots,
+              std::unordered_set<uintptr_t>& marked) const;
+
+    /**
+     * @brief Pause of a collection: plans the evacuation of the live objects,
+     * makes the pages they will be moved to inaccessible, and updates the
+     * roots. Requires having a lock.
+     *
+     * @return the collected objects which must be finalized
+     */
+    std::vector<DeadObject> plan_evacuation(
+        const std::vector<FatPtr*>& extra_roots);
+
+    /**
+     * @brief Writes the contents of an evacuated page to `dst`: the parts of
+     * the objects which are moved into the page, with their pointers updated.
+     * Requires `dst` is a zeroed page.
+     */
+    void fill_page(size_t page, std::byte* dst) const noexcept;
+
+    /** Gets the index of the page being evacuated containing `addr` */
+    std::optional<size_t> evacuated_page(const void* addr) const noexcept;
+
+    /**
+     * @brief Fills the page containing `addr` in userfaultfd mode if it
+     * hasn't been filled yet, otherwise waits for it to be filled
+     *
+     * @param buffer page sized buffer the page is filled in before being
+     * copied into place
+     * @return true if `addr` is in a page being evacuated
+     */
+    bool resolve(const void* addr, std::byte* buffer) noexcept;
+
+    /**
+     * @brief Fills the page containing `addr` in protect mode, through the
+     * alias of its space, if it hasn't been filled yet, otherwise waits for it
+     * to be filled. Async-signal-safe.
+     *
+     * @return true if `addr` is in a page being evacuated
+     */
+    bool resolve(const void* addr) noexcept;
+
+    /**
+     * @brief Fills the pages which the mutators haven't touched, and waits for
+     * the pages being filled by the mutators
+     */
+    void evacuate_remaining(std::byte* space);
+
+    /** Gets the index of the space whose view is `space` */
+    uint8_t space_index(const std::byte* space) const noexcept
+    {
+        return m_spaces[0]->view() == space ? 0 : 1;
+    }
+
+    /** Fault handler registered in protect mode */
+    static bool handle_fault(void* collector, void* addr);
+};
+
+static_assert(
+    Collector<CompressorCollector<SerialGCPolicy, FinalGenerationPolicy>>);
+static_assert(
+    Collector<CompressorCollector<ConcurrentGCPolicy, FinalGenerationPolicy>>);
+}  // namespace gcpp
@@ -1,21 +1,41 @@
 #pragma once
 #include <array>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <new>
+#include <optional>
 #include <ranges>
 #include <stdexcept>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "collector.h"
 #include "concurrent_gc.h"
+#include "dirty_tracker.h"
 #include "gc_base.h"
 #include "generational_gc.h"
+#include "heap_dump.h"
 #include "mem_prot.h"
 
 namespace gcpp
 {
 enum class SpaceNum : uint8_t { Zero = 0, One = 1 };
+
+/** Order in which a collection copies the reachable objects */
+enum class CopyOrder : uint8_t {
+    /** Depth first, so a chain of pointers is copied contiguously */
+    DepthFirst,
+    /**
+     * Breadth first within the page being filled and depth first across
+     * pages, so an object shares its page with its children and its
+     * siblings, and the subgraph below a full page continues on the next
+     */
+    Hierarchical,
+};
+
 template <CollectorLockingPolicy LockPolicy, GCGenerationPolicy GenPolicy>
 class CopyingCollector
 {
@@ -33,6 +53,19 @@ class CopyingCollector
     /** Index of the space in which we allocate new objects */
     typename LockPolicy::gc_uint8_t m_space_num = 0;
     std::unordered_map<FatPtr, MetaData> m_metadata;
+    /**
+     * For each space, a bit per byte which is set if an object in
+     * `m_metadata` starts at that byte. Bit `i % 64` of word `i / 64` is byte
+     * `i`.
+     */
+    std::array<std::vector<uint64_t>, 2> m_starts;
+    /**
+     * For each space, an entry per card of `card_size` bytes holding the
+     * distance back from the first byte of the card to the start of the
+     * object covering it, or 0 if no object starts before the card and
+     * covers it
+     */
+    std::array<std::vector<size_t>, 2> m_card_offsets;
     /** Maximum amount of data we can externally allocate */
     size_t m_max_alloc_size;
     std::shared_future<CollectionResultT> m_collect_result;
@@ -41,8 +74,70 @@ class CopyingCollector
     std::atomic<size_t> m_tcount = 0;
     std::mutex m_test_mu;
     GenPolicy m_gen_policy;
+    /** Callback run on the collecting thread before each collection */
+    std::function<void()> m_collection_hook;
+    /** Callback run on the collecting thread at the end of each collection */
+    std::function<void(const std::function<uintptr_t(uintptr_t)>&)>
+        m_forwarding_hook;
+    /** Mutex held by each collection, shared with other collectors */
+    std::mutex* m_collection_mutex = nullptr;
+    /** Result of finalizing the objects freed by the last collection */
+    std::future<void> m_finalized;
+    /** Number of times each pinned object has been pinned */
+    std::unordered_map<FatPtr, size_t> m_pins;
+    /**
+     * Held by a collection for its duration, and to update `m_pins`.
+     * Collections may read `m_pins` without any other lock.
+     */
+    std::mutex m_pin_mutex;
+    /**
+     * Pointers to the storage attached to each object by `attach_storage`,
+     * which are traced as if they were members of the object. Guarded by
+     * `m_pin_mutex` and the collection mutex, and also by the lock for
+     * writes.
+     */
+    std::unordered_map<FatPtr, std::vector<FatPtr>> m_storage;
+    /** Object each attached storage is attached to */
+    std::unordered_map<FatPtr, FatPtr> m_storage_holders;
+    /**
+     * Objects pinned by the collection in progress because words on the
+     * stacks point inside them. Only used by the collecting thread.
+     */
+    std::unordered_set<FatPtr> m_interior_pins;
+    std::atomic<bool> m_interior_pointers = false;
+    /**
+     * For each space, the index ranges [start, end) of pinned objects that
+     * were left in place when the space was evacuated. New objects are not
+     * placed over them.
+     */
+    std::array<std::map<size_t, size_t>, 2> m_retained;
+    /**
+     * Trackers of the pages of each space written during a collection, or
+     * `nullptr` if collections don't remark
+     */
+    std::array<std::unique_ptr<DirtyPageTracker>, 2> m_dirty_trackers;
+    std::atomic<CopyOrder> m_copy_order = CopyOrder::DepthFirst;
+    /**
+     * Number of discovered pointers whose targets are prefetched before the
+     * oldest of them is traced
+     */
+    std::atomic<size_t> m_prefetch_distance = 0;
 
   public:
+    /** Largest prefetch distance which can be set */
+    static constexpr size_t max_prefetch_distance = 64;
+
+    /**
+     * Objects larger than this many bytes are copied and scanned in chunks
+     * of this size, unless they have compressed references
+     */
+    static constexpr size_t large_object_chunk_size = 16 * 1024;
+
+    /** Bytes of a space covered by each entry of the card table */
+    static constexpr size_t card_size = 512;
+    static_assert(card_size % 64 == 0,
+                  "Cards must cover whole words of the start bitmap");
+
     /**
      * @brief Collector static interface
      * @see Collector
@@ -55,6 +150,11 @@ class CopyingCollector
                MemStore(new(page_size_align())
                             std::byte[page_size_ceil(size)])}),
           m_metadata(m_heap_size / 4),
+          m_starts({std::vector<uint64_t>((m_heap_size + 63) / 64),
+                    std::vector<uint64_t>((m_heap_size + 63) / 64)}),
+          m_card_offsets(
+              {std::vector<size_t>((m_heap_size + card_size - 1) / card_size),
+               std::vector<size_t>((m_heap_size + card_size - 1) / card_size)}),
           m_max_alloc_size(size / 2),
           m_gen_policy()
     {
@@ -69,9 +169,20 @@ class CopyingCollector
                 ~static_cast<uintptr_t>(page_size() - 1)));
     }
 
+    ~CopyingCollector();
+    CopyingCollector(const CopyingCollector&) = delete;
+    CopyingCollector& operator=(const CopyingCollector&) = delete;
+    CopyingCollector(CopyingCollector&&) = delete;
+    CopyingCollector& operator=(CopyingCollector&&) = delete;
+
+    /**
+     * @param finalizer function to run on the object after it is collected
+     * @param compressed compressed references of the object to trace
+     */
     [[nodiscard]] FatPtr alloc(size_t size,
-                               std::align_val_t alignment = std::align_val_t{
-                                   1});
+                               std::align_val_t alignment = std::align_val_t{1},
+                               FinalizerFn finalizer = nullptr,
+                               const CompressedLayout* compressed = nullptr);
 
     std::future<std::vector<FatPtr>> async_collect(
         const std::vector<FatPtr*>& extra_roots) noexcept;
@@ -81,6 +192,22 @@ class CopyingCollector
     [[nodiscard]] size_t free_space() const noexcept;
     /** @} */
 
+    /**
+     * @brief Allocates `count` objects of `size` bytes each with a single
+     * reservation and a single metadata update. The objects are contiguous,
+     * except for the padding needed to align each one, but are collected
+     * individually.
+     *
+     * @param finalizer function to run on each object after it is collected
+     * @param compressed compressed references of each object to trace
+     * @return pointers to the objects in address order
+     */
+    [[nodiscard]] std::vector<FatPtr> alloc_batch(
+        size_t count, size_t size,
+        std::align_val_t alignment = std::align_val_t{1},
+        FinalizerFn finalizer = nullptr,
+        const CompressedLayout* compressed = nullptr);
+
     /**
      * @brief Dispatches an async collection task
      * Waits for the current collection to finish before starting a new one
@@ -93,8 +220,186 @@ class CopyingCollector
     void collect(
         size_t needed_space = std::numeric_limits<size_t>::max()) noexcept;
 
+    /** Blocks until the collection in progress, if any, has finished */
+    void wait_for_collection() const;
+
     auto test_lock() { return std::unique_lock{m_test_mu}; }
 
+    /**
+     * @brief Pins an object so that collections leave it in place. Pinned
+     * objects are roots. Pins are counted, so an object stays pinned until
+     * `unpin` is called as many times as `pin`.
+     * Blocks while a collection is in progress.
+     *
+     * @param ptr pointer to the object. Read once a running collection has
+     * finished so it may be a root which the collection forwards
+     * @throws `std::out_of_range` if `ptr` is not an object on this heap
+     */
+    void pin(const FatPtr& ptr);
+
+    /**
+     * @brief Removes a pin added by `pin`
+     *
+     * @throws `std::out_of_range` if `ptr` is not pinned
+     */
+    void unpin(const FatPtr& ptr);
+
+    /**
+     * @brief Attaches `storage` to the object containing `holder`, such as
+     * the buffer of a standard container which is a member of the object.
+     * Collections leave the storage in place, since the container holds a
+     * raw pointer to it, and trace it as if the object pointed to it: it is
+     * not a root, and is freed with the object.
+     * Blocks while a collection is in progress.
+     *
+     * @param holder address inside the object, such as the container
+     * @param storage pointer to the storage, an object on this heap. Read
+     * once a running collection has finished, like the pointer to `pin`
+     * @return false if `holder` is not inside an object on this heap
+     * @throws `std::out_of_range` if `storage` is not an object on this heap
+     */
+    bool attach_storage(const void* holder, const FatPtr& storage);
+
+    /**
+     * @brief Detaches storage attached by `attach_storage`, so that the next
+     * collection frees it
+     *
+     * @return false if `storage` is not attached to an object
+     */
+    bool detach_storage(const FatPtr& storage);
+
+    /**
+     * @brief Sets the order in which later collections copy objects. The
+     * default is `CopyOrder::DepthFirst`.
+     */
+    void set_copy_order(CopyOrder order) noexcept;
+
+    /**
+     * @brief Sets how many of the pointers discovered by the trace have their
+     * targets prefetched before the oldest of them is traced. The default of
+     * 0 traces every pointer as soon as it is discovered, since prefetching
+     * has not been measured to help (see trace_bench).
+     *
+     * @throws `std::invalid_argument` if `distance` is larger than
+     * `max_prefetch_distance`
+     */
+    void set_prefetch_distance(size_t distance);
+
+    /**
+     * @brief Sets a callback to run on the collecting thread at the start of
+     * every collection, such as to set the affinity of the thread
+     */
+    void set_collection_hook(std::function<void()> hook) noexcept;
+
+    /**
+     * @brief Sets a callback to run on the collecting thread at the end of
+     * every collection, while it still holds the mutex set by
+     * `set_collection_mutex`. The callback is given a function which maps the
+     * untagged address of an object before the collection to its address
+     * after it, or to 0 if the object was freed.
+     */
+    void set_forwarding_hook(
+        std::function<void(const std::function<uintptr_t(uintptr_t)>&)>
+            hook) noexcept;
+
+    /**
+     * @brief Makes every collection hold `mutex` for its duration, so that
+     * it never runs at the same time as a collection of another collector
+     * sharing `mutex`, such as one which forwards pointers held by this heap.
+     * Must be called before the first collection.
+     */
+    void set_collection_mutex(std::mutex& mutex) noexcept;
+
+    /**
+     * @brief Appends the addresses of all GC pointers stored in objects on
+     * this heap to `out`. Used so that other heaps can treat pointers held by
+     * this heap as roots.
+     */
+    void get_heap_ptrs(std::vector<FatPtr*>& out) const;
+
+    /**
+     * @brief Appends the addresses of the GC pointers stored in the pinned
+     * objects on this heap, which are roots of its collections, to `out`
+     */
+    void get_pinned_ptrs(std::vector<FatPtr*>& out);
+
+    /**
+     * @brief Appends the addresses of the GC pointers stored in the object
+     * starting at `ptr`, and of the pointers to the storage attached to it, to
+     * `out`
+     *
+     * @return false if no object on this heap starts at `ptr`
+     */
+    bool get_object_ptrs(const FatPtr& ptr, std::vector<FatPtr*>& out);
+
+    /**
+     * @brief Records every object on this heap, with the targets of the GC
+     * pointers stored in it, to `out`. Objects which are garbage but haven't
+     * been collected yet are included.
+     * Blocks while a collection is in progress.
+     */
+    void dump(HeapDumpWriter& out);
+
+    /**
+     * @brief Copies the objects on this heap reachable from `root` to memory
+     * given by `alloc`, such as another heap. Pointers between the copies are
+     * updated to point to the copies, and the finalizers of the originals are
+     * moved to the copies. The originals are left for a collection to free.
+     * Blocks while a collection is in progress.
+     *
+     * @param alloc allocates an object with the given metadata, which must
+     * stay in place until `transfer` returns
+     * @return pointer to the copy of `root`, or `root` if it is not an object
+     * on this heap
+     * @throws `std::out_of_range` if a compressed reference of a copy can't
+     * reach its target
+     */
+    FatPtr transfer(const FatPtr& root,
+                    const std::function<FatPtr(const MetaData&)>& alloc);
+
+    /**
+     * @brief Updates the pointers stored in objects on this heap to objects
+     * outside of it which have moved, such as arena objects promoted into a
+     * heap.
+     * Blocks while a collection is in progress.
+     *
+     * @param moved map from the old address of each moved object to a pointer
+     * to its new location
+     */
+    void forward_external(const std::unordered_map<uintptr_t, FatPtr>& moved);
+
+    /**
+     * @brief Makes collections track the pages written while they trace,
+     * and finish with a remark phase which rescans the roots and only the
+     * written pages for pointers stored behind the trace.
+     * Blocks while a collection is in progress.
+     *
+     * @param mode how to find the written pages
+     */
+    void enable_remark(DirtyTracking mode = DirtyTracking::Auto);
+
+    /**
+     * @brief Finds the object on this heap which contains `addr`: the last
+     * object starting in the card of `addr` at or before it, found in the
+     * start bitmap of its space, or else the object covering the start of
+     * the card, found in the card table. Reads at most `card_size / 64`
+     * words of the bitmap, whatever the sizes of the objects.
+     *
+     * @return pointer to the start of the object, or `std::nullopt` if
+     * `addr` is not inside an object on this heap
+     */
+    [[nodiscard]] std::optional<FatPtr> object_start(const void* addr) const;
+
+    /**
+     * @brief Makes collections treat every word on the stacks of threads
+     * without a `RootScope` which points inside an object on this heap, such
+     * as a raw pointer from `SafePtr::get` or an iterator, as a pin of the
+     * object for the duration of the collection. Such objects are kept alive
+     * and left in place, so the raw pointers stay valid. Words which only
+     * look like pointers retain garbage until they are overwritten.
+     */
+    void enable_interior_pointers() noexcept;
+
   private:
     /**
      * @brief Copies the object pointed to by `ptr` to the other space
@@ -108,9 +413,26 @@ class CopyingCollector
     [[nodiscard]] FatPtr copy(FatPtr& to_update, SpaceNum to_space,
                               const FatPtr& ptr);
 
+    /**
+     * @brief Allocates the copy of the object pointed to by `ptr` in
+     * `to_space`, without copying its data
+     *
+     * @return pointer to the uninitialized copy, and the size of the object
+     */
+    [[nodiscard]] std::pair<FatPtr, size_t> reserve_copy(SpaceNum to_space,
+                                                         const FatPtr& ptr);
+
     /**
      * @brief Forwards a pointer to the other space
-     * Forwards the pointer and all members via depth-first traversal
+     * Forwards the pointer and all members via depth-first traversal, or
+     * in hierarchical order if set by `set_copy_order`.
+     * Objects larger than `large_object_chunk_size` are copied and scanned a
+     * chunk at a time, tracing the pointers of each chunk before copying the
+     * next, so no single step of the trace is proportional to the size of an
+     * object.
+     * With a prefetch distance set by `set_prefetch_distance`, pointers pass
+     * through a FIFO whose entries have their targets prefetched, so that the
+     * target of a pointer is in the cache by the time it is traced.
      *
      * @param to_space space to forward the pointer to
      * @param ptr [in/out] pointer to forward
@@ -120,6 +442,91 @@ class CopyingCollector
     void forward_ptr(SpaceNum to_space, FatPtr& ptr,
                      std::unordered_map<FatPtr, FatPtr>& visited);
 
+    /**
+     * @brief Calls `f(target, field, shift)` for every non-null compressed
+     * reference of an object, with the untagged `target` of the reference and
+     * the address of the `field` in the copy of the object
+     *
+     * @param layout compressed references of the object
+     * @param size size of the object
+     * @param old_addr address the references of the object are relative to
+     * @param new_addr address of the copy of the object
+     */
+    template <typename Fn>
+    static void trace_compressed(const CompressedLayout& layout, size_t size,
+                                 uintptr_t old_addr, uintptr_t new_addr,
+                                 Fn&& f);
+
+    /**
+     * @brief Points the compressed reference at `field` to `target`
+     * @throws `std::runtime_error` if `target` is out of range of the field
+     */
+    static void store_compressed(uintptr_t field, uintptr_t target,
+                                 uint8_t shift);
+
+    /**
+     * @brief Points the compressed reference at `field` from `old_target` to
+     * `new_target`, unless a mutator has changed it meanwhile
+     * @throws `std::runtime_error` if `new_target` is out of range of the field
+     */
+    static void forward_compressed(uintptr_t field, uintptr_t old_target,
+                                   uintptr_t new_target, uint8_t shift);
+
+    /**
+     * @brief Forwards all objects reachable from the roots to the other space
+     *
+     * @param to_space space to forward the objects to
+     * @param extra_roots roots in addition to the stack and global roots
+     * @param visited [out] map from the old address to the new address of
+     * every forwarded object
+     */
+    void trace(SpaceNum to_space, const std::vector<FatPtr*>& extra_roots,
+               std::unordered_map<FatPtr, FatPtr>& visited);
+
+    /**
+     * @brief Stops tracking written pages, then forwards the roots again and
+     * every pointer, including compressed references, on a written page of
+     * the to space or of a pinned object
+     *
+     * @param visited [in/out] map of forwarded objects built by `trace`
+     */
+    void remark(SpaceNum to_space, const std::vector<FatPtr*>& extra_roots,
+                std::unordered_map<FatPtr, FatPtr>& visited);
+
+    /**
+     * @brief Forwards the targets of the compressed references on a written
+     * page of the objects of the to space and of the pinned objects, which
+     * scanning the pages can't find
+     *
+     * @param dirty bitmaps of the written pages of each space
+     */
+    void rescan_compressed(SpaceNum to_space,
+                           const std::array<std::vector<bool>, 2>& dirty,
+                           std::unordered_map<FatPtr, FatPtr>& visited);
+
+    /**
+     * @brief Forwards the pointers in [begin, end) which overlap a written
+     * page of `space`
+     *
+     * @param dirty bitmap of the written pages of `space`
+     */
+    void rescan_dirty(SpaceNum to_space, SpaceNum space, uintptr_t begin,
+                      uintptr_t end, const std::vector<bool>& dirty,
+                      std::unordered_map<FatPtr, FatPtr>& visited);
+
+    /**
+     * @brief Gets the address of an object after a collection
+     *
+     * @param to_space space objects were forwarded to
+     * @param target untagged address of the object before the collection
+     * @param visited map of forwarded objects built by `trace`
+     * @return uintptr_t the new untagged address of the object, or 0 if it
+     * was collected. Addresses not on this heap are returned unchanged
+     */
+    [[nodiscard]] uintptr_t forwarded_address(
+        SpaceNum to_space, uintptr_t target,
+        const std::unordered_map<FatPtr, FatPtr>& visited) const;
+
     /**
      * @brief Get the space num a pointer belongs to
      *
@@ -147,14 +554,27 @@ class CopyingCollector
      * If allocation fails, invokes a collection and tries again.
      * If the retry fails, throws `std::bad_alloc`.
      *
-     * @param size size of the object to allocate
-     * @param alignment alignment of the object to allocate
+     * @param meta_data size, alignment and finalizer of the object to
+     * allocate
      * @param attempts number of times we have attempted to allocate
      * @return FatPtr
      */
-    [[nodiscard]] FatPtr alloc_attempt(size_t size, std::align_val_t alignment,
+    [[nodiscard]] FatPtr alloc_attempt(const MetaData& meta_data,
                                        uint8_t attempts = 0);
 
+    /**
+     * @brief Attempts to allocate a batch of objects on the heap.
+     * If allocation fails, invokes a collection and tries again.
+     * If the retry fails, throws `std::bad_alloc`.
+     *
+     * @param meta_data size, alignment and finalizer of each object
+     * @param count number of objects to allocate
+     * @param stride distance between the starts of consecutive objects
+     */
+    [[nodiscard]] std::vector<FatPtr> alloc_batch_attempt(
+        const MetaData& meta_data, size_t count, size_t stride,
+        uint8_t attempts = 0);
+
     /**
      * @brief Reserves space for an object of the given size in the given space
      * and its padding to achieve its alignment.
@@ -169,6 +589,52 @@ class CopyingCollector
         size_t size, SpaceNum to_space, std::align_val_t alignment,
         size_t max_alloc_size);
 
+    /**
+     * @brief Determines if the `size` bytes starting at `index` in `space`
+     * overlap an object which was retained in place.
+     * Requires having a lock.
+     *
+     * @return the index of the end of the retained object, or nullopt if there
+     * is no overlap
+     */
+    [[nodiscard]] std::optional<size_t> retained_overlap(SpaceNum space,
+                                                         size_t index,
+                                                         size_t size) const;
+
+    /**
+     * @brief Records the pinned objects which were left in the from space by
+     * a collection so their memory is not reused, and ages them as if they
+     * were copied. Requires having a lock.
+     *
+     * @param visited map of forwarded objects built by `trace`
+     */
+    void retain_pinned(SpaceNum from_space,
+                       const std::unordered_map<FatPtr, FatPtr>& visited);
+
+    /**
+     * @brief Moves the attached storage of the objects forwarded by a
+     * collection to their new addresses, and forgets the storage of the
+     * objects which were freed. Requires having a lock.
+     *
+     * @param visited map of forwarded objects built by `trace`
+     */
+    void forward_storage(SpaceNum to_space,
+                         const std::unordered_map<FatPtr, FatPtr>& visited);
+
+    /**
+     * @brief Sets the bit of the object at `ptr` in the start bitmap of its
+     * space, and the entries of the cards it covers the start of in the card
+     * table, if `is_start`, otherwise clears them. The object must be in
+     * `m_metadata`. Requires having a lock.
+     */
+    void set_start(const FatPtr& ptr, bool is_start);
+
+    /**
+     * @brief Adds the objects which words on the stacks point inside to
+     * `m_interior_pins`, if interior pointers are enabled
+     */
+    void pin_interior();
+
     /**
      * @brief Checks if a new allocation of the given size, starting
      * (excluding padding) at the given index in the given space overlaps
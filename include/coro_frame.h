@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "gc_base.h"
+
+namespace gcpp
+{
+/**
+ * @brief Singleton non-moving heap for the frames of coroutines whose promise
+ * derives from `GCFramePromise`.
+ *
+ * Frames are bump allocated from chunks and reuse the space of freed frames
+ * of the same size. The live frames are a root source, so GC pointers held in
+ * a suspended coroutine keep their targets alive and are updated when the
+ * targets move, like locals on a stack.
+ */
+class FrameHeap
+{
+    using MemStore = std::unique_ptr<std::byte[]>;
+
+    /** Header before every frame */
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) FrameHeader {
+        /** Size of the frame, excluding the header */
+        size_t size;
+        /** False once the frame is freed */
+        bool live;
+    };
+
+    struct Chunk {
+        MemStore mem;
+        size_t size;
+        /** Offset of the next free byte */
+        size_t top = 0;
+    };
+
+  private:
+    std::vector<Chunk> m_chunks;
+    /** Freed frames by size, reused for frames of the same size */
+    std::unordered_map<size_t, std::vector<FrameHeader*>> m_free;
+    size_t m_live_frames = 0;
+    /** Mutex for access to the chunks, frames and free lists */
+    mutable std::mutex m_mutex;
+    // NOLINTNEXTLINE(cppcoreguidelines-*)
+    inline static std::unique_ptr<FrameHeap> g_instance;
+    inline static std::once_flag g_instance_flag;
+    FrameHeap();
+
+  public:
+    /** Size of the chunks frames are allocated from, unless one is larger */
+    static constexpr size_t chunk_size = 64 * 1024;
+
+    ~FrameHeap() = default;
+    FrameHeap(const FrameHeap&) = delete;
+    FrameHeap& operator=(const FrameHeap&) = delete;
+    FrameHeap(FrameHeap&&) = delete;
+    FrameHeap& operator=(FrameHeap&&) = delete;
+
+    /** Gets the singleton instance of the FrameHeap object */
+    static FrameHeap& get_instance();
+
+    /**
+     * @brief Allocates a frame of `size` bytes, aligned for any fundamental
+     * type
+     */
+    [[nodiscard]] void* alloc(size_t size);
+
+    /** Frees a frame allocated by `alloc` with the same `size` */
+    void free(void* frame, size_t size) noexcept;
+
+    /** Gets the number of frames which haven't been freed */
+    [[nodiscard]] size_t live_frames() const;
+
+  private:
+    /**
+     * @brief Appends the addresses of the GC pointers in live frames to `out`
+     */
+    void get_roots(std::vector<FatPtr*>& out) const;
+};
+
+/**
+ * @brief Mixin for the promise type of a coroutine which allocates its frame
+ * from the `FrameHeap`, so that `SafePtr`s held across a suspension are roots.
+ *
+ * @code
+ * struct promise_type : gcpp::GCFramePromise { ... };
+ * @endcode
+ */
+struct GCFramePromise {
+    static void* operator new(size_t size)
+    {
+        return FrameHeap::get_instance().alloc(size);
+    }
+
+    static void operator delete(void* frame, size_t size) noexcept
+    {
+        FrameHeap::get_instance().free(frame, size);
+    }
+};
+}  // namespace gcpp
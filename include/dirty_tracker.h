@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "mem_prot.h"
+
+namespace gcpp
+{
+/** @brief How a `DirtyPageTracker` finds the pages which were written */
+enum class DirtyTracking : uint8_t {
+    /** `SoftDirty` if the kernel supports it, otherwise `WriteProtect` */
+    Auto,
+    /**
+     * Soft-dirty bits of `/proc/self/pagemap`. Clearing them affects the
+     * whole process, so starting a tracker restarts the others
+     */
+    SoftDirty,
+    /** Pages are write protected and the first write to each one faults */
+    WriteProtect,
+};
+
+/**
+ * @brief Finds the pages of a region which were written between `start` and
+ * `stop`, without instrumenting the stores.
+ */
+class DirtyPageTracker
+{
+  private:
+    std::byte* m_start;
+    size_t m_pages;
+    DirtyTracking m_mode;
+    /** Pages written since `start` in write protect mode, one bit per page */
+    std::unique_ptr<std::atomic<uint64_t>[]> m_dirty;
+    /** Protection of the region in write protect mode */
+    std::unique_ptr<PageProtection> m_protection;
+    /** Id of the fault handler in write protect mode */
+    size_t m_fault_handler = 0;
+    std::atomic<bool> m_tracking = false;
+
+    /** Fault handler registered in write protect mode */
+    static bool handle_fault(void* tracker, void* addr);
+
+  public:
+    /**
+     * @param start start of the region. Must be page aligned
+     * @param len size of the region, rounded up to a multiple of pages
+     * @param mode how to find written pages. Throws `std::runtime_error` if
+     * `mode` is `SoftDirty` and soft-dirty bits are unsupported
+     */
+    DirtyPageTracker(void* start, size_t len,
+                     DirtyTracking mode = DirtyTracking::Auto);
+    ~DirtyPageTracker();
+    DirtyPageTracker(const DirtyPageTracker&) = delete;
+    DirtyPageTracker& operator=(const DirtyPageTracker&) = delete;
+    DirtyPageTracker(DirtyPageTracker&&) = delete;
+    DirtyPageTracker& operator=(DirtyPageTracker&&) = delete;
+
+    /** Forgets the pages written so far and starts tracking writes */
+    void start();
+
+    /**
+     * @brief Stops tracking writes
+     *
+     * @return a bitmap with `true` for each page written since `start`
+     */
+    std::vector<bool> stop();
+
+    /** Gets the mechanism used to find written pages */
+    [[nodiscard]] DirtyTracking mode() const noexcept { return m_mode; }
+
+    /** Determines if the kernel reports soft-dirty bits */
+    static bool soft_dirty_available();
+};
+}  // namespace gcpp
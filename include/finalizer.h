@@ -0,0 +1,85 @@
+#pragma once
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "gc_base.h"
+#include "task.inl"
+
+namespace gcpp
+{
+/**
+ * @brief Trait to opt a type into finalization. Specialize it to derive from
+ * `std::true_type` to have the destructor of `T` run after a `T` allocated
+ * through a `SafePtr` is collected.
+ *
+ * Finalizers run on a separate thread after the collection which freed the
+ * object, and must not resurrect the object.
+ */
+template <typename T>
+struct Finalize : std::false_type {
+};
+
+/**
+ * @brief Destroys every `T` in the `size` bytes starting at `obj`
+ */
+template <typename T>
+void finalize_objects(void* obj, size_t size)
+{
+    auto* const objs = static_cast<T*>(obj);
+    for (size_t i = 0; i < size / sizeof(T); ++i) {
+        objs[i].~T();
+    }
+}
+
+/**
+ * @brief Gets the finalizer for an object or array of objects of type `T`, or
+ * `nullptr` if `T` is not finalized
+ */
+template <typename T>
+constexpr FinalizerFn finalizer_of()
+{
+    if constexpr (Finalize<T>::value &&
+                  !std::is_trivially_destructible_v<T>) {
+        return &finalize_objects<T>;
+    } else {
+        return nullptr;
+    }
+}
+
+/**
+ * @brief An object which has been collected and is waiting to be finalized
+ */
+struct DeadObject {
+    FinalizerFn finalizer;
+    void* obj;
+    size_t size;
+};
+
+/**
+ * @brief Singleton thread which runs the finalizers of collected objects in
+ * batches so that they don't lengthen collections
+ */
+class FinalizerThread
+{
+  private:
+    Task<void> m_task;
+    // NOLINTNEXTLINE(cppcoreguidelines-*)
+    inline static std::unique_ptr<FinalizerThread> g_instance;
+    inline static std::once_flag g_instance_flag;
+    FinalizerThread() = default;
+
+  public:
+    /** Gets the singleton instance of the FinalizerThread */
+    static FinalizerThread& get_instance();
+
+    /**
+     * @brief Runs the finalizers of a batch of objects.
+     * The memory of the objects must not be reused until the returned future
+     * is ready.
+     */
+    std::future<void> finalize(std::vector<DeadObject> batch);
+};
+}  // namespace gcpp
@@ -42,6 +42,12 @@ constexpr auto addr_space_size = static_cast<uintptr_t>(1)
  * byte to store a tag. This tag is used to identify the pointer as a GC
  * pointer. Both a header and tag makes it very unlikely to pin garbage
  * and allows us to not have to rescan the entire address space.
+ *
+ * Defining `GCPP_COMPACT_PTR` drops the header so that GC pointers are a
+ * single tagged word, halving the size of pointer-dense structures. Values
+ * are then identified by the tag and the unused address bits alone, and the
+ * collectors rely on their metadata to reject values which aren't the address
+ * of an object.
  */
 
 /**
@@ -69,6 +75,14 @@ constexpr auto ptr_tag_mask = static_cast<uintptr_t>(0xFF)
                               << (ptr_size - 1) * 8;
 /** Mask to AND a ptr of a GC pointer to remove the tag */
 constexpr auto ptr_mask = (static_cast<uintptr_t>(1) << (ptr_size - 1) * 8) - 1;
+#ifdef GCPP_COMPACT_PTR
+/**
+ * Bits between the tag and the address which are clear in every GC pointer,
+ * since user space addresses are below 2^47 with 4-level paging
+ */
+constexpr auto ptr_unused_mask =
+    ptr_mask & ~((static_cast<uintptr_t>(1) << 47) - 1);
+#endif
 
 /**
  * @brief The actual pointer data used by a GC
@@ -87,7 +101,9 @@ static_assert(std::is_standard_layout_v<GCPtr> &&
  */
 struct FatPtr {
   private:
+#ifndef GCPP_COMPACT_PTR
     uintptr_t m_header = ptr_header();
+#endif
     mutable uintptr_t m_ptr;
     friend struct std::hash<FatPtr>;
 
@@ -131,8 +147,8 @@ struct FatPtr {
 
     /**
      * @brief Determines if a value may be a pointer.
-     * Requires `ptr` and `ptr + 1` are valid addresses and are aligned
-     * to `FatPtr`
+     * Requires `ptr` and `ptr + 1` (only `ptr` with `GCPP_COMPACT_PTR`) are
+     * valid addresses and are aligned to `FatPtr`
      *
      * Acquire semantics
      *
@@ -166,7 +182,11 @@ struct FatPtr {
         // return read_header == ptr_header() &&
         //        (read_ptr & ptr_tag_mask) == ptr_tag;
         asm("mfence" ::: "memory");
+#ifdef GCPP_COMPACT_PTR
+        return (*ptr & (ptr_tag_mask | ptr_unused_mask)) == ptr_tag;
+#else
         return *ptr == ptr_header() && (*(ptr + 1) & ptr_tag_mask) == ptr_tag;
+#endif
         // only check the header since that is never modified
     }
 
@@ -256,8 +276,7 @@ struct FatPtr {
     /**
      * @brief Tests if the given pointer is still a GC pointer, and if so
      * returns a copy. Loads with acquire semantics.
-     * Requires `ptr` and `ptr + 1` are valid addresses and are aligned to
-     * `alignof(FatPtr)`
+     * Requires `ptr` is valid and aligned to `alignof(FatPtr)`
      *
      * @param ptr
      * @return std::optional<FatPtr>
@@ -267,6 +286,15 @@ struct FatPtr {
     {
         FatPtr val;
         // use mov to ensure 8-byte move for atomicity
+#ifdef GCPP_COMPACT_PTR
+        asm("mfence\n"
+            "mov (%1), " RAX
+            "\n"
+            "mov " RAX ", %0"
+            : "=rm"(val.m_ptr)
+            : "r"(ptr)
+            : RAX_S, "memory");
+#else
         asm("mfence\n"
             "mov (%2), " RAX
             "\n"
@@ -278,6 +306,7 @@ struct FatPtr {
             : "=rm"(val.m_header), "=rm"(val.m_ptr)
             : "r"(ptr)
             : RAX_S, RCX_S, "memory");
+#endif
         if (FatPtr::maybe_ptr(reinterpret_cast<uintptr_t*>(&val))) {
             return val;
         }
@@ -286,9 +315,15 @@ struct FatPtr {
 };
 // must be trivially copyable to memcpy it
 // must be standard layout so ptr to it is same as ptr to header
+#ifdef GCPP_COMPACT_PTR
+static_assert(std::is_standard_layout_v<FatPtr> &&
+              std::is_trivially_copyable_v<FatPtr> &&
+              sizeof(FatPtr) == sizeof(uintptr_t));
+#else
 static_assert(std::is_standard_layout_v<FatPtr> &&
               std::is_trivially_copyable_v<FatPtr> &&
               sizeof(FatPtr) == sizeof(uintptr_t) * 2);
+#endif
 
 namespace std
 {
@@ -330,19 +365,32 @@ inline void scan_memory(uintptr_t begin, uintptr_t end, Func f,
     const auto aligned_start = begin & gc_ptr_alignment_mask;
     begin = aligned_start == begin ? aligned_start
                                    : aligned_start + gc_ptr_alignment;
-    for (auto ptr = begin; ptr + gc_ptr_size < end; ptr += gc_ptr_alignment) {
+    for (auto ptr = begin; ptr + gc_ptr_size <= end; ptr += gc_ptr_alignment) {
         if (FatPtr::maybe_ptr(reinterpret_cast<uintptr_t*>(ptr), read_only)) {
             f(reinterpret_cast<FatPtr*>(ptr));
         }
     }
 }
 
+/**
+ * @brief Function which destroys the object(s) at `obj` occupying `size` bytes
+ */
+using FinalizerFn = void (*)(void* obj, size_t size);
+
+struct CompressedLayout;
+
 /**
  * @brief Metadata of an object managed by the GC
  */
 struct MetaData {
     size_t size;
     std::align_val_t alignment;
+    /** Function to run when the object is collected, or `nullptr` */
+    FinalizerFn finalizer = nullptr;
+    /** Compressed references of the object, or `nullptr` */
+    const CompressedLayout* compressed = nullptr;
+    /** Number of collections the object has survived */
+    uint32_t age = 0;
 };
 
 }  // namespace gcpp
\ No newline at end of file
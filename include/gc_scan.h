@@ -2,10 +2,11 @@
 
 #include <sys/types.h>
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <queue>
-#include <shared_mutex>
 #include <thread>
 #include <unordered_map>
 #include <vector>
@@ -14,36 +15,118 @@
 
 namespace gcpp
 {
+/**
+ * @brief Callback which appends the addresses of roots that are not on a stack
+ * or in a global (such as GC pointers held in another heap) to the given vector
+ */
+using RootSource = std::function<void(std::vector<FatPtr*>&)>;
 /**
  * @brief Singleton class to fetch the roots of a program
  *
  */
 class GCRoots
 {
+  public:
+    struct RootLink;
+
+    /**
+     * @brief The range of the stack of a thread which may hold roots.
+     * Each thread claims a descriptor the first time it updates its stack
+     * range and only that thread writes to it until it exits.
+     */
+    struct StackDescriptor {
+        /** Earliest (numerically greatest) frame base seen, or 0 if the
+         * descriptor is not in use */
+        std::atomic<uintptr_t> start = 0;
+        /** Stack pointer at the latest update (numerically smallest) */
+        std::atomic<uintptr_t> end = 0;
+        /** Lowest address of the stack of the thread */
+        std::atomic<uintptr_t> low = 0;
+        /** Highest address of the stack of the thread */
+        std::atomic<uintptr_t> high = 0;
+        /** True while a thread owns the descriptor */
+        std::atomic<bool> in_use = false;
+        /**
+         * Number of `RootScope`s alive on the thread. While positive, the
+         * roots of the thread are `roots` and the stack isn't scanned.
+         */
+        std::atomic<size_t> precise_scopes = 0;
+        /** Head of the intrusive list of registered roots of the thread */
+        RootLink* roots = nullptr;
+        /** Mutex for access to `roots` and the links in it */
+        mutable std::mutex roots_mutex;
+        /** Next descriptor in the registry, never changed once published */
+        StackDescriptor* next = nullptr;
+    };
+
+    /**
+     * @brief Node of the intrusive list of precise roots of a thread,
+     * embedded in the root it registers
+     */
+    struct RootLink {
+        /** The registered root */
+        FatPtr* slot = nullptr;
+        RootLink* prev = nullptr;
+        RootLink* next = nullptr;
+        /** Descriptor of the thread which registered the root */
+        StackDescriptor* stack = nullptr;
+    };
+
   private:
     /** Pointer to addresses of global roots */
     const std::vector<uintptr_t> m_global_roots;
-    /** Set of the largest stack range for each thread. Each pair is the
-     * earliest (numerically greatest) stack start and the latest (numerically
-     * smallest) stack end. (start, end)
+    /**
+     * Head of the lock-free registry of stack descriptors. Descriptors are
+     * never removed, instead a descriptor released by an exited thread is
+     * reused by the next new thread.
      */
-    std::unordered_map<std::thread::id, std::pair<uintptr_t, uintptr_t>>
-        m_stack_ranges;
+    std::atomic<StackDescriptor*> m_stacks = nullptr;
     // NOLINTNEXTLINE(cppcoreguidelines-*)
     inline static std::unique_ptr<GCRoots> g_instance;
     /** Mutex for creation of g_instance */
     inline static std::once_flag g_instance_flag;
-    /**
-     * Mutex for access to local_roots, scanned_ranges, and stack_ranges.
-     * Exclusive ownership is needed for adding a new thread entry or adding new
-     * local roots to a thread entry. Shared onwership for everything else.
-     */
-    std::shared_mutex m_mutex;
+    /** Extra root sources, keyed by the id returned from `add_root_source` */
+    std::unordered_map<size_t, RootSource> m_root_sources;
+    size_t m_next_source_id = 0;
+    /** Mutex for access to `m_root_sources` and `m_next_source_id` */
+    std::mutex m_sources_mutex;
+    /** Number of `RootsInUse` alive */
+    inline static std::atomic<size_t> g_roots_in_use = 0;
     GCRoots() noexcept;
 
   public:
+    ~GCRoots();
+    GCRoots(const GCRoots&) = delete;
+    GCRoots& operator=(const GCRoots&) = delete;
+    GCRoots(GCRoots&&) = delete;
+    GCRoots& operator=(GCRoots&&) = delete;
+
+    /**
+     * @brief RAII type held by a collection while it uses the roots returned
+     * by `get_roots`. The roots may be in a thread's stack or in memory
+     * provided by a root source, so stack descriptors are not reused and
+     * large objects are not unmapped while any `RootsInUse` is alive.
+     */
+    class RootsInUse
+    {
+      public:
+        RootsInUse() noexcept { ++g_roots_in_use; }
+        ~RootsInUse() { --g_roots_in_use; }
+        RootsInUse(const RootsInUse&) = delete;
+        RootsInUse& operator=(const RootsInUse&) = delete;
+        RootsInUse(RootsInUse&&) = delete;
+        RootsInUse& operator=(RootsInUse&&) = delete;
+    };
+
     /** Gets the singleton instance of the GCRoots object */
     static GCRoots& get_instance();
+
+    /**
+     * @brief Waits until no `RootsInUse` is alive, so that the roots found by
+     * every scan which started before the call are no longer used. Must not
+     * be called while the calling thread holds a `RootsInUse`.
+     */
+    static void wait_for_roots_unused() noexcept;
     /**
      * @brief Get the root nodes of the object graph.
      * Mutates the GCRoots instance with the strong guaruntee
@@ -53,24 +136,98 @@ class GCRoots
      */
     std::vector<FatPtr*> get_roots(uintptr_t base_ptr);
 
+    /**
+     * @brief Gets the words on the stacks of threads without a `RootScope`
+     * which are not part of a GC pointer, such as raw pointers into objects.
+     * The stacks are scanned over the ranges recorded by the last update of
+     * each thread, such as by `get_roots`.
+     */
+    std::vector<uintptr_t> get_stack_words() const;
+
     /**
      * @brief Updates the min and max stack range for the current thread.
-     * Should be called on a new allocation.
+     * Should be called on a new allocation. Lock-free.
      *
      * @param base_ptr
      */
     void update_stack_range(uintptr_t base_ptr);
 
-  private:
     /**
-     * @brief Scans the stack of the given thread for for local roots.
-     * Scans the difference between `m_scanned_ranges` and `m_stack_ranges` for
-     * `id`.
-     * Requires unique lock on `m_mutex`
-     * Requires an entry in `m_scanned_ranges` and `m_stack_ranges` for `id`
+     * @brief Claims a stack descriptor for the calling thread, with the
+     * bounds of its stack
+     */
+    StackDescriptor& acquire_stack();
+
+    /** Releases a descriptor claimed by `acquire_stack` */
+    static void release_stack(StackDescriptor& stack) noexcept;
+
+    /** Gets the stack descriptor of the calling thread */
+    StackDescriptor& thread_stack();
+
+    /** Determines if the calling thread is within a `RootScope` */
+    bool precise_roots();
+
+    /**
+     * @brief Registers `slot` as a precise root of the calling thread until
+     * `remove_root` is called with `link`
+     *
+     * @param link node to insert, which must outlive the registration
+     */
+    void add_root(RootLink& link, FatPtr* slot);
+
+    /** Unregisters a root registered by `add_root` */
+    static void remove_root(RootLink& link) noexcept;
+
+    /**
+     * @brief Registers a callback which is invoked by `get_roots` to provide
+     * additional roots
      *
+     * @return size_t id to pass to `remove_root_source`
+     */
+    size_t add_root_source(RootSource source);
+
+    /**
+     * @brief Unregisters a root source added with `add_root_source`
      */
-    std::vector<uintptr_t> scan_locals(std::thread::id id);
+    void remove_root_source(size_t id);
+
+  private:
+    /**
+     * @brief Scans the recorded range of a thread's stack for local roots,
+     * appending their addresses to `out`
+     */
+    static void scan_locals(const StackDescriptor& stack,
+                            std::vector<uintptr_t>& out);
+
+    /**
+     * @brief Scans the recorded range of a thread's stack for words which
+     * are not part of a GC pointer, appending their values to `out`
+     */
+    __attribute__((no_sanitize("thread"))) static void scan_words(
+        const StackDescriptor& stack, std::vector<uintptr_t>& out);
+};
+
+/**
+ * @brief RAII type which makes root enumeration precise for the calling thread
+ * for its lifetime: the stack of the thread is not scanned, and its only
+ * roots are those registered with `GCRoots::add_root`, such as `Root`s.
+ * Every local which must keep an object alive, including those in callers
+ * of the scope, must then be registered.
+ *
+ * Scopes nest, and enumeration is precise while any scope is alive.
+ */
+class RootScope
+{
+  private:
+    GCRoots::StackDescriptor& m_stack;
+
+  public:
+    RootScope();
+    ~RootScope();
+    RootScope(const RootScope&) = delete;
+    RootScope& operator=(const RootScope&) = delete;
+    RootScope(RootScope&&) = delete;
+    RootScope& operator=(RootScope&&) = delete;
 };
 
 /**
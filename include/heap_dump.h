@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <variant>
+#include <vector>
+
+#include "gc_base.h"
+
+namespace gcpp
+{
+/**
+ * Heap dumps are a stream of records, each starting with a tag byte, after a
+ * header of `heap_dump_magic` and `heap_dump_version`. Integers are written
+ * in the byte order of the machine which took the dump.
+ *
+ * 'R' u64 target: a root pointing to the object at `target`
+ * 'O' u64 address, u64 size, u64 alignment, u32 age, u32 edge count,
+ *     u64 edges[edge count]: an object and the targets of the GC pointers
+ *     stored in it
+ * 'E': the end of the dump
+ *
+ * Addresses are untagged. Records can be read one at a time so that tools
+ * never need to hold an entire dump in memory.
+ */
+constexpr char heap_dump_magic[8] = {'G', 'C', 'P', 'P', 'D', 'U', 'M', 'P'};
+constexpr uint32_t heap_dump_version = 1;
+
+/** A root recorded in a heap dump */
+struct HeapDumpRoot {
+    /** Address of the object the root points to */
+    uint64_t target;
+};
+
+/** An object recorded in a heap dump */
+struct HeapDumpObject {
+    uint64_t address;
+    uint64_t size;
+    uint64_t alignment;
+    /** Number of collections the object survived */
+    uint32_t age;
+    /** Addresses the GC pointers in the object point to */
+    std::vector<uint64_t> edges;
+};
+
+/** Writes the records of a heap dump to a stream */
+class HeapDumpWriter
+{
+  private:
+    std::ostream& m_out;
+    bool m_finished = false;
+
+  public:
+    /** Writes the header of the dump to `out` */
+    explicit HeapDumpWriter(std::ostream& out);
+    ~HeapDumpWriter();
+    HeapDumpWriter(const HeapDumpWriter&) = delete;
+    HeapDumpWriter& operator=(const HeapDumpWriter&) = delete;
+    HeapDumpWriter(HeapDumpWriter&&) = delete;
+    HeapDumpWriter& operator=(HeapDumpWriter&&) = delete;
+
+    /** Records a root pointing to the object at `target` */
+    void root(uintptr_t target);
+
+    /**
+     * @brief Records an object
+     *
+     * @param addr untagged address of the object
+     * @param edges untagged targets of the GC pointers stored in the object
+     */
+    void object(uintptr_t addr, const MetaData& meta_data,
+                const std::vector<uintptr_t>& edges);
+
+    /**
+     * @brief Writes the end of the dump and flushes the stream. Called by the
+     * destructor if not called before.
+     * @throws `std::runtime_error` if the stream failed
+     */
+    void finish();
+};
+
+/** Reads the records of a heap dump one at a time */
+class HeapDumpReader
+{
+  private:
+    std::istream& m_in;
+    bool m_done = false;
+
+  public:
+    using Record = std::variant<HeapDumpRoot, HeapDumpObject>;
+
+    /**
+     * @brief Reads the header of the dump from `in`
+     * @throws `std::runtime_error` if `in` is not a heap dump of a supported
+     * version
+     */
+    explicit HeapDumpReader(std::istream& in);
+
+    /**
+     * @brief Reads the next record
+     *
+     * @return the record, or `std::nullopt` at the end of the dump
+     * @throws `std::runtime_error` if the dump is truncated or corrupt
+     */
+    std::optional<Record> next();
+};
+}  // namespace gcpp
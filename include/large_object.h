@@ -0,0 +1,194 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "gc_base.h"
+#include "heap_dump.h"
+
+namespace gcpp
+{
+/**
+ * @brief Singleton non-moving space for the large objects of `GC`, which can
+ * be cloned copy-on-write.
+ *
+ * Objects are mapped anonymously. The first clone of an object copies it into
+ * a memfd, remaps it privately over the file, which nothing writes
+ * afterwards, and maps the clone privately over the same file, so both share
+ * the physical pages until either writes one. Cloning an object which shares
+ * its file with another copies it into a new file first, and cloning an
+ * object which has stopped sharing its file writes its written pages back to
+ * the file first. Only cloned objects hold a file open.
+ *
+ * The objects are a root source of the heaps, and are freed by `sweep` once
+ * they are not reachable from the roots through the objects on the heaps and
+ * other large objects, so a cycle through a large object and an object on a
+ * heap is freed by a sweep and the collection after it. Objects must not be
+ * written while they are cloned.
+ */
+class LargeObjectSpace
+{
+    /** File an object and its clones are mapped from */
+    struct Backing {
+        int fd;
+        /** Size of the file, a multiple of the page size */
+        size_t size;
+        /** Number of files open */
+        inline static std::atomic<size_t> g_open = 0;
+
+        explicit Backing(size_t file_size);
+        ~Backing();
+        Backing(const Backing&) = delete;
+        Backing& operator=(const Backing&) = delete;
+        Backing(Backing&&) = delete;
+        Backing& operator=(Backing&&) = delete;
+    };
+
+    struct Object {
+        size_t size;
+        FinalizerFn finalizer;
+        /** File the object is mapped from, or `nullptr` until it is cloned */
+        std::shared_ptr<Backing> backing;
+        /** Number of times the object has been pinned */
+        size_t pins = 0;
+        /** Sweeps started before this epoch don't free the object */
+        uint64_t epoch = 0;
+    };
+
+  private:
+    /** Objects by address */
+    std::map<uintptr_t, Object> m_objects;
+    /** Bytes mapped for all objects */
+    size_t m_mapped = 0;
+    /** Bytes mapped when the next sweep is due */
+    size_t m_next_sweep = initial_sweep_size;
+    /** Files open when the next sweep is due */
+    size_t m_next_sweep_files = initial_sweep_files;
+    std::atomic<uint64_t> m_epoch = 0;
+    std::atomic<bool> m_interior_pointers = false;
+    /** Mutex for access to the objects and their mappings */
+    mutable std::mutex m_mutex;
+    // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+    inline static thread_local bool g_sweeping = false;
+    // NOLINTNEXTLINE(cppcoreguidelines-*)
+    inline static std::unique_ptr<LargeObjectSpace> g_instance;
+    inline static std::once_flag g_instance_flag;
+    LargeObjectSpace();
+
+  public:
+    /** Objects of at least this many bytes are allocated by `GC` here */
+    static constexpr size_t min_size = 16 * 1024;
+    /** Bytes which may be mapped before the first sweep is due */
+    static constexpr size_t initial_sweep_size = 64 * 1024 * 1024;
+    /** Files which may be open before the first sweep is due */
+    static constexpr size_t initial_sweep_files = 256;
+
+    ~LargeObjectSpace() = default;
+    LargeObjectSpace(const LargeObjectSpace&) = delete;
+    LargeObjectSpace& operator=(const LargeObjectSpace&) = delete;
+    LargeObjectSpace(LargeObjectSpace&&) = delete;
+    LargeObjectSpace& operator=(LargeObjectSpace&&) = delete;
+
+    /** Gets the singleton instance of the LargeObjectSpace object */
+    static LargeObjectSpace& get_instance();
+
+    /**
+     * @brief Allocates a zeroed, page aligned object of `size` bytes
+     * @throws `std::runtime_error` if the object can't be mapped
+     */
+    [[nodiscard]] FatPtr alloc(size_t size, FinalizerFn finalizer);
+
+    /**
+     * @brief Makes a copy-on-write clone of the object starting at `ptr`
+     *
+     * @return the clone, or `std::nullopt` if no object starts at `ptr`
+     * @throws `std::system_error` if no file can be created for the object,
+     * such as when too many are open, or `std::runtime_error` if the clone
+     * can't be mapped
+     */
+    [[nodiscard]] std::optional<FatPtr> clone(const FatPtr& ptr);
+
+    /** Determines if `ptr` is in a large object */
+    [[nodiscard]] bool contains(const void* ptr) const;
+
+    /** Gets the number of objects which haven't been freed */
+    [[nodiscard]] size_t object_count() const;
+
+    /** Keeps the object at `ptr` alive until it is unpinned */
+    void pin(const FatPtr& ptr);
+
+    /**
+     * @brief Removes a pin added by `pin`
+     * @throws `std::out_of_range` if `ptr` is not pinned
+     */
+    void unpin(const FatPtr& ptr);
+
+    /**
+     * @brief Determines if enough has been mapped, or enough files opened,
+     * since the last sweep to sweep
+     */
+    [[nodiscard]] bool sweep_due() const;
+
+    /**
+     * @brief Frees the objects which are unreachable, running all of their
+     * finalizers before unmapping any of them
+     *
+     * @param get_roots appends the roots, and the GC pointers of the pinned
+     * objects on the heaps, to its argument. Called while this space is not a
+     * root source.
+     * @param get_object_ptrs appends the GC pointers of the object on a heap
+     * starting at its first argument to its second, returning false if no
+     * object on the heaps starts there
+     * @param find_object gets the start of the object on a heap which
+     * contains its argument, if any. Only called, on the words on the
+     * stacks, if interior pointers are enabled. The heaps must not be
+     * collecting while any of these is called.
+     */
+    void sweep(
+        const std::function<void(std::vector<FatPtr*>&)>& get_roots,
+        const std::function<bool(const FatPtr&, std::vector<FatPtr*>&)>&
+            get_object_ptrs,
+        const std::function<std::optional<FatPtr>(uintptr_t)>& find_object);
+
+    /**
+     * @brief Makes sweeps keep the objects which words on the stacks of
+     * threads without a `RootScope` point inside alive, as well as the objects
+     * reachable from the objects on the heaps they point inside
+     * @see CopyingCollector::enable_interior_pointers
+     */
+    void enable_interior_pointers() noexcept;
+
+    /**
+     * @brief Records every object, with the targets of the GC pointers
+     * stored in it, to `out`
+     */
+    void dump(HeapDumpWriter& out) const;
+
+  private:
+    /**
+     * @brief Appends the addresses of the GC pointers in the objects to `out`
+     */
+    void get_roots(std::vector<FatPtr*>& out) const;
+
+    /**
+     * @brief Finds the object which contains `addr`. Requires holding
+     * `m_mutex`.
+     * @return iterator to the object, or the end of `m_objects` if none does
+     */
+    [[nodiscard]] std::map<uintptr_t, Object>::const_iterator find_containing(
+        uintptr_t addr) const;
+
+    /**
+     * @brief Maps the object at `addr` privately over a file which nothing
+     * else writes, with the same contents, creating the file if the object
+     * has none or shares it
+     */
+    void freeze(uintptr_t addr, Object& obj);
+};
+}  // namespace gcpp
@@ -0,0 +1,146 @@
+#pragma once
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "collector.h"
+#include "concurrent_gc.h"
+#include "gc_base.h"
+#include "generational_gc.h"
+#include "mem_prot.h"
+
+namespace gcpp
+{
+/**
+ * @brief A sliding (Lisp-2) mark-compact collector over a single space.
+ *
+ * Unlike `CopyingCollector`, this collector needs no reserve space so nearly
+ * the entire heap can be allocated. Live objects are slid towards the start of
+ * the heap in address order, which preserves their allocation order.
+ *
+ * Forwarding addresses are kept in a side table instead of in object headers.
+ * Compaction stops the world: it holds the collector lock for its duration so
+ * allocations block, and mutators must not access the heap while it runs.
+ */
+template <CollectorLockingPolicy LockPolicy, GCGenerationPolicy GenPolicy>
+class MarkCompactCollector
+{
+    using MemStore = std::unique_ptr<std::byte[]>;
+
+  private:
+    size_t m_heap_size;
+    MemStore m_space;
+    /** Next index to allocate an object */
+    typename LockPolicy::gc_size_t m_next = 0;
+    /** Metadata of each object, ordered by address */
+    std::map<uintptr_t, MetaData> m_metadata;
+    std::shared_future<CollectionResultT> m_collect_result;
+    mutable LockPolicy m_lock;
+    GenPolicy m_gen_policy;
+    /** Result of finalizing the objects found dead by the last collection */
+    std::future<void> m_finalized;
+
+  public:
+    /**
+     * @brief Collector static interface
+     * @see Collector
+     * @{
+     */
+    explicit MarkCompactCollector(size_t size)
+        : m_heap_size(page_size_ceil(size)),
+          m_space(new(page_size_align()) std::byte[page_size_ceil(size)]),
+          m_gen_policy()
+    {
+        if (size >= ptr_mask) {
+            throw std::runtime_error("Heap size too large");
+        }
+        register_heap(m_space.get(), m_heap_size);
+    }
+
+    ~MarkCompactCollector();
+    MarkCompactCollector(const MarkCompactCollector&) = delete;
+    MarkCompactCollector& operator=(const MarkCompactCollector&) = delete;
+    MarkCompactCollector(MarkCompactCollector&&) = delete;
+    MarkCompactCollector& operator=(MarkCompactCollector&&) = delete;
+
+    /**
+     * @param finalizer function to run on the object after it is collected
+     */
+    [[nodiscard]] FatPtr alloc(size_t size,
+                               std::align_val_t alignment = std::align_val_t{1},
+                               FinalizerFn finalizer = nullptr);
+
+    std::future<std::vector<FatPtr>> async_collect(
+        const std::vector<FatPtr*>& extra_roots) noexcept;
+
+    [[nodiscard]] bool contains(void* ptr) const noexcept;
+
+    [[nodiscard]] size_t free_space() const noexcept;
+    /** @} */
+
+    /**
+     * @brief Dispatches an async collection task
+     * Waits for the current collection to finish before starting a new one
+     * if one is already in progress
+     *
+     * @param needed_space amount of space needed to be free. Avoids collection
+     * if there is already enough space. Any sufficiently large value will
+     * always trigger a collection
+     */
+    void collect(
+        size_t needed_space = std::numeric_limits<size_t>::max()) noexcept;
+
+  private:
+    /**
+     * @brief Attempts to allocate a new object on the heap.
+     * If allocation fails, invokes a collection and tries again.
+     * If the retry fails, throws `std::bad_alloc`.
+     */
+    [[nodiscard]] FatPtr alloc_attempt(const MetaData& meta_data,
+                                       uint8_t attempts = 0);
+
+    /**
+     * @brief Marks every object reachable from `roots`.
+     * Requires having a lock.
+     *
+     * @param roots addresses of objects to start marking from
+     * @param marked [in/out] addresses of marked objects
+     */
+    void mark(std::vector<uintptr_t> roots,
+              std::unordered_set<uintptr_t>& marked) const;
+
+    /**
+     * @brief Computes the address each marked object will be slid to.
+     * Requires having a lock.
+     *
+     * @return the forwarding table and the index of the end of the compacted
+     * objects
+     */
+    [[nodiscard]] std::pair<std::unordered_map<uintptr_t, uintptr_t>, size_t>
+    compute_forwarding(const std::unordered_set<uintptr_t>& marked) const;
+
+    /**
+     * @brief Slides the marked objects to their forwarded addresses and
+     * rebuilds the metadata.
+     * Requires having a lock and that all pointers have been updated.
+     */
+    void slide(const std::unordered_map<uintptr_t, uintptr_t>& forwarding);
+
+    /**
+     * @brief Runs a full collection.
+     * Requires having a lock.
+     */
+    void compact(const std::vector<FatPtr*>& extra_roots);
+};
+
+static_assert(
+    Collector<MarkCompactCollector<SerialGCPolicy, FinalGenerationPolicy>>);
+static_assert(
+    Collector<MarkCompactCollector<ConcurrentGCPolicy, FinalGenerationPolicy>>);
+}  // namespace gcpp
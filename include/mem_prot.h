@@ -2,11 +2,16 @@
 #include <sys/mman.h>
 
 #include <cstddef>
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <new>
+#include <utility>
+#include <vector>
 namespace gcpp
 {
 enum class ProtectionMode : int {
+    None = PROT_NONE,
     ReadOnly = PROT_READ,
     WriteOnly = PROT_WRITE,
     ReadWrite = PROT_READ | PROT_WRITE,
@@ -40,6 +45,8 @@ class RegionProtection
 int page_size();
 /** Registers a heap so that it can be protected */
 void register_heap(const void* start, size_t len);
+/** Unregisters a heap added with `register_heap` */
+void unregister_heap(const void* start, size_t len);
 /** Gets a size that is a multiple of page_size which is >= `size` */
 size_t page_size_ceil(size_t size);
 /**
@@ -51,4 +58,125 @@ size_t page_size_ceil(size_t size);
 /** Gets the page size in bytes as `std::align_val_t` */
 std::align_val_t page_size_align();
 
+/**
+ * @brief Handler for segmentation faults in a registered range.
+ * Runs in the signal handler of the faulting thread so it must be
+ * async-signal-safe.
+ *
+ * @param context the context passed when registering the handler
+ * @param addr faulting address
+ * @return true if the fault was resolved and the access should be retried
+ */
+using FaultHandler = bool (*)(void* context, void* addr);
+
+/**
+ * @brief Registers a handler for faults in [start, start + len)
+ *
+ * @return size_t id to pass to `unregister_fault_handler`
+ */
+size_t register_fault_handler(const void* start, size_t len,
+                              FaultHandler handler, void* context);
+
+/** Unregisters a handler added with `register_fault_handler` */
+void unregister_fault_handler(size_t id);
+
+/**
+ * @brief Shared memory which is mapped at two addresses.
+ * Changing the protection of the view does not affect the alias, so pages
+ * which are inaccessible through the view can still be filled through the
+ * alias.
+ */
+class AliasedRegion
+{
+  private:
+    std::byte* m_view;
+    std::byte* m_alias;
+    size_t m_size;
+    int m_fd;
+
+    /** Unmaps the region */
+    void release() noexcept;
+
+  public:
+    /** @param size size of the region, rounded up to a multiple of pages */
+    explicit AliasedRegion(size_t size);
+    ~AliasedRegion();
+    AliasedRegion(const AliasedRegion&) = delete;
+    AliasedRegion& operator=(const AliasedRegion&) = delete;
+    AliasedRegion(AliasedRegion&&) = delete;
+    AliasedRegion& operator=(AliasedRegion&&) = delete;
+
+    std::byte* view() const noexcept { return m_view; }
+    std::byte* alias() const noexcept { return m_alias; }
+    size_t size() const noexcept { return m_size; }
+
+    /**
+     * @brief Frees the pages in [offset, offset + len) of the region.
+     * Freed pages are read as zeros, and are missing for userfaultfd.
+     * Requires `offset` and `len` are multiples of the page size
+     */
+    void discard(size_t offset, size_t len);
+};
+
+/**
+ * @brief Tracks the protection of each page of a region so that protection
+ * changes can be staged during a GC phase and applied with as few `mprotect`
+ * calls as possible.
+ */
+class PageProtection
+{
+  private:
+    std::byte* m_start;
+    size_t m_pages;
+    /** Current protection of each page, as a `ProtectionMode` */
+    std::unique_ptr<std::atomic<int>[]> m_current;
+    /** Staged protection of each page, or `no_change` */
+    std::vector<int> m_staged;
+    /** Range of pages with staged changes */
+    size_t m_staged_begin;
+    size_t m_staged_end = 0;
+
+    static constexpr int no_change = -1;
+
+    /** Gets the pages overlapping [addr, addr + len) as [first, last) */
+    std::pair<size_t, size_t> page_range(const void* addr, size_t len) const;
+
+  public:
+    /**
+     * @param start start of the region. Must be page aligned
+     * @param len size of the region, rounded up to a multiple of pages
+     * @param initial current protection of the region
+     */
+    PageProtection(void* start, size_t len,
+                   ProtectionMode initial = ProtectionMode::ReadWrite);
+
+    /**
+     * @brief Stages a protection change of the pages overlapping
+     * [addr, addr + len). Nothing changes until `commit` is called
+     */
+    void protect(const void* addr, size_t len, ProtectionMode mode);
+
+    /**
+     * @brief Applies the staged changes. Consecutive pages which change to the
+     * same protection, including pages which already have it, are protected
+     * with a single `mprotect` call. Throws `std::runtime_error` on failure
+     *
+     * @return the number of `mprotect` calls made
+     */
+    size_t commit();
+
+    /**
+     * @brief Immediately changes the protection of the pages overlapping
+     * [addr, addr + len). Async-signal-safe, but must not be called
+     * concurrently with `commit` on the same pages
+     *
+     * @return true on success
+     */
+    bool protect_now(const void* addr, size_t len,
+                     ProtectionMode mode) noexcept;
+
+    /** Gets the current protection of the page containing `addr` */
+    ProtectionMode protection(const void* addr) const;
+};
+
 }  // namespace gcpp
\ No newline at end of file
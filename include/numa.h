@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace gcpp
+{
+/**
+ * @brief Gets the ids of the online NUMA nodes of this machine in increasing
+ * order. Ids may be sparse. Returns `{0}` if the topology cannot be read
+ * (non-NUMA machines or no sysfs).
+ */
+const std::vector<size_t>& numa_nodes() noexcept;
+
+/** Gets the number of online NUMA nodes on this machine */
+size_t numa_node_count() noexcept;
+
+/**
+ * @brief Gets the id of the NUMA node the calling thread is currently running
+ * on. Always one of `numa_nodes()`
+ */
+size_t current_numa_node() noexcept;
+
+/**
+ * @brief Restricts the calling thread to run on the CPUs of the given NUMA
+ * node
+ *
+ * @return true if the affinity of the thread was changed
+ */
+bool pin_to_numa_node(size_t node) noexcept;
+}  // namespace gcpp
@@ -0,0 +1,239 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "collector.h"
+#include "concurrent_gc.h"
+#include "gc_base.h"
+#include "generational_gc.h"
+#include "mem_prot.h"
+
+namespace gcpp
+{
+/** Statistics of the last collection of a `RegionCollector` */
+struct RegionCollectionStats {
+    /** Number of regions evacuated and freed */
+    size_t regions_evacuated = 0;
+    /** Bytes of live objects copied out of the evacuated regions */
+    size_t bytes_copied = 0;
+    /** Time spent evacuating and updating references */
+    std::chrono::nanoseconds evacuation_time{0};
+    /** Time of the entire collection, including marking */
+    std::chrono::nanoseconds pause_time{0};
+};
+
+/**
+ * @brief A region-based evacuating collector over a single space split into
+ * fixed-size regions.
+ *
+ * Objects are bump allocated in one region at a time. Each collection marks
+ * the heap, recording the live bytes of every region and the slots outside a
+ * region which point into it, then evacuates only the regions with the most
+ * garbage whose predicted copying time fits the pause budget. Only the
+ * recorded slots of those regions are updated, so the work of the evacuation
+ * scales with the live data of the chosen regions rather than the heap.
+ *
+ * The prediction is the live bytes of a region times the copying rate
+ * measured by previous collections. Marking is not bounded by the budget.
+ *
+ * Like `MarkCompactCollector`, collections stop the world: the collector lock
+ * is held for their duration and mutators must not access the heap while
+ * they run. Objects larger than a region can't be allocated.
+ */
+template <CollectorLockingPolicy LockPolicy, GCGenerationPolicy GenPolicy>
+class RegionCollector
+{
+    using MemStore = std::unique_ptr<std::byte[]>;
+
+    struct Region {
+        /** Offset of the next free byte from the start of the region */
+        size_t top = 0;
+        /** Bytes of objects found live by the last mark */
+        size_t live = 0;
+        /**
+         * Slots outside the region, roots included, found pointing into it by
+         * the last mark
+         */
+        std::vector<FatPtr*> incoming;
+    };
+
+    /** Index of a region, or `no_region` */
+    using RegionIdx = size_t;
+    static constexpr RegionIdx no_region = std::numeric_limits<size_t>::max();
+
+  private:
+    size_t m_heap_size;
+    size_t m_region_size;
+    MemStore m_space;
+    std::vector<Region> m_regions;
+    /** Regions which are empty */
+    std::vector<RegionIdx> m_free_regions;
+    /** Number of free regions kept for evacuation rather than allocation */
+    size_t m_reserve;
+    /** Region new objects are allocated in */
+    RegionIdx m_alloc_region = no_region;
+    /** Cached result of `free_space`, updated whenever regions change */
+    typename LockPolicy::gc_size_t m_free = 0;
+    /** Metadata of each object, ordered by address */
+    std::map<uintptr_t, MetaData> m_metadata;
+    std::shared_future<CollectionResultT> m_collect_result;
+    mutable LockPolicy m_lock;
+    GenPolicy m_gen_policy;
+    /** Result of finalizing the objects found dead by the last collection */
+    std::future<void> m_finalized;
+    std::chrono::nanoseconds m_pause_budget;
+    /** Measured time to evacuate a byte of live objects */
+    double m_ns_per_byte = 1.0;
+    RegionCollectionStats m_stats;
+
+  public:
+    /** Region size used unless another is given */
+    static constexpr size_t default_region_size = 64 * 1024;
+
+    /**
+     * @brief Collector static interface
+     * @see Collector
+     * @{
+     */
+    /**
+     * @param size size of the heap, rounded up to a whole number of regions
+     * @param region_size size of each region, rounded up to a whole number of
+     * pages
+     * @param pause_budget time each collection may spend evacuating
+     */
+    explicit RegionCollector(
+        size_t size, size_t region_size = default_region_size,
+        std::chrono::nanoseconds pause_budget = std::chrono::milliseconds{5});
+
+    ~RegionCollector();
+    RegionCollector(const RegionCollector&) = delete;
+    RegionCollector& operator=(const RegionCollector&) = delete;
+    RegionCollector(RegionCollector&&) = delete;
+    RegionCollector& operator=(RegionCollector&&) = delete;
+
+    /**
+     * @param finalizer function to run on the object after it is collected
+     * @throws `std::bad_alloc` if `size` is larger than a region, `alignment`
+     * is larger than a page, or the heap is still full after a collection
+     */
+    [[nodiscard]] FatPtr alloc(size_t size,
+                               std::align_val_t alignment = std::align_val_t{1},
+                               FinalizerFn finalizer = nullptr);
+
+    std::future<std::vector<FatPtr>> async_collect(
+        const std::vector<FatPtr*>& extra_roots) noexcept;
+
+    [[nodiscard]] bool contains(void* ptr) const noexcept;
+
+    /**
+     * @brief Gets the space which can be allocated before a collection is
+     * required. Excludes the regions reserved for evacuation.
+     */
+    [[nodiscard]] size_t free_space() const noexcept;
+    /** @} */
+
+    /**
+     * @brief Dispatches an async collection task
+     * Waits for the current collection to finish before starting a new one
+     * if one is already in progress
+     *
+     * @param needed_space amount of space needed to be free. Avoids collection
+     * if there is already enough space. Any sufficiently large value will
+     * always trigger a collection
+     */
+    void collect(
+        size_t needed_space = std::numeric_limits<size_t>::max()) noexcept;
+
+    /** Sets the time later collections may spend evacuating */
+    void set_pause_budget(std::chrono::nanoseconds budget) noexcept;
+
+    /**
+     * @brief Gets the statistics of the last finished collection.
+     * Blocks while a collection is in progress.
+     */
+    [[nodiscard]] RegionCollectionStats last_collection() const;
+
+  private:
+    /** Gets the index of the region containing `addr` */
+    [[nodiscard]] RegionIdx region_of(uintptr_t addr) const noexcept;
+
+    /** Gets the address of the start of region `idx` */
+    [[nodiscard]] uintptr_t region_start(RegionIdx idx) const noexcept;
+
+    /**
+     * @brief Recomputes `m_free`.
+     * Requires having a lock.
+     */
+    void update_free_space() noexcept;
+
+    /**
+     * @brief Bump allocates in region `idx`
+     * @return the address of the object, or `std::nullopt` if it doesn't fit
+     */
+    [[nodiscard]] std::optional<uintptr_t> bump(RegionIdx idx, size_t size,
+                                                std::align_val_t alignment);
+
+    /**
+     * @brief Attempts to allocate a new object on the heap.
+     * If allocation fails, invokes a collection and tries again.
+     * If the retry fails, throws `std::bad_alloc`.
+     */
+    [[nodiscard]] FatPtr alloc_attempt(const MetaData& meta_data,
+                                       uint8_t attempts = 0);
+
+    /**
+     * @brief Marks every object reachable from the objects `slots` point to,
+     * adding their size to the live bytes of their region and recording
+     * every slot which points into a different region than its own.
+     * Requires having a lock.
+     *
+     * @param slots roots or slots of objects to start marking from
+     * @param marked [in/out] addresses of marked objects
+     */
+    void mark(std::vector<FatPtr*> slots,
+              std::unordered_set<uintptr_t>& marked);
+
+    /**
+     * @brief Chooses the regions to evacuate: those with the most garbage
+     * whose predicted evacuation time fits the pause budget, and whose live
+     * objects fit in the free regions. At least one region with garbage is
+     * chosen if any fits.
+     * Requires having a lock.
+     */
+    [[nodiscard]] std::vector<RegionIdx> choose_regions(
+        const std::unordered_set<uintptr_t>& marked) const;
+
+    /**
+     * @brief Copies the marked objects of `regions` into free regions, then
+     * updates the slots which point to them and frees `regions`.
+     * Requires having a lock.
+     *
+     * @return map from the old to the new address of each copied object
+     */
+    std::unordered_map<uintptr_t, uintptr_t> evacuate(
+        const std::vector<RegionIdx>& regions,
+        const std::unordered_set<uintptr_t>& marked);
+
+    /**
+     * @brief Runs a collection.
+     * Requires having a lock.
+     */
+    void collect_regions(const std::vector<FatPtr*>& extra_roots);
+};
+
+static_assert(
+    Collector<RegionCollector<SerialGCPolicy, FinalGenerationPolicy>>);
+static_assert(
+    Collector<RegionCollector<ConcurrentGCPolicy, FinalGenerationPolicy>>);
+}  // namespace gcpp
@@ -1,5 +1,13 @@
 #pragma once
+#include <cstddef>
 #include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include "gc_base.h"
 namespace gcpp
@@ -15,14 +23,222 @@ concept GCFrontEnd = requires(T a) {
     } -> std::same_as<FatPtr>;
 };
 
+/**
+ * @brief Front end sharing one heap per NUMA node between all threads.
+ * Allocations are made from the innermost `ArenaScope` of the calling thread
+ * if it has one. Otherwise objects of at least `LargeObjectSpace::min_size`
+ * bytes are allocated from the `LargeObjectSpace`, and are freed by `collect`.
+ */
 struct GC {
     static FatPtr alloc(size_t size,
-                        std::align_val_t alignment = std::align_val_t{1});
+                        std::align_val_t alignment = std::align_val_t{1},
+                        FinalizerFn finalizer = nullptr,
+                        const CompressedLayout* compressed = nullptr);
+    /**
+     * @brief Allocates `count` objects of `size` bytes at once
+     * @see CopyingCollector::alloc_batch
+     */
+    static std::vector<FatPtr> alloc_batch(
+        size_t count, size_t size,
+        std::align_val_t alignment = std::align_val_t{1},
+        FinalizerFn finalizer = nullptr,
+        const CompressedLayout* compressed = nullptr);
     static void collect() noexcept;
+    /**
+     * @brief Pins an object so that collections leave it in place. Does
+     * nothing for objects of an `ArenaScope` of the calling thread, which
+     * don't move while the scope is alive.
+     * @see CopyingCollector::pin
+     */
+    static void pin(const FatPtr& ptr);
+    /** Removes a pin added by `pin` */
+    static void unpin(const FatPtr& ptr);
+    /**
+     * @brief Allocates an object as `alloc` does, but never from an
+     * `ArenaScope`, and pins it until it is unpinned with `unpin`
+     * @throws `std::bad_alloc` if the heap is still too full after collecting
+     */
+    static FatPtr alloc_pinned(
+        size_t size, std::align_val_t alignment = std::align_val_t{1});
+    /**
+     * @brief Allocates the storage of a standard container at `holder`. If
+     * `holder` is inside an object on the heaps and the storage is smaller
+     * than `LargeObjectSpace::min_size`, the storage is attached to that
+     * object (see `CopyingCollector::attach_storage`), otherwise it is
+     * allocated as `alloc_pinned` does.
+     * @throws `std::bad_alloc` if the heap is still too full after collecting
+     */
+    static FatPtr alloc_storage(size_t size, std::align_val_t alignment,
+                                const void* holder);
+    /**
+     * @brief Releases storage from `alloc_storage`, which the next collection
+     * frees unless something else keeps it alive. Does nothing for storage
+     * which isn't attached or pinned.
+     */
+    static void free_storage(const FatPtr& ptr) noexcept;
+    /**
+     * @brief Updates the pointers held by the heaps to objects outside of them
+     * which have moved
+     * @see CopyingCollector::forward_external
+     */
+    static void forward_external(
+        const std::unordered_map<uintptr_t, FatPtr>& moved);
+    /**
+     * @brief Makes a copy-on-write clone of a large object
+     * @return the clone, or `std::nullopt` if `ptr` is not a large object
+     * @see LargeObjectSpace::clone
+     */
+    static std::optional<FatPtr> clone_large(const FatPtr& ptr);
+    /**
+     * @brief Makes collections of the heaps, and sweeps of the large objects,
+     * keep the objects which raw pointers on the stacks point inside alive,
+     * and those on the heaps in place
+     * @see CopyingCollector::enable_interior_pointers
+     * @see LargeObjectSpace::enable_interior_pointers
+     */
+    static void enable_interior_pointers();
+    /**
+     * @brief Sets the number of heaps, which is one per online NUMA node
+     * unless set. The heaps are dealt out to the nodes in turn.
+     * @throws `std::logic_error` if the heaps have already been created
+     * @throws `std::invalid_argument` if `count` is 0
+     */
+    static void set_heap_count(size_t count);
+};
+
+/**
+ * @brief Front end giving each thread a private heap which is collected
+ * serially by the thread itself, so allocating needs no synchronization with
+ * other threads, and collecting never waits for another thread's collection.
+ * A collection still finds its roots as a collection of `GC` does: it scans
+ * the stacks of every registered thread and runs the root sources, and takes
+ * the locks of `GCRoots`, `WeakRefs`, `AllocProfiler` and the root sources,
+ * such as the one of the shared heaps, while doing so.
+ *
+ * Objects of a thread's heap must not escape the thread: they must not be
+ * referenced by other threads or from the shared heap of `GC`, and are freed
+ * when the thread exits. `publish` copies a graph of them into the shared
+ * heap when it must escape. Pointers from a thread's heap to shared objects
+ * are not roots of the shared heap, so the thread must keep shared objects
+ * alive by other means, such as locals.
+ */
+struct ThreadLocalGC {
+    /**
+     * @brief Allocates from the calling thread's heap, collecting it first if
+     * it is full
+     * @throws `std::bad_alloc` if the heap is still too full after collecting
+     */
+    static FatPtr alloc(size_t size,
+                        std::align_val_t alignment = std::align_val_t{1},
+                        FinalizerFn finalizer = nullptr,
+                        const CompressedLayout* compressed = nullptr);
+    /** @see GC::alloc_batch */
+    static std::vector<FatPtr> alloc_batch(
+        size_t count, size_t size,
+        std::align_val_t alignment = std::align_val_t{1},
+        FinalizerFn finalizer = nullptr,
+        const CompressedLayout* compressed = nullptr);
+    /** Collects the calling thread's heap before returning */
+    static void collect() noexcept;
+    /** @see GC::pin */
+    static void pin(const FatPtr& ptr);
+    /** Removes a pin added by `pin` */
+    static void unpin(const FatPtr& ptr);
+    /**
+     * @brief Makes collections of every thread's heap keep the objects which
+     * raw pointers on the stacks point inside alive and in place
+     * @see CopyingCollector::enable_interior_pointers
+     */
+    static void enable_interior_pointers();
+
+    /**
+     * @brief Copies the objects of the calling thread's heap reachable from
+     * `root` into the shared heap of `GC`
+     *
+     * @return pointer to the copy of `root`, or `root` if it is not on the
+     * calling thread's heap
+     * @see CopyingCollector::transfer
+     */
+    static FatPtr publish(const FatPtr& root);
+
+    /**
+     * @brief Sets the size of the calling thread's heap
+     * @throws `std::logic_error` if the thread has already allocated
+     */
+    static void set_heap_size(size_t size);
+};
+
+/**
+ * @brief Allocator for standard containers which keeps their storage on the
+ * heaps of `GC`, so that `SafePtr`s stored in a container are traced even when
+ * the container itself is not a root, such as when it is a member of a GC
+ * object.
+ *
+ * Containers hold raw pointers to their storage, so it never moves. The
+ * storage of a container which is a member of a GC object is traced from the
+ * object, so it is freed with the object even if it points back to it, and
+ * the container must not be moved out of the object. Other storage is pinned
+ * until it is deallocated: as a root, it keeps the objects it points to
+ * alive. So is storage of at least `LargeObjectSpace::min_size` bytes, which
+ * is a large object, and storage allocated through a temporary copy of the
+ * allocator, such as the bucket arrays of unordered containers, so those
+ * should be destroyed by a finalizer (see `Finalize`).
+ */
+template <typename T>
+struct GCAllocator {
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using is_always_equal = std::true_type;
+
+    template <typename U>
+    // NOLINTNEXTLINE(readability-identifier-naming)
+    struct rebind {
+        using other = GCAllocator<U>;
+    };
+
+    template <typename U>
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    GCAllocator(const GCAllocator<U>&) noexcept
+    {
+    }
+
+    GCAllocator() noexcept = default;
+
+    [[nodiscard]] T* allocate(std::size_t n)
+    {
+        // containers allocate through the allocator they hold
+        return reinterpret_cast<T*>(
+            GC::alloc_storage(sizeof(T) * n, std::align_val_t{alignof(T)},
+                              this)
+                .as_ptr());
+    }
+
+    void deallocate(T* p, std::size_t) noexcept
+    {
+        GC::free_storage(FatPtr{reinterpret_cast<uintptr_t>(p)});
+    }
+
+    template <typename U>
+    bool operator==(const GCAllocator<U>&) const noexcept
+    {
+        return true;
+    }
 };
 
 [[nodiscard]] std::unique_lock<std::mutex> test_lock();
 
+/**
+ * @brief Writes a snapshot of the global GC's heaps and large objects to the
+ * file at `path`: every object, the pointers between them and the roots of
+ * the calling thread and the other registered threads. Read with `HeapDumpReader` or the
+ * `heap_analyzer` tool.
+ *
+ * @throws `std::runtime_error` if the file cannot be written
+ */
+void dump_heap(const std::string& path);
+
 static_assert(GCFrontEnd<GC>);
+static_assert(GCFrontEnd<ThreadLocalGC>);
 
 }  // namespace gcpp
\ No newline at end of file
@@ -1,13 +1,24 @@
 #pragma once
 #include <sys/types.h>
 
+#include <algorithm>
+#include <bit>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <new>
 #include <optional>
+#include <stdexcept>
 #include <type_traits>
+#include <vector>
 
+#include "arena.h"
+#include "compressed_ptr.h"
+#include "finalizer.h"
 #include "gc_scan.h"
 #include "safe_alloc.h"
+#include "weak_ref.h"
 namespace gcpp
 {
 
@@ -37,9 +48,82 @@ struct AlignmentOf<T, std::void_t<decltype(alignof(T))>> {
 };
 /** @} */
 
+/**
+ * @brief Allocates space for `count` objects of type `T` from `GC`, registering
+ * their finalizer if `T` is finalized and their compressed references if `T`
+ * has any.
+ * Since the finalizer is registered before the objects are constructed, the
+ * constructors of finalized types should not throw.
+ */
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+FatPtr alloc_objects(size_t count = 1)
+{
+    if constexpr (compressed_layout_of<T>() != nullptr) {
+        return GC::alloc(sizeof(T) * count, AlignmentVal, finalizer_of<T>(),
+                         compressed_layout_of<T>());
+    } else if constexpr (finalizer_of<T>() != nullptr) {
+        return GC::alloc(sizeof(T) * count, AlignmentVal, finalizer_of<T>());
+    } else {
+        return GC::alloc(sizeof(T) * count, AlignmentVal);
+    }
+}
+
+/**
+ * @brief Allocates space for `count` separate objects of type `T` from `GC` at
+ * once, registering their finalizer and compressed references.
+ * @see alloc_objects
+ */
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+std::vector<FatPtr> alloc_object_batch(size_t count)
+{
+    return GC::alloc_batch(count, sizeof(T), AlignmentVal, finalizer_of<T>(),
+                           compressed_layout_of<T>());
+}
+
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+class WeakSafePtrBase;
+
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+class PinGuard;
+
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+class Root;
+
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+class TempRoot;
+
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+class CompressedSafePtr;
+
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+class SafePtrBase;
+
+template <typename T, std::align_val_t AlignmentVal>
+SafePtrBase<T, AlignmentVal, gcpp::GC> publish(
+    const SafePtrBase<T, AlignmentVal, ThreadLocalGC>& ptr);
+
 template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
 class SafePtrBase
 {
+    template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
+    friend class WeakSafePtrBase;
+
+    template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
+    friend class PinGuard;
+
+    template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
+    friend class Root;
+
+    template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
+    friend class TempRoot;
+
+    template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
+    friend class CompressedSafePtr;
+
+    template <typename U, std::align_val_t AlignmentValF>
+    friend SafePtrBase<U, AlignmentValF, gcpp::GC> publish(
+        const SafePtrBase<U, AlignmentValF, ThreadLocalGC>&);
+
     template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
     friend bool operator==(std::nullptr_t,
                            const SafePtrBase<U, AlignmentValF, GC2>&);
@@ -59,20 +143,89 @@ class SafePtrBase
   private:
     FatPtr m_ptr;
 
+    static auto from_fat_ptr(FatPtr ptr)
+    {
+        SafePtrBase res;
+        res.m_ptr = ptr;
+        res.note_store();
+        return res;
+    }
+
+    /** Runs the write barrier of `ArenaScope` on a store to `m_ptr` */
+    void note_store() const { ArenaScope::note_store(&m_ptr, m_ptr); }
+
   public:
+    // a single pointer, such as a `Root`, is copied rather than passed to the
+    // constructor of `T`
     template <typename... Args>
+        requires(!(sizeof...(Args) == 1 &&
+                   (std::is_base_of_v<SafePtrBase, std::remove_cvref_t<Args>> &&
+                    ...)))
     explicit SafePtrBase(Args&&... args)
-        : m_ptr(reinterpret_cast<uintptr_t>(new(GC::alloc(
-              sizeof(T), AlignmentVal)) T(std::forward<Args>(args)...)))
+        : m_ptr(reinterpret_cast<uintptr_t>(
+              new(alloc_objects<T, AlignmentVal, GC>())
+                  T(std::forward<Args>(args)...)))
     {
+        note_store();
     }
 
     template <typename... Args>
     static auto make(Args&&... args)
     {
         SafePtrBase res;
-        res.m_ptr = FatPtr{reinterpret_cast<uintptr_t>(new (GC::alloc(
-            sizeof(T), AlignmentVal)) T(std::forward<Args>(args)...))};
+        res.m_ptr = FatPtr{reinterpret_cast<uintptr_t>(
+            new (alloc_objects<T, AlignmentVal, GC>())
+                T(std::forward<Args>(args)...))};
+        res.note_store();
+        return res;
+    }
+
+    /**
+     * @brief Makes `count` objects, each constructed from copies of `args`,
+     * with a single allocation from the GC
+     *
+     * @return a GC array of pointers to the objects
+     */
+    template <typename... Args>
+    static auto make_n(size_t count, const Args&... args)
+    {
+        using Array =
+            SafePtrBase<SafePtrBase[], AlignmentOf<SafePtrBase>::value, GC>;
+        if (count == 0) {
+            return TempRoot<SafePtrBase[], AlignmentOf<SafePtrBase>::value,
+                            GC>{};
+        }
+        GC_UPDATE_STACK_RANGE_NESTED_1();
+        // a root within a `RootScope` while the constructors allocate
+        TempRoot<SafePtrBase[], AlignmentOf<SafePtrBase>::value, GC> res =
+            Array::make(count);
+        if constexpr (std::is_nothrow_constructible_v<T, const Args&...>) {
+            // a constructor which can't throw can't allocate, so no
+            // collection is started before the objects are referenced
+            const auto ptrs = alloc_object_batch<T, AlignmentVal, GC>(count);
+            for (size_t i = 0; i < count; ++i) {
+                new (ptrs[i].as_ptr()) T(args...);
+                res[i].m_ptr = ptrs[i];
+                res[i].note_store();
+            }
+        } else {
+            {
+                // a constructor may allocate and collect, so the objects are
+                // referenced by `res` before any is constructed. They are
+                // cleared so collections find no stale pointers in them
+                const auto ptrs =
+                    alloc_object_batch<T, AlignmentVal, GC>(count);
+                for (size_t i = 0; i < count; ++i) {
+                    std::memset(ptrs[i].as_ptr(), 0, sizeof(T));
+                    res[i].m_ptr = ptrs[i];
+                    res[i].note_store();
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                const auto pinned = PinGuard<T, AlignmentVal, GC>{res[i]};
+                new (res[i].m_ptr.as_ptr()) T(args...);
+            }
+        }
         return res;
     }
 
@@ -80,6 +233,32 @@ class SafePtrBase
 
     SafePtrBase(std::nullptr_t) : m_ptr() {}
 
+    SafePtrBase(const SafePtrBase& other) : m_ptr(other.m_ptr)
+    {
+        note_store();
+    }
+
+    SafePtrBase(SafePtrBase&& other) noexcept : m_ptr(other.m_ptr)
+    {
+        note_store();
+    }
+
+    SafePtrBase& operator=(const SafePtrBase& other)
+    {
+        m_ptr = other.m_ptr;
+        note_store();
+        return *this;
+    }
+
+    SafePtrBase& operator=(SafePtrBase&& other) noexcept
+    {
+        m_ptr = other.m_ptr;
+        note_store();
+        return *this;
+    }
+
+    ~SafePtrBase() = default;
+
     auto& operator=(std::nullptr_t)
     {
         m_ptr = FatPtr{};
@@ -114,7 +293,8 @@ class SafePtrBase
     {
         SafePtrBase res;
         res.m_ptr = FatPtr{reinterpret_cast<uintptr_t>(
-            new (GC::alloc(sizeof(T), AlignmentVal)) T(*get()))};
+            new (alloc_objects<T, AlignmentVal, GC>()) T(*get()))};
+        res.note_store();
         return res;
     }
 };
@@ -122,6 +302,18 @@ class SafePtrBase
 template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
 class SafePtrBase<T[], AlignmentVal, GC>
 {
+    template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
+    friend class PinGuard;
+
+    template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
+    friend class Root;
+
+    template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
+    friend class TempRoot;
+
+    template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
+    friend class CompressedSafePtr;
+
     template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC2>
     friend bool operator==(std::nullptr_t,
                            const SafePtrBase<U, AlignmentValF, GC2>&);
@@ -142,13 +334,17 @@ class SafePtrBase<T[], AlignmentVal, GC>
     FatPtr m_ptr;
     size_t m_size;
 
+    /** Runs the write barrier of `ArenaScope` on a store to `m_ptr` */
+    void note_store() const { ArenaScope::note_store(&m_ptr, m_ptr); }
+
   public:
     explicit SafePtrBase(size_t size)
         : m_ptr(reinterpret_cast<uintptr_t>(
-              new(GC::alloc(sizeof(T) * size, AlignmentVal)) T[size])),
+              new(alloc_objects<T, AlignmentVal, GC>(size)) T[size])),
           m_size(size)
     {
         GC_UPDATE_STACK_RANGE_NESTED_1();
+        note_store();
     }
 
     static auto make(size_t size) { return SafePtrBase{size}; }
@@ -157,6 +353,36 @@ class SafePtrBase<T[], AlignmentVal, GC>
 
     SafePtrBase(std::nullptr_t) : m_ptr() {}
 
+    SafePtrBase(const SafePtrBase& other)
+        : m_ptr(other.m_ptr), m_size(other.m_size)
+    {
+        note_store();
+    }
+
+    SafePtrBase(SafePtrBase&& other) noexcept
+        : m_ptr(other.m_ptr), m_size(other.m_size)
+    {
+        note_store();
+    }
+
+    SafePtrBase& operator=(const SafePtrBase& other)
+    {
+        m_ptr = other.m_ptr;
+        m_size = other.m_size;
+        note_store();
+        return *this;
+    }
+
+    SafePtrBase& operator=(SafePtrBase&& other) noexcept
+    {
+        m_ptr = other.m_ptr;
+        m_size = other.m_size;
+        note_store();
+        return *this;
+    }
+
+    ~SafePtrBase() = default;
+
     auto& operator=(std::nullptr_t)
     {
         m_ptr = FatPtr{};
@@ -207,12 +433,26 @@ class SafePtrBase<T[], AlignmentVal, GC>
         return (*this)[index];
     }
 
+    /**
+     * @brief Copies the array. A large array of trivially copyable elements
+     * is cloned copy-on-write if the front end supports it, so its pages are
+     * only copied when written.
+     */
     SafePtrBase clone() const
     {
         SafePtrBase res;
-        res.m_ptr = FatPtr{reinterpret_cast<uintptr_t>(
-            new (GC::alloc(sizeof(T) * m_size, AlignmentVal)) T[m_size])};
         res.m_size = m_size;
+        if constexpr (std::is_trivially_copyable_v<T> &&
+                      requires { GC::clone_large(m_ptr); }) {
+            if (const auto ptr = GC::clone_large(m_ptr)) {
+                res.m_ptr = ptr.value();
+                res.note_store();
+                return res;
+            }
+        }
+        res.m_ptr = FatPtr{reinterpret_cast<uintptr_t>(
+            new (alloc_objects<T, AlignmentVal, GC>(m_size)) T[m_size])};
+        res.note_store();
         for (size_t i = 0; i < m_size; ++i) {
             res[i] = (*this)[i];
         }
@@ -220,15 +460,371 @@ class SafePtrBase<T[], AlignmentVal, GC>
     }
 };
 
+/**
+ * @brief A reference to a GC object which does not keep it alive.
+ * The reference is cleared when a collection frees its target.
+ */
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+class WeakSafePtrBase
+{
+    static_assert(!std::is_array_v<T>, "Weak references to arrays are not "
+                                       "supported");
+
+  private:
+    std::shared_ptr<WeakRefs::Cell> m_cell;
+
+  public:
+    WeakSafePtrBase() = default;
+
+    WeakSafePtrBase(std::nullptr_t) {}
+
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    WeakSafePtrBase(const SafePtrBase<T, AlignmentVal, GC>& ptr)
+        : m_cell(ptr == nullptr ? nullptr
+                                : WeakRefs::get_instance().make_cell(
+                                      ptr.m_ptr.get_gc_ptr().ptr))
+    {
+    }
+
+    /**
+     * @brief Gets a strong reference to the target, or `nullptr` if the target
+     * has been collected
+     */
+    TempRoot<T, AlignmentVal, GC> lock() const
+    {
+        if (m_cell == nullptr) {
+            return nullptr;
+        }
+        GC_UPDATE_STACK_RANGE_NESTED_1();
+        TempRoot<T, AlignmentVal, GC> res;
+        // the strong reference must be a root before a collection can start
+        // and move or free the target
+        WeakRefs::get_instance().load(*m_cell, [&res](uintptr_t target) {
+            if (target != 0) {
+                res = SafePtrBase<T, AlignmentVal, GC>::from_fat_ptr(
+                    FatPtr{target});
+            }
+        });
+        return res;
+    }
+
+    /** Determines if the target has been collected */
+    bool expired() const { return lock() == nullptr; }
+
+    void reset() { m_cell = nullptr; }
+};
+
+/**
+ * @brief RAII type which pins a GC object for its lifetime. While pinned, the
+ * object is not moved or collected so raw pointers to it (such as buffers
+ * given to the kernel for I/O) stay valid.
+ */
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+class PinGuard
+{
+  private:
+    SafePtrBase<T, AlignmentVal, GC> m_ptr;
+
+  public:
+    explicit PinGuard(const SafePtrBase<T, AlignmentVal, GC>& ptr) : m_ptr(ptr)
+    {
+        if (m_ptr != nullptr) {
+            GC::pin(m_ptr.m_ptr);
+        }
+    }
+
+    ~PinGuard()
+    {
+        if (m_ptr != nullptr) {
+            GC::unpin(m_ptr.m_ptr);
+        }
+    }
+
+    PinGuard(const PinGuard&) = delete;
+    PinGuard& operator=(const PinGuard&) = delete;
+    PinGuard(PinGuard&&) = delete;
+    PinGuard& operator=(PinGuard&&) = delete;
+
+    /** Gets a raw pointer to the object which is stable while pinned */
+    auto get() { return m_ptr.get(); }
+    auto get() const { return m_ptr.get(); }
+};
+
+/**
+ * @brief Pins `ptr` until the returned guard is destroyed
+ */
+template <typename T, std::align_val_t AlignmentVal, GCFrontEnd GC>
+[[nodiscard]] auto pin(const SafePtrBase<T, AlignmentVal, GC>& ptr)
+{
+    return PinGuard<T, AlignmentVal, GC>{ptr};
+}
+
 template <typename T, std::align_val_t AlignmentVal = AlignmentOf<T>::value,
           GCFrontEnd GC = gcpp::GC>
 using SafePtr = SafePtrBase<T, AlignmentVal, GC>;
 
+template <typename T, std::align_val_t AlignmentVal = AlignmentOf<T>::value,
+          GCFrontEnd GC = gcpp::GC>
+using WeakSafePtr = WeakSafePtrBase<T, AlignmentVal, GC>;
+
+/** A `SafePtr` to an object on the calling thread's heap */
+template <typename T, std::align_val_t AlignmentVal = AlignmentOf<T>::value>
+using LocalSafePtr = SafePtrBase<T, AlignmentVal, ThreadLocalGC>;
+
+/**
+ * @brief A local `SafePtr` which registers itself as a precise root of the
+ * calling thread for its lifetime. Within a `RootScope` the stack is not
+ * scanned, so only `Root`s, and the `TempRoot`s returned by the library, keep
+ * objects alive: plain `SafePtr` locals don't.
+ *
+ * Must be destroyed on the thread that created it.
+ */
+template <typename T, std::align_val_t AlignmentVal = AlignmentOf<T>::value,
+          GCFrontEnd GC = gcpp::GC>
+class Root : public SafePtrBase<T, AlignmentVal, GC>
+{
+    using Base = SafePtrBase<T, AlignmentVal, GC>;
+
+  private:
+    GCRoots::RootLink m_link;
+
+    void link() { GCRoots::get_instance().add_root(m_link, &this->m_ptr); }
+
+  public:
+    Root() { link(); }
+
+    Root(std::nullptr_t) { link(); }
+
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    Root(const Base& ptr) : Base(ptr) { link(); }
+
+    // cast so that the variadic constructor of the base isn't chosen
+    Root(const Root& other) : Base(static_cast<const Base&>(other)) { link(); }
+
+    Root& operator=(const Root& other)
+    {
+        Base::operator=(other);
+        return *this;
+    }
+
+    Root& operator=(const Base& ptr)
+    {
+        Base::operator=(ptr);
+        return *this;
+    }
+
+    Root& operator=(std::nullptr_t)
+    {
+        Base::operator=(nullptr);
+        return *this;
+    }
+
+    ~Root() { GCRoots::remove_root(m_link); }
+};
+
+/**
+ * @brief The `SafePtr` returned by the functions which make or look up
+ * objects, such as `make_safe` and `WeakSafePtr::lock`. If it is made within a
+ * `RootScope` it registers itself as a precise root of the calling thread for
+ * its lifetime, so the object stays alive until the caller binds it to a
+ * `Root`. Outside of one the stack is scanned, and nothing is registered.
+ */
+template <typename T, std::align_val_t AlignmentVal = AlignmentOf<T>::value,
+          GCFrontEnd GC = gcpp::GC>
+class TempRoot : public SafePtrBase<T, AlignmentVal, GC>
+{
+    using Base = SafePtrBase<T, AlignmentVal, GC>;
+
+  private:
+    GCRoots::RootLink m_link;
+
+    void link()
+    {
+        if (auto& roots = GCRoots::get_instance(); roots.precise_roots()) {
+            roots.add_root(m_link, &this->m_ptr);
+        }
+    }
+
+  public:
+    TempRoot() { link(); }
+
+    TempRoot(std::nullptr_t) { link(); }
+
+    // the pointer is stored once it is a root
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    TempRoot(const Base& ptr)
+    {
+        link();
+        Base::operator=(ptr);
+    }
+
+    TempRoot(const TempRoot& other) : Base()
+    {
+        link();
+        Base::operator=(other);
+    }
+
+    TempRoot& operator=(const TempRoot& other)
+    {
+        Base::operator=(other);
+        return *this;
+    }
+
+    TempRoot& operator=(const Base& ptr)
+    {
+        Base::operator=(ptr);
+        return *this;
+    }
+
+    TempRoot& operator=(std::nullptr_t)
+    {
+        Base::operator=(nullptr);
+        return *this;
+    }
+
+    ~TempRoot() { GCRoots::remove_root(m_link); }
+};
+
+/**
+ * @brief A 32-bit reference to a GC object, for the members of GC objects
+ * which would otherwise hold a `SafePtr`. The reference is an offset from
+ * itself to its target (see compressed_ptr.h), so it must be stored in the
+ * object it was assigned in and can't be used for locals or globals: only the
+ * collector traces it, through the `CompressedFields` of the type holding it.
+ *
+ * Compressed references are traced when the object holding them is copied,
+ * and those on pages dirtied during a concurrent collection are retraced by
+ * its remark. Only the copying collector allocates objects with compressed
+ * references. Stores go through the barrier of `ArenaScope`, although arena
+ * objects are usually out of range of a reference on the heaps.
+ */
+template <typename T, std::align_val_t AlignmentVal = AlignmentOf<T>::value,
+          GCFrontEnd GC = gcpp::GC>
+class CompressedSafePtr
+{
+    static_assert(!std::is_array_v<T>, "Compressed references to arrays are "
+                                       "not supported");
+    using Ptr = SafePtrBase<T, AlignmentVal, GC>;
+
+  public:
+    /** Log2 of the scale of the reference */
+    static constexpr uint8_t shift = std::min<uint8_t>(
+        static_cast<uint8_t>(std::countr_zero(static_cast<size_t>(AlignmentVal))),
+        max_compressed_shift);
+
+  private:
+    int32_t m_val = compressed_null;
+
+    auto field() const { return reinterpret_cast<uintptr_t>(&m_val); }
+
+    auto target() const { return decode_compressed(field(), m_val, shift); }
+
+    void assign(uintptr_t target)
+    {
+        const auto val = encode_compressed(field(), target, shift);
+        if (!val) {
+            throw std::out_of_range(
+                "Target is out of range of a compressed reference");
+        }
+        m_val = val.value();
+        ArenaScope::note_store(&m_val, FatPtr{target});
+    }
+
+  public:
+    CompressedSafePtr() = default;
+
+    CompressedSafePtr(std::nullptr_t) {}
+
+    /**
+     * @throws `std::out_of_range` if `ptr` is out of range of the reference
+     */
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    CompressedSafePtr(const Ptr& ptr)
+    {
+        assign(reinterpret_cast<uintptr_t>(ptr.m_ptr.as_ptr()));
+    }
+
+    // the value is relative to the reference, so copies are re-encoded
+    CompressedSafePtr(const CompressedSafePtr& other) { assign(other.target()); }
+
+    CompressedSafePtr& operator=(const CompressedSafePtr& other)
+    {
+        assign(other.target());
+        return *this;
+    }
+
+    CompressedSafePtr& operator=(const Ptr& ptr)
+    {
+        assign(reinterpret_cast<uintptr_t>(ptr.m_ptr.as_ptr()));
+        return *this;
+    }
+
+    CompressedSafePtr& operator=(std::nullptr_t)
+    {
+        m_val = compressed_null;
+        return *this;
+    }
+
+    /** Gets a `SafePtr` to the target, which can be held outside GC objects */
+    TempRoot<T, AlignmentVal, GC> lock() const
+    {
+        return Ptr::from_fat_ptr(FatPtr{target()});
+    }
+
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    operator Ptr() const { return lock(); }
+
+    auto operator==(std::nullptr_t) const { return m_val == compressed_null; }
+    auto operator!=(std::nullptr_t) const { return m_val != compressed_null; }
+
+    explicit operator bool() const { return m_val != compressed_null; }
+
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    T* get() const { return reinterpret_cast<T*>(target()); }
+    T& operator*() const { return *get(); }
+    T* operator->() const { return get(); }
+};
+
+/**
+ * @brief Copies the object of `ptr` and the objects reachable from it from
+ * the calling thread's heap to the shared heap so they can escape the thread.
+ * Members of the copies keep their types, so they must not be assigned
+ * objects of the thread's heap.
+ * @see ThreadLocalGC::publish
+ */
+template <typename T, std::align_val_t AlignmentVal>
+SafePtrBase<T, AlignmentVal, gcpp::GC> publish(
+    const SafePtrBase<T, AlignmentVal, ThreadLocalGC>& ptr)
+{
+    return SafePtrBase<T, AlignmentVal, gcpp::GC>::from_fat_ptr(
+        ThreadLocalGC::publish(ptr.m_ptr));
+}
+
 template <typename T, typename... Args>
 auto make_safe(Args&&... args)
 {
     GC_UPDATE_STACK_RANGE_NESTED_1();
-    return SafePtr<T>::make(std::forward<Args>(args)...);
+    return TempRoot<T>{SafePtr<T>::make(std::forward<Args>(args)...)};
+}
+
+/** Makes an object of type `T` on the calling thread's heap */
+template <typename T, typename... Args>
+auto make_local(Args&&... args)
+{
+    GC_UPDATE_STACK_RANGE_NESTED_1();
+    return TempRoot<T, AlignmentOf<T>::value, ThreadLocalGC>{
+        LocalSafePtr<T>::make(std::forward<Args>(args)...)};
+}
+
+/**
+ * @brief Makes `count` objects of type `T` with a single allocation
+ * @see SafePtrBase::make_n
+ */
+template <typename T, typename... Args>
+auto make_safe_n(size_t count, const Args&... args)
+{
+    GC_UPDATE_STACK_RANGE_NESTED_1();
+    return SafePtr<T>::make_n(count, args...);
 }
 
 template <typename U, std::align_val_t AlignmentValF, GCFrontEnd GC>
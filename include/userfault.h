@@ -0,0 +1,66 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+namespace gcpp
+{
+/**
+ * @brief RAII wrapper of a userfaultfd which reports accesses to missing
+ * pages of registered ranges.
+ *
+ * Faulting threads sleep until the page is filled with `copy_page`. Only
+ * user mode accesses are reported, so the kernel fails accesses to missing
+ * pages with `EFAULT` instead of waiting for them to be filled.
+ */
+class UserFaultFd
+{
+  private:
+    int m_fd;
+    explicit UserFaultFd(int fd) : m_fd(fd) {}
+
+  public:
+    /**
+     * @brief Opens a new userfaultfd
+     *
+     * @return the userfaultfd or `nullptr` if userfaultfd is unavailable
+     */
+    static std::unique_ptr<UserFaultFd> open();
+    ~UserFaultFd();
+    UserFaultFd(const UserFaultFd&) = delete;
+    UserFaultFd& operator=(const UserFaultFd&) = delete;
+    UserFaultFd(UserFaultFd&&) = delete;
+    UserFaultFd& operator=(UserFaultFd&&) = delete;
+
+    /**
+     * @brief Reports faults on missing pages in [start, start + len).
+     * Requires the range is page aligned
+     *
+     * @return false if the memory of the range can't be registered
+     */
+    bool register_range(void* start, size_t len) noexcept;
+
+    /** Stops reporting faults on a range added with `register_range` */
+    void unregister_range(void* start, size_t len);
+
+    /**
+     * @brief Atomically fills the missing page at `dst` with the page at `src`
+     * and wakes the threads waiting on it
+     *
+     * @return false if the page was already filled
+     */
+    bool copy_page(void* dst, const void* src);
+
+    /** Wakes the threads waiting on the page at `page` */
+    void wake(void* page);
+
+    /**
+     * @brief Waits for the next fault
+     *
+     * @return the faulting address, or nullopt if no fault occurred within
+     * `timeout`
+     */
+    std::optional<void*> wait_fault(std::chrono::milliseconds timeout);
+};
+}  // namespace gcpp
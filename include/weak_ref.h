@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace gcpp
+{
+/**
+ * @brief Singleton registry of the targets of weak references.
+ *
+ * A weak reference keeps its target in a cell outside of the GC heaps. The
+ * cell stores the untagged address so it is never mistaken for a GC pointer
+ * and doesn't keep the target alive. Every collection updates the cells of
+ * the objects it moved and clears the cells of the objects it freed.
+ */
+class WeakRefs
+{
+  public:
+    struct Cell {
+        /** Untagged address of the target or 0 if it has been collected */
+        std::atomic<uintptr_t> target;
+    };
+
+  private:
+    std::vector<std::weak_ptr<Cell>> m_cells;
+    /** Number of collections currently in progress */
+    size_t m_collections = 0;
+    /** Mutex for access to `m_cells` and `m_collections` */
+    std::mutex m_mutex;
+    std::condition_variable m_collection_done;
+    // NOLINTNEXTLINE(cppcoreguidelines-*)
+    inline static std::unique_ptr<WeakRefs> g_instance;
+    inline static std::once_flag g_instance_flag;
+    WeakRefs() = default;
+
+  public:
+    /** Gets the singleton instance of the WeakRefs object */
+    static WeakRefs& get_instance();
+
+    /**
+     * @brief Creates a new cell referring to `target`
+     *
+     * @param target untagged address of the object
+     */
+    std::shared_ptr<Cell> make_cell(uintptr_t target);
+
+    /**
+     * @brief Loads the target of a cell. Blocks while a collection is in
+     * progress since the collection may be about to clear the target. A
+     * collection starting after it returns may move or free the target.
+     *
+     * @return uintptr_t untagged address of the target or 0
+     */
+    uintptr_t load(const Cell& cell);
+
+    /**
+     * @brief Loads the target of a cell as `load` does, and calls `use` with
+     * it before another collection can start, such as to make a strong
+     * reference to it which the collection will find.
+     *
+     * @param use called with the untagged address of the target or 0. Must
+     * not start a collection.
+     */
+    void load(const Cell& cell, const std::function<void(uintptr_t)>& use);
+
+    /**
+     * @brief Marks the start of a collection. Must be called before the
+     * collection gets its roots.
+     */
+    void begin_collection();
+
+    /**
+     * @brief Updates the target of every cell and ends a collection started
+     * with `begin_collection`
+     *
+     * @param update callable which returns the new address of the given
+     * target, or 0 if the target was collected
+     */
+    void end_collection(const std::function<uintptr_t(uintptr_t)>& update);
+};
+}  // namespace gcpp
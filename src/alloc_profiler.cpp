@@ -0,0 +1,147 @@
+#include "alloc_profiler.h"
+
+#include <execinfo.h>
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <random>
+#include <string>
+
+namespace
+{
+/** Maximum number of frames recorded for each sample */
+constexpr int max_frames = 64;
+/** Frames of the profiler and the collector to leave out of each sample */
+constexpr int skipped_frames = 3;
+
+/** Sampling state of a thread */
+struct ThreadSampler {
+    /** Bytes left to allocate before the next sample */
+    int64_t bytes_until_sample = 0;
+    /** Epoch of the profiler when the countdown was last reset */
+    uint64_t epoch = 0;
+    std::minstd_rand rng{std::random_device{}()};
+
+    /**
+     * @brief Draws the number of bytes until the next sample from an
+     * exponential distribution, so samples form a Poisson process
+     */
+    int64_t next_interval(size_t mean)
+    {
+        std::exponential_distribution<double> dist(1.0 /
+                                                   static_cast<double>(mean));
+        return static_cast<int64_t>(dist(rng)) + 1;
+    }
+};
+}  // namespace
+
+gcpp::AllocProfiler& gcpp::AllocProfiler::get_instance()
+{
+    if (g_instance == nullptr) {
+        std::call_once(g_instance_flag, []() {
+            g_instance = std::unique_ptr<AllocProfiler>(new AllocProfiler());
+        });
+    }
+    return *g_instance;
+}
+
+void gcpp::AllocProfiler::start(size_t sample_interval)
+{
+    auto lk = std::unique_lock{m_mutex};
+    m_sites.clear();
+    m_site_index.clear();
+    m_live.clear();
+    m_sample_interval = std::max(sample_interval, size_t{1});
+    ++m_epoch;
+    m_enabled = true;
+}
+
+void gcpp::AllocProfiler::stop() noexcept { m_enabled = false; }
+
+void gcpp::AllocProfiler::count_alloc(const void* ptr, size_t size)
+{
+    thread_local ThreadSampler g_sampler;
+    const auto interval = m_sample_interval.load();
+    if (const auto epoch = m_epoch.load(); g_sampler.epoch != epoch) {
+        g_sampler.epoch = epoch;
+        g_sampler.bytes_until_sample = g_sampler.next_interval(interval);
+    }
+    g_sampler.bytes_until_sample -= static_cast<int64_t>(size);
+    if (g_sampler.bytes_until_sample > 0) {
+        return;
+    }
+    g_sampler.bytes_until_sample = g_sampler.next_interval(interval);
+    std::array<void*, max_frames> frames{};
+    const auto depth = backtrace(frames.data(), max_frames);
+    std::vector<void*> stack(
+        frames.begin() + std::min(depth, skipped_frames),
+        frames.begin() + depth);
+    auto lk = std::unique_lock{m_mutex};
+    const auto [it, inserted] = m_site_index.emplace(stack, m_sites.size());
+    if (inserted) {
+        m_sites.push_back({std::move(stack)});
+    }
+    auto& site = m_sites[it->second];
+    ++site.alloc_count;
+    site.alloc_bytes += size;
+    ++site.live_count;
+    site.live_bytes += size;
+    m_live.insert_or_assign(reinterpret_cast<uintptr_t>(ptr),
+                            Sample{size, it->second});
+}
+
+void gcpp::AllocProfiler::update_live(
+    const std::function<uintptr_t(uintptr_t)>& update)
+{
+    auto lk = std::unique_lock{m_mutex};
+    if (m_live.empty()) {
+        return;
+    }
+    std::unordered_map<uintptr_t, Sample> live;
+    live.reserve(m_live.size());
+    for (const auto& [addr, sample] : m_live) {
+        if (const auto new_addr = update(addr); new_addr != 0) {
+            live.emplace(new_addr, sample);
+        } else {
+            auto& site = m_sites[sample.site];
+            --site.live_count;
+            site.live_bytes -= sample.size;
+        }
+    }
+    m_live = std::move(live);
+}
+
+void gcpp::AllocProfiler::write_profile(std::ostream& out) const
+{
+    auto lk = std::unique_lock{m_mutex};
+    Site total;
+    for (const auto& site : m_sites) {
+        total.alloc_count += site.alloc_count;
+        total.alloc_bytes += site.alloc_bytes;
+        total.live_count += site.live_count;
+        total.live_bytes += site.live_bytes;
+    }
+    const auto counts = [&out](const Site& site) {
+        out << site.live_count << ": " << site.live_bytes << " ["
+            << site.alloc_count << ": " << site.alloc_bytes << "] @";
+    };
+    // heap_v2 tells pprof to unsample the counts of a Poisson process
+    out << "heap profile: ";
+    counts(total);
+    out << " heap_v2/" << m_sample_interval << '\n';
+    for (const auto& site : m_sites) {
+        counts(site);
+        for (auto* frame : site.stack) {
+            out << ' ' << frame;
+        }
+        out << '\n';
+    }
+    // lets pprof symbolize the addresses
+    out << "\nMAPPED_LIBRARIES:\n";
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        out << line << '\n';
+    }
+}
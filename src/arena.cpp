@@ -0,0 +1,264 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include "gc_scan.h"
+#include "safe_alloc.h"
+#include "weak_ref.h"
+
+namespace
+{
+/** Most arenas each thread keeps for reuse by its later scopes */
+constexpr size_t max_cached_arenas = 4;
+
+/** Arenas of the ended scopes of the calling thread, with their sizes */
+thread_local std::vector<std::pair<size_t, std::unique_ptr<std::byte[]>>>
+    g_free_arenas;
+
+/** Gets an arena of `size` bytes, reusing a cached one if possible */
+std::unique_ptr<std::byte[]> acquire_arena(size_t size)
+{
+    const auto it = std::ranges::find(g_free_arenas, size,
+                                      &decltype(g_free_arenas)::value_type::first);
+    if (it == g_free_arenas.end()) {
+        return std::make_unique_for_overwrite<std::byte[]>(size);
+    }
+    auto mem = std::move(it->second);
+    g_free_arenas.erase(it);
+    return mem;
+}
+
+/** Caches an arena of `size` bytes for reuse if there is room */
+void release_arena(size_t size, std::unique_ptr<std::byte[]> mem)
+{
+    if (g_free_arenas.size() < max_cached_arenas) {
+        g_free_arenas.emplace_back(size, std::move(mem));
+    }
+}
+}  // namespace
+
+gcpp::ArenaScope::ArenaScope(size_t size)
+    : m_parent(g_current),
+      m_mem(acquire_arena(size)),
+      m_size(size),
+      m_chunk(std::make_shared<Chunk>()),
+      m_stack_low(GCRoots::get_instance().thread_stack().low),
+      m_stack_high(GCRoots::get_instance().thread_stack().high),
+      m_frame(reinterpret_cast<uintptr_t>(__builtin_frame_address(0)))
+{
+    m_chunk->base = reinterpret_cast<uintptr_t>(m_mem.get());
+    m_chunk->top = m_chunk->base;
+    // objects on the heaps referenced by arena objects must stay alive
+    m_root_source = GCRoots::get_instance().add_root_source(
+        [chunk = m_chunk](std::vector<FatPtr*>& out) {
+            auto lk = std::unique_lock{chunk->mutex};
+            if (chunk->base != 0) {
+                scan_memory(chunk->base, chunk->top.load(),
+                            [&out](auto slot) { out.push_back(slot); });
+            }
+        });
+    // the locals of the creator may be updated to promoted objects, which
+    // they must then keep alive
+    GC_UPDATE_STACK_RANGE_NESTED_1();
+    g_current = this;
+}
+
+gcpp::ArenaScope::~ArenaScope()
+{
+    // promoted objects, and those allocated by finalizers, go to the heaps
+    g_current = nullptr;
+    const auto moved =
+        m_escapes.empty() ? std::unordered_map<uintptr_t, FatPtr>{} : promote();
+    if (m_weak_refs) {
+        auto& weak_refs = WeakRefs::get_instance();
+        weak_refs.begin_collection();
+        weak_refs.end_collection([this, &moved](uintptr_t target) {
+            // NOLINTNEXTLINE(performance-no-int-to-ptr)
+            if (!contains(reinterpret_cast<void*>(target))) {
+                return target;
+            }
+            const auto it = moved.find(target);
+            return it == moved.end() ? 0 : static_cast<uintptr_t>(it->second);
+        });
+    }
+    finalize(moved);
+    {
+        auto lk = std::unique_lock{m_chunk->mutex};
+        m_chunk->base = 0;
+    }
+    GCRoots::get_instance().remove_root_source(m_root_source);
+    release_arena(m_size, std::move(m_mem));
+    g_current = m_parent;
+}
+
+std::optional<FatPtr> gcpp::ArenaScope::alloc(size_t size,
+                                              std::align_val_t alignment,
+                                              FinalizerFn finalizer)
+{
+    const auto align = static_cast<uintptr_t>(alignment);
+    const auto top = m_chunk->top.load(std::memory_order_relaxed);
+    const auto start = (top + align - 1) & ~(align - 1);
+    const auto end = m_chunk->base + m_size;
+    if (start > end || end - start < size) {
+        return std::nullopt;
+    }
+    m_objects.emplace_back(start, MetaData{size, alignment, finalizer});
+    m_chunk->top.store(start + size, std::memory_order_release);
+    return FatPtr{start};
+}
+
+bool gcpp::ArenaScope::contains(const void* ptr) const noexcept
+{
+    const auto addr = reinterpret_cast<uintptr_t>(ptr);
+    return addr >= m_chunk->base && addr < m_chunk->top.load();
+}
+
+bool gcpp::ArenaScope::owns(const void* ptr) noexcept
+{
+    for (auto* scope = g_current; scope != nullptr; scope = scope->m_parent) {
+        if (scope->contains(ptr)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t gcpp::ArenaScope::used() const noexcept
+{
+    return m_chunk->top.load() - m_chunk->base;
+}
+
+void gcpp::ArenaScope::note_weak_ref(uintptr_t target) noexcept
+{
+    for (auto* scope = g_current; scope != nullptr; scope = scope->m_parent) {
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        if (scope->contains(reinterpret_cast<void*>(target))) {
+            scope->m_weak_refs = true;
+            return;
+        }
+    }
+}
+
+void gcpp::ArenaScope::record_store(uintptr_t slot, uintptr_t target)
+{
+    for (auto* scope = g_current; scope != nullptr; scope = scope->m_parent) {
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        if (!scope->contains(reinterpret_cast<void*>(target))) {
+            continue;
+        }
+        const auto in_callee =
+            slot >= scope->m_stack_low && slot < scope->m_frame;
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        if (!in_callee && !scope->contains(reinterpret_cast<void*>(slot))) {
+            scope->m_escapes.emplace_back(slot, target);
+        }
+        return;
+    }
+}
+
+auto gcpp::ArenaScope::find_object(uintptr_t addr) const
+    -> std::vector<std::pair<uintptr_t, MetaData>>::const_iterator
+{
+    const auto it = std::ranges::lower_bound(
+        m_objects, addr, std::less{},
+        &std::pair<uintptr_t, MetaData>::first);
+    return it != m_objects.end() && it->first == addr ? it : m_objects.end();
+}
+
+std::unordered_map<uintptr_t, FatPtr> gcpp::ArenaScope::promote()
+{
+    std::unordered_map<uintptr_t, FatPtr> moved;
+    std::vector<std::pair<uintptr_t, FatPtr>> to_update;
+    // the copies are only referenced by each other and the arena until the
+    // pointers to them are updated, so they are pinned to keep collections
+    // from freeing them
+    std::vector<FatPtr> copies;
+    // gets the copy of the object at `addr`, copying it if it hasn't been yet
+    const auto copy_of = [this, &moved, &to_update,
+                          &copies](uintptr_t addr) -> std::optional<FatPtr> {
+        if (const auto it = moved.find(addr); it != moved.end()) {
+            return it->second;
+        }
+        const auto obj = find_object(addr);
+        if (obj == m_objects.end()) {
+            return std::nullopt;
+        }
+        const auto& meta_data = obj->second;
+        auto copy = GC::alloc(meta_data.size, meta_data.alignment,
+                              meta_data.finalizer);
+        GC::pin(copy);
+        copies.push_back(copy);
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        std::memcpy(copy.as_ptr(), reinterpret_cast<void*>(addr),
+                    meta_data.size);
+        moved.emplace(addr, copy);
+        to_update.emplace_back(addr, copy);
+        return copy;
+    };
+    // updates `slot` if it points to a promoted object
+    const auto forward = [&moved](FatPtr* slot) {
+        const auto target = FatPtr::test_ptr(slot);
+        if (!target) {
+            return;
+        }
+        const auto it = moved.find(static_cast<uintptr_t>(target.value()));
+        if (it != moved.end()) {
+            slot->compare_exchange(target.value(), it->second);
+        }
+    };
+    for (const auto& [_, target] : m_escapes) {
+        (void)copy_of(target);
+    }
+    while (!to_update.empty()) {
+        const auto [old_addr, copy] = to_update.back();
+        to_update.pop_back();
+        const auto new_addr = static_cast<uintptr_t>(copy);
+        scan_memory(new_addr, new_addr + find_object(old_addr)->second.size,
+                    [&copy_of](auto slot) {
+                        const auto target = FatPtr::test_ptr(slot);
+                        if (!target) {
+                            return;
+                        }
+                        const auto target_copy =
+                            copy_of(static_cast<uintptr_t>(target.value()));
+                        if (target_copy) {
+                            slot->compare_exchange(target.value(),
+                                                   target_copy.value());
+                        }
+                    });
+    }
+    // stack slots may not be in the scanned range of the stack, but stay in
+    // place. Other slots are found again since heap objects may have moved.
+    for (const auto& [slot, _] : m_escapes) {
+        if (slot >= m_stack_low && slot < m_stack_high) {
+            // NOLINTNEXTLINE(performance-no-int-to-ptr)
+            forward(reinterpret_cast<FatPtr*>(slot));
+        }
+    }
+    const auto roots_in_use = GCRoots::RootsInUse{};
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    for (auto* root : roots) {
+        if (!contains(root)) {
+            forward(root);
+        }
+    }
+    GC::forward_external(moved);
+    for (const auto& copy : copies) {
+        GC::unpin(copy);
+    }
+    return moved;
+}
+
+void gcpp::ArenaScope::finalize(
+    const std::unordered_map<uintptr_t, FatPtr>& moved) const
+{
+    for (const auto& [addr, meta_data] : m_objects) {
+        if (meta_data.finalizer != nullptr && !moved.contains(addr)) {
+            // NOLINTNEXTLINE(performance-no-int-to-ptr)
+            meta_data.finalizer(reinterpret_cast<void*>(addr), meta_data.size);
+        }
+    }
+}
@@ -0,0 +1,550 @@
+#include "compressor_collector.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "collector.h"
+#include "concurrent_gc.h"
+#include "finalizer.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+#include "generational_gc.h"
+#include "mem_prot.h"
+#include "userfault.h"
+#include "weak_ref.h"
+
+namespace
+{
+/**
+ * @brief Gets the lowest address not less than `addr` that is aligned to
+ * `alignment`
+ */
+inline uintptr_t align_up(uintptr_t addr, std::align_val_t alignment)
+{
+    const auto align = static_cast<uintptr_t>(alignment);
+    return (addr + align - 1) & ~(align - 1);
+}
+
+/** Allocates a page aligned buffer of one page */
+std::unique_ptr<std::byte[]> make_page_buffer()
+{
+    return std::unique_ptr<std::byte[]>(
+        new (gcpp::page_size_align())
+            std::byte[static_cast<size_t>(gcpp::page_size())]);
+}
+}  // namespace
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+gcpp::CompressorCollector<L, G>::CompressorCollector(size_t size,
+                                                     FaultMode mode)
+    : m_heap_size(page_size_ceil(size)),
+      m_spaces({std::make_unique<AliasedRegion>(size),
+                std::make_unique<AliasedRegion>(size)}),
+      m_gen_policy(),
+      m_page_states(std::make_unique<std::atomic<uint8_t>[]>(
+          m_heap_size / static_cast<size_t>(page_size()))),
+      m_fill_buffer(make_page_buffer())
+{
+    if (size >= ptr_mask) {
+        throw std::runtime_error("Heap size too large");
+    }
+    if (mode != FaultMode::Protect) {
+        m_uffd = UserFaultFd::open();
+        // check that the memory of the spaces supports missing page faults
+        if (m_uffd &&
+            !m_uffd->register_range(m_spaces[0]->view(), m_heap_size)) {
+            m_uffd = nullptr;
+        } else if (m_uffd) {
+            m_uffd->unregister_range(m_spaces[0]->view(), m_heap_size);
+        }
+        if (!m_uffd && mode == FaultMode::UserFault) {
+            throw std::runtime_error("userfaultfd is unavailable");
+        }
+    }
+    for (uint8_t i = 0; i < 2; ++i) {
+        register_heap(m_spaces[i]->view(), m_heap_size);
+        if (!m_uffd) {
+            m_protection[i] = std::make_unique<PageProtection>(
+                m_spaces[i]->view(), m_heap_size);
+            m_fault_handlers[i] = register_fault_handler(
+                m_spaces[i]->view(), m_heap_size, &handle_fault, this);
+        }
+    }
+    if (m_uffd) {
+        m_fault_thread = std::jthread([this](std::stop_token stop) {
+            const auto buffer = make_page_buffer();
+            while (!stop.stop_requested()) {
+                if (const auto addr =
+                        m_uffd->wait_fault(std::chrono::milliseconds{10});
+                    addr) {
+                    resolve(addr.value(), buffer.get());
+                }
+            }
+        });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+size_t gcpp::CompressorCollector<L, G>::free_space() const noexcept
+{
+    const size_t next = m_next;
+    return next >= m_heap_size ? 0 : m_heap_size - next;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+bool gcpp::CompressorCollector<L, G>::contains(void* ptr) const noexcept
+{
+    // safe w/o lock (never update m_spaces)
+    return std::ranges::any_of(m_spaces, [this, ptr](const auto& space) {
+        return ptr >= space->view() && ptr < space->view() + m_heap_size;
+    });
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+FatPtr gcpp::CompressorCollector<L, G>::alloc_attempt(const MetaData& meta_data,
+                                                      uint8_t attempts)
+{
+    auto ptr = m_lock.do_with_lock([this, &meta_data]() {
+        const auto base = reinterpret_cast<uintptr_t>(
+            m_spaces[static_cast<uint8_t>(m_space_num)]->view());
+        const auto start = align_up(base + m_next, meta_data.alignment);
+        if (start + meta_data.size > base + m_heap_size) {
+            return std::optional<FatPtr>{};
+        }
+        m_next = start + meta_data.size - base;
+        const auto res = FatPtr{start};
+        m_metadata.emplace(start, meta_data);
+        m_gen_policy.init(res);
+        return std::make_optional(res);
+    });
+    if (!ptr) {
+        if (attempts < 1) {
+            collect(meta_data.size);
+            // nothing is freed until the pause of the collection finishes
+            auto result =
+                m_lock.do_with_lock([this]() { return m_collect_result; });
+            if (result.valid()) {
+                result.wait();
+            }
+            return alloc_attempt(meta_data, attempts + 1);
+        } else {
+            throw std::bad_alloc();
+        }
+    }
+    return ptr.value();
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::CompressorCollector<L, G>::mark(
+    std::vector<uintptr_t> roots, std::unordered_set<uintptr_t>& marked) const
+{
+    while (!roots.empty()) {
+        const auto addr = roots.back();
+        roots.pop_back();
+        const auto it = m_metadata.find(addr);
+        if (it == m_metadata.end() || !marked.insert(addr).second) {
+            continue;
+        }
+        scan_memory(addr, addr + it->second.size, [&roots](auto child) {
+            if (const auto val = FatPtr::test_ptr(child); val) {
+                roots.push_back(static_cast<uintptr_t>(val.value()));
+            }
+        });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+std::vector<gcpp::DeadObject> gcpp::CompressorCollector<L, G>::plan_evacuation(
+    const std::vector<FatPtr*>& extra_roots)
+{
+    const auto from_space = static_cast<uint8_t>(m_space_num);
+    auto& to_space = *m_spaces[from_space ^ 1];
+    const auto to_base = reinterpret_cast<uintptr_t>(to_space.view());
+
+    const auto roots_in_use = GCRoots::RootsInUse{};
+    std::vector<FatPtr*> all_roots;
+    GC_GET_ROOTS(all_roots);
+    all_roots.insert(all_roots.end(), extra_roots.begin(), extra_roots.end());
+    // roots held by our own objects (ie. from a root source) are not roots
+    std::vector<FatPtr*> roots;
+    std::ranges::copy(all_roots | std::views::filter([this](auto ptr) {
+                          const auto opt = FatPtr::test_ptr(ptr);
+                          return opt && contains(opt.value().as_ptr()) &&
+                                 !contains(ptr);
+                      }),
+                      std::back_inserter(roots));
+    std::unordered_set<uintptr_t> marked;
+    {
+        std::vector<uintptr_t> root_addrs;
+        for (const auto* root : roots) {
+            if (const auto val = FatPtr::test_ptr(root); val) {
+                root_addrs.push_back(static_cast<uintptr_t>(val.value()));
+            }
+        }
+        mark(std::move(root_addrs), marked);
+    }
+
+    // plan the new address of every live object
+    m_relocations.clear();
+    m_forwarding.clear();
+    std::map<uintptr_t, MetaData> evacuated;
+    std::vector<DeadObject> dead;
+    auto free = to_base;
+    for (const auto& [addr, meta_data] : m_metadata) {
+        if (!marked.contains(addr)) {
+            if (meta_data.finalizer != nullptr) {
+                // NOLINTNEXTLINE(performance-no-int-to-ptr)
+                dead.push_back({meta_data.finalizer,
+                                reinterpret_cast<void*>(addr),
+                                meta_data.size});
+            }
+            m_gen_policy.collected(FatPtr{addr});
+            continue;
+        }
+        const auto dest = align_up(free, meta_data.alignment);
+        m_relocations.push_back({addr, dest, meta_data.size});
+        m_forwarding.emplace(addr, dest);
+        auto& survivor =
+            evacuated.emplace_hint(evacuated.end(), dest, meta_data)->second;
+        ++survivor.age;
+        m_gen_policy.init(FatPtr{dest});
+        free = dest + meta_data.size;
+    }
+
+    // make the pages of the planned objects inaccessible
+    const auto page = static_cast<size_t>(page_size());
+    const auto pages = page_size_ceil(free - to_base) / page;
+    to_space.discard(0, m_heap_size);
+    for (size_t i = 0; i < m_heap_size / page; ++i) {
+        m_page_states[i] = i < pages ? page_pending : page_done;
+    }
+    if (pages > 0) {
+        if (m_uffd) {
+            if (!m_uffd->register_range(to_space.view(), pages * page)) {
+                throw std::runtime_error("Could not register space");
+            }
+        } else {
+            auto& protection = *m_protection[space_index(to_space.view())];
+            protection.protect(to_space.view(), pages * page,
+                               ProtectionMode::None);
+            protection.commit();
+        }
+    }
+    m_evacuated_pages = pages;
+    m_evacuating = to_space.view();
+
+    // after the roots are updated, the mutators only see the new addresses
+    for (auto* root : roots) {
+        const auto val = FatPtr::test_ptr(root);
+        if (!val) {
+            continue;
+        }
+        const auto it = m_forwarding.find(static_cast<uintptr_t>(val.value()));
+        if (it != m_forwarding.end()) {
+            root->compare_exchange(val.value(), FatPtr{it->second});
+        }
+    }
+    WeakRefs::get_instance().end_collection([this](uintptr_t target) {
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        if (!contains(reinterpret_cast<void*>(target))) {
+            return target;
+        }
+        const auto it = m_forwarding.find(target);
+        return it == m_forwarding.end() ? static_cast<uintptr_t>(0)
+                                        : it->second;
+    });
+    m_metadata = std::move(evacuated);
+    m_space_num = static_cast<uint8_t>(from_space ^ 1);
+    m_next = free - to_base;
+    return dead;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::CompressorCollector<L, G>::fill_page(size_t page,
+                                                std::byte* dst) const noexcept
+{
+    const auto page_start = reinterpret_cast<uintptr_t>(m_evacuating.load()) +
+                            page * static_cast<size_t>(page_size());
+    const auto page_end = page_start + static_cast<size_t>(page_size());
+    // first object which ends after the start of the page
+    auto it = std::ranges::upper_bound(
+        m_relocations, page_start, std::less{},
+        [](const auto& reloc) { return reloc.to + reloc.size; });
+    for (; it != m_relocations.end() && it->to < page_end; ++it) {
+        const auto lo = std::max(it->to, page_start);
+        const auto hi = std::min(it->to + it->size, page_end);
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        std::memcpy(dst + (lo - page_start),
+                    reinterpret_cast<const std::byte*>(it->from + (lo - it->to)),
+                    hi - lo);
+        // update the pointers overlapping the page, which may begin on the
+        // previous page
+        const auto first = it->from + (std::max(lo - gc_ptr_size, it->to) -
+                                       it->to);
+        scan_memory(first, it->from + (hi - it->to) + gc_ptr_size,
+                    [this, &it, page_start, page_end, dst](auto slot) {
+                        const auto slot_end =
+                            reinterpret_cast<uintptr_t>(slot) + gc_ptr_size;
+                        if (slot_end > it->from + it->size) {
+                            return;
+                        }
+                        const auto val = FatPtr::test_ptr(slot);
+                        if (!val) {
+                            return;
+                        }
+                        const auto fwd = m_forwarding.find(
+                            static_cast<uintptr_t>(val.value()));
+                        if (fwd == m_forwarding.end()) {
+                            return;
+                        }
+                        const auto new_val = FatPtr{fwd->second};
+                        const auto* const src =
+                            reinterpret_cast<const std::byte*>(&new_val);
+                        const auto slot_to =
+                            it->to + (reinterpret_cast<uintptr_t>(slot) -
+                                      it->from);
+                        for (size_t i = 0; i < gc_ptr_size; ++i) {
+                            if (slot_to + i >= page_start &&
+                                slot_to + i < page_end) {
+                                dst[slot_to + i - page_start] = src[i];
+                            }
+                        }
+                    });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+std::optional<size_t> gcpp::CompressorCollector<L, G>::evacuated_page(
+    const void* addr) const noexcept
+{
+    const auto* const space = m_evacuating.load();
+    const auto page_bytes = static_cast<size_t>(page_size());
+    if (space == nullptr || addr < space ||
+        addr >= space + m_evacuated_pages * page_bytes) {
+        return std::nullopt;
+    }
+    return static_cast<size_t>(static_cast<const std::byte*>(addr) - space) /
+           page_bytes;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+bool gcpp::CompressorCollector<L, G>::resolve(const void* addr,
+                                              std::byte* buffer) noexcept
+{
+    const auto page = evacuated_page(addr);
+    if (!page) {
+        return false;
+    }
+    const auto page_bytes = static_cast<size_t>(page_size());
+    auto* const page_addr = m_evacuating.load() + page.value() * page_bytes;
+    auto expected = page_pending;
+    if (m_page_states[page.value()].compare_exchange_strong(expected,
+                                                            page_filling)) {
+        std::memset(buffer, 0, page_bytes);
+        fill_page(page.value(), buffer);
+        m_uffd->copy_page(page_addr, buffer);
+        m_page_states[page.value()] = page_done;
+        return true;
+    }
+    while (m_page_states[page.value()] != page_done) {
+        std::this_thread::yield();
+    }
+    // the fault may have been reported after the page was filled
+    m_uffd->wake(page_addr);
+    return true;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+bool gcpp::CompressorCollector<L, G>::resolve(const void* addr) noexcept
+{
+    const auto page = evacuated_page(addr);
+    if (!page) {
+        return false;
+    }
+    const auto page_bytes = static_cast<size_t>(page_size());
+    auto expected = page_pending;
+    if (m_page_states[page.value()].compare_exchange_strong(expected,
+                                                            page_filling)) {
+        // fill through the alias while the page is still inaccessible
+        auto* const space = m_evacuating.load();
+        const auto idx = space_index(space);
+        fill_page(page.value(),
+                  m_spaces[idx]->alias() + page.value() * page_bytes);
+        m_protection[idx]->protect_now(space + page.value() * page_bytes,
+                                       page_bytes, ProtectionMode::ReadWrite);
+        m_page_states[page.value()] = page_done;
+        return true;
+    }
+    while (m_page_states[page.value()] != page_done) {
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::CompressorCollector<L, G>::evacuate_remaining(std::byte* space)
+{
+    const auto page_bytes = static_cast<size_t>(page_size());
+    if (m_uffd) {
+        for (size_t page = 0; page < m_evacuated_pages; ++page) {
+            resolve(space + page * page_bytes, m_fill_buffer.get());
+        }
+        return;
+    }
+    // claim runs of untouched pages, and make each run accessible at once
+    const auto idx = space_index(space);
+    auto& protection = *m_protection[idx];
+    std::vector<size_t> claimed;
+    const auto publish = [this, &protection, &claimed]() {
+        protection.commit();
+        for (const auto page : claimed) {
+            m_page_states[page] = page_done;
+        }
+        claimed.clear();
+    };
+    for (size_t page = 0; page < m_evacuated_pages; ++page) {
+        auto expected = page_pending;
+        if (m_page_states[page].compare_exchange_strong(expected,
+                                                        page_filling)) {
+            fill_page(page, m_spaces[idx]->alias() + page * page_bytes);
+            protection.protect(space + page * page_bytes, page_bytes,
+                               ProtectionMode::ReadWrite);
+            claimed.push_back(page);
+        }
+        if (claimed.size() == max_batch_pages) {
+            publish();
+        }
+    }
+    publish();
+    for (size_t page = 0; page < m_evacuated_pages; ++page) {
+        while (m_page_states[page] != page_done) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+bool gcpp::CompressorCollector<L, G>::handle_fault(void* collector, void* addr)
+{
+    return static_cast<CompressorCollector*>(collector)->resolve(addr);
+}
+
+template <gcpp::CollectorLockingPolicy LockPolicy, gcpp::GCGenerationPolicy G>
+std::future<std::vector<FatPtr>>
+gcpp::CompressorCollector<LockPolicy, G>::async_collect(
+    const std::vector<FatPtr*>& extra_roots) noexcept
+{
+    // finalizers may still be reading the space we will evacuate into
+    if (m_finalized.valid()) {
+        m_finalized.wait();
+    }
+    return m_lock.do_collection([this, extra_roots]() {
+        std::vector<DeadObject> dead;
+        {
+            [[maybe_unused]] auto lk = m_lock.lock();
+            auto& weak_refs = WeakRefs::get_instance();
+            weak_refs.begin_collection();
+            try {
+                dead = plan_evacuation(extra_roots);
+            } catch (...) {
+                weak_refs.end_collection([](auto target) { return target; });
+                throw;
+            }
+        }
+        if (m_evacuation_hook) {
+            m_evacuation_hook();
+        }
+        auto* const space = m_evacuating.load();
+        const auto page_bytes = static_cast<size_t>(page_size());
+        evacuate_remaining(space);
+        m_evacuating = nullptr;
+        if (m_uffd && m_evacuated_pages > 0) {
+            m_uffd->unregister_range(space, m_evacuated_pages * page_bytes);
+        }
+        const auto from_space = m_lock.do_with_lock(
+            [this]() { return static_cast<uint8_t>(m_space_num ^ 1); });
+        if (dead.empty()) {
+            m_spaces[from_space]->discard(0, m_heap_size);
+        } else {
+            // the space is released at the start of the next collection
+            m_finalized =
+                FinalizerThread::get_instance().finalize(std::move(dead));
+        }
+        return CollectionResultT{};
+    });
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CompressorCollector<Lock, G>::collect(size_t needed_space) noexcept
+{
+    while (m_collect_result.valid() &&
+           m_collect_result.wait_for(std::chrono::seconds(0)) ==
+               std::future_status::timeout &&
+           free_space() < needed_space) {
+        m_collect_result.wait();
+    }
+    [[maybe_unused]] auto lk = m_lock.lock();
+    if (free_space() < needed_space &&
+        (!m_collect_result.valid() ||
+         m_collect_result.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready)) {
+        m_collect_result = async_collect({});
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+FatPtr gcpp::CompressorCollector<Lock, G>::alloc(size_t size,
+                                                 std::align_val_t alignment,
+                                                 FinalizerFn finalizer)
+{
+    GC_UPDATE_STACK_RANGE_NESTED_1();
+    if (size == 0 || size > m_heap_size) {
+        throw std::bad_alloc();
+    }
+    return alloc_attempt({size, alignment, finalizer}, 0);
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CompressorCollector<Lock, G>::set_evacuation_hook(
+    std::function<void()> hook) noexcept
+{
+    [[maybe_unused]] auto lk = m_lock.lock();
+    m_evacuation_hook = std::move(hook);
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+gcpp::CompressorCollector<Lock, G>::~CompressorCollector()
+{
+    if (m_collect_result.valid()) {
+        m_collect_result.wait();
+    }
+    // finalizers may still be reading the heap
+    if (m_finalized.valid()) {
+        m_finalized.wait();
+    }
+    m_fault_thread = {};
+    if (!m_uffd) {
+        for (const auto id : m_fault_handlers) {
+            unregister_fault_handler(id);
+        }
+    }
+    for (const auto& space : m_spaces) {
+        unregister_heap(space->view(), m_heap_size);
+    }
+}
+
+template class gcpp::CompressorCollector<gcpp::SerialGCPolicy,
+                                         gcpp::FinalGenerationPolicy>;
+template class gcpp::CompressorCollector<gcpp::ConcurrentGCPolicy,
+                                         gcpp::FinalGenerationPolicy>;
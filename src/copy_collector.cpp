@@ -3,27 +3,39 @@
 #include <bits/types/siginfo_t.h>
 #include <sys/mman.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <functional>
+#include <iterator>
 #include <mutex>
 #include <new>
+#include <span>
 #include <stack>
 #include <stdexcept>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "alloc_profiler.h"
 #include "collector.h"
+#include "compressed_ptr.h"
 #include "concurrent_gc.h"
 #include "copy_collector.h"
 #include "debug_thread_counter.h"
+#include "dirty_tracker.h"
+#include "finalizer.h"
 #include "gc_base.h"
 #include "gc_scan.h"
 #include "generational_gc.h"
 #include "mem_prot.h"
+#include "weak_ref.h"
 
 /*
 I've been thinking for a bit on how best to implement a concurrent copying
@@ -189,31 +201,77 @@ FatPtr gcpp::CopyingCollector<L, G>::alloc_no_constraints(
         &m_spaces[static_cast<uint8_t>(to_space_num)][index])};
     [[maybe_unused]] auto lk = m_lock.lock();
     m_metadata.emplace(ptr, meta_data);
+    set_start(ptr, true);
     m_gen_policy.init(ptr);
     return ptr;
 }
 template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
-FatPtr gcpp::CopyingCollector<L, G>::alloc_attempt(const size_t size,
-                                                   std::align_val_t alignment,
+FatPtr gcpp::CopyingCollector<L, G>::alloc_attempt(const MetaData& meta_data,
                                                    uint8_t attempts)
 {
-    const auto [to_space, alloc_index] = [this, alignment, size]() {
+    const auto [to_space, alloc_index] = [this, &meta_data]() {
         [[maybe_unused]] auto lk = m_lock.lock();
         const auto to = SpaceNum{load(m_space_num)};
-        const auto index = reserve_space(size, to, alignment, m_max_alloc_size);
-        check_overlapping_alloc(index, to, size);
+        const auto index = reserve_space(meta_data.size, to,
+                                         meta_data.alignment, m_max_alloc_size);
+        check_overlapping_alloc(index, to, meta_data.size);
         return std::make_tuple(to, index);
     }();
     if (!alloc_index) {
         if (attempts < 1) {
-            collect(size);
-            return alloc_attempt(size, alignment, attempts + 1);
+            // pinned objects left in place may leave less room than
+            // `free_space` counts, so collect even if it seems enough
+            collect();
+            return alloc_attempt(meta_data, attempts + 1);
         } else {
             throw std::bad_alloc();
         }
     }
-    return alloc_no_constraints(to_space, {size, alignment}, *alloc_index);
+    return alloc_no_constraints(to_space, meta_data, *alloc_index);
 }
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+std::vector<FatPtr> gcpp::CopyingCollector<L, G>::alloc_batch_attempt(
+    const MetaData& meta_data, size_t count, size_t stride, uint8_t attempts)
+{
+    const auto total = stride * (count - 1) + meta_data.size;
+    const auto [to_space, alloc_index] = [this, &meta_data, total]() {
+        [[maybe_unused]] auto lk = m_lock.lock();
+        const auto to = SpaceNum{load(m_space_num)};
+        const auto index =
+            reserve_space(total, to, meta_data.alignment, m_max_alloc_size);
+        check_overlapping_alloc(index, to, total);
+        return std::make_tuple(to, index);
+    }();
+    if (!alloc_index) {
+        if (attempts < 1) {
+            // pinned objects left in place may leave less room than
+            // `free_space` counts, so collect even if it seems enough
+            collect();
+            return alloc_batch_attempt(meta_data, count, stride, attempts + 1);
+        } else {
+            throw std::bad_alloc();
+        }
+    }
+    if (total + *alloc_index >= m_heap_size) {
+        throw std::bad_alloc();
+    }
+    auto* const start =
+        &m_spaces[static_cast<uint8_t>(to_space)][alloc_index.value()];
+    std::vector<FatPtr> ptrs;
+    ptrs.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        ptrs.emplace_back(reinterpret_cast<uintptr_t>(start + i * stride));
+    }
+    [[maybe_unused]] auto lk = m_lock.lock();
+    m_metadata.reserve(m_metadata.size() + count);
+    for (const auto& ptr : ptrs) {
+        m_metadata.emplace(ptr, meta_data);
+        set_start(ptr, true);
+        m_gen_policy.init(ptr);
+    }
+    return ptrs;
+}
+
 template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
 std::optional<size_t> gcpp::CopyingCollector<L, G>::reserve_space(
     size_t size, SpaceNum to_space, std::align_val_t alignment,
@@ -221,16 +279,47 @@ std::optional<size_t> gcpp::CopyingCollector<L, G>::reserve_space(
 {
     auto to_space_num = static_cast<uint8_t>(to_space);
     size_t next = m_nexts[to_space_num];
-    uint8_t padding_bytes = 0;
+    size_t start = 0;
     do {
-        padding_bytes =
-            calc_alignment_bytes(&m_spaces[to_space_num][next], alignment);
-        if (next + size + padding_bytes > max_alloc_size) {
+        start = next;
+        uint8_t padding_bytes = 0;
+        while (true) {
+            padding_bytes =
+                calc_alignment_bytes(&m_spaces[to_space_num][start], alignment);
+            // skip over objects which were left in place
+            const auto retained =
+                retained_overlap(to_space, start + padding_bytes, size);
+            if (!retained) {
+                break;
+            }
+            start = *retained;
+        }
+        start += padding_bytes;
+        if (start + size > max_alloc_size) {
             return std::nullopt;
         }
-    } while (!compare_exchange(m_nexts[to_space_num], next,
-                               next + size + padding_bytes));
-    return next + padding_bytes;
+    } while (!compare_exchange(m_nexts[to_space_num], next, start + size));
+    return start;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+std::optional<size_t> gcpp::CopyingCollector<L, G>::retained_overlap(
+    SpaceNum space, size_t index, size_t size) const
+{
+    const auto& retained = m_retained[static_cast<uint8_t>(space)];
+    if (retained.empty()) {
+        return std::nullopt;
+    }
+    // ranges are disjoint, so only the last range starting at or before
+    // `index` and the first range starting after it can overlap
+    auto it = retained.upper_bound(index);
+    if (it != retained.end() && it->first < index + size) {
+        return it->second;
+    }
+    if (it != retained.begin() && std::prev(it)->second > index) {
+        return std::prev(it)->second;
+    }
+    return std::nullopt;
 }
 template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
 FatPtr gcpp::CopyingCollector<L, G>::copy(FatPtr& to_update, SpaceNum to_space,
@@ -243,68 +332,461 @@ FatPtr gcpp::CopyingCollector<L, G>::copy(FatPtr& to_update, SpaceNum to_space,
             return ptr;
         }
     }
-    const auto old_data =
-        m_lock.do_with_lock([this, ptr]() { return m_metadata.at(ptr); });
-    auto index =
-        reserve_space(old_data.size, to_space, old_data.alignment, m_heap_size);
-    m_lock.do_with_lock([this, index, to_space, size = old_data.size]() {
-        check_overlapping_alloc(index, to_space, size);
-    });
-    if (!index) {
-        throw std::bad_alloc();
-    }
-    auto new_obj = alloc_no_constraints(to_space, old_data, index.value());
+    const auto [new_obj, size] = reserve_copy(to_space, ptr);
     // ISSUE: ptr object data could be updated during the memcpy
     {
         // auto lk2 = std::unique_lock{m_test_mu};
         // SANITY CHECK
         // auto mem_lock = region_readonly(ptr, old_data.size);
-        seq_cst_cpy(new_obj, ptr, old_data.size);
+        seq_cst_cpy(new_obj, ptr, size);
+        // compressed references are relative to themselves, so they are
+        // re-encoded before a mutator can follow them in the copy
+        const auto* const compressed = m_lock.do_with_lock(
+            [this, &new_obj]() { return m_metadata.at(new_obj).compressed; });
+        if (compressed != nullptr) {
+            trace_compressed(*compressed, size, static_cast<uintptr_t>(ptr),
+                             static_cast<uintptr_t>(new_obj),
+                             [](auto target, auto field, auto shift) {
+                                 store_compressed(field, target, shift);
+                             });
+        }
         to_update.compare_exchange(ptr, new_obj);
     }
     [[maybe_unused]] auto lk = m_lock.lock();
+    set_start(ptr, false);
     m_metadata.erase(ptr);
     return new_obj;
 }
 template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+std::pair<FatPtr, size_t> gcpp::CopyingCollector<L, G>::reserve_copy(
+    SpaceNum to_space, const FatPtr& ptr)
+{
+    auto old_data =
+        m_lock.do_with_lock([this, ptr]() { return m_metadata.at(ptr); });
+    ++old_data.age;
+    const auto index = m_lock.do_with_lock([this, to_space, &old_data]() {
+        const auto res = reserve_space(old_data.size, to_space,
+                                       old_data.alignment, m_heap_size);
+        check_overlapping_alloc(res, to_space, old_data.size);
+        return res;
+    });
+    if (!index) {
+        throw std::bad_alloc();
+    }
+    return {alloc_no_constraints(to_space, old_data, index.value()),
+            old_data.size};
+}
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
 void gcpp::CopyingCollector<L, G>::forward_ptr(
     SpaceNum to_space, FatPtr& ptr, std::unordered_map<FatPtr, FatPtr>& visited)
 {
     std::stack<std::reference_wrapper<FatPtr>> stack;
+    // in hierarchical order, pointers of the objects copied to the page
+    // being filled, traced breadth first before the stack
+    std::deque<std::reference_wrapper<FatPtr>> local;
+    const auto hierarchical = m_copy_order == CopyOrder::Hierarchical;
+    uintptr_t local_page = 0;
+    // compressed references are traced through a full pointer to their
+    // target, which is written back once the target is forwarded
+    struct CompressedProxy {
+        FatPtr target;
+        /** Target before it was forwarded */
+        uintptr_t old_target;
+        uintptr_t field;
+        uint8_t shift;
+    };
+    std::deque<CompressedProxy> proxies;
+    // large objects being copied a chunk at a time, by their old address.
+    // Pointers to them are only forwarded once the copy is finished, so
+    // that a mutator never follows one to a partial copy.
+    struct LargeCopy {
+        FatPtr to;
+        size_t size;
+        /** Number of bytes copied */
+        size_t done;
+        std::vector<std::reference_wrapper<FatPtr>> waiting;
+    };
+    std::unordered_map<FatPtr, LargeCopy> large;
+    // copies and scans the next chunk of a large object, finishing its copy
+    // after the last chunk
+    const auto copy_chunk = [this, &large, &stack]() {
+        auto it = large.begin();
+        const auto& from = it->first;
+        auto& job = it->second;
+        const auto begin = static_cast<uintptr_t>(job.to) + job.done;
+        // chunks end on multiples of the chunk size, which pointers can't
+        // straddle
+        const auto end =
+            std::min(static_cast<uintptr_t>(job.to) + job.size,
+                     (begin + large_object_chunk_size) &
+                         ~static_cast<uintptr_t>(large_object_chunk_size - 1));
+        seq_cst_cpy(job.to.as_ptr() + job.done, from.as_ptr() + job.done,
+                    end - begin);
+        job.done += end - begin;
+        scan_memory(begin, end,
+                    [&stack](auto child) { stack.emplace(*child); });
+        if (job.done == job.size) {
+            for (auto& slot : job.waiting) {
+                slot.get().compare_exchange(from, job.to);
+            }
+            m_lock.do_with_lock([this, &from]() {
+                set_start(from, false);
+                m_metadata.erase(from);
+            });
+            large.erase(it);
+        }
+    };
+    // attached storage is traced through the pointers to it kept for its
+    // holder, which it never moves away from
+    const auto push_storage = [this, &stack](const FatPtr& holder) {
+        if (const auto it = m_storage.find(holder); it != m_storage.end()) {
+            for (auto& storage : it->second) {
+                stack.emplace(storage);
+            }
+        }
+    };
+    // takes the next pointer to trace
+    const auto take = [&local, &stack]() {
+        auto res = local.empty() ? stack.top() : local.front();
+        if (local.empty()) {
+            stack.pop();
+        } else {
+            local.pop_front();
+        }
+        return res;
+    };
+    // ring buffer of the pointers whose targets have been prefetched
+    const size_t distance = m_prefetch_distance;
+    std::array<FatPtr*, max_prefetch_distance> prefetched{};
+    size_t prefetch_head = 0;
+    size_t prefetch_count = 0;
     stack.emplace(ptr);
-    while (!stack.empty()) {
-        auto p = stack.top();
+    while (!local.empty() || !stack.empty() || !large.empty() ||
+           prefetch_count > 0) {
+        while (prefetch_count < distance && (!local.empty() || !stack.empty())) {
+            auto& slot = take().get();
+            if (const auto val = FatPtr::test_ptr(&slot)) {
+                // the start of the target is read first, for its pointers
+                __builtin_prefetch(val->as_ptr());
+                prefetched[(prefetch_head + prefetch_count) % distance] = &slot;
+                ++prefetch_count;
+            }
+        }
+        if (local.empty() && stack.empty() && prefetch_count == 0) {
+            // the next chunk of a large object is only copied once the
+            // pointers found in its previous chunk are traced
+            copy_chunk();
+            continue;
+        }
+        const auto from_fifo = prefetch_count > 0;
+        auto p = from_fifo ? std::ref(*prefetched[prefetch_head]) : take();
+        if (from_fifo) {
+            prefetch_head = (prefetch_head + 1) % distance;
+            --prefetch_count;
+        }
+        // reloaded in case a mutator overwrote the pointer since its target
+        // was prefetched
         auto maybe_ptr_val = FatPtr::test_ptr(&p.get());
-        stack.pop();
         if (!maybe_ptr_val) {
             continue;
         }
         auto ptr_val = maybe_ptr_val.value();
         if (visited.contains(ptr_val)) {
-            p.get().compare_exchange(ptr_val, visited.at(ptr_val));
-            continue;
-        } else if (m_lock.do_with_lock([this, ptr_val, to_space]() {
-                       return !m_metadata.contains(ptr_val) ||
-                              get_space_num(ptr_val) == to_space;
-                   })) {
+            if (const auto it = large.find(ptr_val); it != large.end()) {
+                it->second.waiting.emplace_back(p);
+            } else {
+                p.get().compare_exchange(ptr_val, visited.at(ptr_val));
+            }
             continue;
         }
-        {
-            auto meta_data = m_lock.do_with_lock(
-                [this, ptr_val]() { return m_metadata.at(ptr_val); });
-            scan_memory(static_cast<uintptr_t>(ptr_val),
-                        static_cast<uintptr_t>(ptr_val) + meta_data.size,
-                        [&stack](auto ptr) { stack.emplace(*ptr); });
+        const auto [known, in_to_space] =
+            m_lock.do_with_lock([this, ptr_val, to_space]() {
+                const auto res = m_metadata.contains(ptr_val);
+                return std::make_pair(
+                    res, res && get_space_num(ptr_val) == to_space);
+            });
+        // pinned objects in the to space must still have their members
+        // forwarded
+        const auto pinned = m_pins.contains(ptr_val) ||
+                            m_interior_pins.contains(ptr_val) ||
+                            m_storage_holders.contains(ptr_val);
+        if (!known || (in_to_space && !pinned)) {
+            continue;
         }
-        // meta_data& is invalidated by copy
+        const auto [size, compressed] = m_lock.do_with_lock([this, ptr_val]() {
+            const auto& meta_data = m_metadata.at(ptr_val);
+            return std::make_pair(meta_data.size, meta_data.compressed);
+        });
         const auto need_promotion = m_lock.do_with_lock(
             [this, ptr_val]() { return m_gen_policy.need_promotion(ptr_val); });
-        auto new_ptr = need_promotion ? copy(p.get(), to_space, ptr_val) :
-            m_lock.do_with_lock([this, ptr_val]() {
-                return m_gen_policy.promote(ptr_val, m_metadata.at(ptr_val));
-            });
+        if (!pinned && need_promotion && compressed == nullptr &&
+            size > large_object_chunk_size) {
+            const auto new_ptr = reserve_copy(to_space, ptr_val).first;
+            visited.emplace(ptr_val, new_ptr);
+            large.emplace(ptr_val, LargeCopy{new_ptr, size, 0, {p}});
+            push_storage(ptr_val);
+            continue;
+        }
+        auto new_ptr = pinned           ? ptr_val
+                       : need_promotion ? copy(p.get(), to_space, ptr_val)
+                                        : m_lock.do_with_lock([this, ptr_val]() {
+                                              return m_gen_policy.promote(
+                                                  ptr_val,
+                                                  m_metadata.at(ptr_val));
+                                          });
         visited.emplace(ptr_val, new_ptr);
+        push_storage(ptr_val);
+        const auto is_local = hierarchical && !pinned && need_promotion;
+        if (is_local) {
+            // the next copy goes to the page of the end of this one. Once
+            // that is a new page, the pointers of the objects on the
+            // previous page are left for after the new page is traced.
+            const auto page =
+                (static_cast<uintptr_t>(new_ptr) + size - 1) / page_size();
+            if (page != local_page) {
+                while (!local.empty()) {
+                    stack.emplace(local.back());
+                    local.pop_back();
+                }
+                local_page = page;
+            }
+        }
+        const auto push = [is_local, &stack, &local](FatPtr& child) {
+            if (is_local) {
+                local.emplace_back(child);
+            } else {
+                stack.emplace(child);
+            }
+        };
+        // scan the copy so that the pointers of the new object are the ones
+        // which get forwarded
+        scan_memory(static_cast<uintptr_t>(new_ptr),
+                    static_cast<uintptr_t>(new_ptr) + size,
+                    [&push](auto child) { push(*child); });
+        if (compressed != nullptr) {
+            // the copy's references were re-encoded by `copy`
+            trace_compressed(*compressed, size, static_cast<uintptr_t>(new_ptr),
+                             static_cast<uintptr_t>(new_ptr),
+                             [&push, &proxies](auto target, auto field,
+                                               auto shift) {
+                                 push(proxies
+                                          .emplace_back(CompressedProxy{
+                                              FatPtr{target}, target, field,
+                                              shift})
+                                          .target);
+                             });
+        }
+    }
+    for (auto& proxy : proxies) {
+        const auto target = FatPtr::test_ptr(&proxy.target);
+        forward_compressed(proxy.field, proxy.old_target,
+                           target ? static_cast<uintptr_t>(target.value()) : 0,
+                           proxy.shift);
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+template <typename Fn>
+void gcpp::CopyingCollector<L, G>::trace_compressed(
+    const CompressedLayout& layout, size_t size, uintptr_t old_addr,
+    uintptr_t new_addr, Fn&& f)
+{
+    for (size_t elem = 0; elem + layout.stride <= size;
+         elem += layout.stride) {
+        for (const auto& field :
+             std::span{layout.fields, layout.count}) {
+            const auto offset = elem + field.offset;
+            // the value is relative to the field of the original object
+            const auto val = std::atomic_ref<int32_t>(
+                                 *reinterpret_cast<int32_t*>(new_addr + offset))
+                                 .load();
+            const auto target =
+                decode_compressed(old_addr + offset, val, field.shift);
+            if (target != 0) {
+                f(target, new_addr + offset, field.shift);
+            }
+        }
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<L, G>::store_compressed(uintptr_t field,
+                                                    uintptr_t target,
+                                                    uint8_t shift)
+{
+    const auto val = encode_compressed(field, target, shift);
+    if (!val) {
+        throw std::runtime_error(
+            "Compressed reference out of range of its moved target");
     }
+    std::atomic_ref<int32_t>(*reinterpret_cast<int32_t*>(field))
+        .store(val.value());
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<L, G>::forward_compressed(uintptr_t field,
+                                                      uintptr_t old_target,
+                                                      uintptr_t new_target,
+                                                      uint8_t shift)
+{
+    if (old_target == new_target) {
+        return;
+    }
+    const auto val = encode_compressed(field, new_target, shift);
+    if (!val) {
+        throw std::runtime_error(
+            "Compressed reference out of range of its moved target");
+    }
+    // the old value is in range since it was read from the field
+    auto expected = encode_compressed(field, old_target, shift).value();
+    std::atomic_ref<int32_t>(*reinterpret_cast<int32_t*>(field))
+        .compare_exchange_strong(expected, val.value());
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<L, G>::trace(
+    SpaceNum to_space, const std::vector<FatPtr*>& extra_roots,
+    std::unordered_map<FatPtr, FatPtr>& visited)
+{
+    // keeps the memory holding the roots from being freed until we are done
+    const auto roots_in_use = GCRoots::RootsInUse{};
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    // before anything is copied, so objects raw pointers point into stay put
+    pin_interior();
+    roots.insert(roots.end(), extra_roots.begin(), extra_roots.end());
+    // roots held by our own objects (ie. from a root source) are not roots
+    for (auto* it : roots | std::views::filter([this](auto ptr) {
+                        const auto opt = FatPtr::test_ptr(ptr);
+                        return opt && contains(opt.value()) && !contains(ptr);
+                    })) {
+        forward_ptr(to_space, *it, visited);
+    }
+    // pinned objects are roots and never move
+    for (const auto& [ptr, _] : m_pins) {
+        auto root = ptr;
+        forward_ptr(to_space, root, visited);
+    }
+    for (const auto& ptr : m_interior_pins) {
+        auto root = ptr;
+        forward_ptr(to_space, root, visited);
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<L, G>::remark(
+    SpaceNum to_space, const std::vector<FatPtr*>& extra_roots,
+    std::unordered_map<FatPtr, FatPtr>& visited)
+{
+    const std::array<std::vector<bool>, 2> dirty = {
+        m_dirty_trackers[0]->stop(), m_dirty_trackers[1]->stop()};
+    // roots may have been overwritten since they were traced
+    trace(to_space, extra_roots, visited);
+    const auto to = static_cast<uint8_t>(to_space);
+    const auto base = reinterpret_cast<uintptr_t>(m_spaces[to].get());
+    const auto next =
+        m_lock.do_with_lock([this, to]() { return load(m_nexts[to]); });
+    rescan_dirty(to_space, to_space, base, base + next, dirty[to], visited);
+    rescan_compressed(to_space, dirty, visited);
+    // pinned objects left in the from space are not in the range above
+    const auto rescan_pinned = [&](const FatPtr& ptr) {
+        const auto space = get_space_num(ptr);
+        if (space == to_space) {
+            return;
+        }
+        const auto size = m_lock.do_with_lock(
+            [this, &ptr]() { return m_metadata.at(ptr).size; });
+        const auto start = static_cast<uintptr_t>(ptr);
+        rescan_dirty(to_space, space, start, start + size,
+                     dirty[static_cast<uint8_t>(space)], visited);
+    };
+    for (const auto& [ptr, _] : m_pins) {
+        rescan_pinned(ptr);
+    }
+    for (const auto& ptr : m_interior_pins) {
+        rescan_pinned(ptr);
+    }
+    for (const auto& [ptr, _] : m_storage_holders) {
+        if (visited.contains(ptr)) {
+            rescan_pinned(ptr);
+        }
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<L, G>::rescan_compressed(
+    SpaceNum to_space, const std::array<std::vector<bool>, 2>& dirty,
+    std::unordered_map<FatPtr, FatPtr>& visited)
+{
+    const auto page = static_cast<uintptr_t>(page_size());
+    const auto holders = m_lock.do_with_lock([this, to_space]() {
+        std::vector<std::pair<FatPtr, MetaData>> res;
+        for (const auto& [ptr, meta_data] : m_metadata) {
+            if (meta_data.compressed != nullptr &&
+                (get_space_num(ptr) == to_space || m_pins.contains(ptr) ||
+                 m_interior_pins.contains(ptr))) {
+                res.emplace_back(ptr, meta_data);
+            }
+        }
+        return res;
+    });
+    for (const auto& [ptr, meta_data] : holders) {
+        const auto space = static_cast<uint8_t>(get_space_num(ptr));
+        const auto base = reinterpret_cast<uintptr_t>(m_spaces[space].get());
+        const auto addr = static_cast<uintptr_t>(ptr);
+        trace_compressed(
+            *meta_data.compressed, meta_data.size, addr, addr,
+            [&](auto target, auto field, auto shift) {
+                if (!dirty[space][(field - base) / page]) {
+                    return;
+                }
+                auto proxy = FatPtr{target};
+                forward_ptr(to_space, proxy, visited);
+                forward_compressed(field, target,
+                                   static_cast<uintptr_t>(proxy), shift);
+            });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<L, G>::rescan_dirty(
+    SpaceNum to_space, SpaceNum space, uintptr_t begin, uintptr_t end,
+    const std::vector<bool>& dirty,
+    std::unordered_map<FatPtr, FatPtr>& visited)
+{
+    const auto page = static_cast<uintptr_t>(page_size());
+    const auto base =
+        reinterpret_cast<uintptr_t>(m_spaces[static_cast<uint8_t>(space)].get());
+    const auto first = (begin - base) / page;
+    const auto last = std::min((end - base + page - 1) / page, dirty.size());
+    for (auto i = first; i < last; ++i) {
+        if (!dirty[i]) {
+            continue;
+        }
+        // pointers may straddle the previous page
+        const auto lo = std::max(begin, base + i * page - gc_ptr_size + 1);
+        const auto hi = std::min(base + (i + 1) * page + gc_ptr_size, end + 1);
+        scan_memory(lo, hi, [this, to_space, &visited](auto slot) {
+            forward_ptr(to_space, *slot, visited);
+        });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+uintptr_t gcpp::CopyingCollector<L, G>::forwarded_address(
+    SpaceNum to_space, uintptr_t target,
+    const std::unordered_map<FatPtr, FatPtr>& visited) const
+{
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    if (!contains(reinterpret_cast<void*>(target))) {
+        return target;
+    }
+    const auto ptr = FatPtr{target};
+    if (const auto it = visited.find(ptr); it != visited.end()) {
+        return static_cast<uintptr_t>(it->second);
+    }
+    // objects allocated since the flip are live
+    return get_space_num(ptr) == to_space ? target : 0;
 }
 
 template <gcpp::CollectorLockingPolicy LockPolicy, gcpp::GCGenerationPolicy G>
@@ -313,31 +795,126 @@ gcpp::CopyingCollector<LockPolicy, G>::async_collect(
     const std::vector<FatPtr*>& extra_roots) noexcept
 {
     auto tc = ThreadCounter{m_tcount, 1};
+    // the space we collect holds the objects resurrected by the last
+    // collection until they are finalized
+    if (m_finalized.valid()) {
+        m_finalized.wait();
+    }
     const auto [from_space, to_space] = flip_space(m_space_num);
     m_nexts[static_cast<uint8_t>(from_space)] = 0;
-    return m_lock.do_collection([this, extra_roots, to_space]() {
+    return m_lock.do_collection([this, extra_roots, from_space, to_space]() {
+        if (m_collection_hook) {
+            m_collection_hook();
+        }
+        auto collection_lk = m_collection_mutex != nullptr
+                                 ? std::unique_lock{*m_collection_mutex}
+                                 : std::unique_lock<std::mutex>{};
+        auto pin_lk = std::unique_lock{m_pin_mutex};
+        // objects retained in the from space will be moved or retained again
+        m_lock.do_with_lock([this, from_space]() {
+            m_retained[static_cast<uint8_t>(from_space)].clear();
+        });
+        auto& weak_refs = WeakRefs::get_instance();
+        weak_refs.begin_collection();
         std::vector<FatPtr> promoted;
         std::unordered_map<FatPtr, FatPtr> visited;
-        std::vector<FatPtr*> roots;
-        GC_GET_ROOTS(roots);
-        roots.insert(roots.end(), extra_roots.begin(), extra_roots.end());
-        for (auto* it : roots | std::views::filter([this](auto ptr) {
-                            const auto opt = FatPtr::test_ptr(ptr);
-                            return opt && contains(opt.value());
-                        })) {
-            forward_ptr(to_space, *it, visited);
-        }
-        m_lock.do_with_lock([this, &visited, to_space]() {
+        // dead objects with finalizers, and the objects which are reachable
+        // without them
+        std::vector<FatPtr> to_resurrect;
+        std::unordered_set<FatPtr> reachable;
+        const auto remarking = m_dirty_trackers[0] != nullptr;
+        try {
+            if (remarking) {
+                for (const auto& tracker : m_dirty_trackers) {
+                    tracker->start();
+                }
+            }
+            trace(to_space, extra_roots, visited);
+            if (remarking) {
+                remark(to_space, extra_roots, visited);
+            }
+            // finalizable objects are copied with everything they reach, so
+            // that their finalizers never read freed memory. They are freed
+            // by the next collection.
+            to_resurrect = m_lock.do_with_lock([this, &visited, to_space]() {
+                std::vector<FatPtr> res;
+                for (const auto& [ptr, meta_data] : m_metadata) {
+                    if (meta_data.finalizer != nullptr &&
+                        get_space_num(ptr) != to_space &&
+                        !visited.contains(ptr)) {
+                        res.push_back(ptr);
+                    }
+                }
+                return res;
+            });
+            if (!to_resurrect.empty()) {
+                for (const auto& [ptr, _] : visited) {
+                    reachable.insert(ptr);
+                }
+                for (auto ptr : to_resurrect) {
+                    forward_ptr(to_space, ptr, visited);
+                }
+            }
+        } catch (...) {
+            if (remarking) {
+                for (const auto& tracker : m_dirty_trackers) {
+                    tracker->stop();
+                }
+            }
+            weak_refs.end_collection([](auto target) { return target; });
+            if (m_forwarding_hook) {
+                m_forwarding_hook([](auto target) { return target; });
+            }
+            m_interior_pins.clear();
+            throw;
+        }
+        // resurrected objects are dead to everything but the finalizers
+        const auto forward_live = [this, &visited, &to_resurrect, &reachable,
+                                   to_space](uintptr_t target) {
+            const auto ptr = FatPtr{target};
+            if (!to_resurrect.empty() && visited.contains(ptr) &&
+                !reachable.contains(ptr)) {
+                return uintptr_t{0};
+            }
+            return forwarded_address(to_space, target, visited);
+        };
+        weak_refs.end_collection(forward_live);
+        AllocProfiler::get_instance().update_live(forward_live);
+        if (m_forwarding_hook) {
+            m_forwarding_hook([this, &visited, to_space](uintptr_t target) {
+                return forwarded_address(to_space, target, visited);
+            });
+        }
+        // pinned objects which weren't moved are found from `visited`
+        m_interior_pins.clear();
+        m_lock.do_with_lock([this, &visited, &to_resurrect, from_space,
+                             to_space]() {
+            retain_pinned(from_space, visited);
+            forward_storage(to_space, visited);
             std::vector<FatPtr> to_remove = {};
             for (auto& [ptr, _] : m_metadata) {
                 if (get_space_num(ptr) != to_space && !visited.contains(ptr)) {
                     to_remove.push_back(ptr);
                 }
             }
+            // finalizers run on the copies, which are only finalized once
+            std::vector<DeadObject> to_finalize;
+            for (auto ptr : to_resurrect) {
+                const auto new_ptr = visited.at(ptr);
+                auto& meta_data = m_metadata.at(new_ptr);
+                to_finalize.push_back(
+                    {meta_data.finalizer, new_ptr.as_ptr(), meta_data.size});
+                meta_data.finalizer = nullptr;
+            }
             for (auto ptr : to_remove) {
+                set_start(ptr, false);
                 m_metadata.erase(ptr);
                 m_gen_policy.collected(ptr);
             }
+            if (!to_finalize.empty()) {
+                m_finalized = FinalizerThread::get_instance().finalize(
+                    std::move(to_finalize));
+            }
         });
         return promoted;
     });
@@ -362,20 +939,75 @@ void gcpp::CopyingCollector<Lock, G>::collect(size_t needed_space) noexcept
 }
 
 template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
-FatPtr gcpp::CopyingCollector<Lock, G>::alloc(size_t size,
-                                              std::align_val_t alignment)
+void gcpp::CopyingCollector<Lock, G>::wait_for_collection() const
+{
+    const auto result =
+        m_lock.do_with_lock([this]() { return m_collect_result; });
+    if (result.valid()) {
+        result.wait();
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+FatPtr gcpp::CopyingCollector<Lock, G>::alloc(
+    size_t size, std::align_val_t alignment, FinalizerFn finalizer,
+    const CompressedLayout* compressed)
 {
     GC_UPDATE_STACK_RANGE_NESTED_1();
     if (size == 0 || size > m_max_alloc_size) {
         throw std::bad_alloc();
     }
-    return alloc_attempt(size, alignment, 0);
+    auto ptr = alloc_attempt({size, alignment, finalizer, compressed}, 0);
+    AllocProfiler::get_instance().record_alloc(ptr.as_ptr(), size);
+    return ptr;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+std::vector<FatPtr> gcpp::CopyingCollector<Lock, G>::alloc_batch(
+    size_t count, size_t size, std::align_val_t alignment,
+    FinalizerFn finalizer, const CompressedLayout* compressed)
+{
+    GC_UPDATE_STACK_RANGE_NESTED_1();
+    if (count == 0) {
+        return {};
+    }
+    const auto align = static_cast<size_t>(alignment);
+    const auto stride = (size + align - 1) / align * align;
+    if (size == 0 || stride > m_max_alloc_size ||
+        count - 1 > (m_max_alloc_size - size) / stride) {
+        throw std::bad_alloc();
+    }
+    auto ptrs = alloc_batch_attempt({size, alignment, finalizer, compressed},
+                                    count, stride, 0);
+    if (auto& profiler = AllocProfiler::get_instance(); profiler.enabled()) {
+        for (const auto& ptr : ptrs) {
+            profiler.record_alloc(ptr.as_ptr(), size);
+        }
+    }
+    return ptrs;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+gcpp::CopyingCollector<Lock, G>::~CopyingCollector()
+{
+    if (m_collect_result.valid()) {
+        m_collect_result.wait();
+    }
+    // finalizers may still be reading the heap
+    if (m_finalized.valid()) {
+        m_finalized.wait();
+    }
+    unregister_heap(m_spaces[0].get(), m_heap_size);
+    unregister_heap(m_spaces[1].get(), m_heap_size);
 }
 
 template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
 void gcpp::CopyingCollector<Lock, G>::check_overlapping_alloc(
     const std::optional<size_t>& index, SpaceNum space, size_t size) const
 {
+    if (!index) {
+        return;
+    }
     for (auto& [f_ptr, data] : m_metadata) {
         const auto addr = &m_spaces[static_cast<size_t>(space)][index.value()];
         const auto ptr_v = f_ptr.as_ptr();
@@ -386,6 +1018,431 @@ void gcpp::CopyingCollector<Lock, G>::check_overlapping_alloc(
     }
 }
 
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::enable_remark(DirtyTracking mode)
+{
+    auto pin_lk = std::unique_lock{m_pin_mutex};
+    for (size_t i = 0; i < m_spaces.size(); ++i) {
+        m_dirty_trackers[i] = std::make_unique<DirtyPageTracker>(
+            m_spaces[i].get(), m_heap_size, mode);
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::set_copy_order(CopyOrder order) noexcept
+{
+    m_copy_order = order;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::set_prefetch_distance(size_t distance)
+{
+    if (distance > max_prefetch_distance) {
+        throw std::invalid_argument("Prefetch distance is too large");
+    }
+    m_prefetch_distance = distance;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::set_collection_hook(
+    std::function<void()> hook) noexcept
+{
+    [[maybe_unused]] auto lk = m_lock.lock();
+    m_collection_hook = std::move(hook);
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::set_forwarding_hook(
+    std::function<void(const std::function<uintptr_t(uintptr_t)>&)>
+        hook) noexcept
+{
+    [[maybe_unused]] auto lk = m_lock.lock();
+    m_forwarding_hook = std::move(hook);
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::set_collection_mutex(
+    std::mutex& mutex) noexcept
+{
+    [[maybe_unused]] auto lk = m_lock.lock();
+    m_collection_mutex = &mutex;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::get_heap_ptrs(
+    std::vector<FatPtr*>& out) const
+{
+    [[maybe_unused]] auto lk = m_lock.lock();
+    for (const auto& [ptr, meta_data] : m_metadata) {
+        scan_memory(static_cast<uintptr_t>(ptr),
+                    static_cast<uintptr_t>(ptr) + meta_data.size,
+                    [&out](auto slot) { out.push_back(slot); });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::get_pinned_ptrs(
+    std::vector<FatPtr*>& out)
+{
+    auto pin_lk = std::unique_lock{m_pin_mutex};
+    [[maybe_unused]] auto lk = m_lock.lock();
+    for (const auto& [ptr, _] : m_pins) {
+        scan_memory(static_cast<uintptr_t>(ptr),
+                    static_cast<uintptr_t>(ptr) + m_metadata.at(ptr).size,
+                    [&out](auto slot) { out.push_back(slot); });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+bool gcpp::CopyingCollector<Lock, G>::get_object_ptrs(
+    const FatPtr& ptr, std::vector<FatPtr*>& out)
+{
+    [[maybe_unused]] auto lk = m_lock.lock();
+    const auto it = m_metadata.find(ptr);
+    if (it == m_metadata.end()) {
+        return false;
+    }
+    scan_memory(static_cast<uintptr_t>(ptr),
+                static_cast<uintptr_t>(ptr) + it->second.size,
+                [&out](auto slot) { out.push_back(slot); });
+    if (const auto storage = m_storage.find(ptr); storage != m_storage.end()) {
+        for (auto& slot : storage->second) {
+            out.push_back(&slot);
+        }
+    }
+    return true;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::dump(HeapDumpWriter& out)
+{
+    auto pin_lk = std::unique_lock{m_pin_mutex};
+    [[maybe_unused]] auto lk = m_lock.lock();
+    std::vector<uintptr_t> edges;
+    for (const auto& [ptr, meta_data] : m_metadata) {
+        edges.clear();
+        scan_memory(static_cast<uintptr_t>(ptr),
+                    static_cast<uintptr_t>(ptr) + meta_data.size,
+                    [&edges](auto slot) {
+                        if (const auto target = FatPtr::test_ptr(slot)) {
+                            edges.push_back(
+                                static_cast<uintptr_t>(target.value()));
+                        }
+                    });
+        if (meta_data.compressed != nullptr) {
+            const auto addr = static_cast<uintptr_t>(ptr);
+            trace_compressed(*meta_data.compressed, meta_data.size, addr, addr,
+                             [&edges](auto target, auto, auto) {
+                                 edges.push_back(target);
+                             });
+        }
+        out.object(static_cast<uintptr_t>(ptr), meta_data, edges);
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+FatPtr gcpp::CopyingCollector<Lock, G>::transfer(
+    const FatPtr& root, const std::function<FatPtr(const MetaData&)>& alloc)
+{
+    auto pin_lk = std::unique_lock{m_pin_mutex};
+    [[maybe_unused]] auto lk = m_lock.lock();
+    std::unordered_map<FatPtr, FatPtr> copies;
+    std::stack<std::pair<FatPtr, FatPtr>> to_update;
+    // gets the copy of `ptr`, copying it if it hasn't been yet
+    const auto copy_of = [this, &alloc, &copies, &to_update](FatPtr ptr) {
+        if (const auto it = copies.find(ptr); it != copies.end()) {
+            return it->second;
+        }
+        auto& meta_data = m_metadata.at(ptr);
+        const auto copy = alloc(meta_data);
+        std::memcpy(copy.as_ptr(), ptr.as_ptr(), meta_data.size);
+        meta_data.finalizer = nullptr;
+        copies.emplace(ptr, copy);
+        to_update.emplace(ptr, copy);
+        return copy;
+    };
+    const auto root_val = FatPtr::test_ptr(&root);
+    if (!root_val || !m_metadata.contains(root_val.value())) {
+        return root;
+    }
+    const auto res = copy_of(root_val.value());
+    while (!to_update.empty()) {
+        const auto [old_ptr, new_ptr] = to_update.top();
+        to_update.pop();
+        const auto& meta_data = m_metadata.at(old_ptr);
+        const auto old_addr = static_cast<uintptr_t>(old_ptr);
+        const auto new_addr = static_cast<uintptr_t>(new_ptr);
+        scan_memory(new_addr, new_addr + meta_data.size,
+                    [this, &copy_of](auto slot) {
+                        const auto target = FatPtr::test_ptr(slot);
+                        if (target && m_metadata.contains(target.value())) {
+                            slot->compare_exchange(target.value(),
+                                                   copy_of(target.value()));
+                        }
+                    });
+        if (meta_data.compressed == nullptr) {
+            continue;
+        }
+        trace_compressed(
+            *meta_data.compressed, meta_data.size, old_addr, new_addr,
+            [this, &copy_of](auto target, auto field, auto shift) {
+                const auto ptr = FatPtr{target};
+                if (m_metadata.contains(ptr)) {
+                    target = static_cast<uintptr_t>(copy_of(ptr));
+                }
+                const auto val = encode_compressed(field, target, shift);
+                if (!val) {
+                    throw std::out_of_range("Compressed reference out of range "
+                                            "of its transferred target");
+                }
+                std::atomic_ref<int32_t>(*reinterpret_cast<int32_t*>(field))
+                    .store(val.value());
+            });
+    }
+    return res;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::forward_external(
+    const std::unordered_map<uintptr_t, FatPtr>& moved)
+{
+    auto pin_lk = std::unique_lock{m_pin_mutex};
+    [[maybe_unused]] auto lk = m_lock.lock();
+    for (const auto& [ptr, meta_data] : m_metadata) {
+        const auto addr = static_cast<uintptr_t>(ptr);
+        scan_memory(addr, addr + meta_data.size, [&moved](auto slot) {
+            const auto target = FatPtr::test_ptr(slot);
+            if (!target) {
+                return;
+            }
+            const auto it = moved.find(static_cast<uintptr_t>(target.value()));
+            if (it != moved.end()) {
+                slot->compare_exchange(target.value(), it->second);
+            }
+        });
+        if (meta_data.compressed == nullptr) {
+            continue;
+        }
+        trace_compressed(*meta_data.compressed, meta_data.size, addr, addr,
+                         [&moved](auto target, auto field, auto shift) {
+                             const auto it = moved.find(target);
+                             if (it != moved.end()) {
+                                 forward_compressed(
+                                     field, target,
+                                     static_cast<uintptr_t>(it->second), shift);
+                             }
+                         });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::retain_pinned(
+    SpaceNum from_space, const std::unordered_map<FatPtr, FatPtr>& visited)
+{
+    const auto space = static_cast<uint8_t>(from_space);
+    for (const auto& [old_ptr, new_ptr] : visited) {
+        if (old_ptr == new_ptr && get_space_num(old_ptr) == from_space) {
+            const auto index =
+                static_cast<size_t>(old_ptr.as_ptr() - m_spaces[space].get());
+            auto& meta_data = m_metadata.at(old_ptr);
+            ++meta_data.age;
+            m_retained[space].emplace(index, index + meta_data.size);
+        }
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::forward_storage(
+    SpaceNum to_space, const std::unordered_map<FatPtr, FatPtr>& visited)
+{
+    std::unordered_map<FatPtr, std::vector<FatPtr>> storage;
+    for (auto& [holder, attached] : m_storage) {
+        auto new_holder = holder;
+        if (const auto it = visited.find(holder); it != visited.end()) {
+            new_holder = it->second;
+        } else if (get_space_num(holder) != to_space) {
+            // the storage is freed with its holder
+            for (const auto& ptr : attached) {
+                m_storage_holders.erase(ptr);
+            }
+            continue;
+        }
+        for (const auto& ptr : attached) {
+            m_storage_holders[ptr] = new_holder;
+        }
+        storage.emplace(new_holder, std::move(attached));
+    }
+    m_storage = std::move(storage);
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::set_start(const FatPtr& ptr,
+                                                bool is_start)
+{
+    const auto space = static_cast<uint8_t>(get_space_num(ptr));
+    const auto index =
+        static_cast<size_t>(ptr.as_ptr() - m_spaces[space].get());
+    const auto bit = uint64_t{1} << (index % 64);
+    if (is_start) {
+        m_starts[space][index / 64] |= bit;
+    } else {
+        m_starts[space][index / 64] &= ~bit;
+    }
+    // objects don't overlap, so only this one covers the starts of these
+    // cards
+    const auto end = index + m_metadata.at(ptr).size;
+    auto& offsets = m_card_offsets[space];
+    for (auto card = index / card_size + 1; card * card_size < end; ++card) {
+        offsets[card] = is_start ? card * card_size - index : 0;
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+std::optional<FatPtr> gcpp::CopyingCollector<Lock, G>::object_start(
+    const void* addr) const
+{
+    const auto* byte = static_cast<const std::byte*>(addr);
+    for (uint8_t space = 0; space < m_spaces.size(); ++space) {
+        const auto* base = m_spaces[space].get();
+        if (byte < base || byte >= base + m_heap_size) {
+            continue;
+        }
+        const auto index = static_cast<size_t>(byte - base);
+        return m_lock.do_with_lock([this, space, base,
+                                    index]() -> std::optional<FatPtr> {
+            const auto& starts = m_starts[space];
+            const auto card = index / card_size;
+            const auto first_word = card * card_size / 64;
+            auto word = index / 64;
+            // the starts at or below `index` in its word
+            auto bits = starts[word] & (~uint64_t{0} >> (63 - index % 64));
+            while (bits == 0 && word > first_word) {
+                bits = starts[--word];
+            }
+            size_t start = 0;
+            if (bits != 0) {
+                start = word * 64 + 63 -
+                        static_cast<size_t>(std::countl_zero(bits));
+            } else if (const auto offset = m_card_offsets[space][card];
+                       offset != 0) {
+                start = card * card_size - offset;
+            } else {
+                return std::nullopt;
+            }
+            const auto ptr = FatPtr{reinterpret_cast<uintptr_t>(base + start)};
+            // `addr` may be in the padding after the object
+            if (const auto it = m_metadata.find(ptr);
+                it == m_metadata.end() || index - start >= it->second.size) {
+                return std::nullopt;
+            }
+            return ptr;
+        });
+    }
+    return std::nullopt;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::enable_interior_pointers() noexcept
+{
+    m_interior_pointers = true;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::pin_interior()
+{
+    if (!m_interior_pointers) {
+        return;
+    }
+    for (const auto word : GCRoots::get_instance().get_stack_words()) {
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        if (const auto start = object_start(reinterpret_cast<void*>(word))) {
+            m_interior_pins.insert(start.value());
+        }
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::pin(const FatPtr& ptr)
+{
+    auto pin_lk = std::unique_lock{m_pin_mutex};
+    // read `ptr` after acquiring the lock since a collection may have
+    // forwarded it
+    const auto val = FatPtr::test_ptr(&ptr);
+    if (!val || !m_lock.do_with_lock([this, &val]() {
+            return m_metadata.contains(val.value());
+        })) {
+        throw std::out_of_range("Collector does not manage given ptr");
+    }
+    ++m_pins[val.value()];
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::CopyingCollector<Lock, G>::unpin(const FatPtr& ptr)
+{
+    auto pin_lk = std::unique_lock{m_pin_mutex};
+    const auto val = FatPtr::test_ptr(&ptr);
+    if (!val || !m_pins.contains(val.value())) {
+        throw std::out_of_range("Object is not pinned");
+    }
+    if (--m_pins.at(val.value()) == 0) {
+        m_pins.erase(val.value());
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+bool gcpp::CopyingCollector<Lock, G>::attach_storage(const void* holder,
+                                                     const FatPtr& storage)
+{
+    // the pointers to the storage are handed out while the heaps are marked
+    auto collection_lk = m_collection_mutex != nullptr
+                             ? std::unique_lock{*m_collection_mutex}
+                             : std::unique_lock<std::mutex>{};
+    auto pin_lk = std::unique_lock{m_pin_mutex};
+    const auto val = FatPtr::test_ptr(&storage);
+    if (!val || !m_lock.do_with_lock([this, &val]() {
+            return m_metadata.contains(val.value());
+        })) {
+        throw std::out_of_range("Collector does not manage given ptr");
+    }
+    // found once no collection can move the holder
+    const auto owner = object_start(holder);
+    if (!owner || owner.value() == val.value()) {
+        return false;
+    }
+    m_lock.do_with_lock([this, &owner, &val]() {
+        m_storage[owner.value()].push_back(val.value());
+        m_storage_holders[val.value()] = owner.value();
+    });
+    return true;
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+bool gcpp::CopyingCollector<Lock, G>::detach_storage(const FatPtr& storage)
+{
+    // as in `attach_storage`
+    auto collection_lk = m_collection_mutex != nullptr
+                             ? std::unique_lock{*m_collection_mutex}
+                             : std::unique_lock<std::mutex>{};
+    auto pin_lk = std::unique_lock{m_pin_mutex};
+    const auto val = FatPtr::test_ptr(&storage);
+    if (!val) {
+        return false;
+    }
+    return m_lock.do_with_lock([this, &val]() {
+        const auto it = m_storage_holders.find(val.value());
+        if (it == m_storage_holders.end()) {
+            return false;
+        }
+        auto& attached = m_storage.at(it->second);
+        std::erase(attached, val.value());
+        if (attached.empty()) {
+            m_storage.erase(it->second);
+        }
+        m_storage_holders.erase(it);
+        return true;
+    });
+}
+
 template class gcpp::CopyingCollector<gcpp::SerialGCPolicy,
                                       gcpp::FinalGenerationPolicy>;
 template class gcpp::CopyingCollector<gcpp::ConcurrentGCPolicy,
@@ -0,0 +1,94 @@
+#include "coro_frame.h"
+
+#include <algorithm>
+#include <new>
+
+#include "gc_scan.h"
+
+gcpp::FrameHeap::FrameHeap()
+{
+    GCRoots::get_instance().add_root_source(
+        [this](std::vector<FatPtr*>& out) { get_roots(out); });
+}
+
+gcpp::FrameHeap& gcpp::FrameHeap::get_instance()
+{
+    if (g_instance == nullptr) {
+        std::call_once(g_instance_flag, []() {
+            g_instance = std::unique_ptr<FrameHeap>(new FrameHeap());
+        });
+    }
+    return *g_instance;
+}
+
+void* gcpp::FrameHeap::alloc(size_t size)
+{
+    constexpr auto align = alignof(FrameHeader);
+    const auto frame_size =
+        (std::max(size, size_t{1}) + align - 1) & ~(align - 1);
+    const auto needed = sizeof(FrameHeader) + frame_size;
+    auto lk = std::unique_lock{m_mutex};
+    FrameHeader* header = nullptr;
+    if (const auto it = m_free.find(frame_size);
+        it != m_free.end() && !it->second.empty()) {
+        header = it->second.back();
+        it->second.pop_back();
+    } else {
+        auto* chunk = m_chunks.empty() ? nullptr : &m_chunks.back();
+        if (chunk == nullptr || chunk->size - chunk->top < needed) {
+            const auto new_size = std::max(chunk_size, needed);
+            auto fresh = Chunk{
+                std::make_unique_for_overwrite<std::byte[]>(new_size),
+                new_size};
+            // a frame too large for a chunk gets its own, which must not
+            // replace the chunk later frames are bumped in
+            if (new_size > chunk_size && chunk != nullptr) {
+                chunk = &*m_chunks.insert(m_chunks.end() - 1, std::move(fresh));
+            } else {
+                chunk = &m_chunks.emplace_back(std::move(fresh));
+            }
+        }
+        header = new (chunk->mem.get() + chunk->top)
+            FrameHeader{frame_size, false};
+        chunk->top += needed;
+    }
+    header->live = true;
+    ++m_live_frames;
+    return header + 1;
+}
+
+void gcpp::FrameHeap::free(void* frame, [[maybe_unused]] size_t size) noexcept
+{
+    auto* header = static_cast<FrameHeader*>(frame) - 1;
+    auto lk = std::unique_lock{m_mutex};
+    header->live = false;
+    --m_live_frames;
+    try {
+        m_free[header->size].push_back(header);
+    } catch (...) {
+        // the frame is leaked if it can't be recorded for reuse
+    }
+}
+
+size_t gcpp::FrameHeap::live_frames() const
+{
+    auto lk = std::unique_lock{m_mutex};
+    return m_live_frames;
+}
+
+void gcpp::FrameHeap::get_roots(std::vector<FatPtr*>& out) const
+{
+    auto lk = std::unique_lock{m_mutex};
+    for (const auto& chunk : m_chunks) {
+        for (size_t offset = 0; offset < chunk.top;) {
+            const auto* header =
+                reinterpret_cast<const FrameHeader*>(chunk.mem.get() + offset);
+            if (header->live) {
+                const auto frame = reinterpret_cast<uintptr_t>(header + 1);
+                scan_memory(frame, frame + header->size,
+                            [&out](auto slot) { out.push_back(slot); });
+            }
+            offset += sizeof(FrameHeader) + header->size;
+        }
+    }
+}
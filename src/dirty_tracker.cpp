@@ -0,0 +1,177 @@
+#include "dirty_tracker.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include "mem_prot.h"
+
+namespace
+{
+/** Bit of a pagemap entry which is set if the page is soft-dirty */
+constexpr uint64_t soft_dirty_bit = 1ULL << 55U;
+constexpr size_t bits_per_word = 64;
+
+[[noreturn]] void throw_proc_error(const char* what)
+{
+    std::stringstream ss;
+    ss << "Could not " << what << ". Error code: " << errno;
+    throw std::runtime_error(ss.str());
+}
+
+/** Clears the soft-dirty bits of every page of the process */
+void clear_soft_dirty()
+{
+    const auto fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw_proc_error("open clear_refs");
+    }
+    const auto written = write(fd, "4", 1);
+    close(fd);
+    if (written != 1) {
+        throw_proc_error("clear soft-dirty bits");
+    }
+}
+
+/** Reads the pagemap entries of `pages` pages starting at `start` */
+std::vector<uint64_t> read_pagemap(const std::byte* start, size_t pages)
+{
+    std::vector<uint64_t> entries(pages);
+    const auto fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw_proc_error("open pagemap");
+    }
+    const auto offset = static_cast<off_t>(
+        reinterpret_cast<uintptr_t>(start) /
+        static_cast<uintptr_t>(gcpp::page_size()) * sizeof(uint64_t));
+    const auto bytes = pages * sizeof(uint64_t);
+    const auto read = pread(fd, entries.data(), bytes, offset);
+    close(fd);
+    if (read != static_cast<ssize_t>(bytes)) {
+        throw_proc_error("read pagemap");
+    }
+    return entries;
+}
+}  // namespace
+
+bool gcpp::DirtyPageTracker::soft_dirty_available()
+{
+    static bool available = false;
+    static std::once_flag available_flag;
+    std::call_once(available_flag, []() {
+        const auto page = static_cast<size_t>(page_size());
+        auto* const probe = static_cast<std::byte*>(
+            mmap(nullptr, page, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (probe == MAP_FAILED) {
+            return;
+        }
+        try {
+            *static_cast<volatile std::byte*>(probe) = std::byte{1};
+            clear_soft_dirty();
+            *static_cast<volatile std::byte*>(probe) = std::byte{2};
+            // kernels without soft-dirty support never set the bit
+            available = (read_pagemap(probe, 1)[0] & soft_dirty_bit) != 0;
+        } catch (const std::runtime_error&) {
+            available = false;
+        }
+        munmap(probe, page);
+    });
+    return available;
+}
+
+gcpp::DirtyPageTracker::DirtyPageTracker(void* start, size_t len,
+                                         DirtyTracking mode)
+    : m_start(static_cast<std::byte*>(start)),
+      m_pages(page_size_ceil(len) / static_cast<size_t>(page_size())),
+      m_mode(mode)
+{
+    if (m_mode == DirtyTracking::Auto) {
+        m_mode = soft_dirty_available() ? DirtyTracking::SoftDirty
+                                        : DirtyTracking::WriteProtect;
+    } else if (m_mode == DirtyTracking::SoftDirty && !soft_dirty_available()) {
+        throw std::runtime_error("Soft-dirty bits are unavailable");
+    }
+    if (m_mode == DirtyTracking::WriteProtect) {
+        const auto words = (m_pages + bits_per_word - 1) / bits_per_word;
+        m_dirty = std::make_unique<std::atomic<uint64_t>[]>(words);
+        m_protection = std::make_unique<PageProtection>(start, len);
+        m_fault_handler = register_fault_handler(
+            start, m_pages * static_cast<size_t>(page_size()), &handle_fault,
+            this);
+    }
+}
+
+gcpp::DirtyPageTracker::~DirtyPageTracker()
+{
+    if (m_mode == DirtyTracking::WriteProtect) {
+        if (m_tracking) {
+            m_protection->protect_now(
+                m_start, m_pages * static_cast<size_t>(page_size()),
+                ProtectionMode::ReadWrite);
+        }
+        unregister_fault_handler(m_fault_handler);
+    }
+}
+
+bool gcpp::DirtyPageTracker::handle_fault(void* tracker, void* addr)
+{
+    auto& self = *static_cast<DirtyPageTracker*>(tracker);
+    if (!self.m_tracking) {
+        return false;
+    }
+    const auto page = static_cast<size_t>(static_cast<std::byte*>(addr) -
+                                          self.m_start) /
+                      static_cast<size_t>(page_size());
+    self.m_dirty[page / bits_per_word].fetch_or(1ULL << (page % bits_per_word));
+    return self.m_protection->protect_now(addr, 1, ProtectionMode::ReadWrite);
+}
+
+void gcpp::DirtyPageTracker::start()
+{
+    const auto len = m_pages * static_cast<size_t>(page_size());
+    if (m_mode == DirtyTracking::SoftDirty) {
+        clear_soft_dirty();
+        m_tracking = true;
+        return;
+    }
+    for (size_t i = 0; i < (m_pages + bits_per_word - 1) / bits_per_word;
+         ++i) {
+        m_dirty[i] = 0;
+    }
+    m_tracking = true;
+    if (!m_protection->protect_now(m_start, len, ProtectionMode::ReadOnly)) {
+        m_tracking = false;
+        throw_proc_error("write protect the region");
+    }
+}
+
+std::vector<bool> gcpp::DirtyPageTracker::stop()
+{
+    std::vector<bool> dirty(m_pages);
+    if (m_mode == DirtyTracking::SoftDirty) {
+        m_tracking = false;
+        const auto entries = read_pagemap(m_start, m_pages);
+        for (size_t i = 0; i < m_pages; ++i) {
+            dirty[i] = (entries[i] & soft_dirty_bit) != 0;
+        }
+        return dirty;
+    }
+    // keep resolving faults until the whole region is writable
+    if (!m_protection->protect_now(m_start,
+                                   m_pages * static_cast<size_t>(page_size()),
+                                   ProtectionMode::ReadWrite)) {
+        throw_proc_error("unprotect the region");
+    }
+    m_tracking = false;
+    for (size_t i = 0; i < m_pages; ++i) {
+        dirty[i] = (m_dirty[i / bits_per_word] & (1ULL << (i % bits_per_word))) !=
+                   0;
+    }
+    return dirty;
+}
@@ -0,0 +1,22 @@
+#include "finalizer.h"
+
+gcpp::FinalizerThread& gcpp::FinalizerThread::get_instance()
+{
+    if (g_instance == nullptr) {
+        std::call_once(g_instance_flag, []() {
+            g_instance =
+                std::unique_ptr<FinalizerThread>(new FinalizerThread());
+        });
+    }
+    return *g_instance;
+}
+
+std::future<void> gcpp::FinalizerThread::finalize(
+    std::vector<DeadObject> batch)
+{
+    return m_task.push_work([batch = std::move(batch)]() {
+        for (const auto& dead : batch) {
+            dead.finalizer(dead.obj, dead.size);
+        }
+    });
+}
@@ -1,13 +1,18 @@
 #include "gc_scan.h"
 
+#include <link.h>
+#include <pthread.h>
+
 #include <algorithm>
 #include <concepts>
 #include <cstdint>
 #include <fstream>
+#include <limits>
 #include <mutex>
 #include <thread>
 #include <type_traits>
 #include <unordered_set>
+#include <utility>
 
 #include "gc_base.h"
 
@@ -35,6 +40,28 @@ inline auto get_sp()
     return stack_ptr;
 }
 
+/** Gets the memory ranges of the loaded segments of every module */
+std::vector<std::pair<uintptr_t, uintptr_t>> loaded_segments() noexcept
+{
+    std::vector<std::pair<uintptr_t, uintptr_t>> segments;
+    dl_iterate_phdr(
+        [](dl_phdr_info* info, size_t, void* data) {
+            auto& out =
+                *static_cast<std::vector<std::pair<uintptr_t, uintptr_t>>*>(
+                    data);
+            for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+                const auto& header = info->dlpi_phdr[i];
+                if (header.p_type == PT_LOAD) {
+                    const auto start = info->dlpi_addr + header.p_vaddr;
+                    out.emplace_back(start, start + header.p_memsz);
+                }
+            }
+            return 0;
+        },
+        &segments);
+    return segments;
+}
+
 auto scan_globals() noexcept
 {
     // scans the "data segment" for all possible global GC ptrs
@@ -44,10 +71,21 @@ auto scan_globals() noexcept
     std::ifstream proc("/proc/self/maps");
     std::string line;
     std::vector<uintptr_t> vals;
+    // a mapping rounds a segment out to whole pages, which hold whatever
+    // follows or precedes it in the file, so only the segment is scanned
+    const auto segments = loaded_segments();
     while (std::getline(proc, line)) {
         if (line.find("/") != std::string::npos) {
             // section is not a non-data segment
             const auto access = line.substr(line.find(' ') + 1, 4);
+#ifdef GCPP_COMPACT_PTR
+            // without a header, constant tables are likely to contain values
+            // which look like pointers. GC pointers are never read-only since
+            // they can't be constant initialized
+            if (access.find('w') == std::string::npos) {
+                continue;
+            }
+#endif
             if (access.find('r') != std::string::npos &&
                 access.find('x') == std::string::npos) {
                 // section is readable and not executable
@@ -56,19 +94,75 @@ auto scan_globals() noexcept
 
                 const auto addr_end = line.substr(
                     addr_midpt + 1, line.find(' ') - addr_midpt - 1);
-                const auto data_start = std::stoull(addr_start, nullptr, 16);
-                const auto data_end = std::stoull(addr_end, nullptr, 16);
-                gcpp::scan_memory(
-                    data_start, data_end,
-                    [&vals](auto val) {
-                        vals.push_back(reinterpret_cast<uintptr_t>(val));
-                    },
-                    access.find('w') == std::string::npos);
+                const uintptr_t data_start =
+                    std::stoull(addr_start, nullptr, 16);
+                const uintptr_t data_end = std::stoull(addr_end, nullptr, 16);
+                const auto scan = [&vals, &access](auto start, auto end) {
+                    gcpp::scan_memory(
+                        start, end,
+                        [&vals](auto val) {
+                            vals.push_back(reinterpret_cast<uintptr_t>(val));
+                        },
+                        access.find('w') == std::string::npos);
+                };
+                const auto in_segment = std::ranges::any_of(
+                    segments, [data_start, data_end](const auto& seg) {
+                        return seg.first < data_end && data_start < seg.second;
+                    });
+                if (!in_segment) {
+                    scan(data_start, data_end);
+                }
+                for (const auto& [seg_start, seg_end] : segments) {
+                    if (seg_start < data_end && data_start < seg_end) {
+                        scan(std::max(data_start, seg_start),
+                             std::min(data_end, seg_end));
+                    }
+                }
             }
         }
     }
     return vals;
 }
+
+/**
+ * @brief Owns the stack descriptor of a thread, which is claimed on first use
+ * and released when the thread exits
+ */
+class ThreadStack
+{
+  private:
+    gcpp::GCRoots::StackDescriptor& m_stack;
+
+  public:
+    explicit ThreadStack(gcpp::GCRoots& roots) : m_stack(roots.acquire_stack())
+    {
+    }
+    ~ThreadStack() { gcpp::GCRoots::release_stack(m_stack); }
+    ThreadStack(const ThreadStack&) = delete;
+    ThreadStack& operator=(const ThreadStack&) = delete;
+    ThreadStack(ThreadStack&&) = delete;
+    ThreadStack& operator=(ThreadStack&&) = delete;
+
+    gcpp::GCRoots::StackDescriptor& get() { return m_stack; }
+};
+
+/** Gets the bounds of the stack of the calling thread as (low, high) */
+std::pair<uintptr_t, uintptr_t> thread_stack_bounds()
+{
+    pthread_attr_t attr;
+    void* addr = nullptr;
+    size_t size = 0;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+        return {0, std::numeric_limits<uintptr_t>::max()};
+    }
+    const auto res = pthread_attr_getstack(&attr, &addr, &size);
+    pthread_attr_destroy(&attr);
+    if (res != 0) {
+        return {0, std::numeric_limits<uintptr_t>::max()};
+    }
+    const auto low = reinterpret_cast<uintptr_t>(addr);
+    return {low, low + size};
+}
 }  // namespace
 
 gcpp::GCRoots::GCRoots() noexcept : m_global_roots(scan_globals()) {}
@@ -83,75 +177,249 @@ gcpp::GCRoots& gcpp::GCRoots::get_instance()
     return *g_instance;
 }
 
-std::vector<uintptr_t> gcpp::GCRoots::scan_locals(std::thread::id id)
+gcpp::GCRoots::~GCRoots()
+{
+    auto* stack = m_stacks.load();
+    while (stack != nullptr) {
+        // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+        delete std::exchange(stack, stack->next);
+    }
+}
+
+void gcpp::GCRoots::scan_locals(const StackDescriptor& stack,
+                                std::vector<uintptr_t>& out)
 {
     // (I belive) we can't really cache scanned locals due to the ABA problem
     // we can scan 0xff - 0xaa, save the results and by the next time we scan
     // the stack range is once again 0xff - 0xaa but with completely different
     // stack variables
-    std::vector<uintptr_t> local_roots;
-    const auto [stack_start, stack_end] = m_stack_ranges.at(id);
-    const auto scan_callback = [&local_roots](auto ptr) {
-        local_roots.push_back(reinterpret_cast<uintptr_t>(ptr));
-    };
-    gcpp::scan_memory(stack_end - red_zone_size, stack_start + 1, scan_callback);
-    return local_roots;
+    if (stack.precise_scopes.load(std::memory_order_acquire) > 0) {
+        auto lk = std::unique_lock{stack.roots_mutex};
+        for (const auto* link = stack.roots; link != nullptr;
+             link = link->next) {
+            out.push_back(reinterpret_cast<uintptr_t>(link->slot));
+        }
+        return;
+    }
+    const auto stack_start = stack.start.load(std::memory_order_acquire);
+    const auto stack_end = stack.end.load(std::memory_order_relaxed);
+    if (stack_start == 0 || stack_end == 0) {
+        return;
+    }
+    // the red zone may not extend past the bottom of the stack
+    const auto scan_start =
+        std::max(stack_end - red_zone_size, stack.low.load());
+    const auto scan_end = std::min(stack_start + 1, stack.high.load());
+    gcpp::scan_memory(scan_start, scan_end, [&out](auto ptr) {
+        out.push_back(reinterpret_cast<uintptr_t>(ptr));
+    });
+}
+
+void gcpp::GCRoots::scan_words(const StackDescriptor& stack,
+                               std::vector<uintptr_t>& out)
+{
+    if (stack.precise_scopes.load(std::memory_order_acquire) > 0) {
+        return;
+    }
+    const auto stack_start = stack.start.load(std::memory_order_acquire);
+    const auto stack_end = stack.end.load(std::memory_order_relaxed);
+    if (stack_start == 0 || stack_end == 0) {
+        return;
+    }
+    const auto scan_start =
+        std::max(stack_end - red_zone_size, stack.low.load()) &
+        ~static_cast<uintptr_t>(sizeof(uintptr_t) - 1);
+    const auto scan_end = std::min(stack_start + 1, stack.high.load());
+    for (auto addr = scan_start; addr + sizeof(uintptr_t) <= scan_end;) {
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        auto* word = reinterpret_cast<uintptr_t*>(addr);
+        if (addr + gc_ptr_size <= scan_end &&
+            FatPtr::maybe_ptr(word, true)) {
+            addr += gc_ptr_size;
+            continue;
+        }
+        out.push_back(*word);
+        addr += sizeof(uintptr_t);
+    }
+}
+
+std::vector<uintptr_t> gcpp::GCRoots::get_stack_words() const
+{
+    std::vector<uintptr_t> words;
+    for (const auto* stack = m_stacks.load(); stack != nullptr;
+         stack = stack->next) {
+        if (stack->in_use) {
+            scan_words(*stack, words);
+        }
+    }
+    return words;
 }
 
 std::vector<FatPtr*> gcpp::GCRoots::get_roots(uintptr_t base_ptr)
 {
+    // covers the scan for callers which don't hold one
+    const auto in_use = RootsInUse{};
     update_stack_range(base_ptr);
-    auto lk = std::unique_lock{m_mutex};
-
     std::vector<uintptr_t> total_local_roots;
-    for (auto& roots : m_stack_ranges) {
-        auto vec = scan_locals(roots.first);
-        total_local_roots.insert(total_local_roots.end(), vec.begin(),
-                                 vec.end());
+    for (const auto* stack = m_stacks.load(); stack != nullptr;
+         stack = stack->next) {
+        if (stack->in_use) {
+            scan_locals(*stack, total_local_roots);
+        }
     }
-    lk.unlock();
     auto res = std::vector<FatPtr*>();
     res.reserve(m_global_roots.size() + total_local_roots.size());
     for (auto val : m_global_roots) {
         res.push_back(reinterpret_cast<FatPtr*>(val));
     }
-    auto reader_lk = std::shared_lock{m_mutex};
     for (const auto ptr : total_local_roots) {
         res.push_back(reinterpret_cast<FatPtr*>(ptr));
     }
+    // copy the sources so callbacks can take their own locks without
+    // holding ours
+    const auto sources = [this]() {
+        auto sources_lk = std::unique_lock{m_sources_mutex};
+        std::vector<RootSource> copies;
+        copies.reserve(m_root_sources.size());
+        for (const auto& [_, source] : m_root_sources) {
+            copies.push_back(source);
+        }
+        return copies;
+    }();
+    for (const auto& source : sources) {
+        source(res);
+    }
     return res;
 }
 
+size_t gcpp::GCRoots::add_root_source(RootSource source)
+{
+    auto lk = std::unique_lock{m_sources_mutex};
+    const auto id = m_next_source_id++;
+    m_root_sources.emplace(id, std::move(source));
+    return id;
+}
+
+void gcpp::GCRoots::remove_root_source(size_t id)
+{
+    auto lk = std::unique_lock{m_sources_mutex};
+    m_root_sources.erase(id);
+}
+
 void gcpp::GCRoots::update_stack_range(uintptr_t base_ptr)
 {
-    auto sp = get_sp();
-    auto lk = std::shared_lock{m_mutex};
-    bool existing_record = false;
-    if (m_stack_ranges.contains(std::this_thread::get_id())) {
-        const auto [stack_start, stack_end] =
-            m_stack_ranges.at(std::this_thread::get_id());
-        if (base_ptr <= stack_start && sp == stack_end) {
-            // stack_start -- biggest
-            // ...
-            // base_ptr
-            // ...
-            // sp
-            // ...
-            // stack_end  -- smallest
-            return;
+    auto& stack = thread_stack();
+    const auto sp = get_sp();
+    // stack_start -- biggest
+    // ...
+    // base_ptr
+    // ...
+    // sp
+    // ...
+    // stack_end  -- smallest
+    stack.end.store(sp, std::memory_order_relaxed);
+    if (base_ptr > stack.start.load(std::memory_order_relaxed)) {
+        stack.start.store(std::min(base_ptr, stack.high.load()),
+                          std::memory_order_release);
+    }
+}
+
+gcpp::GCRoots::StackDescriptor& gcpp::GCRoots::acquire_stack()
+{
+    const auto [low, high] = thread_stack_bounds();
+    const auto claim = [low, high](StackDescriptor& stack) -> auto& {
+        stack.low = low;
+        stack.high = high;
+        return stack;
+    };
+    // reuse the descriptor of a thread which has exited
+    for (auto* stack = m_stacks.load(); stack != nullptr;
+         stack = stack->next) {
+        auto expected = false;
+        if (stack->in_use.compare_exchange_strong(expected, true)) {
+            return claim(*stack);
         }
-        existing_record = true;
-    }
-    if (existing_record) {
-        auto& [stack_start, stack_end] =
-            m_stack_ranges.at(std::this_thread::get_id());
-        stack_start = std::max(stack_start, base_ptr);
-        stack_end = sp;
-    } else {
-        lk.unlock();
-        // gap in locks is safe because each thread has its own entry
-        auto writer_lk = std::unique_lock{m_mutex};
-        m_stack_ranges.insert(
-            {std::this_thread::get_id(), std::make_pair(base_ptr, sp)});
-    }
-}
\ No newline at end of file
+    }
+    auto* stack = new StackDescriptor();
+    stack->in_use = true;
+    claim(*stack);
+    stack->next = m_stacks.load();
+    while (!m_stacks.compare_exchange_weak(stack->next, stack)) {
+    }
+    return *stack;
+}
+
+void gcpp::GCRoots::wait_for_roots_unused() noexcept
+{
+    while (g_roots_in_use > 0) {
+        std::this_thread::yield();
+    }
+}
+
+void gcpp::GCRoots::release_stack(StackDescriptor& stack) noexcept
+{
+    stack.start = 0;
+    stack.end = 0;
+    // scans which read the range before it was cleared may still be reading
+    // the stack or using slots in it, and must not see the next owner's range
+    wait_for_roots_unused();
+    stack.precise_scopes = 0;
+    {
+        auto lk = std::unique_lock{stack.roots_mutex};
+        stack.roots = nullptr;
+    }
+    stack.in_use = false;
+}
+
+gcpp::GCRoots::StackDescriptor& gcpp::GCRoots::thread_stack()
+{
+    thread_local ThreadStack g_thread_stack{*this};
+    return g_thread_stack.get();
+}
+
+bool gcpp::GCRoots::precise_roots()
+{
+    return thread_stack().precise_scopes.load(std::memory_order_relaxed) > 0;
+}
+
+void gcpp::GCRoots::add_root(RootLink& link, FatPtr* slot)
+{
+    auto& stack = thread_stack();
+    auto lk = std::unique_lock{stack.roots_mutex};
+    link.slot = slot;
+    link.stack = &stack;
+    link.prev = nullptr;
+    link.next = stack.roots;
+    if (link.next != nullptr) {
+        link.next->prev = &link;
+    }
+    stack.roots = &link;
+}
+
+void gcpp::GCRoots::remove_root(RootLink& link) noexcept
+{
+    if (link.stack == nullptr) {
+        return;
+    }
+    auto lk = std::unique_lock{link.stack->roots_mutex};
+    if (link.prev != nullptr) {
+        link.prev->next = link.next;
+    } else if (link.stack->roots == &link) {
+        link.stack->roots = link.next;
+    }
+    if (link.next != nullptr) {
+        link.next->prev = link.prev;
+    }
+    link.stack = nullptr;
+}
+
+gcpp::RootScope::RootScope()
+    : m_stack(GCRoots::get_instance().thread_stack())
+{
+    m_stack.precise_scopes.fetch_add(1, std::memory_order_release);
+}
+
+gcpp::RootScope::~RootScope()
+{
+    m_stack.precise_scopes.fetch_sub(1, std::memory_order_release);
+}
@@ -0,0 +1,115 @@
+#include "heap_dump.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+constexpr char root_tag = 'R';
+constexpr char object_tag = 'O';
+constexpr char end_tag = 'E';
+
+template <typename T>
+void write_value(std::ostream& out, T val)
+{
+    out.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template <typename T>
+T read_value(std::istream& in)
+{
+    T val{};
+    if (!in.read(reinterpret_cast<char*>(&val), sizeof(T))) {
+        throw std::runtime_error("Truncated heap dump");
+    }
+    return val;
+}
+}  // namespace
+
+gcpp::HeapDumpWriter::HeapDumpWriter(std::ostream& out) : m_out(out)
+{
+    m_out.write(heap_dump_magic, sizeof(heap_dump_magic));
+    write_value(m_out, heap_dump_version);
+}
+
+gcpp::HeapDumpWriter::~HeapDumpWriter()
+{
+    if (!m_finished) {
+        try {
+            finish();
+        } catch (const std::runtime_error&) {
+            // the stream is left in its failed state for the caller
+        }
+    }
+}
+
+void gcpp::HeapDumpWriter::root(uintptr_t target)
+{
+    m_out.put(root_tag);
+    write_value<uint64_t>(m_out, target);
+}
+
+void gcpp::HeapDumpWriter::object(uintptr_t addr, const MetaData& meta_data,
+                                  const std::vector<uintptr_t>& edges)
+{
+    m_out.put(object_tag);
+    write_value<uint64_t>(m_out, addr);
+    write_value<uint64_t>(m_out, meta_data.size);
+    write_value<uint64_t>(m_out,
+                          static_cast<uint64_t>(meta_data.alignment));
+    write_value<uint32_t>(m_out, meta_data.age);
+    write_value<uint32_t>(m_out, static_cast<uint32_t>(edges.size()));
+    for (const auto edge : edges) {
+        write_value<uint64_t>(m_out, edge);
+    }
+}
+
+void gcpp::HeapDumpWriter::finish()
+{
+    m_finished = true;
+    m_out.put(end_tag);
+    m_out.flush();
+    if (!m_out) {
+        throw std::runtime_error("Failed to write heap dump");
+    }
+}
+
+gcpp::HeapDumpReader::HeapDumpReader(std::istream& in) : m_in(in)
+{
+    char magic[sizeof(heap_dump_magic)] = {};
+    if (!m_in.read(magic, sizeof(magic)) ||
+        !std::equal(magic, magic + sizeof(magic), heap_dump_magic)) {
+        throw std::runtime_error("Not a heap dump");
+    }
+    if (read_value<uint32_t>(m_in) != heap_dump_version) {
+        throw std::runtime_error("Unsupported heap dump version");
+    }
+}
+
+std::optional<gcpp::HeapDumpReader::Record> gcpp::HeapDumpReader::next()
+{
+    if (m_done) {
+        return std::nullopt;
+    }
+    switch (read_value<char>(m_in)) {
+        case root_tag:
+            return HeapDumpRoot{read_value<uint64_t>(m_in)};
+        case object_tag: {
+            HeapDumpObject obj{};
+            obj.address = read_value<uint64_t>(m_in);
+            obj.size = read_value<uint64_t>(m_in);
+            obj.alignment = read_value<uint64_t>(m_in);
+            obj.age = read_value<uint32_t>(m_in);
+            obj.edges.resize(read_value<uint32_t>(m_in));
+            for (auto& edge : obj.edges) {
+                edge = read_value<uint64_t>(m_in);
+            }
+            return obj;
+        }
+        case end_tag:
+            m_done = true;
+            return std::nullopt;
+        default:
+            throw std::runtime_error("Corrupt heap dump record");
+    }
+}
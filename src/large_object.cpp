@@ -0,0 +1,400 @@
+#include "large_object.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_set>
+
+#include "alloc_profiler.h"
+#include "gc_scan.h"
+#include "mem_prot.h"
+
+namespace
+{
+[[noreturn]] void fail(const char* what, size_t size)
+{
+    std::stringstream ss;
+    ss << "Could not " << what << " large object with size " << size
+       << ". Error code: " << errno;
+    throw std::runtime_error(ss.str());
+}
+
+/**
+ * @brief Determines which of the `pages` pages starting at `addr`, in a
+ * private file mapping, have been written and so are no longer backed by the
+ * file. Every page counts as written if the page map can't be read.
+ */
+std::vector<bool> written_pages(uintptr_t addr, size_t pages)
+{
+    constexpr auto present = uint64_t{1} << 63U;
+    constexpr auto swapped = uint64_t{1} << 62U;
+    constexpr auto file_page = uint64_t{1} << 61U;
+    std::vector<bool> written(pages, true);
+    const auto fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return written;
+    }
+    std::vector<uint64_t> entries(pages);
+    const auto len = static_cast<ssize_t>(pages * sizeof(uint64_t));
+    const auto offset = static_cast<off_t>(
+        addr / static_cast<uintptr_t>(gcpp::page_size()) * sizeof(uint64_t));
+    if (pread(fd, entries.data(), static_cast<size_t>(len), offset) == len) {
+        for (size_t i = 0; i < pages; ++i) {
+            written[i] = (entries[i] & swapped) != 0 ||
+                         ((entries[i] & present) != 0 &&
+                          (entries[i] & file_page) == 0);
+        }
+    }
+    close(fd);
+    return written;
+}
+
+/** Writes the `len` bytes at `src` to `fd` at `offset` */
+void write_all(int fd, const std::byte* src, size_t len, size_t offset)
+{
+    while (len > 0) {
+        const auto res = pwrite(fd, src, len, static_cast<off_t>(offset));
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            fail("write back", len);
+        }
+        const auto written = static_cast<size_t>(res);
+        src += written;
+        offset += written;
+        len -= written;
+    }
+}
+
+/**
+ * @brief Maps `size` bytes of the file `fd` privately at `addr`, or anywhere
+ * if `addr` is 0
+ * @return the address of the mapping
+ */
+uintptr_t map_object(int fd, size_t size, uintptr_t addr = 0)
+{
+    const auto flags = MAP_PRIVATE | (addr != 0 ? MAP_FIXED : 0);
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    auto* res = mmap(reinterpret_cast<void*>(addr), size,
+                     PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (res == MAP_FAILED) {
+        fail("map", size);
+    }
+    return reinterpret_cast<uintptr_t>(res);
+}
+
+/** Maps `size` zeroed bytes anywhere */
+uintptr_t map_anonymous(size_t size)
+{
+    auto* res = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED) {
+        fail("map", size);
+    }
+    return reinterpret_cast<uintptr_t>(res);
+}
+}  // namespace
+
+gcpp::LargeObjectSpace::Backing::Backing(size_t file_size)
+    : fd(memfd_create("gcpp-large-object", MFD_CLOEXEC)), size(file_size)
+{
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Could not create large object file");
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        fail("create", size);
+    }
+    ++g_open;
+}
+
+gcpp::LargeObjectSpace::Backing::~Backing()
+{
+    close(fd);
+    --g_open;
+}
+
+gcpp::LargeObjectSpace::LargeObjectSpace()
+{
+    GCRoots::get_instance().add_root_source(
+        [this](std::vector<FatPtr*>& out) { get_roots(out); });
+}
+
+gcpp::LargeObjectSpace& gcpp::LargeObjectSpace::get_instance()
+{
+    if (g_instance == nullptr) {
+        std::call_once(g_instance_flag, []() {
+            g_instance =
+                std::unique_ptr<LargeObjectSpace>(new LargeObjectSpace());
+        });
+    }
+    return *g_instance;
+}
+
+FatPtr gcpp::LargeObjectSpace::alloc(size_t size, FinalizerFn finalizer)
+{
+    const auto addr = map_anonymous(page_size_ceil(size));
+    auto lk = std::unique_lock{m_mutex};
+    m_mapped += page_size_ceil(size);
+    m_objects.emplace(addr, Object{size, finalizer, nullptr, 0, ++m_epoch});
+    lk.unlock();
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    AllocProfiler::get_instance().record_alloc(reinterpret_cast<void*>(addr),
+                                               size);
+    return FatPtr{addr};
+}
+
+void gcpp::LargeObjectSpace::freeze(uintptr_t addr, Object& obj)
+{
+    if (obj.backing != nullptr && obj.backing.use_count() == 1) {
+        // only the written pages differ from the file
+        auto& backing = *obj.backing;
+        const auto page = static_cast<size_t>(page_size());
+        const auto written = written_pages(addr, backing.size / page);
+        for (size_t i = 0; i < written.size(); ++i) {
+            if (written[i]) {
+                // NOLINTNEXTLINE(performance-no-int-to-ptr)
+                write_all(backing.fd,
+                          reinterpret_cast<const std::byte*>(addr + i * page),
+                          page, i * page);
+            }
+        }
+    } else {
+        // an anonymous object has no file yet, and the clones sharing a file
+        // still read their unwritten pages from it, so it can't change
+        auto fresh = std::make_shared<Backing>(page_size_ceil(obj.size));
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        write_all(fresh->fd, reinterpret_cast<const std::byte*>(addr),
+                  fresh->size, 0);
+        obj.backing = std::move(fresh);
+    }
+    // replaces the written pages of the mapping by the file's copy of them
+    map_object(obj.backing->fd, obj.backing->size, addr);
+}
+
+std::optional<FatPtr> gcpp::LargeObjectSpace::clone(const FatPtr& ptr)
+{
+    const auto addr = static_cast<uintptr_t>(ptr);
+    auto lk = std::unique_lock{m_mutex};
+    const auto it = m_objects.find(addr);
+    if (it == m_objects.end()) {
+        return std::nullopt;
+    }
+    auto& obj = it->second;
+    freeze(addr, obj);
+    const auto copy = map_object(obj.backing->fd, obj.backing->size);
+    m_mapped += obj.backing->size;
+    const auto size = obj.size;
+    m_objects.emplace(copy,
+                      Object{size, obj.finalizer, obj.backing, 0, ++m_epoch});
+    lk.unlock();
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    AllocProfiler::get_instance().record_alloc(reinterpret_cast<void*>(copy),
+                                               size);
+    return FatPtr{copy};
+}
+
+bool gcpp::LargeObjectSpace::contains(const void* ptr) const
+{
+    auto lk = std::unique_lock{m_mutex};
+    return find_containing(reinterpret_cast<uintptr_t>(ptr)) != m_objects.end();
+}
+
+std::map<uintptr_t, gcpp::LargeObjectSpace::Object>::const_iterator
+gcpp::LargeObjectSpace::find_containing(uintptr_t addr) const
+{
+    auto it = m_objects.upper_bound(addr);
+    if (it == m_objects.begin()) {
+        return m_objects.end();
+    }
+    --it;
+    return addr < it->first + it->second.size ? it : m_objects.end();
+}
+
+size_t gcpp::LargeObjectSpace::object_count() const
+{
+    auto lk = std::unique_lock{m_mutex};
+    return m_objects.size();
+}
+
+void gcpp::LargeObjectSpace::pin(const FatPtr& ptr)
+{
+    auto lk = std::unique_lock{m_mutex};
+    ++m_objects.at(static_cast<uintptr_t>(ptr)).pins;
+}
+
+void gcpp::LargeObjectSpace::unpin(const FatPtr& ptr)
+{
+    auto lk = std::unique_lock{m_mutex};
+    auto& obj = m_objects.at(static_cast<uintptr_t>(ptr));
+    if (obj.pins == 0) {
+        throw std::out_of_range("Large object is not pinned");
+    }
+    --obj.pins;
+}
+
+bool gcpp::LargeObjectSpace::sweep_due() const
+{
+    auto lk = std::unique_lock{m_mutex};
+    return m_mapped >= m_next_sweep || Backing::g_open >= m_next_sweep_files;
+}
+
+void gcpp::LargeObjectSpace::sweep(
+    const std::function<void(std::vector<FatPtr*>&)>& get_roots,
+    const std::function<bool(const FatPtr&, std::vector<FatPtr*>&)>&
+        get_object_ptrs,
+    const std::function<std::optional<FatPtr>(uintptr_t)>& find_object)
+{
+    // objects made after the roots are found may only be referenced by
+    // locals which have already been scanned
+    const auto epoch = m_epoch.load();
+    std::vector<FatPtr*> roots;
+    g_sweeping = true;
+    try {
+        get_roots(roots);
+    } catch (...) {
+        g_sweeping = false;
+        throw;
+    }
+    g_sweeping = false;
+    // raw pointers may point anywhere inside objects
+    const auto words = m_interior_pointers
+                           ? GCRoots::get_instance().get_stack_words()
+                           : std::vector<uintptr_t>{};
+    std::vector<std::pair<uintptr_t, Object>> dead;
+    {
+        auto lk = std::unique_lock{m_mutex};
+        std::unordered_set<uintptr_t> marked;
+        std::vector<uintptr_t> to_scan;
+        // objects on the heaps are traced through rather than being roots,
+        // so garbage on them doesn't keep large objects alive
+        std::unordered_set<uintptr_t> heap_marked;
+        std::vector<FatPtr*> slots = std::move(roots);
+        const auto mark = [this, &marked, &to_scan](uintptr_t addr) {
+            if (m_objects.contains(addr) && marked.insert(addr).second) {
+                to_scan.push_back(addr);
+            }
+        };
+        for (const auto& [addr, obj] : m_objects) {
+            if (obj.pins > 0 || obj.epoch > epoch) {
+                mark(addr);
+            }
+        }
+        for (const auto word : words) {
+            if (const auto it = find_containing(word);
+                it != m_objects.end()) {
+                mark(it->first);
+            } else if (const auto start = find_object(word);
+                       start && heap_marked
+                                    .insert(static_cast<uintptr_t>(*start))
+                                    .second) {
+                (void)get_object_ptrs(start.value(), slots);
+            }
+        }
+        while (!slots.empty() || !to_scan.empty()) {
+            if (slots.empty()) {
+                const auto addr = to_scan.back();
+                to_scan.pop_back();
+                scan_memory(addr, addr + m_objects.at(addr).size,
+                            [&slots](auto slot) { slots.push_back(slot); },
+                            true);
+                continue;
+            }
+            const auto target = FatPtr::test_ptr(slots.back());
+            slots.pop_back();
+            if (!target) {
+                continue;
+            }
+            const auto addr = static_cast<uintptr_t>(target.value());
+            if (m_objects.contains(addr)) {
+                mark(addr);
+            } else if (heap_marked.insert(addr).second) {
+                (void)get_object_ptrs(target.value(), slots);
+            }
+        }
+        for (auto it = m_objects.begin(); it != m_objects.end();) {
+            if (marked.contains(it->first)) {
+                ++it;
+            } else {
+                m_mapped -= page_size_ceil(it->second.size);
+                dead.emplace_back(it->first, std::move(it->second));
+                it = m_objects.erase(it);
+            }
+        }
+        m_next_sweep = std::max(initial_sweep_size, 2 * m_mapped);
+    }
+    if (!dead.empty()) {
+        // collections which found roots in the dead objects before they were
+        // removed may still be forwarding them
+        GCRoots::wait_for_roots_unused();
+        std::unordered_set<uintptr_t> dead_addrs;
+        for (const auto& [addr, _] : dead) {
+            dead_addrs.insert(addr);
+        }
+        AllocProfiler::get_instance().update_live(
+            [&dead_addrs](uintptr_t addr) -> uintptr_t {
+                return dead_addrs.contains(addr) ? 0 : addr;
+            });
+        // a finalizer may read any other dead object
+        for (auto& [addr, obj] : dead) {
+            if (obj.finalizer != nullptr) {
+                // NOLINTNEXTLINE(performance-no-int-to-ptr)
+                obj.finalizer(reinterpret_cast<void*>(addr), obj.size);
+            }
+        }
+        for (auto& [addr, obj] : dead) {
+            // NOLINTNEXTLINE(performance-no-int-to-ptr)
+            munmap(reinterpret_cast<void*>(addr), page_size_ceil(obj.size));
+        }
+        // closes the files of the dead objects
+        dead.clear();
+    }
+    auto lk = std::unique_lock{m_mutex};
+    m_next_sweep_files = std::max(initial_sweep_files, 2 * Backing::g_open);
+}
+
+void gcpp::LargeObjectSpace::enable_interior_pointers() noexcept
+{
+    m_interior_pointers = true;
+}
+
+void gcpp::LargeObjectSpace::dump(HeapDumpWriter& out) const
+{
+    auto lk = std::unique_lock{m_mutex};
+    std::vector<uintptr_t> edges;
+    for (const auto& [addr, obj] : m_objects) {
+        edges.clear();
+        scan_memory(
+            addr, addr + obj.size,
+            [&edges](auto slot) {
+                if (const auto target = FatPtr::test_ptr(slot)) {
+                    edges.push_back(static_cast<uintptr_t>(target.value()));
+                }
+            },
+            true);
+        out.object(addr,
+                   MetaData{obj.size,
+                            std::align_val_t{static_cast<size_t>(page_size())},
+                            obj.finalizer},
+                   edges);
+    }
+}
+
+void gcpp::LargeObjectSpace::get_roots(std::vector<FatPtr*>& out) const
+{
+    if (g_sweeping) {
+        return;
+    }
+    auto lk = std::unique_lock{m_mutex};
+    for (const auto& [addr, obj] : m_objects) {
+        scan_memory(addr, addr + obj.size,
+                    [&out](auto slot) { out.push_back(slot); }, true);
+    }
+}
@@ -0,0 +1,324 @@
+#include "mark_compact_collector.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <ranges>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "collector.h"
+#include "concurrent_gc.h"
+#include "finalizer.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+#include "generational_gc.h"
+#include "mem_prot.h"
+#include "weak_ref.h"
+
+/*
+The collector is the classic Lisp-2 algorithm:
+1. Mark everything reachable from the roots
+2. Walk the live objects in address order, assigning each the lowest address
+after the previous live object
+3. Update every root and every pointer in a live object to the new address
+4. Slide each live object down to its new address
+
+Because objects only ever move towards lower addresses and are visited in
+address order, sliding an object never overwrites a live object that has not
+yet been moved.
+
+Dead objects with a finalizer are resurrected by the collection which finds
+them dead: they (and everything they refer to) survive one more collection so
+that their finalizers can run on the moved objects after the collection.
+*/
+
+namespace
+{
+/**
+ * @brief Gets the lowest address not less than `addr` that is aligned to
+ * `alignment`
+ */
+inline uintptr_t align_up(uintptr_t addr, std::align_val_t alignment)
+{
+    const auto align = static_cast<uintptr_t>(alignment);
+    return (addr + align - 1) & ~(align - 1);
+}
+}  // namespace
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+size_t gcpp::MarkCompactCollector<L, G>::free_space() const noexcept
+{
+    const size_t next = m_next;
+    return next >= m_heap_size ? 0 : m_heap_size - next;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+bool gcpp::MarkCompactCollector<L, G>::contains(void* ptr) const noexcept
+{
+    // safe w/o lock (never update m_space)
+    return ptr >= m_space.get() && ptr < m_space.get() + m_heap_size;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+FatPtr gcpp::MarkCompactCollector<L, G>::alloc_attempt(const MetaData& meta_data,
+                                                       uint8_t attempts)
+{
+    const auto base = reinterpret_cast<uintptr_t>(m_space.get());
+    auto ptr = m_lock.do_with_lock([this, base, &meta_data]() {
+        const auto start = align_up(base + m_next, meta_data.alignment);
+        if (start + meta_data.size > base + m_heap_size) {
+            return std::optional<FatPtr>{};
+        }
+        m_next = start + meta_data.size - base;
+        const auto res = FatPtr{start};
+        m_metadata.emplace(start, meta_data);
+        m_gen_policy.init(res);
+        return std::make_optional(res);
+    });
+    if (!ptr) {
+        if (attempts < 1) {
+            collect(meta_data.size);
+            // unlike a copying collection, nothing is freed until the
+            // compaction finishes
+            auto result =
+                m_lock.do_with_lock([this]() { return m_collect_result; });
+            if (result.valid()) {
+                result.wait();
+            }
+            return alloc_attempt(meta_data, attempts + 1);
+        } else {
+            throw std::bad_alloc();
+        }
+    }
+    return ptr.value();
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::MarkCompactCollector<L, G>::mark(
+    std::vector<uintptr_t> roots, std::unordered_set<uintptr_t>& marked) const
+{
+    while (!roots.empty()) {
+        const auto addr = roots.back();
+        roots.pop_back();
+        const auto it = m_metadata.find(addr);
+        if (it == m_metadata.end() || !marked.insert(addr).second) {
+            continue;
+        }
+        scan_memory(addr, addr + it->second.size, [&roots](auto child) {
+            if (const auto val = FatPtr::test_ptr(child); val) {
+                roots.push_back(static_cast<uintptr_t>(val.value()));
+            }
+        });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+std::pair<std::unordered_map<uintptr_t, uintptr_t>, size_t>
+gcpp::MarkCompactCollector<L, G>::compute_forwarding(
+    const std::unordered_set<uintptr_t>& marked) const
+{
+    const auto base = reinterpret_cast<uintptr_t>(m_space.get());
+    std::unordered_map<uintptr_t, uintptr_t> forwarding(marked.size());
+    auto free = base;
+    for (const auto& [addr, meta_data] : m_metadata) {
+        if (!marked.contains(addr)) {
+            continue;
+        }
+        // `free <= addr` and `addr` is aligned, so `dest <= addr`
+        const auto dest = align_up(free, meta_data.alignment);
+        forwarding.emplace(addr, dest);
+        free = dest + meta_data.size;
+    }
+    return std::make_pair(std::move(forwarding), free - base);
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::MarkCompactCollector<L, G>::slide(
+    const std::unordered_map<uintptr_t, uintptr_t>& forwarding)
+{
+    std::map<uintptr_t, MetaData> compacted;
+    for (const auto& [addr, meta_data] : m_metadata) {
+        const auto it = forwarding.find(addr);
+        if (it == forwarding.end()) {
+            m_gen_policy.collected(FatPtr{addr});
+            continue;
+        }
+        const auto dest = it->second;
+        if (dest != addr) {
+            // NOLINTNEXTLINE(performance-no-int-to-ptr)
+            std::memmove(reinterpret_cast<void*>(dest),
+                         reinterpret_cast<void*>(addr), meta_data.size);
+            m_gen_policy.init(FatPtr{dest});
+        }
+        auto& survivor =
+            compacted.emplace_hint(compacted.end(), dest, meta_data)->second;
+        ++survivor.age;
+    }
+    m_metadata = std::move(compacted);
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::MarkCompactCollector<L, G>::compact(
+    const std::vector<FatPtr*>& extra_roots)
+{
+    const auto roots_in_use = GCRoots::RootsInUse{};
+    std::vector<FatPtr*> all_roots;
+    GC_GET_ROOTS(all_roots);
+    all_roots.insert(all_roots.end(), extra_roots.begin(), extra_roots.end());
+    // roots held by our own objects (ie. from a root source) are not roots
+    std::vector<FatPtr*> roots;
+    std::ranges::copy(all_roots | std::views::filter([this](auto ptr) {
+                          const auto opt = FatPtr::test_ptr(ptr);
+                          return opt && contains(opt.value().as_ptr()) &&
+                                 !contains(ptr);
+                      }),
+                      std::back_inserter(roots));
+    std::unordered_set<uintptr_t> marked;
+    {
+        std::vector<uintptr_t> root_addrs;
+        for (const auto* root : roots) {
+            if (const auto val = FatPtr::test_ptr(root); val) {
+                root_addrs.push_back(static_cast<uintptr_t>(val.value()));
+            }
+        }
+        mark(std::move(root_addrs), marked);
+    }
+    // resurrect dead objects with finalizers until they are finalized
+    std::vector<uintptr_t> to_finalize;
+    for (auto& [addr, meta_data] : m_metadata) {
+        if (!marked.contains(addr) && meta_data.finalizer != nullptr) {
+            to_finalize.push_back(addr);
+        }
+    }
+    // weak references to resurrected objects are cleared
+    const auto reachable =
+        to_finalize.empty() ? std::unordered_set<uintptr_t>{} : marked;
+    mark(to_finalize, marked);
+
+    const auto [forwarding, end] = compute_forwarding(marked);
+    const auto forward = [&forwarding](FatPtr* slot) {
+        const auto val = FatPtr::test_ptr(slot);
+        if (!val) {
+            return;
+        }
+        const auto it = forwarding.find(static_cast<uintptr_t>(val.value()));
+        if (it != forwarding.end() && it->second != it->first) {
+            slot->compare_exchange(val.value(), FatPtr{it->second});
+        }
+    };
+    for (auto* root : roots) {
+        forward(root);
+    }
+    for (const auto addr : marked) {
+        scan_memory(addr, addr + m_metadata.at(addr).size, forward);
+    }
+
+    std::vector<DeadObject> dead;
+    for (const auto addr : to_finalize) {
+        auto& meta_data = m_metadata.at(addr);
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        dead.push_back({meta_data.finalizer,
+                        reinterpret_cast<void*>(forwarding.at(addr)),
+                        meta_data.size});
+        meta_data.finalizer = nullptr;
+    }
+    slide(forwarding);
+    m_next = end;
+
+    WeakRefs::get_instance().end_collection(
+        [this, &forwarding, &reachable, &to_finalize](uintptr_t target) {
+            // NOLINTNEXTLINE(performance-no-int-to-ptr)
+            if (!contains(reinterpret_cast<void*>(target))) {
+                return target;
+            }
+            const auto it = forwarding.find(target);
+            if (it == forwarding.end() ||
+                (!to_finalize.empty() && !reachable.contains(target))) {
+                return static_cast<uintptr_t>(0);
+            }
+            return it->second;
+        });
+    if (!dead.empty()) {
+        m_finalized = FinalizerThread::get_instance().finalize(std::move(dead));
+    }
+}
+
+template <gcpp::CollectorLockingPolicy LockPolicy, gcpp::GCGenerationPolicy G>
+std::future<std::vector<FatPtr>>
+gcpp::MarkCompactCollector<LockPolicy, G>::async_collect(
+    const std::vector<FatPtr*>& extra_roots) noexcept
+{
+    // finalizers may still be using the objects resurrected by the last
+    // collection
+    if (m_finalized.valid()) {
+        m_finalized.wait();
+    }
+    return m_lock.do_collection([this, extra_roots]() {
+        // hold the lock for the entire collection so that allocations wait
+        // for the compaction to finish
+        [[maybe_unused]] auto lk = m_lock.lock();
+        auto& weak_refs = WeakRefs::get_instance();
+        weak_refs.begin_collection();
+        try {
+            compact(extra_roots);
+        } catch (...) {
+            weak_refs.end_collection([](auto target) { return target; });
+            throw;
+        }
+        return CollectionResultT{};
+    });
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::MarkCompactCollector<Lock, G>::collect(size_t needed_space) noexcept
+{
+    while (m_collect_result.valid() &&
+           m_collect_result.wait_for(std::chrono::seconds(0)) ==
+               std::future_status::timeout &&
+           free_space() < needed_space) {
+        m_collect_result.wait();
+    }
+    [[maybe_unused]] auto lk = m_lock.lock();
+    if (free_space() < needed_space &&
+        (!m_collect_result.valid() ||
+         m_collect_result.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready)) {
+        m_collect_result = async_collect({});
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+FatPtr gcpp::MarkCompactCollector<Lock, G>::alloc(size_t size,
+                                                  std::align_val_t alignment,
+                                                  FinalizerFn finalizer)
+{
+    GC_UPDATE_STACK_RANGE_NESTED_1();
+    if (size == 0 || size > m_heap_size) {
+        throw std::bad_alloc();
+    }
+    return alloc_attempt({size, alignment, finalizer}, 0);
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+gcpp::MarkCompactCollector<Lock, G>::~MarkCompactCollector()
+{
+    if (m_collect_result.valid()) {
+        m_collect_result.wait();
+    }
+    // finalizers may still be reading the heap
+    if (m_finalized.valid()) {
+        m_finalized.wait();
+    }
+    unregister_heap(m_space.get(), m_heap_size);
+}
+
+template class gcpp::MarkCompactCollector<gcpp::SerialGCPolicy,
+                                          gcpp::FinalGenerationPolicy>;
+template class gcpp::MarkCompactCollector<gcpp::ConcurrentGCPolicy,
+                                          gcpp::FinalGenerationPolicy>;
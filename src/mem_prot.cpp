@@ -1,31 +1,122 @@
 #include "mem_prot.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cassert>
 #include <csignal>
 #include <cstring>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <new>
 #include <sstream>
+#include <thread>
 #include <utility>
+#include <vector>
 namespace
 {
-std::array<std::pair<const void*, const void*>, 128> g_heaps;
-std::atomic<int> g_heap_count = 0;
+/**
+ * @brief A registered range of addresses. Faults in a heap are ignored, and
+ * faults in the range of a handler are passed to the handler
+ */
+struct Region {
+    uintptr_t start;
+    uintptr_t end;
+    /** Handler of the range, or `nullptr` for a heap */
+    gcpp::FaultHandler handler;
+    void* context;
+    size_t id;
+};
+
+/**
+ * @brief Immutable snapshot of the registered regions, sorted by start.
+ * `max_end[i]` is the largest end of the first `i + 1` regions, so a lookup is
+ * a binary search followed by a walk over only the regions that may overlap
+ * the address.
+ */
+struct RegionIndex {
+    std::vector<Region> regions;
+    std::vector<uintptr_t> max_end;
+};
+
+/** Current snapshot, read by the signal handler without locking */
+std::atomic<const RegionIndex*> g_regions = nullptr;
+/** Number of signal handlers reading a snapshot */
+std::atomic<int> g_region_readers = 0;
+/** Held to update the regions */
+std::mutex g_regions_mutex;
+size_t g_next_region_id = 0;
+
+/** Maximum number of fault handlers overlapping a single address */
+constexpr size_t max_overlapping_handlers = 8;
+
+/**
+ * @brief Publishes a copy of the current regions modified by `update`.
+ * Requires holding `g_regions_mutex`
+ */
+template <typename F>
+void update_regions(F update)
+{
+    const auto* old = g_regions.load();
+    auto regions = old == nullptr ? std::vector<Region>{} : old->regions;
+    update(regions);
+    std::ranges::sort(regions, std::less{}, &Region::start);
+    auto next = std::make_unique<RegionIndex>();
+    next->max_end.reserve(regions.size());
+    uintptr_t max_end = 0;
+    for (const auto& region : regions) {
+        max_end = std::max(max_end, region.end);
+        next->max_end.push_back(max_end);
+    }
+    next->regions = std::move(regions);
+    g_regions = next.release();
+    // wait for signal handlers which may still be reading the old snapshot
+    while (g_region_readers > 0) {
+        std::this_thread::yield();
+    }
+    delete old;
+}
 
 void segfault_handler(int, siginfo_t* si, void*)
 {
-    const int heap_counts = g_heap_count;
-    for (int i = 0; i < heap_counts; ++i) {
-        const auto& heap = g_heaps[static_cast<size_t>(i)];
-        if (si->si_addr >= heap.first && si->si_addr < heap.second) {
+    const auto addr = reinterpret_cast<uintptr_t>(si->si_addr);
+    std::array<std::pair<gcpp::FaultHandler, void*>, max_overlapping_handlers>
+        handlers{};
+    size_t handler_count = 0;
+    bool in_heap = false;
+    ++g_region_readers;
+    if (const auto* index = g_regions.load(); index != nullptr) {
+        const auto& regions = index->regions;
+        auto i = static_cast<size_t>(
+            std::ranges::upper_bound(regions, addr, std::less{},
+                                     &Region::start) -
+            regions.begin());
+        for (; i > 0 && index->max_end[i - 1] > addr; --i) {
+            const auto& region = regions[i - 1];
+            if (addr >= region.end) {
+                continue;
+            }
+            if (region.handler == nullptr) {
+                in_heap = true;
+            } else if (handler_count < handlers.size()) {
+                handlers[handler_count++] = {region.handler, region.context};
+            }
+        }
+    }
+    --g_region_readers;
+    for (size_t i = 0; i < handler_count; ++i) {
+        if (handlers[i].first(handlers[i].second, si->si_addr)) {
             return;
         }
     }
-    abort();
+    if (!in_heap) {
+        abort();
+    }
 }
 
 bool is_segfault_handler_registered()
@@ -36,6 +127,18 @@ bool is_segfault_handler_registered()
     return sa.sa_sigaction == segfault_handler;
 }
 
+void install_segfault_handler()
+{
+    if (!is_segfault_handler_registered()) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_sigaction = segfault_handler;
+        assert(sigaction(SIGSEGV, &sa, nullptr) == 0);
+    }
+}
+
 void* page_aligned_floor(const void* addr)
 {
     return reinterpret_cast<void*>(
@@ -62,22 +165,54 @@ int gcpp::page_size()
 
 void gcpp::register_heap(const void* start, size_t len)
 {
-    const void* end = static_cast<const uint8_t*>(start) + len;
-    for (size_t i = 0; static_cast<int>(i) < g_heap_count; ++i) {
-        if (g_heaps[i].first == start && g_heaps[i].second == end) {
-            return;
+    const auto begin = reinterpret_cast<uintptr_t>(start);
+    auto lk = std::unique_lock{g_regions_mutex};
+    update_regions([begin, len](auto& regions) {
+        const auto registered =
+            std::ranges::any_of(regions, [begin, len](const auto& region) {
+                return region.handler == nullptr && region.start == begin &&
+                       region.end == begin + len;
+            });
+        if (!registered) {
+            regions.push_back(
+                {begin, begin + len, nullptr, nullptr, g_next_region_id++});
         }
-    }
-    auto idx = static_cast<size_t>(g_heap_count++);
-    g_heaps.at(idx) = std::make_pair(start, end);
-    if (!is_segfault_handler_registered()) {
-        struct sigaction sa;
-        memset(&sa, 0, sizeof(sa));
-        sa.sa_flags = SA_SIGINFO;
-        sigemptyset(&sa.sa_mask);
-        sa.sa_sigaction = segfault_handler;
-        assert(sigaction(SIGSEGV, &sa, nullptr) == 0);
-    }
+    });
+    install_segfault_handler();
+}
+
+void gcpp::unregister_heap(const void* start, size_t len)
+{
+    const auto begin = reinterpret_cast<uintptr_t>(start);
+    auto lk = std::unique_lock{g_regions_mutex};
+    update_regions([begin, len](auto& regions) {
+        std::erase_if(regions, [begin, len](const auto& region) {
+            return region.handler == nullptr && region.start == begin &&
+                   region.end == begin + len;
+        });
+    });
+}
+
+size_t gcpp::register_fault_handler(const void* start, size_t len,
+                                    FaultHandler handler, void* context)
+{
+    const auto begin = reinterpret_cast<uintptr_t>(start);
+    auto lk = std::unique_lock{g_regions_mutex};
+    const auto id = g_next_region_id++;
+    update_regions([begin, len, handler, context, id](auto& regions) {
+        regions.push_back({begin, begin + len, handler, context, id});
+    });
+    install_segfault_handler();
+    return id;
+}
+
+void gcpp::unregister_fault_handler(size_t id)
+{
+    auto lk = std::unique_lock{g_regions_mutex};
+    update_regions([id](auto& regions) {
+        std::erase_if(regions,
+                      [id](const auto& region) { return region.id == id; });
+    });
 }
 
 size_t gcpp::page_size_ceil(size_t size)
@@ -165,3 +300,157 @@ gcpp::RegionProtection gcpp::region_writeonly(void* start, size_t len)
     return {start, static_cast<const uint8_t*>(start) + len,
             ProtectionMode::WriteOnly};
 }
+
+gcpp::AliasedRegion::AliasedRegion(size_t size)
+    : m_view(nullptr),
+      m_alias(nullptr),
+      m_size(page_size_ceil(size)),
+      m_fd(memfd_create("gcpp-heap", MFD_CLOEXEC))
+{
+    const auto fail = [this](const char* what) {
+        std::stringstream ss;
+        ss << "Could not " << what << " aliased region with size " << m_size
+           << ". Error code: " << errno;
+        release();
+        throw std::runtime_error(ss.str());
+    };
+    if (m_fd < 0 || ftruncate(m_fd, static_cast<off_t>(m_size)) != 0) {
+        fail("create");
+    }
+    for (auto* mapping : {&m_view, &m_alias}) {
+        void* addr = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          m_fd, 0);
+        if (addr == MAP_FAILED) {
+            fail("map");
+        }
+        *mapping = static_cast<std::byte*>(addr);
+    }
+}
+
+gcpp::AliasedRegion::~AliasedRegion() { release(); }
+
+void gcpp::AliasedRegion::release() noexcept
+{
+    for (auto* mapping : {m_view, m_alias}) {
+        if (mapping != nullptr) {
+            munmap(mapping, m_size);
+        }
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    m_view = m_alias = nullptr;
+    m_fd = -1;
+}
+
+void gcpp::AliasedRegion::discard(size_t offset, size_t len)
+{
+    if (len > 0 &&
+        fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  static_cast<off_t>(offset), static_cast<off_t>(len)) != 0) {
+        std::stringstream ss;
+        ss << "Could not discard " << len << " bytes at offset " << offset
+           << ". Error code: " << errno;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+gcpp::PageProtection::PageProtection(void* start, size_t len,
+                                     ProtectionMode initial)
+    : m_start(static_cast<std::byte*>(start)),
+      m_pages(page_size_ceil(len) / static_cast<size_t>(page_size())),
+      m_current(std::make_unique<std::atomic<int>[]>(m_pages)),
+      m_staged(m_pages, no_change),
+      m_staged_begin(m_pages)
+{
+    for (size_t i = 0; i < m_pages; ++i) {
+        m_current[i] = static_cast<int>(initial);
+    }
+}
+
+std::pair<size_t, size_t> gcpp::PageProtection::page_range(const void* addr,
+                                                           size_t len) const
+{
+    const auto page = static_cast<size_t>(page_size());
+    const auto offset = static_cast<size_t>(
+        static_cast<const std::byte*>(addr) - m_start);
+    return {offset / page, std::min((offset + len + page - 1) / page, m_pages)};
+}
+
+void gcpp::PageProtection::protect(const void* addr, size_t len,
+                                   ProtectionMode mode)
+{
+    const auto [first, last] = page_range(addr, len);
+    for (auto i = first; i < last; ++i) {
+        m_staged[i] = static_cast<int>(mode);
+    }
+    if (first < last) {
+        m_staged_begin = std::min(m_staged_begin, first);
+        m_staged_end = std::max(m_staged_end, last);
+    }
+}
+
+size_t gcpp::PageProtection::commit()
+{
+    const auto page = static_cast<size_t>(page_size());
+    size_t calls = 0;
+    auto i = m_staged_begin;
+    while (i < m_staged_end) {
+        if (m_staged[i] == no_change || m_staged[i] == m_current[i]) {
+            m_staged[i++] = no_change;
+            continue;
+        }
+        const auto mode = m_staged[i];
+        auto run_end = i;
+        auto changed_end = i;
+        // extend the run over pages which change to, or already have, `mode`
+        while (run_end < m_staged_end &&
+               (m_staged[run_end] == mode ||
+                (m_staged[run_end] == no_change &&
+                 m_current[run_end] == mode))) {
+            if (m_staged[run_end] == mode) {
+                changed_end = run_end + 1;
+            }
+            ++run_end;
+        }
+        if (mprotect(m_start + i * page, (changed_end - i) * page, mode) != 0) {
+            std::stringstream ss;
+            ss << "Could not protect " << changed_end - i << " pages at "
+               << std::hex << static_cast<void*>(m_start + i * page)
+               << ". Error code: " << std::dec << errno;
+            throw std::runtime_error(ss.str());
+        }
+        ++calls;
+        for (; i < changed_end; ++i) {
+            m_current[i] = mode;
+            m_staged[i] = no_change;
+        }
+    }
+    m_staged_begin = m_pages;
+    m_staged_end = 0;
+    return calls;
+}
+
+bool gcpp::PageProtection::protect_now(const void* addr, size_t len,
+                                       ProtectionMode mode) noexcept
+{
+    const auto [first, last] = page_range(addr, len);
+    const auto page = static_cast<size_t>(page_size());
+    if (first >= last) {
+        return true;
+    }
+    if (mprotect(m_start + first * page, (last - first) * page,
+                 static_cast<int>(mode)) != 0) {
+        return false;
+    }
+    for (auto i = first; i < last; ++i) {
+        m_current[i] = static_cast<int>(mode);
+    }
+    return true;
+}
+
+gcpp::ProtectionMode gcpp::PageProtection::protection(const void* addr) const
+{
+    return static_cast<ProtectionMode>(
+        m_current[page_range(addr, 1).first].load());
+}
@@ -0,0 +1,103 @@
+#include "numa.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+constexpr auto node_dir = "/sys/devices/system/node/";
+
+/**
+ * @brief Parses a sysfs list such as `0-3,8,10-11` into the ids it contains
+ */
+std::vector<size_t> parse_id_list(const std::string& list)
+{
+    std::vector<size_t> ids;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        const auto dash = range.find('-');
+        const auto first = std::stoul(range.substr(0, dash));
+        const auto last = dash == std::string::npos
+                              ? first
+                              : std::stoul(range.substr(dash + 1));
+        for (auto id = first; id <= last; ++id) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+/** Reads the first line of a sysfs file, or the empty string on failure */
+std::string read_sysfs(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+}  // namespace
+
+const std::vector<size_t>& gcpp::numa_nodes() noexcept
+{
+    static std::vector<size_t> nodes;
+    static std::once_flag nodes_flag;
+    std::call_once(nodes_flag, []() {
+        try {
+            nodes = parse_id_list(read_sysfs(std::string(node_dir) + "online"));
+            std::ranges::sort(nodes);
+        } catch (const std::exception&) {
+            nodes.clear();
+        }
+        if (nodes.empty()) {
+            nodes.push_back(0);
+        }
+    });
+    return nodes;
+}
+
+size_t gcpp::numa_node_count() noexcept { return numa_nodes().size(); }
+
+size_t gcpp::current_numa_node() noexcept
+{
+    const auto& nodes = numa_nodes();
+    if (nodes.size() == 1) {
+        return nodes.front();
+    }
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (getcpu(&cpu, &node) != 0 || !std::ranges::binary_search(nodes, node)) {
+        return nodes.front();
+    }
+    return node;
+}
+
+bool gcpp::pin_to_numa_node(size_t node) noexcept
+{
+    try {
+        const auto cpus = parse_id_list(read_sysfs(std::string(node_dir) + "node" +
+                                                   std::to_string(node) +
+                                                   "/cpulist"));
+        if (cpus.empty()) {
+            return false;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const auto cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
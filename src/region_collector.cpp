@@ -0,0 +1,534 @@
+#include "region_collector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <ranges>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "collector.h"
+#include "concurrent_gc.h"
+#include "finalizer.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+#include "generational_gc.h"
+#include "mem_prot.h"
+#include "weak_ref.h"
+
+/*
+Each collection:
+1. Marks everything reachable from the roots. Every slot which points into a
+region from outside of it (a root or an object in another region) is recorded
+as an incoming reference of that region, and the size of every marked object
+is added to the live bytes of its region.
+2. Resurrects dead objects with finalizers, as `MarkCompactCollector` does, so
+their finalizers can run after the collection.
+3. Chooses the collection set: regions in decreasing order of garbage whose
+predicted evacuation time, the live bytes of the region times the measured
+copying rate, fits the pause budget. A region is only chosen if its live
+objects fit in the free regions, which is checked by packing them exactly as
+the evacuation will.
+4. Copies the live objects of the collection set into free regions, updates
+the incoming references of the collection set and the pointers in the copies,
+then frees the regions of the collection set.
+
+Pointers between two regions of the collection set are recorded in the
+objects being moved, so they are updated by scanning the copies rather than
+through the incoming references. Garbage outside of the collection set stays
+in place until its region is chosen.
+*/
+
+namespace
+{
+/**
+ * @brief Gets the lowest value not less than `val` that is aligned to
+ * `alignment`
+ */
+inline uintptr_t align_up(uintptr_t val, std::align_val_t alignment)
+{
+    const auto align = static_cast<uintptr_t>(alignment);
+    return (val + align - 1) & ~(align - 1);
+}
+}  // namespace
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+gcpp::RegionCollector<L, G>::RegionCollector(
+    size_t size, size_t region_size, std::chrono::nanoseconds pause_budget)
+    : m_heap_size(0),
+      m_region_size(page_size_ceil(region_size)),
+      m_reserve(0),
+      m_gen_policy(),
+      m_pause_budget(pause_budget)
+{
+    if (size >= ptr_mask) {
+        throw std::runtime_error("Heap size too large");
+    }
+    const auto count =
+        std::max((page_size_ceil(size) + m_region_size - 1) / m_region_size,
+                 size_t{1});
+    m_heap_size = count * m_region_size;
+    m_space = MemStore(new (page_size_align()) std::byte[m_heap_size]);
+    m_regions.resize(count);
+    // regions are taken from the back, so allocate from the start first
+    for (auto idx = count; idx > 0; --idx) {
+        m_free_regions.push_back(idx - 1);
+    }
+    // evacuation needs free regions to copy into
+    m_reserve = count > 1 ? std::max(count / 8, size_t{1}) : 0;
+    update_free_space();
+    register_heap(m_space.get(), m_heap_size);
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+gcpp::RegionCollector<L, G>::~RegionCollector()
+{
+    if (m_collect_result.valid()) {
+        m_collect_result.wait();
+    }
+    // finalizers may still be reading the heap
+    if (m_finalized.valid()) {
+        m_finalized.wait();
+    }
+    unregister_heap(m_space.get(), m_heap_size);
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+size_t gcpp::RegionCollector<L, G>::free_space() const noexcept
+{
+    return m_free;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+bool gcpp::RegionCollector<L, G>::contains(void* ptr) const noexcept
+{
+    // safe w/o lock (never update m_space)
+    return ptr >= m_space.get() && ptr < m_space.get() + m_heap_size;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+auto gcpp::RegionCollector<L, G>::region_of(uintptr_t addr) const noexcept
+    -> RegionIdx
+{
+    return (addr - reinterpret_cast<uintptr_t>(m_space.get())) / m_region_size;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+uintptr_t gcpp::RegionCollector<L, G>::region_start(RegionIdx idx) const noexcept
+{
+    return reinterpret_cast<uintptr_t>(m_space.get()) + idx * m_region_size;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::RegionCollector<L, G>::update_free_space() noexcept
+{
+    const auto free_regions = m_free_regions.size();
+    auto free = free_regions > m_reserve
+                    ? (free_regions - m_reserve) * m_region_size
+                    : size_t{0};
+    if (m_alloc_region != no_region) {
+        free += m_region_size - m_regions[m_alloc_region].top;
+    }
+    m_free = free;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+std::optional<uintptr_t> gcpp::RegionCollector<L, G>::bump(
+    RegionIdx idx, size_t size, std::align_val_t alignment)
+{
+    auto& region = m_regions[idx];
+    // regions are page aligned, so aligning the offset aligns the address
+    const auto start = align_up(region.top, alignment);
+    if (start + size > m_region_size) {
+        return {};
+    }
+    region.top = start + size;
+    return region_start(idx) + start;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+FatPtr gcpp::RegionCollector<L, G>::alloc_attempt(const MetaData& meta_data,
+                                                  uint8_t attempts)
+{
+    auto ptr = m_lock.do_with_lock([this, &meta_data]() {
+        auto addr =
+            m_alloc_region == no_region
+                ? std::optional<uintptr_t>{}
+                : bump(m_alloc_region, meta_data.size, meta_data.alignment);
+        if (!addr && m_free_regions.size() > m_reserve) {
+            m_alloc_region = m_free_regions.back();
+            m_free_regions.pop_back();
+            addr = bump(m_alloc_region, meta_data.size, meta_data.alignment);
+        }
+        if (!addr) {
+            return std::optional<FatPtr>{};
+        }
+        const auto res = FatPtr{addr.value()};
+        m_metadata.emplace(addr.value(), meta_data);
+        m_gen_policy.init(res);
+        update_free_space();
+        return std::make_optional(res);
+    });
+    if (!ptr) {
+        if (attempts < 1) {
+            collect(meta_data.size);
+            // nothing is freed until the evacuation finishes
+            auto result =
+                m_lock.do_with_lock([this]() { return m_collect_result; });
+            if (result.valid()) {
+                result.wait();
+            }
+            return alloc_attempt(meta_data, attempts + 1);
+        } else {
+            throw std::bad_alloc();
+        }
+    }
+    return ptr.value();
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::RegionCollector<L, G>::mark(std::vector<FatPtr*> slots,
+                                       std::unordered_set<uintptr_t>& marked)
+{
+    while (!slots.empty()) {
+        auto* slot = slots.back();
+        slots.pop_back();
+        const auto val = FatPtr::test_ptr(slot);
+        if (!val) {
+            continue;
+        }
+        const auto addr = static_cast<uintptr_t>(val.value());
+        const auto it = m_metadata.find(addr);
+        if (it == m_metadata.end()) {
+            continue;
+        }
+        auto& region = m_regions[region_of(addr)];
+        if (!contains(slot) ||
+            region_of(reinterpret_cast<uintptr_t>(slot)) != region_of(addr)) {
+            region.incoming.push_back(slot);
+        }
+        if (!marked.insert(addr).second) {
+            continue;
+        }
+        region.live += it->second.size;
+        scan_memory(addr, addr + it->second.size,
+                    [&slots](auto child) { slots.push_back(child); });
+    }
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+auto gcpp::RegionCollector<L, G>::choose_regions(
+    const std::unordered_set<uintptr_t>& marked) const -> std::vector<RegionIdx>
+{
+    std::vector<RegionIdx> candidates;
+    for (RegionIdx idx = 0; idx < m_regions.size(); ++idx) {
+        if (m_regions[idx].top > m_regions[idx].live) {
+            candidates.push_back(idx);
+        }
+    }
+    std::ranges::sort(candidates, [this](auto a, auto b) {
+        return m_regions[a].top - m_regions[a].live >
+               m_regions[b].top - m_regions[b].live;
+    });
+    const auto budget = static_cast<double>(m_pause_budget.count());
+    std::vector<RegionIdx> chosen;
+    double predicted = 0;
+    // the evacuation starts with a fresh region
+    auto free_left = m_free_regions.size();
+    auto top = m_region_size;
+    for (const auto idx : candidates) {
+        const auto cost =
+            static_cast<double>(m_regions[idx].live) * m_ns_per_byte;
+        if (!chosen.empty() && predicted + cost > budget) {
+            continue;
+        }
+        auto regions_left = free_left;
+        auto region_top = top;
+        auto fits = true;
+        const auto begin = region_start(idx);
+        for (auto it = m_metadata.lower_bound(begin);
+             it != m_metadata.end() && it->first < begin + m_region_size;
+             ++it) {
+            if (!marked.contains(it->first)) {
+                continue;
+            }
+            const auto& meta_data = it->second;
+            auto start = align_up(region_top, meta_data.alignment);
+            if (start + meta_data.size > m_region_size) {
+                if (regions_left == 0) {
+                    fits = false;
+                    break;
+                }
+                --regions_left;
+                start = 0;
+            }
+            region_top = start + meta_data.size;
+        }
+        if (!fits) {
+            continue;
+        }
+        free_left = regions_left;
+        top = region_top;
+        predicted += cost;
+        chosen.push_back(idx);
+    }
+    return chosen;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+std::unordered_map<uintptr_t, uintptr_t> gcpp::RegionCollector<L, G>::evacuate(
+    const std::vector<RegionIdx>& regions,
+    const std::unordered_set<uintptr_t>& marked)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+    std::unordered_map<uintptr_t, uintptr_t> forwarding;
+    std::map<uintptr_t, MetaData> copies;
+    auto to = no_region;
+    size_t copied = 0;
+    for (const auto idx : regions) {
+        const auto begin = region_start(idx);
+        auto it = m_metadata.lower_bound(begin);
+        while (it != m_metadata.end() && it->first < begin + m_region_size) {
+            const auto& [addr, meta_data] = *it;
+            if (!marked.contains(addr)) {
+                m_gen_policy.collected(FatPtr{addr});
+                it = m_metadata.erase(it);
+                continue;
+            }
+            auto dest = to == no_region
+                            ? std::optional<uintptr_t>{}
+                            : bump(to, meta_data.size, meta_data.alignment);
+            if (!dest) {
+                // `choose_regions` checked that the copies fit
+                to = m_free_regions.back();
+                m_free_regions.pop_back();
+                dest = bump(to, meta_data.size, meta_data.alignment);
+            }
+            // NOLINTNEXTLINE(performance-no-int-to-ptr)
+            std::memcpy(reinterpret_cast<void*>(dest.value()),
+                        reinterpret_cast<void*>(addr), meta_data.size);
+            forwarding.emplace(addr, dest.value());
+            auto& survivor = copies.emplace(dest.value(), meta_data).first->second;
+            ++survivor.age;
+            m_gen_policy.init(FatPtr{dest.value()});
+            copied += meta_data.size;
+            it = m_metadata.erase(it);
+        }
+    }
+    m_metadata.merge(copies);
+
+    const auto forward = [&forwarding](FatPtr* slot) {
+        const auto val = FatPtr::test_ptr(slot);
+        if (!val) {
+            return;
+        }
+        const auto it = forwarding.find(static_cast<uintptr_t>(val.value()));
+        if (it != forwarding.end()) {
+            slot->compare_exchange(val.value(), FatPtr{it->second});
+        }
+    };
+    const std::unordered_set<RegionIdx> collection_set(regions.begin(),
+                                                       regions.end());
+    for (const auto idx : regions) {
+        for (auto* slot : m_regions[idx].incoming) {
+            // slots in the collection set were moved with their object
+            if (!contains(slot) ||
+                !collection_set.contains(
+                    region_of(reinterpret_cast<uintptr_t>(slot)))) {
+                forward(slot);
+            }
+        }
+    }
+    for (const auto& [_, dest] : forwarding) {
+        scan_memory(dest, dest + m_metadata.at(dest).size, forward);
+    }
+
+    for (const auto idx : regions) {
+        m_regions[idx] = Region{};
+        m_free_regions.push_back(idx);
+        if (m_alloc_region == idx) {
+            m_alloc_region = no_region;
+        }
+    }
+    // allocate in the space left after the copies
+    if (m_alloc_region == no_region) {
+        m_alloc_region = to;
+    }
+    update_free_space();
+
+    const auto elapsed = std::chrono::steady_clock::now() - start_time;
+    m_stats.regions_evacuated = regions.size();
+    m_stats.bytes_copied = copied;
+    m_stats.evacuation_time =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    if (copied > 0) {
+        // smooth the rate since a single evacuation is noisy
+        const auto rate = static_cast<double>(m_stats.evacuation_time.count()) /
+                          static_cast<double>(copied);
+        m_ns_per_byte = (m_ns_per_byte + rate) / 2;
+    }
+    return forwarding;
+}
+
+template <gcpp::CollectorLockingPolicy L, gcpp::GCGenerationPolicy G>
+void gcpp::RegionCollector<L, G>::collect_regions(
+    const std::vector<FatPtr*>& extra_roots)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto roots_in_use = GCRoots::RootsInUse{};
+    std::vector<FatPtr*> all_roots;
+    GC_GET_ROOTS(all_roots);
+    all_roots.insert(all_roots.end(), extra_roots.begin(), extra_roots.end());
+    // roots held by our own objects (ie. from a root source) are not roots
+    std::vector<FatPtr*> roots;
+    std::ranges::copy(all_roots | std::views::filter([this](auto ptr) {
+                          const auto opt = FatPtr::test_ptr(ptr);
+                          return opt && contains(opt.value().as_ptr()) &&
+                                 !contains(ptr);
+                      }),
+                      std::back_inserter(roots));
+    for (auto& region : m_regions) {
+        region.live = 0;
+        region.incoming.clear();
+    }
+    std::unordered_set<uintptr_t> marked;
+    mark(std::move(roots), marked);
+
+    // resurrect dead objects with finalizers until they are finalized
+    std::vector<uintptr_t> to_finalize;
+    for (auto& [addr, meta_data] : m_metadata) {
+        if (!marked.contains(addr) && meta_data.finalizer != nullptr) {
+            to_finalize.push_back(addr);
+        }
+    }
+    // weak references to resurrected objects are cleared
+    const auto reachable =
+        to_finalize.empty() ? std::unordered_set<uintptr_t>{} : marked;
+    for (const auto addr : to_finalize) {
+        if (!marked.insert(addr).second) {
+            continue;
+        }
+        const auto size = m_metadata.at(addr).size;
+        m_regions[region_of(addr)].live += size;
+        std::vector<FatPtr*> children;
+        scan_memory(addr, addr + size,
+                    [&children](auto child) { children.push_back(child); });
+        mark(std::move(children), marked);
+    }
+
+    const auto forwarding = evacuate(choose_regions(marked), marked);
+    const auto forwarded = [&forwarding](uintptr_t addr) {
+        const auto it = forwarding.find(addr);
+        return it == forwarding.end() ? addr : it->second;
+    };
+
+    std::vector<DeadObject> dead;
+    for (const auto addr : to_finalize) {
+        const auto dest = forwarded(addr);
+        auto& meta_data = m_metadata.at(dest);
+        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+        dead.push_back(
+            {meta_data.finalizer, reinterpret_cast<void*>(dest), meta_data.size});
+        meta_data.finalizer = nullptr;
+    }
+
+    WeakRefs::get_instance().end_collection(
+        [this, &forwarded, &marked, &reachable, &to_finalize](uintptr_t target) {
+            // NOLINTNEXTLINE(performance-no-int-to-ptr)
+            if (!contains(reinterpret_cast<void*>(target))) {
+                return target;
+            }
+            if (!marked.contains(target) ||
+                (!to_finalize.empty() && !reachable.contains(target))) {
+                return static_cast<uintptr_t>(0);
+            }
+            return forwarded(target);
+        });
+    if (!dead.empty()) {
+        m_finalized = FinalizerThread::get_instance().finalize(std::move(dead));
+    }
+    m_stats.pause_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_time);
+}
+
+template <gcpp::CollectorLockingPolicy LockPolicy, gcpp::GCGenerationPolicy G>
+std::future<std::vector<FatPtr>>
+gcpp::RegionCollector<LockPolicy, G>::async_collect(
+    const std::vector<FatPtr*>& extra_roots) noexcept
+{
+    // finalizers may still be using the objects resurrected by the last
+    // collection
+    if (m_finalized.valid()) {
+        m_finalized.wait();
+    }
+    return m_lock.do_collection([this, extra_roots]() {
+        // hold the lock for the entire collection so that allocations wait
+        // for the evacuation to finish
+        [[maybe_unused]] auto lk = m_lock.lock();
+        auto& weak_refs = WeakRefs::get_instance();
+        weak_refs.begin_collection();
+        try {
+            collect_regions(extra_roots);
+        } catch (...) {
+            weak_refs.end_collection([](auto target) { return target; });
+            throw;
+        }
+        return CollectionResultT{};
+    });
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::RegionCollector<Lock, G>::collect(size_t needed_space) noexcept
+{
+    while (m_collect_result.valid() &&
+           m_collect_result.wait_for(std::chrono::seconds(0)) ==
+               std::future_status::timeout &&
+           free_space() < needed_space) {
+        m_collect_result.wait();
+    }
+    [[maybe_unused]] auto lk = m_lock.lock();
+    if (free_space() < needed_space &&
+        (!m_collect_result.valid() ||
+         m_collect_result.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready)) {
+        m_collect_result = async_collect({});
+    }
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+FatPtr gcpp::RegionCollector<Lock, G>::alloc(size_t size,
+                                             std::align_val_t alignment,
+                                             FinalizerFn finalizer)
+{
+    GC_UPDATE_STACK_RANGE_NESTED_1();
+    if (size == 0 || size > m_region_size ||
+        static_cast<size_t>(alignment) > static_cast<size_t>(page_size())) {
+        throw std::bad_alloc();
+    }
+    return alloc_attempt({size, alignment, finalizer}, 0);
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+void gcpp::RegionCollector<Lock, G>::set_pause_budget(
+    std::chrono::nanoseconds budget) noexcept
+{
+    m_lock.do_with_lock([this, budget]() { m_pause_budget = budget; });
+}
+
+template <gcpp::CollectorLockingPolicy Lock, gcpp::GCGenerationPolicy G>
+gcpp::RegionCollectionStats gcpp::RegionCollector<Lock, G>::last_collection()
+    const
+{
+    return m_lock.do_with_lock([this]() { return m_stats; });
+}
+
+template class gcpp::RegionCollector<gcpp::SerialGCPolicy,
+                                     gcpp::FinalGenerationPolicy>;
+template class gcpp::RegionCollector<gcpp::ConcurrentGCPolicy,
+                                     gcpp::FinalGenerationPolicy>;
@@ -1,33 +1,731 @@
 #include "safe_alloc.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include "arena.h"
 #include "concurrent_gc.h"
 #include "copy_collector.h"
 #include "gc_scan.h"
+#include "heap_dump.h"
+#include "large_object.h"
+#include "numa.h"
 using collector_t = gcpp::CopyingCollector<gcpp::ConcurrentGCPolicy, gcpp::FinalGenerationPolicy>;
+using local_collector_t =
+    gcpp::CopyingCollector<gcpp::SerialGCPolicy, gcpp::FinalGenerationPolicy>;
+/** Size of the heap of each NUMA node */
 constexpr uintptr_t heap_size = 51200;
-// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
-static collector_t g_collector(heap_size);
+/** Default size of the heap of each thread using `ThreadLocalGC` */
+constexpr uintptr_t thread_heap_size = 51200;
 
-FatPtr gcpp::GC::alloc(size_t size, std::align_val_t alignment)
+namespace
 {
-    if (g_collector.free_space() < size) {
-        collect();
-        if (g_collector.free_space() < size) {
+/** Number of heaps of `GC`, or 0 for one per NUMA node */
+std::atomic<size_t> g_heap_count = 0;
+/** True once the heaps of `GC` have been created */
+std::atomic<bool> g_heaps_created = false;
+/** Index of the heap of `GC` which the calling thread is collecting, if any */
+thread_local std::optional<size_t> g_collecting;
+
+/**
+ * @brief One heap per NUMA node, or the number of heaps set by
+ * `GC::set_heap_count`, which are dealt out to the nodes in turn.
+ * Threads allocate from a heap of the node they are running on and the
+ * collection thread of each heap is pinned to that heap's node so both
+ * allocation and evacuation touch local memory. Since the pages of a heap are
+ * untouched until first use, the first-touch policy of the kernel places them
+ * on the node of the heap. A node with several heaps hands them out to its
+ * threads in turn.
+ *
+ * With more than one heap, collections of the heaps run one at a time, since
+ * a collection forwards the pointers to its heap held by the other heaps. The
+ * pointers held by an object of another heap are roots of a collection if the
+ * object was reachable from the other roots when the heaps were last marked,
+ * so garbage in one heap doesn't keep objects of another alive. `collect_all`
+ * marks once for the collections of all the heaps, and a collection of a
+ * single heap marks for itself.
+ *
+ * On machines with a single node this is a single heap.
+ */
+class NodeHeaps
+{
+  private:
+    /** A GC pointer stored in an object, by the address of the object */
+    struct Slot {
+        uintptr_t object;
+        uintptr_t offset;
+    };
+
+    /** Online node of each heap */
+    std::vector<size_t> m_nodes;
+    std::vector<std::unique_ptr<collector_t>> m_heaps;
+    /** Held by each collection of a heap */
+    std::mutex m_collection_mutex;
+    /** Number of threads which have picked a heap */
+    std::atomic<size_t> m_threads = 0;
+    /**
+     * `m_remembered[i][j]` holds the pointers into heap `j` of the objects of
+     * heap `i` which were reachable when the heaps were marked. The objects
+     * are updated as collections move them. Guarded by `m_collection_mutex`,
+     * like the members below.
+     */
+    std::vector<std::vector<std::vector<Slot>>> m_remembered;
+    /** True if `m_remembered` is up to date with the last mark */
+    bool m_marked = false;
+    /** True while `collect_all` keeps the mark for all the collections */
+    bool m_remembering = false;
+
+    /** Gets the index of the heap which contains `ptr` */
+    std::optional<size_t> heap_of(void* ptr) const
+    {
+        for (size_t i = 0; i < m_heaps.size(); ++i) {
+            if (m_heaps[i]->contains(ptr)) {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /** Forgets the pointers remembered by the last mark */
+    void clear_remembered()
+    {
+        for (auto& from : m_remembered) {
+            for (auto& slots : from) {
+                slots.clear();
+            }
+        }
+        m_marked = false;
+    }
+
+    /**
+     * @brief Marks the objects of the heaps which are reachable from the
+     * other roots, remembering the pointers between the heaps which they hold
+     */
+    void remember()
+    {
+        clear_remembered();
+        std::vector<FatPtr*> slots;
+        // the roots are gathered without this source
+        const auto collecting = std::exchange(g_collecting, std::nullopt);
+        try {
+            GC_GET_ROOTS(slots);
+        } catch (...) {
+            g_collecting = collecting;
+            throw;
+        }
+        g_collecting = collecting;
+        std::unordered_set<uintptr_t> marked;
+        std::vector<FatPtr*> fields;
+        while (!slots.empty()) {
+            const auto target = FatPtr::test_ptr(slots.back());
+            slots.pop_back();
+            if (!target) {
+                continue;
+            }
+            const auto addr = static_cast<uintptr_t>(target.value());
+            const auto from = heap_of(target->as_ptr());
+            if (!from || !marked.insert(addr).second) {
+                continue;
+            }
+            fields.clear();
+            if (!m_heaps[*from]->get_object_ptrs(target.value(), fields)) {
+                continue;
+            }
+            for (auto* field : fields) {
+                slots.push_back(field);
+                const auto field_target = FatPtr::test_ptr(field);
+                if (!field_target) {
+                    continue;
+                }
+                if (const auto to = heap_of(field_target->as_ptr());
+                    to && *to != *from) {
+                    m_remembered[*from][*to].push_back(
+                        {addr, reinterpret_cast<uintptr_t>(field) - addr});
+                }
+            }
+        }
+        m_marked = true;
+    }
+
+    /**
+     * @brief Appends the remembered pointers into the heap which the calling
+     * thread is collecting to `out`, marking first if the last mark is out of
+     * date. Other scans of the roots don't need them.
+     */
+    void get_remembered_ptrs(std::vector<FatPtr*>& out)
+    {
+        if (!g_collecting) {
+            return;
+        }
+        if (!m_marked) {
+            remember();
+        }
+        for (const auto& from : m_remembered) {
+            for (const auto& slot : from[*g_collecting]) {
+                // NOLINTNEXTLINE(performance-no-int-to-ptr)
+                out.push_back(reinterpret_cast<FatPtr*>(slot.object +
+                                                        slot.offset));
+            }
+        }
+    }
+
+    /**
+     * @brief Ends the collection of heap `heap` by the calling thread,
+     * updating the objects holding the remembered pointers of the heap
+     *
+     * @param forwarded gets the address of an object of the heap after the
+     * collection, or 0 if it was freed
+     */
+    void forward_remembered(
+        size_t heap, const std::function<uintptr_t(uintptr_t)>& forwarded)
+    {
+        g_collecting.reset();
+        if (!m_remembering) {
+            // the mark was only for this collection
+            clear_remembered();
+            return;
+        }
+        for (auto& slots : m_remembered[heap]) {
+            for (auto& slot : slots) {
+                slot.object = forwarded(slot.object);
+            }
+            std::erase_if(slots,
+                          [](const Slot& slot) { return slot.object == 0; });
+        }
+    }
+
+  public:
+    NodeHeaps() : m_nodes(gcpp::numa_nodes())
+    {
+        g_heaps_created = true;
+        const auto count = g_heap_count.load() == 0 ? m_nodes.size()
+                                                     : g_heap_count.load();
+        m_heaps.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            m_heaps.push_back(std::make_unique<collector_t>(heap_size));
+        }
+        for (size_t i = 0; i < count; ++i) {
+            m_heaps[i]->set_collection_hook(
+                [i, node = m_nodes[i % m_nodes.size()],
+                 pin = m_nodes.size() > 1]() {
+                    if (pin) {
+                        thread_local const auto pinned =
+                            gcpp::pin_to_numa_node(node);
+                        (void)pinned;
+                    }
+                    g_collecting = i;
+                });
+        }
+        if (count > 1) {
+            m_remembered.assign(count,
+                                std::vector<std::vector<Slot>>(count));
+            for (size_t i = 0; i < count; ++i) {
+                m_heaps[i]->set_collection_mutex(m_collection_mutex);
+                m_heaps[i]->set_forwarding_hook(
+                    [this, i](const auto& forwarded) {
+                        forward_remembered(i, forwarded);
+                    });
+            }
+            // objects in one heap may be referenced from objects in another
+            gcpp::GCRoots::get_instance().add_root_source(
+                [this](std::vector<FatPtr*>& out) {
+                    get_remembered_ptrs(out);
+                });
+        }
+    }
+
+    /**
+     * @brief Collects every heap, with a single mark of the pointers between
+     * them, and waits for the collections to finish
+     */
+    void collect_all() noexcept
+    {
+        if (m_heaps.size() > 1) {
+            auto lk = std::unique_lock{m_collection_mutex};
+            try {
+                remember();
+                m_remembering = true;
+            } catch (...) {
+                // each collection marks for itself instead
+                clear_remembered();
+            }
+        }
+        for (const auto& heap : m_heaps) {
+            heap->collect();
+        }
+        for (const auto& heap : m_heaps) {
+            heap->wait_for_collection();
+        }
+        if (m_heaps.size() > 1) {
+            auto lk = std::unique_lock{m_collection_mutex};
+            m_remembering = false;
+            clear_remembered();
+        }
+    }
+
+    /** Gets the heap of the calling thread on the node it is running on */
+    collector_t& local()
+    {
+        if (m_heaps.size() == 1) {
+            return *m_heaps.front();
+        }
+        thread_local const auto thread_index = m_threads++;
+        const auto node = static_cast<size_t>(
+            std::ranges::lower_bound(m_nodes, gcpp::current_numa_node()) -
+            m_nodes.begin());
+        const auto stride = m_nodes.size();
+        if (node >= m_heaps.size()) {
+            return *m_heaps[node % m_heaps.size()];
+        }
+        // heaps `node`, `node + stride`, ... are on the node
+        const auto node_heaps = (m_heaps.size() - node + stride - 1) / stride;
+        return *m_heaps[node + (thread_index % node_heaps) * stride];
+    }
+
+    /**
+     * @brief Gets the heap which contains `ptr`
+     * @throws `std::out_of_range` if no heap contains `ptr`
+     */
+    collector_t& owner(const FatPtr& ptr)
+    {
+        const auto addr = FatPtr::test_ptr(&ptr);
+        for (const auto& heap : m_heaps) {
+            if (addr && heap->contains(addr->as_ptr())) {
+                return *heap;
+            }
+        }
+        throw std::out_of_range("No heap contains the given ptr");
+    }
+
+    /** Determines if any heap contains `ptr` */
+    bool contains(void* ptr) const
+    {
+        return std::ranges::any_of(
+            m_heaps, [ptr](const auto& heap) { return heap->contains(ptr); });
+    }
+
+    auto begin() { return m_heaps.begin(); }
+    auto end() { return m_heaps.end(); }
+};
+
+/**
+ * @brief Gets the heaps of the global GC.
+ * Constructed on first use so that the root scanner is not created before
+ * the globals of the program are initialized
+ */
+NodeHeaps& heaps()
+{
+    static NodeHeaps g_heaps;
+    return g_heaps;
+}
+
+/**
+ * @brief Frees the unreachable large objects. Should follow a collection of
+ * the heaps, so that garbage on them doesn't keep large objects alive.
+ */
+void sweep_large_objects()
+{
+    // a collection in progress may be moving the heap pointers the sweep
+    // marks from
+    for (auto& heap : heaps()) {
+        heap->wait_for_collection();
+    }
+    gcpp::LargeObjectSpace::get_instance().sweep(
+        [](std::vector<FatPtr*>& out) {
+            GC_GET_ROOTS(out);
+            for (auto& heap : heaps()) {
+                heap->get_pinned_ptrs(out);
+            }
+        },
+        [](const FatPtr& ptr, std::vector<FatPtr*>& out) {
+            return std::ranges::any_of(heaps(), [&ptr, &out](auto& heap) {
+                return heap->get_object_ptrs(ptr, out);
+            });
+        },
+        [](uintptr_t addr) -> std::optional<FatPtr> {
+            for (auto& heap : heaps()) {
+                if (auto start = heap->object_start(
+                        // NOLINTNEXTLINE(performance-no-int-to-ptr)
+                        reinterpret_cast<void*>(addr))) {
+                    return start;
+                }
+            }
+            return std::nullopt;
+        });
+}
+
+thread_local uintptr_t g_thread_heap_size = thread_heap_size;
+thread_local std::unique_ptr<local_collector_t> g_thread_heap;
+/** True once `ThreadLocalGC::enable_interior_pointers` has been called */
+std::atomic<bool> g_thread_interior_pointers = false;
+
+/** Gets the heap of the calling thread, creating it on first use */
+local_collector_t& thread_heap()
+{
+    if (!g_thread_heap) {
+        g_thread_heap = std::make_unique<local_collector_t>(g_thread_heap_size);
+    }
+    return *g_thread_heap;
+}
+
+/** Collects the calling thread's heap */
+void collect_thread_heap(local_collector_t& heap)
+{
+    // threads may have created their heaps before interior pointers were
+    // enabled
+    if (g_thread_interior_pointers) {
+        heap.enable_interior_pointers();
+    }
+    heap.collect();
+}
+}  // namespace
+
+FatPtr gcpp::GC::alloc(size_t size, std::align_val_t alignment,
+                       FinalizerFn finalizer,
+                       const CompressedLayout* compressed)
+{
+    // promotions don't re-encode compressed references, so objects holding
+    // them are allocated from the heaps
+    if (auto* arena = ArenaScope::current();
+        arena != nullptr && compressed == nullptr) {
+        if (const auto ptr = arena->alloc(size, alignment, finalizer)) {
+            return ptr.value();
+        }
+    }
+    // compressed references of large objects wouldn't be traced
+    if (size >= LargeObjectSpace::min_size && compressed == nullptr &&
+        static_cast<size_t>(alignment) <= static_cast<size_t>(page_size())) {
+        auto& space = LargeObjectSpace::get_instance();
+        if (space.sweep_due()) {
+            GC_UPDATE_STACK_RANGE();
+            sweep_large_objects();
+        }
+        return space.alloc(size, finalizer);
+    }
+    auto& heap = heaps().local();
+    if (heap.free_space() < size) {
+        GC_UPDATE_STACK_RANGE();
+        heap.collect();
+        if (heap.free_space() < size) {
             throw std::bad_alloc();
         }
     }
-    return g_collector.alloc(size, alignment);
+    return heap.alloc(size, alignment, finalizer, compressed);
+}
+
+std::vector<FatPtr> gcpp::GC::alloc_batch(size_t count, size_t size,
+                                          std::align_val_t alignment,
+                                          FinalizerFn finalizer,
+                                          const CompressedLayout* compressed)
+{
+    std::vector<FatPtr> res;
+    if (auto* arena = ArenaScope::current();
+        arena != nullptr && compressed == nullptr) {
+        res.reserve(count);
+        while (res.size() < count) {
+            const auto ptr = arena->alloc(size, alignment, finalizer);
+            if (!ptr) {
+                break;
+            }
+            res.push_back(ptr.value());
+        }
+        if (res.size() == count) {
+            return res;
+        }
+    }
+    // the rest of the objects don't fit the arena
+    count -= res.size();
+    auto& heap = heaps().local();
+    if (heap.free_space() / std::max(size, size_t{1}) < count) {
+        GC_UPDATE_STACK_RANGE();
+        heap.collect();
+    }
+    auto rest = heap.alloc_batch(count, size, alignment, finalizer, compressed);
+    if (res.empty()) {
+        return rest;
+    }
+    res.insert(res.end(), rest.begin(), rest.end());
+    return res;
 }
 
 void gcpp::GC::collect() noexcept
 {
     GC_UPDATE_STACK_RANGE();
-    g_collector.collect();
+    heaps().collect_all();
+    sweep_large_objects();
+}
+
+void gcpp::GC::pin(const FatPtr& ptr)
+{
+    if (ArenaScope::owns(ptr.as_ptr())) {
+        return;
+    }
+    if (auto& space = LargeObjectSpace::get_instance();
+        space.contains(ptr.as_ptr())) {
+        space.pin(ptr);
+        return;
+    }
+    heaps().owner(ptr).pin(ptr);
+}
+
+void gcpp::GC::unpin(const FatPtr& ptr)
+{
+    if (ArenaScope::owns(ptr.as_ptr())) {
+        return;
+    }
+    if (auto& space = LargeObjectSpace::get_instance();
+        space.contains(ptr.as_ptr())) {
+        space.unpin(ptr);
+        return;
+    }
+    heaps().owner(ptr).unpin(ptr);
+}
+
+std::optional<FatPtr> gcpp::GC::clone_large(const FatPtr& ptr)
+{
+    auto& space = LargeObjectSpace::get_instance();
+    GC_UPDATE_STACK_RANGE();
+    if (space.sweep_due()) {
+        sweep_large_objects();
+    }
+    try {
+        return space.clone(ptr);
+    } catch (const std::system_error& e) {
+        if (e.code() != std::errc::too_many_files_open &&
+            e.code() != std::errc::too_many_files_open_in_system) {
+            throw;
+        }
+    }
+    // the sweep closes the files of the unreachable clones
+    sweep_large_objects();
+    return space.clone(ptr);
+}
+
+FatPtr gcpp::GC::alloc_pinned(size_t size, std::align_val_t alignment)
+{
+    if (size >= LargeObjectSpace::min_size &&
+        static_cast<size_t>(alignment) <= static_cast<size_t>(page_size())) {
+        auto& space = LargeObjectSpace::get_instance();
+        if (space.sweep_due()) {
+            GC_UPDATE_STACK_RANGE();
+            sweep_large_objects();
+        }
+        const auto ptr = space.alloc(size, nullptr);
+        space.pin(ptr);
+        return ptr;
+    }
+    auto& heap = heaps().local();
+    // `ptr` must be a root in case a collection forwards it before it's pinned
+    GC_UPDATE_STACK_RANGE();
+    if (heap.free_space() < size) {
+        heap.collect();
+        if (heap.free_space() < size) {
+            throw std::bad_alloc();
+        }
+    }
+    const auto ptr = heap.alloc(size, alignment);
+    heap.pin(ptr);
+    return ptr;
+}
+
+FatPtr gcpp::GC::alloc_storage(size_t size, std::align_val_t alignment,
+                               const void* holder)
+{
+    const auto addr = FatPtr{reinterpret_cast<uintptr_t>(holder)};
+    if (size >= LargeObjectSpace::min_size ||
+        !heaps().contains(addr.as_ptr())) {
+        return alloc_pinned(size, alignment);
+    }
+    auto& heap = heaps().owner(addr);
+    // `ptr` must be a root in case a collection forwards it before it's
+    // attached
+    GC_UPDATE_STACK_RANGE();
+    if (heap.free_space() < size) {
+        heap.collect();
+        if (heap.free_space() < size) {
+            throw std::bad_alloc();
+        }
+    }
+    auto ptr = heap.alloc(size, alignment);
+    if (!heap.attach_storage(holder, ptr)) {
+        heap.pin(ptr);
+    }
+    return ptr;
+}
+
+void gcpp::GC::free_storage(const FatPtr& ptr) noexcept
+{
+    try {
+        if (heaps().contains(ptr.as_ptr()) &&
+            heaps().owner(ptr).detach_storage(ptr)) {
+            return;
+        }
+        unpin(ptr);
+    } catch (const std::exception&) {
+        // storage which is neither attached nor pinned has nothing to release
+    }
+}
+
+void gcpp::GC::forward_external(
+    const std::unordered_map<uintptr_t, FatPtr>& moved)
+{
+    for (auto& heap : heaps()) {
+        heap->forward_external(moved);
+    }
+}
+
+void gcpp::GC::enable_interior_pointers()
+{
+    for (auto& heap : heaps()) {
+        heap->enable_interior_pointers();
+    }
+    LargeObjectSpace::get_instance().enable_interior_pointers();
+}
+
+FatPtr gcpp::ThreadLocalGC::alloc(size_t size, std::align_val_t alignment,
+                                  FinalizerFn finalizer,
+                                  const CompressedLayout* compressed)
+{
+    auto& heap = thread_heap();
+    if (heap.free_space() < size) {
+        GC_UPDATE_STACK_RANGE();
+        collect_thread_heap(heap);
+        if (heap.free_space() < size) {
+            throw std::bad_alloc();
+        }
+    }
+    return heap.alloc(size, alignment, finalizer, compressed);
+}
+
+std::vector<FatPtr> gcpp::ThreadLocalGC::alloc_batch(
+    size_t count, size_t size, std::align_val_t alignment,
+    FinalizerFn finalizer, const CompressedLayout* compressed)
+{
+    auto& heap = thread_heap();
+    if (heap.free_space() / std::max(size, size_t{1}) < count) {
+        GC_UPDATE_STACK_RANGE();
+        collect_thread_heap(heap);
+    }
+    return heap.alloc_batch(count, size, alignment, finalizer, compressed);
+}
+
+void gcpp::ThreadLocalGC::collect() noexcept
+{
+    if (g_thread_heap) {
+        GC_UPDATE_STACK_RANGE();
+        collect_thread_heap(*g_thread_heap);
+    }
+}
+
+void gcpp::ThreadLocalGC::pin(const FatPtr& ptr) { thread_heap().pin(ptr); }
+
+void gcpp::ThreadLocalGC::unpin(const FatPtr& ptr)
+{
+    thread_heap().unpin(ptr);
+}
+
+void gcpp::ThreadLocalGC::enable_interior_pointers()
+{
+    g_thread_interior_pointers = true;
+}
+
+FatPtr gcpp::ThreadLocalGC::publish(const FatPtr& root)
+{
+    if (!g_thread_heap) {
+        return root;
+    }
+    GC_UPDATE_STACK_RANGE();
+    // the copies must be on the shared heap, not in an arena of the thread
+    const auto suspended = ArenaScope::Suspension{};
+    // the copies are only referenced by each other until `transfer` returns,
+    // so they are pinned to keep shared collections from freeing them
+    std::vector<FatPtr> copies;
+    const auto unpin_copies = [&copies]() {
+        for (const auto& copy : copies) {
+            GC::unpin(copy);
+        }
+    };
+    try {
+        const auto res = g_thread_heap->transfer(
+            root, [&copies](const MetaData& meta_data) {
+                auto copy = GC::alloc(meta_data.size, meta_data.alignment,
+                                      meta_data.finalizer,
+                                      meta_data.compressed);
+                GC::pin(copy);
+                copies.push_back(copy);
+                return copy;
+            });
+        unpin_copies();
+        return res;
+    } catch (...) {
+        unpin_copies();
+        throw;
+    }
+}
+
+void gcpp::GC::set_heap_count(size_t count)
+{
+    if (count == 0) {
+        throw std::invalid_argument("GC needs at least one heap");
+    }
+    if (g_heaps_created) {
+        throw std::logic_error("The heaps of GC already exist");
+    }
+    g_heap_count = count;
+}
+
+void gcpp::ThreadLocalGC::set_heap_size(size_t size)
+{
+    if (g_thread_heap) {
+        throw std::logic_error("The heap of this thread already exists");
+    }
+    g_thread_heap_size = size;
+}
+
+void gcpp::dump_heap(const std::string& path)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    HeapDumpWriter out(file);
+    // the locals of the caller are roots too
+    GC_UPDATE_STACK_RANGE_NESTED_1();
+    const auto roots_in_use = GCRoots::RootsInUse{};
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    auto& space = LargeObjectSpace::get_instance();
+    for (auto* root : roots) {
+        // pointers held by one heap for another, or by large objects, are
+        // edges, not roots
+        if (heaps().contains(root) || space.contains(root)) {
+            continue;
+        }
+        if (const auto target = FatPtr::test_ptr(root);
+            target && (heaps().contains(target->as_ptr()) ||
+                       space.contains(target->as_ptr()))) {
+            out.root(static_cast<uintptr_t>(target.value()));
+        }
+    }
+    for (auto& heap : heaps()) {
+        heap->dump(out);
+    }
+    space.dump(out);
+    out.finish();
 }
 
 std::unique_lock<std::mutex> gcpp::test_lock()
 {
-    return g_collector.test_lock();
-}
\ No newline at end of file
+    return heaps().local().test_lock();
+}
@@ -0,0 +1,115 @@
+#include "userfault.h"
+
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+
+#include "mem_prot.h"
+
+namespace
+{
+[[noreturn]] void throw_uffd_error(const char* what, const void* addr)
+{
+    std::stringstream ss;
+    ss << "Could not " << what << " at " << std::hex << addr
+       << ". Error code: " << std::dec << errno;
+    throw std::runtime_error(ss.str());
+}
+}  // namespace
+
+std::unique_ptr<gcpp::UserFaultFd> gcpp::UserFaultFd::open()
+{
+    // user mode only faults don't need privileges
+    auto fd = static_cast<int>(syscall(
+        SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+    if (fd < 0 && errno == EINVAL) {
+        // kernel predates UFFD_USER_MODE_ONLY
+        fd = static_cast<int>(
+            syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+    }
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto uffd = std::unique_ptr<UserFaultFd>(new UserFaultFd(fd));
+    uffdio_api api{};
+    api.api = UFFD_API;
+    if (ioctl(fd, UFFDIO_API, &api) != 0) {
+        return nullptr;
+    }
+    return uffd;
+}
+
+gcpp::UserFaultFd::~UserFaultFd() { close(m_fd); }
+
+bool gcpp::UserFaultFd::register_range(void* start, size_t len) noexcept
+{
+    uffdio_register reg{};
+    reg.range.start = reinterpret_cast<uintptr_t>(start);
+    reg.range.len = len;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+    if (ioctl(m_fd, UFFDIO_REGISTER, &reg) != 0) {
+        return false;
+    }
+    if ((reg.ioctls & (static_cast<uint64_t>(1) << _UFFDIO_COPY)) == 0) {
+        unregister_range(start, len);
+        return false;
+    }
+    return true;
+}
+
+void gcpp::UserFaultFd::unregister_range(void* start, size_t len)
+{
+    uffdio_range range{reinterpret_cast<uintptr_t>(start), len};
+    if (ioctl(m_fd, UFFDIO_UNREGISTER, &range) != 0) {
+        throw_uffd_error("unregister range", start);
+    }
+}
+
+bool gcpp::UserFaultFd::copy_page(void* dst, const void* src)
+{
+    uffdio_copy copy{};
+    copy.dst = reinterpret_cast<uintptr_t>(dst);
+    copy.src = reinterpret_cast<uintptr_t>(src);
+    copy.len = static_cast<uint64_t>(page_size());
+    while (ioctl(m_fd, UFFDIO_COPY, &copy) != 0) {
+        if (errno == EEXIST) {
+            return false;
+        } else if (errno != EAGAIN) {
+            throw_uffd_error("fill page", dst);
+        }
+        copy.copy = 0;
+    }
+    return true;
+}
+
+void gcpp::UserFaultFd::wake(void* page)
+{
+    uffdio_range range{reinterpret_cast<uintptr_t>(page),
+                       static_cast<uint64_t>(page_size())};
+    if (ioctl(m_fd, UFFDIO_WAKE, &range) != 0) {
+        throw_uffd_error("wake page", page);
+    }
+}
+
+std::optional<void*> gcpp::UserFaultFd::wait_fault(
+    std::chrono::milliseconds timeout)
+{
+    pollfd poll_fd{m_fd, POLLIN, 0};
+    if (poll(&poll_fd, 1, static_cast<int>(timeout.count())) <= 0) {
+        return {};
+    }
+    uffd_msg msg{};
+    if (read(m_fd, &msg, sizeof(msg)) != sizeof(msg) ||
+        msg.event != UFFD_EVENT_PAGEFAULT) {
+        return {};
+    }
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    return reinterpret_cast<void*>(msg.arg.pagefault.address);
+}
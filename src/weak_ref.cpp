@@ -0,0 +1,64 @@
+#include "weak_ref.h"
+
+#include <algorithm>
+
+#include "arena.h"
+
+gcpp::WeakRefs& gcpp::WeakRefs::get_instance()
+{
+    if (g_instance == nullptr) {
+        std::call_once(g_instance_flag, []() {
+            g_instance = std::unique_ptr<WeakRefs>(new WeakRefs());
+        });
+    }
+    return *g_instance;
+}
+
+std::shared_ptr<gcpp::WeakRefs::Cell> gcpp::WeakRefs::make_cell(
+    uintptr_t target)
+{
+    ArenaScope::note_weak_ref(target);
+    auto cell = std::make_shared<Cell>();
+    cell->target = target;
+    auto lk = std::unique_lock{m_mutex};
+    m_cells.emplace_back(cell);
+    return cell;
+}
+
+uintptr_t gcpp::WeakRefs::load(const Cell& cell)
+{
+    auto lk = std::unique_lock{m_mutex};
+    m_collection_done.wait(lk, [this]() { return m_collections == 0; });
+    return cell.target;
+}
+
+void gcpp::WeakRefs::load(const Cell& cell,
+                          const std::function<void(uintptr_t)>& use)
+{
+    auto lk = std::unique_lock{m_mutex};
+    m_collection_done.wait(lk, [this]() { return m_collections == 0; });
+    // `begin_collection` waits for the lock
+    use(cell.target);
+}
+
+void gcpp::WeakRefs::begin_collection()
+{
+    auto lk = std::unique_lock{m_mutex};
+    ++m_collections;
+}
+
+void gcpp::WeakRefs::end_collection(
+    const std::function<uintptr_t(uintptr_t)>& update)
+{
+    {
+        auto lk = std::unique_lock{m_mutex};
+        std::erase_if(m_cells, [](const auto& cell) { return cell.expired(); });
+        for (const auto& weak_cell : m_cells) {
+            if (const auto cell = weak_cell.lock(); cell && cell->target != 0) {
+                cell->target = update(cell->target);
+            }
+        }
+        --m_collections;
+    }
+    m_collection_done.notify_all();
+}
@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "concurrent_gc.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+#include "mark_compact_collector.h"
+#include "weak_ref.h"
+
+template <typename T>
+class CompactTest : public testing::Test
+{
+};
+
+template <typename T>
+using Compactor = gcpp::MarkCompactCollector<T, gcpp::FinalGenerationPolicy>;
+
+using TypeParams =
+    testing::Types<gcpp::SerialGCPolicy, gcpp::ConcurrentGCPolicy>;
+TYPED_TEST_SUITE(CompactTest, TypeParams);
+
+/** Overwrites the stack below the caller to remove stale GC pointers */
+__attribute__((noinline)) void clobber_stack()
+{
+    volatile std::array<std::byte, 4096> buf{};
+    (void)buf;
+}
+
+template <typename T>
+__attribute__((noinline)) void alloc_garbage(Compactor<T>& collector,
+                                             int count)
+{
+    for (int i = 0; i < count; ++i) {
+        auto ptr = collector.alloc(16);
+        memset(ptr.as_ptr(), 10 + i, 16);
+    }
+}
+
+TYPED_TEST(CompactTest, Alloc)
+{
+    auto collector = Compactor<TypeParam>{4096};
+    std::vector<std::pair<FatPtr, std::byte>> ptrs;
+    for (int i = 0; i < 16; ++i) {
+        auto ptr = collector.alloc(100);
+        memset(ptr.as_ptr(), i, 100);
+        ptrs.emplace_back(ptr, static_cast<std::byte>(i));
+    }
+    for (auto [ptr, data] : ptrs) {
+        for (int j = 0; j < 100; ++j) {
+            ASSERT_EQ(ptr.as_ptr()[j], data);
+        }
+    }
+    // no reserve space is needed
+    ASSERT_EQ(collector.free_space(), 4096 - 1600);
+}
+
+TYPED_TEST(CompactTest, Collect)
+{
+    auto collector = Compactor<TypeParam>{4096};
+    alloc_garbage(collector, 10);
+    auto persist1 = collector.alloc(16);
+    const auto data1 = persist1.as_ptr();
+    memset(persist1.as_ptr(), 1, 16);
+    alloc_garbage(collector, 10);
+    auto persist2 = collector.alloc(16);
+    const auto data2 = persist2.as_ptr();
+    memset(persist2.as_ptr(), 2, 16);
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_EQ(collector.free_space(), 4096 - 32);
+    // survivors are slid to the start of the heap in allocation order
+    ASSERT_LT(persist1.as_ptr(), data1);
+    ASSERT_LT(persist2.as_ptr(), data2);
+    ASSERT_EQ(persist1.as_ptr() + 16, persist2.as_ptr());
+    for (int i = 0; i < 16; ++i) {
+        ASSERT_EQ(persist1.as_ptr()[i], std::byte{1});
+        ASSERT_EQ(persist2.as_ptr()[i], std::byte{2});
+    }
+}
+
+TYPED_TEST(CompactTest, AlignedCollect)
+{
+    auto collector = Compactor<TypeParam>{4096};
+    alloc_garbage(collector, 3);
+    auto ptr = collector.alloc(64, std::align_val_t{64});
+    memset(ptr.as_ptr(), 3, 64);
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr.as_ptr()) % 64, 0);
+    for (int i = 0; i < 64; ++i) {
+        ASSERT_EQ(ptr.as_ptr()[i], std::byte{3});
+    }
+}
+
+TYPED_TEST(CompactTest, RepeatedCollectLinkedList)
+{
+    auto collector = Compactor<TypeParam>{4096};
+    constexpr auto size = sizeof(FatPtr) + sizeof(int);
+    auto node = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+    const auto head = node;
+    for (int i = 0; i < 16; ++i) {
+        alloc_garbage(collector, 2);
+        auto next = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+        memcpy(node.as_ptr(), &next, sizeof(next));
+        memcpy(node.as_ptr() + sizeof(next), &i, sizeof(i));
+        node = next;
+    }
+    const auto null = FatPtr{0};
+    memcpy(node.as_ptr(), &null, sizeof(node));
+    int num = 16;
+    memcpy(node.as_ptr() + sizeof(node), &num, sizeof(num));
+    node = null;
+    for (int gc = 0; gc < 3; ++gc) {
+        clobber_stack();
+        std::vector<FatPtr*> roots;
+        GC_GET_ROOTS(roots);
+        (void)collector.async_collect(roots).get();
+        alloc_garbage(collector, 8);
+    }
+    int i = 0;
+    node = head;
+    while (node != null) {
+        ASSERT_TRUE(collector.contains(node.as_ptr()));
+        memcpy(&num, node.as_ptr() + sizeof(node), sizeof(num));
+        memcpy(&node, node.as_ptr(), sizeof(node));
+        ASSERT_EQ(num, i++);
+    }
+    ASSERT_EQ(i, 17);
+}
+
+TYPED_TEST(CompactTest, AutoCollect)
+{
+    auto collector = Compactor<TypeParam>{4096};
+    auto ptr = collector.alloc(100);
+    memset(ptr.as_ptr(), 7, 100);
+    // only possible if the whole heap is reused
+    for (int i = 0; i < 64; ++i) {
+        alloc_garbage(collector, 5);
+    }
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(ptr.as_ptr()[i], std::byte{7});
+    }
+}
+
+template <typename T>
+__attribute__((noinline)) auto make_garbage_cell(Compactor<T>& collector)
+{
+    auto ptr = collector.alloc(16);
+    memset(ptr.as_ptr(), 0, 16);
+    return gcpp::WeakRefs::get_instance().make_cell(
+        static_cast<uintptr_t>(ptr));
+}
+
+TYPED_TEST(CompactTest, WeakRefs)
+{
+    auto collector = Compactor<TypeParam>{4096};
+    auto live = collector.alloc(16);
+    memset(live.as_ptr(), 1, 16);
+    const auto live_cell = gcpp::WeakRefs::get_instance().make_cell(
+        static_cast<uintptr_t>(live));
+    const auto dead_cell = make_garbage_cell(collector);
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_EQ(gcpp::WeakRefs::get_instance().load(*live_cell),
+              static_cast<uintptr_t>(live));
+    ASSERT_EQ(gcpp::WeakRefs::get_instance().load(*dead_cell), 0);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<int> g_finalized = 0;
+
+template <typename T>
+__attribute__((noinline)) void alloc_finalized_garbage(Compactor<T>& collector)
+{
+    auto ptr = collector.alloc(16, std::align_val_t{1},
+                               [](void* obj, size_t size) {
+                                   ASSERT_EQ(size, 16);
+                                   ASSERT_EQ(static_cast<std::byte*>(obj)[0],
+                                             std::byte{5});
+                                   ++g_finalized;
+                               });
+    memset(ptr.as_ptr(), 5, 16);
+}
+
+TYPED_TEST(CompactTest, Finalization)
+{
+    g_finalized = 0;
+    auto collector = Compactor<TypeParam>{4096};
+    alloc_garbage(collector, 4);
+    alloc_finalized_garbage(collector);
+    auto live = collector.alloc(16, std::align_val_t{1},
+                                [](void*, size_t) { ++g_finalized; });
+    memset(live.as_ptr(), 1, 16);
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    // the next collection waits for the finalizers of the last one
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_EQ(g_finalized, 1);
+    ASSERT_EQ(live.as_ptr()[0], std::byte{1});
+}
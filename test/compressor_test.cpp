@@ -0,0 +1,221 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "compressor_collector.h"
+#include "concurrent_gc.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+#include "weak_ref.h"
+
+template <typename Policy, gcpp::FaultMode Mode>
+struct Config {
+    using policy = Policy;
+    static constexpr auto mode = Mode;
+};
+
+template <typename T>
+class CompressorTest : public testing::Test
+{
+};
+
+template <typename P>
+using Compressor = gcpp::CompressorCollector<P, gcpp::FinalGenerationPolicy>;
+
+using TypeParams = testing::Types<
+    Config<gcpp::SerialGCPolicy, gcpp::FaultMode::Protect>,
+    Config<gcpp::SerialGCPolicy, gcpp::FaultMode::UserFault>,
+    Config<gcpp::ConcurrentGCPolicy, gcpp::FaultMode::Protect>,
+    Config<gcpp::ConcurrentGCPolicy, gcpp::FaultMode::UserFault>>;
+TYPED_TEST_SUITE(CompressorTest, TypeParams);
+
+/**
+ * @brief Makes a collector for the config, or nullptr if the fault mode is
+ * unavailable
+ */
+template <typename T>
+std::unique_ptr<Compressor<typename T::policy>> make_collector(size_t size)
+{
+    try {
+        return std::make_unique<Compressor<typename T::policy>>(size, T::mode);
+    } catch (const std::runtime_error&) {
+        return nullptr;
+    }
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-macro-usage)
+#define MAKE_COLLECTOR(name, size)                          \
+    auto name##_ptr = make_collector<TypeParam>(size);      \
+    if (!name##_ptr) {                                      \
+        GTEST_SKIP() << "userfaultfd is unavailable";       \
+    }                                                       \
+    auto& name = *name##_ptr;
+
+/** Overwrites the stack below the caller to remove stale GC pointers */
+__attribute__((noinline)) void clobber_stack()
+{
+    volatile std::array<std::byte, 4096> buf{};
+    (void)buf;
+}
+
+template <typename P>
+__attribute__((noinline)) void alloc_garbage(Compressor<P>& collector,
+                                             int count)
+{
+    for (int i = 0; i < count; ++i) {
+        auto ptr = collector.alloc(16);
+        memset(ptr.as_ptr(), 10 + i, 16);
+    }
+}
+
+TYPED_TEST(CompressorTest, Collect)
+{
+    MAKE_COLLECTOR(collector, 4096);
+    ASSERT_EQ(collector.fault_mode(), TypeParam::mode);
+    alloc_garbage(collector, 10);
+    auto persist1 = collector.alloc(16);
+    memset(persist1.as_ptr(), 1, 16);
+    alloc_garbage(collector, 10);
+    auto persist2 = collector.alloc(16);
+    memset(persist2.as_ptr(), 2, 16);
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_EQ(collector.free_space(), 4096 - 32);
+    ASSERT_EQ(persist1.as_ptr() + 16, persist2.as_ptr());
+    for (int i = 0; i < 16; ++i) {
+        ASSERT_EQ(persist1.as_ptr()[i], std::byte{1});
+        ASSERT_EQ(persist2.as_ptr()[i], std::byte{2});
+    }
+}
+
+/**
+ * @brief Allocates a linked list of `count` nodes, each with the index of the
+ * node and large enough that the list spans several pages
+ *
+ * @return the head of the list
+ */
+template <typename P>
+FatPtr alloc_list(Compressor<P>& collector, int count)
+{
+    constexpr auto size = 1000;
+    auto node = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+    const auto head = node;
+    for (int i = 0; i < count; ++i) {
+        alloc_garbage(collector, 2);
+        auto next = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+        memcpy(node.as_ptr(), &next, sizeof(next));
+        memcpy(node.as_ptr() + sizeof(next), &i, sizeof(i));
+        node = next;
+    }
+    const auto null = FatPtr{0};
+    memcpy(node.as_ptr(), &null, sizeof(node));
+    memcpy(node.as_ptr() + sizeof(node), &count, sizeof(count));
+    return head;
+}
+
+/** Checks the list allocated with `alloc_list` */
+template <typename P>
+void check_list(Compressor<P>& collector, FatPtr node, int count)
+{
+    const auto null = FatPtr{0};
+    int i = 0;
+    int num = 0;
+    while (node != null) {
+        ASSERT_TRUE(collector.contains(node.as_ptr()));
+        memcpy(&num, node.as_ptr() + sizeof(node), sizeof(num));
+        memcpy(&node, node.as_ptr(), sizeof(node));
+        ASSERT_EQ(num, i++);
+    }
+    ASSERT_EQ(i, count + 1);
+}
+
+TYPED_TEST(CompressorTest, RepeatedCollectLinkedList)
+{
+    MAKE_COLLECTOR(collector, 64 * 1024);
+    const auto head = alloc_list(collector, 16);
+    for (int gc = 0; gc < 3; ++gc) {
+        clobber_stack();
+        std::vector<FatPtr*> roots;
+        GC_GET_ROOTS(roots);
+        (void)collector.async_collect(roots).get();
+        alloc_garbage(collector, 8);
+    }
+    check_list(collector, head, 16);
+}
+
+TYPED_TEST(CompressorTest, EvacuateOnFault)
+{
+    if constexpr (std::is_same_v<typename TypeParam::policy,
+                                 gcpp::SerialGCPolicy>) {
+        GTEST_SKIP() << "Mutators can't run during serial collections";
+    }
+    MAKE_COLLECTOR(collector, 64 * 1024);
+    const auto head = alloc_list(collector, 16);
+    std::promise<void> paused;
+    std::promise<void> resume;
+    // stop the background evacuation so that the mutator faults on every page
+    collector.set_evacuation_hook(
+        [&paused, resume_fut = resume.get_future().share()]() {
+            paused.set_value();
+            resume_fut.wait();
+        });
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    auto result = collector.async_collect(roots);
+    paused.get_future().wait();
+    check_list(collector, head, 16);
+    // allocate into the partially evacuated last page
+    memset(collector.alloc(64).as_ptr(), 0xAB, 64);
+    resume.set_value();
+    (void)result.get();
+    check_list(collector, head, 16);
+}
+
+TYPED_TEST(CompressorTest, AutoCollect)
+{
+    MAKE_COLLECTOR(collector, 4096);
+    auto ptr = collector.alloc(100);
+    memset(ptr.as_ptr(), 7, 100);
+    for (int i = 0; i < 64; ++i) {
+        alloc_garbage(collector, 5);
+    }
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(ptr.as_ptr()[i], std::byte{7});
+    }
+}
+
+template <typename P>
+__attribute__((noinline)) auto make_garbage_cell(Compressor<P>& collector)
+{
+    auto ptr = collector.alloc(16);
+    memset(ptr.as_ptr(), 0, 16);
+    return gcpp::WeakRefs::get_instance().make_cell(
+        static_cast<uintptr_t>(ptr));
+}
+
+TYPED_TEST(CompressorTest, WeakRefs)
+{
+    MAKE_COLLECTOR(collector, 4096);
+    auto live = collector.alloc(16);
+    memset(live.as_ptr(), 1, 16);
+    const auto live_cell = gcpp::WeakRefs::get_instance().make_cell(
+        static_cast<uintptr_t>(live));
+    const auto dead_cell = make_garbage_cell(collector);
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_EQ(gcpp::WeakRefs::get_instance().load(*live_cell),
+              static_cast<uintptr_t>(live));
+    ASSERT_EQ(gcpp::WeakRefs::get_instance().load(*dead_cell), 0);
+}
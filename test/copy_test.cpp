@@ -1,15 +1,24 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <new>
 #include <optional>
 #include <random>
 #include <ranges>
+#include <sstream>
+#include <thread>
 
+#include "alloc_profiler.h"
+#include "compressed_ptr.h"
 #include "concurrent_gc.h"
 #include "copy_collector.h"
 #include "gc_base.h"
 #include "gc_scan.h"
+#include "heap_dump.h"
+#include "weak_ref.h"
 
 template <typename T>
 class CopyTest : public testing::Test
@@ -214,4 +223,663 @@ TYPED_TEST(CopyTest, RepeatedRealloc)
     for (size_t i = 0; i < 100; ++i) {
         ASSERT_EQ(array[i], i & 0xFF);
     }
-}
\ No newline at end of file
+}
+
+template <typename T>
+__attribute__((noinline)) auto make_garbage_cell(
+    gcpp::CopyingCollector<T, gcpp::FinalGenerationPolicy>& collector)
+{
+    auto ptr = collector.alloc(16);
+    memset(ptr.as_ptr(), 0, 16);
+    return gcpp::WeakRefs::get_instance().make_cell(
+        static_cast<uintptr_t>(ptr));
+}
+
+/** Overwrites the stack below the caller to remove stale GC pointers */
+__attribute__((noinline)) void clobber_stack()
+{
+    volatile std::array<std::byte, 4096> buf{};
+    (void)buf;
+}
+
+TYPED_TEST(CopyTest, WeakRefs)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{1024};
+    auto live = collector.alloc(16);
+    memset(live.as_ptr(), 1, 16);
+    const auto live_cell = gcpp::WeakRefs::get_instance().make_cell(
+        static_cast<uintptr_t>(live));
+    const auto dead_cell = make_garbage_cell(collector);
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_EQ(gcpp::WeakRefs::get_instance().load(*live_cell),
+              static_cast<uintptr_t>(live));
+    ASSERT_EQ(gcpp::WeakRefs::get_instance().load(*dead_cell), 0);
+}
+
+TEST(WeakRefs, LoadHoldsOffCollections)
+{
+    auto& weak_refs = gcpp::WeakRefs::get_instance();
+    const auto cell = weak_refs.make_cell(0x1000);
+    std::atomic<bool> began = false;
+    std::promise<void> loading;
+    std::thread loader([&]() {
+        weak_refs.load(*cell, [&](uintptr_t target) {
+            loading.set_value();
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            // a strong reference made here is a root of the next collection
+            EXPECT_FALSE(began);
+            EXPECT_EQ(target, 0x1000u);
+        });
+    });
+    loading.get_future().wait();
+    weak_refs.begin_collection();
+    began = true;
+    weak_refs.end_collection([](auto target) { return target; });
+    loader.join();
+}
+
+TYPED_TEST(CopyTest, RepeatedCollectLinkedList)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{4096};
+    constexpr auto size = sizeof(FatPtr) + sizeof(int);
+    auto node = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+    const auto head = node;
+    for (int i = 0; i < 16; ++i) {
+        auto next = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+        memcpy(node.as_ptr(), &next, sizeof(next));
+        memcpy(node.as_ptr() + sizeof(next), &i, sizeof(i));
+        node = next;
+    }
+    const auto null = FatPtr{0};
+    memcpy(node.as_ptr(), &null, sizeof(node));
+    int num = 16;
+    memcpy(node.as_ptr() + sizeof(node), &num, sizeof(num));
+    node = null;
+    for (int gc = 0; gc < 3; ++gc) {
+        std::vector<FatPtr*> roots;
+        GC_GET_ROOTS(roots);
+        (void)collector.async_collect(roots).get();
+        for (int j = 0; j < 8; ++j) {
+            memset(collector.alloc(16).as_ptr(), 0xAB, 16);
+        }
+    }
+    int i = 0;
+    node = head;
+    while (node != null) {
+        ASSERT_TRUE(collector.contains(node.as_ptr()));
+        memcpy(&num, node.as_ptr() + sizeof(node), sizeof(num));
+        memcpy(&node, node.as_ptr(), sizeof(node));
+        ASSERT_EQ(num, i++);
+    }
+    ASSERT_EQ(i, 17);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<int> g_finalized = 0;
+
+template <typename T>
+__attribute__((noinline)) void alloc_finalized_garbage(
+    gcpp::CopyingCollector<T, gcpp::FinalGenerationPolicy>& collector)
+{
+    auto ptr = collector.alloc(16, std::align_val_t{1},
+                               [](void*, size_t size) {
+                                   ASSERT_EQ(size, 16);
+                                   ++g_finalized;
+                               });
+    memset(ptr.as_ptr(), 0, 16);
+}
+
+TYPED_TEST(CopyTest, Finalization)
+{
+    g_finalized = 0;
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{1024};
+    auto live = collector.alloc(16, std::align_val_t{1},
+                                [](void*, size_t) { ++g_finalized; });
+    memset(live.as_ptr(), 1, 16);
+    alloc_finalized_garbage(collector);
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    // the next collection waits for the finalizers of the last one
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_EQ(g_finalized, 1);
+    ASSERT_EQ(live.as_ptr()[0], std::byte{1});
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+const FatPtr* g_member = nullptr;
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<int> g_member_forwarded = 0;
+
+template <typename T>
+__attribute__((noinline)) void alloc_finalized_owner(
+    gcpp::CopyingCollector<T, gcpp::FinalGenerationPolicy>& collector)
+{
+    auto ptr = collector.alloc(sizeof(FatPtr), std::align_val_t{1},
+                               [](void* obj, size_t) {
+                                   FatPtr val;
+                                   memcpy(&val, obj, sizeof(val));
+                                   g_member_forwarded =
+                                       val == *g_member ? 1 : -1;
+                               });
+    memcpy(ptr.as_ptr(), g_member, sizeof(FatPtr));
+}
+
+TYPED_TEST(CopyTest, FinalizerReadsMember)
+{
+    g_member_forwarded = 0;
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{1024};
+    auto member = collector.alloc(16);
+    memset(member.as_ptr(), 1, 16);
+    g_member = &member;
+    alloc_finalized_owner(collector);
+    clobber_stack();
+    // the last collection waits for the finalizers of the ones before
+    for (int gc = 0; gc < 3; ++gc) {
+        std::vector<FatPtr*> roots;
+        GC_GET_ROOTS(roots);
+        (void)collector.async_collect(roots).get();
+    }
+    // the finalized object's member was forwarded with it
+    ASSERT_EQ(g_member_forwarded, 1);
+}
+
+TYPED_TEST(CopyTest, Pinning)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{2048};
+    auto pinned = collector.alloc(64);
+    memset(pinned.as_ptr(), 7, 64);
+    const auto data = pinned.as_ptr();
+    collector.pin(pinned);
+    std::vector<FatPtr*> roots;
+    for (int gc = 0; gc < 4; ++gc) {
+        GC_GET_ROOTS(roots);
+        (void)collector.async_collect(roots).get();
+        // fill the space so allocations would overwrite a moved object
+        for (int i = 0; i < 8; ++i) {
+            memset(collector.alloc(64).as_ptr(), 0xAB, 64);
+        }
+        ASSERT_EQ(pinned.as_ptr(), data);
+        for (int i = 0; i < 64; ++i) {
+            ASSERT_EQ(data[i], std::byte{7});
+        }
+    }
+    collector.unpin(pinned);
+    ASSERT_THROW(collector.unpin(pinned), std::out_of_range);
+    // the object is moved by whichever of the next two collections
+    // evacuates its space
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    const auto first_addr = pinned.as_ptr();
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_TRUE(first_addr != data || pinned.as_ptr() != first_addr);
+    for (int i = 0; i < 64; ++i) {
+        ASSERT_EQ(pinned.as_ptr()[i], std::byte{7});
+    }
+}
+
+TYPED_TEST(CopyTest, Remark)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{8192};
+    collector.enable_remark(gcpp::DirtyTracking::WriteProtect);
+    constexpr auto size = sizeof(FatPtr) + sizeof(int);
+    auto node = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+    const auto head = node;
+    for (int i = 0; i < 32; ++i) {
+        auto next = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+        memcpy(node.as_ptr(), &next, sizeof(next));
+        memcpy(node.as_ptr() + sizeof(next), &i, sizeof(i));
+        node = next;
+    }
+    const auto null = FatPtr{0};
+    memcpy(node.as_ptr(), &null, sizeof(node));
+    int num = 32;
+    memcpy(node.as_ptr() + sizeof(node), &num, sizeof(num));
+    node = null;
+    for (int gc = 0; gc < 3; ++gc) {
+        std::vector<FatPtr*> roots;
+        GC_GET_ROOTS(roots);
+        (void)collector.async_collect(roots).get();
+        for (int j = 0; j < 8; ++j) {
+            memset(collector.alloc(16).as_ptr(), 0xAB, 16);
+        }
+    }
+    int i = 0;
+    node = head;
+    while (node != null) {
+        ASSERT_TRUE(collector.contains(node.as_ptr()));
+        memcpy(&num, node.as_ptr() + sizeof(node), sizeof(num));
+        memcpy(&node, node.as_ptr(), sizeof(node));
+        ASSERT_EQ(num, i++);
+    }
+    ASSERT_EQ(i, 33);
+}
+
+TYPED_TEST(CopyTest, RemarkCompressed)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{8192};
+    collector.enable_remark(gcpp::DirtyTracking::WriteProtect);
+    // each node is a compressed reference to the next followed by its index
+    static constexpr std::array<gcpp::CompressedField, 1> fields{
+        gcpp::CompressedField{0, 3}};
+    static constexpr gcpp::CompressedLayout layout{fields.data(), 1, 8};
+    const auto alloc_node = [&collector]() {
+        return collector.alloc(8, std::align_val_t{8}, nullptr, &layout);
+    };
+    const auto link = [](FatPtr node, FatPtr next) {
+        const auto field = reinterpret_cast<uintptr_t>(node.as_ptr());
+        const auto val = gcpp::encode_compressed(
+            field, reinterpret_cast<uintptr_t>(next.as_ptr()), 3);
+        ASSERT_TRUE(val.has_value());
+        memcpy(node.as_ptr(), &*val, sizeof(*val));
+    };
+    auto head = alloc_node();
+    auto node = head;
+    for (int32_t i = 0; i < 32; ++i) {
+        auto next = alloc_node();
+        link(node, next);
+        memcpy(node.as_ptr() + 4, &i, sizeof(i));
+        node = next;
+    }
+    link(node, FatPtr{0});
+    int32_t num = 32;
+    memcpy(node.as_ptr() + 4, &num, sizeof(num));
+    node = FatPtr{0};
+    for (int gc = 0; gc < 3; ++gc) {
+        std::vector<FatPtr*> roots;
+        GC_GET_ROOTS(roots);
+        (void)collector.async_collect(roots).get();
+        for (int j = 0; j < 8; ++j) {
+            memset(collector.alloc(16).as_ptr(), 0xAB, 16);
+        }
+    }
+    int32_t i = 0;
+    auto addr = reinterpret_cast<uintptr_t>(head.as_ptr());
+    while (addr != 0) {
+        ASSERT_TRUE(collector.contains(reinterpret_cast<void*>(addr)));
+        int32_t val = 0;
+        memcpy(&val, reinterpret_cast<void*>(addr), sizeof(val));
+        memcpy(&num, reinterpret_cast<void*>(addr + 4), sizeof(num));
+        ASSERT_EQ(num, i++);
+        addr = gcpp::decode_compressed(addr, val, 3);
+    }
+    ASSERT_EQ(i, 33);
+}
+
+TYPED_TEST(CopyTest, AllocBatch)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{4096};
+    ASSERT_TRUE(collector.alloc_batch(0, 16).empty());
+    ASSERT_THROW((void)collector.alloc_batch(4096, 16), std::bad_alloc);
+    auto ptrs = collector.alloc_batch(16, 12, std::align_val_t{8});
+    ASSERT_EQ(ptrs.size(), 16u);
+    for (size_t i = 0; i < ptrs.size(); ++i) {
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(ptrs[i].as_ptr()) & 7, 0);
+        if (i > 0) {
+            ASSERT_EQ(ptrs[i].as_ptr(), ptrs[i - 1].as_ptr() + 16);
+        }
+        memset(ptrs[i].as_ptr(), static_cast<int>(i), 12);
+    }
+    // only the objects which are still referenced survive
+    auto first = ptrs.front();
+    auto last = ptrs.back();
+    ptrs.clear();
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    ASSERT_GT(collector.free_space(), 2048 - 16 * 16);
+    for (int i = 0; i < 12; ++i) {
+        ASSERT_EQ(first.as_ptr()[i], std::byte{0});
+        ASSERT_EQ(last.as_ptr()[i], std::byte{15});
+    }
+}
+
+template <typename T>
+__attribute__((noinline)) void alloc_profiled_garbage(
+    gcpp::CopyingCollector<T, gcpp::FinalGenerationPolicy>& collector)
+{
+    for (int i = 0; i < 10; ++i) {
+        memset(collector.alloc(16).as_ptr(), 0, 16);
+    }
+}
+
+TYPED_TEST(CopyTest, AllocProfiler)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{2048};
+    auto& profiler = gcpp::AllocProfiler::get_instance();
+    // sample every allocation
+    profiler.start(1);
+    auto live = collector.alloc(16);
+    memset(live.as_ptr(), 1, 16);
+    alloc_profiled_garbage(collector);
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+    profiler.stop();
+    (void)collector.alloc(16);
+    std::stringstream profile;
+    profiler.write_profile(profile);
+    size_t live_count = 0;
+    size_t live_bytes = 0;
+    size_t alloc_count = 0;
+    size_t alloc_bytes = 0;
+    ASSERT_EQ(sscanf(profile.str().c_str(),
+                     "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/1",
+                     &live_count, &live_bytes, &alloc_count, &alloc_bytes),
+              4);
+    ASSERT_EQ(alloc_count, 11u);
+    ASSERT_EQ(alloc_bytes, 11u * 16);
+    ASSERT_GE(live_count, 1u);
+    ASSERT_LT(live_count, alloc_count);
+    ASSERT_EQ(live_bytes, live_count * 16);
+    ASSERT_NE(profile.str().find("MAPPED_LIBRARIES:"), std::string::npos);
+}
+
+TYPED_TEST(CopyTest, HeapDump)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{2048};
+    auto parent = collector.alloc(32, std::align_val_t{16});
+    auto child = collector.alloc(24);
+    // the rest of the parent must not hold anything that looks like a pointer
+    memset(parent.as_ptr(), 0, 32);
+    memcpy(parent.as_ptr(), &child, sizeof(child));
+    memset(child.as_ptr(), 1, 24);
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    (void)collector.async_collect(roots).get();
+
+    std::stringstream dump;
+    {
+        gcpp::HeapDumpWriter writer(dump);
+        writer.root(static_cast<uintptr_t>(parent));
+        collector.dump(writer);
+    }
+    gcpp::HeapDumpReader reader(dump);
+    auto record = reader.next();
+    ASSERT_TRUE(record.has_value());
+    ASSERT_EQ(std::get<gcpp::HeapDumpRoot>(*record).target,
+              static_cast<uintptr_t>(parent));
+    std::unordered_map<uint64_t, gcpp::HeapDumpObject> objects;
+    while ((record = reader.next())) {
+        auto obj = std::get<gcpp::HeapDumpObject>(std::move(*record));
+        objects.emplace(obj.address, std::move(obj));
+    }
+    ASSERT_EQ(objects.size(), 2u);
+    const auto& parent_obj = objects.at(static_cast<uintptr_t>(parent));
+    ASSERT_EQ(parent_obj.size, 32u);
+    ASSERT_EQ(parent_obj.alignment, 16u);
+    ASSERT_EQ(parent_obj.age, 1u);
+    ASSERT_EQ(parent_obj.edges,
+              std::vector<uint64_t>{static_cast<uintptr_t>(child)});
+    const auto& child_obj = objects.at(static_cast<uintptr_t>(child));
+    ASSERT_EQ(child_obj.size, 24u);
+    ASSERT_EQ(child_obj.age, 1u);
+    ASSERT_TRUE(child_obj.edges.empty());
+    ASSERT_FALSE(reader.next().has_value());
+
+    std::stringstream garbage("GCPPDUMP");
+    ASSERT_THROW(gcpp::HeapDumpReader{garbage}, std::runtime_error);
+}
+
+// complete binary tree stored in level order
+struct TreeNode {
+    FatPtr left;
+    FatPtr right;
+    int val;
+};
+constexpr int tree_nodes = 31;
+
+/** Allocates a tree of `tree_nodes` nodes, returning its root */
+template <typename T>
+FatPtr make_tree(
+    gcpp::CopyingCollector<T, gcpp::FinalGenerationPolicy>& collector)
+{
+    const auto nodes = collector.alloc_batch(
+        tree_nodes, sizeof(TreeNode), std::align_val_t{alignof(TreeNode)});
+    const auto child = [&nodes](int idx) {
+        return idx < tree_nodes ? nodes[static_cast<size_t>(idx)] : FatPtr{0};
+    };
+    for (int i = 0; i < tree_nodes; ++i) {
+        new (nodes[static_cast<size_t>(i)].as_ptr())
+            TreeNode{child(2 * i + 1), child(2 * i + 2), i};
+    }
+    return nodes.front();
+}
+
+const TreeNode* as_tree_node(const FatPtr& ptr)
+{
+    return reinterpret_cast<const TreeNode*>(ptr.as_ptr());
+}
+
+/** Checks that `root` is a tree made by `make_tree` on the heap */
+template <typename T>
+void check_tree(
+    const gcpp::CopyingCollector<T, gcpp::FinalGenerationPolicy>& collector,
+    const FatPtr& root)
+{
+    std::vector<std::pair<FatPtr, int>> stack{{root, 0}};
+    int count = 0;
+    while (!stack.empty()) {
+        const auto [ptr, idx] = stack.back();
+        stack.pop_back();
+        ASSERT_TRUE(collector.contains(ptr.as_ptr()));
+        const auto* node = as_tree_node(ptr);
+        ASSERT_EQ(node->val, idx);
+        ++count;
+        if (node->left != FatPtr{0}) {
+            stack.emplace_back(node->left, 2 * idx + 1);
+        }
+        if (node->right != FatPtr{0}) {
+            stack.emplace_back(node->right, 2 * idx + 2);
+        }
+    }
+    ASSERT_EQ(count, tree_nodes);
+}
+
+TYPED_TEST(CopyTest, HierarchicalCopyOrder)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{8192};
+    collector.set_copy_order(gcpp::CopyOrder::Hierarchical);
+    auto root = make_tree(collector);
+    (void)collector.async_collect({&root}).get();
+    check_tree(collector, root);
+    // the tree fits a page, so it is copied breadth first: each level
+    // follows the one above it
+    for (int i = 0; i < tree_nodes / 2; ++i) {
+        const auto* node = as_tree_node(root) + i;
+        ASSERT_EQ(as_tree_node(node->left), as_tree_node(root) + 2 * i + 1);
+        ASSERT_EQ(as_tree_node(node->right), as_tree_node(root) + 2 * i + 2);
+    }
+}
+
+TYPED_TEST(CopyTest, LargeObjectChunks)
+{
+    using Collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>;
+    auto collector = Collector{1024 * 1024};
+    // spans several chunks, and points to itself so it is reached again
+    // while it is being copied
+    constexpr size_t len = 3 * Collector::large_object_chunk_size / 16 + 5;
+    auto array = collector.alloc(len * sizeof(FatPtr),
+                                 std::align_val_t{alignof(FatPtr)});
+    auto* elems = reinterpret_cast<FatPtr*>(array.as_ptr());
+    for (size_t i = 0; i < len; ++i) {
+        if (i % 100 == 0) {
+            new (&elems[i]) FatPtr{array};
+        } else {
+            auto elem = collector.alloc(sizeof(size_t));
+            memcpy(elem.as_ptr(), &i, sizeof(i));
+            new (&elems[i]) FatPtr{elem};
+        }
+    }
+    auto other_root = array;
+    (void)collector.async_collect({&array, &other_root}).get();
+    ASSERT_EQ(array, other_root);
+    ASSERT_TRUE(collector.contains(array.as_ptr()));
+    elems = reinterpret_cast<FatPtr*>(array.as_ptr());
+    for (size_t i = 0; i < len; ++i) {
+        if (i % 100 == 0) {
+            ASSERT_EQ(elems[i], array);
+        } else {
+            ASSERT_TRUE(collector.contains(elems[i].as_ptr()));
+            size_t val = 0;
+            memcpy(&val, elems[i].as_ptr(), sizeof(val));
+            ASSERT_EQ(val, i);
+        }
+    }
+}
+
+TYPED_TEST(CopyTest, ObjectStart)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{2048};
+    // objects with an alignment of 1 may start at any byte
+    auto first = collector.alloc(13);
+    auto second = collector.alloc(70);
+    auto aligned = collector.alloc(8, std::align_val_t{64});
+    const auto check_starts = [&collector](const FatPtr& ptr, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            ASSERT_EQ(collector.object_start(ptr.as_ptr() + i), ptr);
+        }
+        ASSERT_NE(collector.object_start(ptr.as_ptr() + size), ptr);
+    };
+    check_starts(first, 13);
+    check_starts(second, 70);
+    check_starts(aligned, 8);
+    ASSERT_FALSE(collector.object_start(aligned.as_ptr() + 8));
+    int local = 0;
+    ASSERT_FALSE(collector.object_start(&local));
+    const auto* const old_first = first.as_ptr();
+    (void)collector.async_collect({&first, &second, &aligned}).get();
+    // the originals are gone once they are copied
+    ASSERT_NE(first.as_ptr(), old_first);
+    ASSERT_FALSE(collector.object_start(old_first));
+    check_starts(first, 13);
+    check_starts(second, 70);
+    check_starts(aligned, 8);
+}
+
+TYPED_TEST(CopyTest, ObjectStartAcrossCards)
+{
+    using collector_t =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>;
+    auto collector = collector_t{16384};
+    constexpr size_t size = 3 * collector_t::card_size + 100;
+    // starts partway through a card and covers the starts of the next ones
+    auto small = collector.alloc(40);
+    auto big = collector.alloc(size);
+    auto after = collector.alloc(16);
+    const auto check_starts = [&collector](const FatPtr& ptr, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            ASSERT_EQ(collector.object_start(ptr.as_ptr() + i), ptr);
+        }
+    };
+    check_starts(big, size);
+    check_starts(after, 16);
+    const auto* const old_big = big.as_ptr();
+    // only the small objects survive, so the cards `big` covered are empty
+    (void)collector.async_collect({&small, &after}).get();
+    for (size_t i = 0; i < size; ++i) {
+        ASSERT_FALSE(collector.object_start(old_big + i));
+    }
+    check_starts(after, 16);
+}
+
+TYPED_TEST(CopyTest, InteriorPointers)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{2048};
+    collector.enable_interior_pointers();
+    // only a raw pointer into the middle of the object is kept
+    std::byte* volatile interior = [&collector]() {
+        auto obj = collector.alloc(64);
+        memset(obj.as_ptr(), 7, 64);
+        return obj.as_ptr() + 40;
+    }();
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    for (int gc = 0; gc < 4; ++gc) {
+        GC_GET_ROOTS(roots);
+        (void)collector.async_collect(roots).get();
+        // fill the space so allocations would overwrite a freed object
+        for (int i = 0; i < 8; ++i) {
+            memset(collector.alloc(64).as_ptr(), 0xAB, 64);
+        }
+        const auto start = collector.object_start(interior);
+        ASSERT_TRUE(start.has_value());
+        ASSERT_EQ(start->as_ptr(), interior - 40);
+        for (int i = 0; i < 64; ++i) {
+            ASSERT_EQ(start->as_ptr()[i], std::byte{7});
+        }
+    }
+}
+
+TYPED_TEST(CopyTest, PrefetchDistance)
+{
+    auto collector =
+        gcpp::CopyingCollector<TypeParam, gcpp::FinalGenerationPolicy>{8192};
+    ASSERT_THROW(collector.set_prefetch_distance(
+                     decltype(collector)::max_prefetch_distance + 1),
+                 std::invalid_argument);
+    // complete binary tree stored in level order, so each node has more
+    // children to trace than a distance of 1 keeps in flight
+    struct Node {
+        FatPtr left;
+        FatPtr right;
+        int val;
+    };
+    constexpr int num_nodes = 31;
+    auto nodes = collector.alloc_batch(num_nodes, sizeof(Node),
+                                       std::align_val_t{alignof(Node)});
+    for (int i = 0; i < num_nodes; ++i) {
+        const auto child = [&nodes](int idx) {
+            return idx < num_nodes ? nodes[static_cast<size_t>(idx)]
+                                   : FatPtr{0};
+        };
+        new (nodes[static_cast<size_t>(i)].as_ptr())
+            Node{child(2 * i + 1), child(2 * i + 2), i};
+    }
+    auto root = nodes.front();
+    nodes.clear();
+    for (const size_t distance :
+         {size_t{0}, size_t{1}, decltype(collector)::max_prefetch_distance}) {
+        collector.set_prefetch_distance(distance);
+        (void)collector.async_collect({&root}).get();
+        std::vector<std::pair<FatPtr, int>> stack{{root, 0}};
+        int count = 0;
+        while (!stack.empty()) {
+            const auto [ptr, idx] = stack.back();
+            stack.pop_back();
+            ASSERT_TRUE(collector.contains(ptr.as_ptr()));
+            const auto* node = reinterpret_cast<const Node*>(ptr.as_ptr());
+            ASSERT_EQ(node->val, idx);
+            ++count;
+            if (node->left != FatPtr{0}) {
+                stack.emplace_back(node->left, 2 * idx + 1);
+            }
+            if (node->right != FatPtr{0}) {
+                stack.emplace_back(node->right, 2 * idx + 2);
+            }
+        }
+        ASSERT_EQ(count, num_nodes);
+    }
+}
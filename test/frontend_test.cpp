@@ -1,5 +1,25 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <array>
+#include <coroutine>
+#include <cstring>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
 #include <new>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <variant>
+#include <vector>
 
+#include "alloc_profiler.h"
+#include "coro_frame.h"
+#include "heap_dump.h"
+#include "large_object.h"
 #include "gtest/gtest.h"
 #include "safe_alloc.h"
 #include "safe_ptr.h"
@@ -78,4 +98,736 @@ TEST(SafePtr, LinkedList)
     }
     ASSERT_EQ(len(*head), 11);
     ASSERT_EQ(sum(*head), 1 + 2 + 3 + 4 + 5 + 6 + 7 + 8 + 9 + 10);
-}
\ No newline at end of file
+}
+
+TEST(SafePtr, MakeN)
+{
+    auto nodes = gcpp::make_safe_n<LinkedList>(32, LinkedList{7, nullptr});
+    ASSERT_EQ(nodes.size(), 32u);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        ASSERT_EQ(nodes[i]->val, 7);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(nodes[i].get()) &
+                      (alignof(LinkedList) - 1),
+                  0);
+        nodes[i]->val = static_cast<int>(i);
+        if (i + 1 < nodes.size()) {
+            nodes[i]->next = nodes[i + 1];
+        }
+    }
+    // each object can be collected separately
+    nodes[0] = nullptr;
+    gcpp::GC::collect();
+    (void)gcpp::make_safe<int>(0);
+    ASSERT_EQ(len(*nodes[1]), 31);
+    ASSERT_EQ(sum(*nodes[1]), 31 * 32 / 2);
+    ASSERT_EQ(gcpp::make_safe_n<int>(0).size(), 0u);
+}
+
+struct AllocatingNode {
+    int val;
+    gcpp::LocalSafePtr<int> child;
+    explicit AllocatingNode(int v) : val(v), child(gcpp::make_local<int>(v))
+    {
+        // the objects of the batch made so far must survive the collections
+        // and keep their place, and the freed memory is reused
+        for (int i = 0; i < 2; ++i) {
+            gcpp::ThreadLocalGC::collect();
+            for (int j = 0; j < 64; ++j) {
+                (void)gcpp::make_local<int>(-1);
+            }
+        }
+    }
+};
+
+TEST(SafePtr, MakeNAllocatingConstructor)
+{
+    std::thread([]() {
+        auto nodes = gcpp::LocalSafePtr<AllocatingNode>::make_n(16, 1234);
+        gcpp::ThreadLocalGC::collect();
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            ASSERT_EQ(nodes[i]->val, 1234);
+            ASSERT_EQ(*nodes[i]->child, 1234);
+        }
+    }).join();
+    gcpp::ArenaScope scope;
+    auto nodes = gcpp::make_safe_n<LinkedList>(4, LinkedList{3, nullptr});
+    ASSERT_EQ(nodes[3]->val, 3);
+}
+
+TEST(SafePtr, Weak)
+{
+    auto strong = gcpp::make_safe<int>(5);
+    gcpp::WeakSafePtr<int> weak = strong;
+    ASSERT_FALSE(weak.expired());
+    ASSERT_EQ(*weak.lock(), 5);
+    gcpp::GC::collect();
+    auto locked = weak.lock();
+    ASSERT_NE(locked, nullptr);
+    ASSERT_EQ(*locked, 5);
+    ASSERT_EQ(locked.get(), strong.get());
+    gcpp::WeakSafePtr<int> null_weak = nullptr;
+    ASSERT_TRUE(null_weak.expired());
+}
+
+struct Closeable {
+    int fd = -1;
+    ~Closeable() { fd = -1; }
+};
+
+template <>
+struct gcpp::Finalize<Closeable> : std::true_type {
+};
+
+TEST(SafePtr, Finalizer)
+{
+    static_assert(gcpp::finalizer_of<int>() == nullptr);
+    static_assert(gcpp::finalizer_of<LinkedList>() == nullptr);
+    static_assert(gcpp::finalizer_of<Closeable>() != nullptr);
+    auto ptr = gcpp::make_safe<Closeable>();
+    ptr->fd = 3;
+    gcpp::finalizer_of<Closeable>()(ptr.get(), sizeof(Closeable));
+    ASSERT_EQ(ptr->fd, -1);
+    auto array = gcpp::make_safe<Closeable[]>(4u);
+    ASSERT_EQ(array.size(), 4u);
+}
+
+TEST(SafePtr, Pin)
+{
+    auto buf = gcpp::make_safe<std::byte[]>(128u);
+    {
+        auto guard = gcpp::pin(buf);
+        std::byte* const raw = guard.get();
+        memset(raw, 1, 128);
+        gcpp::GC::collect();
+        (void)gcpp::make_safe<int>(0);
+        ASSERT_EQ(guard.get(), raw);
+        ASSERT_EQ(buf.get(), raw);
+    }
+    ASSERT_EQ(buf[127], std::byte{1});
+}
+
+TEST(SafePtr, PreciseRoots)
+{
+    // a new thread so no other precise roots are registered on it
+    std::thread([]() {
+        gcpp::RootScope scope;
+        gcpp::Root<int> rooted = gcpp::make_safe<int>(7);
+        gcpp::Root<int> copy = rooted;
+        copy = nullptr;
+        // not registered, so ignored while the scope is alive
+        gcpp::SafePtr<int> unrooted = gcpp::make_safe<int>(8);
+        gcpp::WeakSafePtr<int> weak = unrooted;
+        // the second collection waits for the first to finish
+        gcpp::GC::collect();
+        gcpp::GC::collect();
+        ASSERT_EQ(*rooted, 7);
+        ASSERT_TRUE(weak.expired());
+    }).join();
+}
+
+TEST(SafePtr, PreciseRootsOfTemporaries)
+{
+    std::thread([]() {
+        gcpp::RootScope scope;
+        // the batch is a root while the constructors collect
+        auto nodes = gcpp::LocalSafePtr<AllocatingNode>::make_n(16, 1234);
+        gcpp::ThreadLocalGC::collect();
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            ASSERT_EQ(nodes[i]->val, 1234);
+            ASSERT_EQ(*nodes[i]->child, 1234);
+        }
+        // and so are new objects until they are bound to a `Root`
+        auto made = gcpp::make_safe<int>(5);
+        gcpp::WeakSafePtr<int> weak = made;
+        gcpp::GC::collect();
+        gcpp::GC::collect();
+        ASSERT_EQ(*weak.lock(), 5);
+        ASSERT_EQ(weak.lock().get(), made.get());
+    }).join();
+}
+
+struct CompressedList {
+    int64_t val;
+    gcpp::CompressedSafePtr<CompressedList> next;
+};
+
+template <>
+struct gcpp::CompressedFields<CompressedList> {
+    static constexpr std::array fields{
+        GCPP_COMPRESSED_FIELD(CompressedList, next)};
+};
+
+TEST(SafePtr, Compressed)
+{
+    static_assert(sizeof(gcpp::CompressedSafePtr<CompressedList>) == 4);
+    // precise roots so that stale copies on the stack don't keep nodes alive
+    std::thread([]() {
+        gcpp::RootScope scope;
+        gcpp::Root<CompressedList> head =
+            gcpp::make_safe<CompressedList>(0, nullptr);
+        gcpp::WeakSafePtr<CompressedList> tail = head;
+        for (int64_t i = 1; i < 4; ++i) {
+            gcpp::Root<CompressedList> node =
+                gcpp::make_safe<CompressedList>(i, nullptr);
+            node->next = head;
+            head = node;
+        }
+        // the rest of the list is only reachable through compressed references
+        gcpp::GC::collect();
+        gcpp::GC::collect();
+        ASSERT_FALSE(tail.expired());
+        int64_t expected = 3;
+        for (gcpp::Root<CompressedList> node = head; node != nullptr;
+             node = node->next.lock()) {
+            ASSERT_EQ(node->val, expected--);
+        }
+        ASSERT_EQ(expected, -1);
+    }).join();
+}
+
+struct LocalList {
+    int val;
+    gcpp::LocalSafePtr<LocalList> next;
+};
+
+TEST(ThreadLocalGC, Publish)
+{
+    gcpp::SafePtr<LocalList> published;
+    std::thread([&published]() {
+        auto head = gcpp::make_local<LocalList>(0, nullptr);
+        for (int i = 1; i < 3; ++i) {
+            head = gcpp::make_local<LocalList>(i, head);
+        }
+        gcpp::ThreadLocalGC::collect();
+        ASSERT_EQ(head->next->next->val, 0);
+        published = gcpp::publish(head);
+        ASSERT_NE(static_cast<const void*>(published.get()),
+                  static_cast<const void*>(head.get()));
+    }).join();
+    // the thread's heap is gone with the thread
+    gcpp::GC::collect();
+    int expected = 2;
+    for (auto node = published->next; node != nullptr; node = node->next) {
+        ASSERT_EQ(node->val, --expected);
+    }
+    ASSERT_EQ(published->val, 2);
+    ASSERT_EQ(expected, 0);
+}
+
+TEST(ThreadLocalGC, PublishInArena)
+{
+    gcpp::SafePtr<LocalList> published;
+    std::thread([&published]() {
+        auto head = gcpp::make_local<LocalList>(1, nullptr);
+        head = gcpp::make_local<LocalList>(0, head);
+        gcpp::ArenaScope scope;
+        published = gcpp::publish(head);
+    }).join();
+    gcpp::GC::collect();
+    ASSERT_EQ(published->val, 0);
+    ASSERT_EQ(published->next->val, 1);
+    ASSERT_EQ(published->next->next, nullptr);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+int g_arena_finalized = 0;
+
+struct ArenaNode {
+    int val;
+    gcpp::SafePtr<ArenaNode> next;
+    ~ArenaNode() { ++g_arena_finalized; }
+};
+
+template <>
+struct gcpp::Finalize<ArenaNode> : std::true_type {
+};
+
+/** Sums a list of `len` nodes allocated by the caller's scope */
+__attribute__((noinline)) int arena_list_sum(
+    int len, gcpp::WeakSafePtr<ArenaNode>& weak)
+{
+    auto head = gcpp::make_safe<ArenaNode>(0, nullptr);
+    for (int i = 1; i < len; ++i) {
+        head = gcpp::make_safe<ArenaNode>(i, head);
+    }
+    weak = head;
+    int sum = 0;
+    for (auto node = head; node != nullptr; node = node->next) {
+        sum += node->val;
+    }
+    return sum;
+}
+
+TEST(ArenaScope, Reclaim)
+{
+    g_arena_finalized = 0;
+    gcpp::WeakSafePtr<ArenaNode> weak;
+    {
+        gcpp::ArenaScope scope;
+        ASSERT_EQ(arena_list_sum(100, weak), 4950);
+        ASSERT_GE(scope.used(), 100 * sizeof(ArenaNode));
+        ASSERT_EQ(scope.escapes(), 0);
+        ASSERT_FALSE(weak.expired());
+    }
+    // nothing escaped, so the arena was freed at once
+    ASSERT_EQ(g_arena_finalized, 100);
+    ASSERT_TRUE(weak.expired());
+}
+
+/** Makes a list in `out` and a node in `heap_node`, which outlive the scope */
+__attribute__((noinline)) void arena_escape(
+    gcpp::SafePtr<ArenaNode>& out, gcpp::SafePtr<ArenaNode> heap_node)
+{
+    auto garbage = gcpp::make_safe<ArenaNode>(-1, nullptr);
+    auto tail = gcpp::make_safe<ArenaNode>(2, nullptr);
+    out = gcpp::make_safe<ArenaNode>(1, tail);
+    heap_node->next = gcpp::make_safe<ArenaNode>(3, nullptr);
+}
+
+TEST(ArenaScope, Promote)
+{
+    auto heap_node = gcpp::make_safe<ArenaNode>(0, nullptr);
+    gcpp::SafePtr<ArenaNode> out;
+    const void* arena_addr = nullptr;
+    g_arena_finalized = 0;
+    {
+        gcpp::ArenaScope scope;
+        arena_escape(out, heap_node);
+        arena_addr = out.get();
+        ASSERT_TRUE(scope.contains(arena_addr));
+        ASSERT_TRUE(scope.contains(heap_node->next.get()));
+        ASSERT_FALSE(scope.contains(heap_node.get()));
+        ASSERT_EQ(scope.escapes(), 2);
+    }
+    // only the garbage node is left to be finalized with the arena
+    ASSERT_EQ(g_arena_finalized, 1);
+    ASSERT_NE(static_cast<const void*>(out.get()), arena_addr);
+    gcpp::GC::collect();
+    gcpp::GC::collect();
+    ASSERT_EQ(out->val, 1);
+    ASSERT_EQ(out->next->val, 2);
+    ASSERT_EQ(out->next->next, nullptr);
+    ASSERT_EQ(heap_node->next->val, 3);
+}
+
+/** Coroutine which starts eagerly, with its frame on the `FrameHeap` */
+struct FrameTask {
+    struct promise_type : gcpp::GCFramePromise {
+        FrameTask get_return_object()
+        {
+            return FrameTask{
+                std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+FrameTask hold_across_suspend(gcpp::WeakSafePtr<int>& weak, int& result)
+{
+    auto ptr = gcpp::make_safe<int>(42);
+    weak = ptr;
+    co_await std::suspend_always{};
+    result = *ptr;
+}
+
+TEST(Coroutine, FrameRoots)
+{
+    std::thread([]() {
+        // the stack isn't scanned, so only the frame can keep the object alive
+        gcpp::RootScope scope;
+        auto& frame_heap = gcpp::FrameHeap::get_instance();
+        const auto frames = frame_heap.live_frames();
+        gcpp::WeakSafePtr<int> weak;
+        int result = 0;
+        auto task = hold_across_suspend(weak, result);
+        ASSERT_EQ(frame_heap.live_frames(), frames + 1);
+        gcpp::GC::collect();
+        gcpp::GC::collect();
+        ASSERT_FALSE(weak.expired());
+        task.handle.resume();
+        ASSERT_EQ(result, 42);
+        task.handle.destroy();
+        ASSERT_EQ(frame_heap.live_frames(), frames);
+        gcpp::GC::collect();
+        gcpp::GC::collect();
+        ASSERT_TRUE(weak.expired());
+    }).join();
+}
+
+TEST(GCAllocator, Containers)
+{
+    std::thread([]() {
+        // the containers aren't roots, so only their pinned storage keeps the
+        // elements alive
+        gcpp::RootScope scope;
+        gcpp::WeakSafePtr<int> weak;
+        {
+            std::vector<gcpp::SafePtr<int>,
+                        gcpp::GCAllocator<gcpp::SafePtr<int>>>
+                vec;
+            std::unordered_map<
+                int, gcpp::SafePtr<int>, std::hash<int>, std::equal_to<>,
+                gcpp::GCAllocator<std::pair<const int, gcpp::SafePtr<int>>>>
+                map;
+            for (int i = 0; i < 100; ++i) {
+                vec.push_back(gcpp::make_safe<int>(i));
+                map[i] = vec.back();
+            }
+            weak = vec[50];
+            gcpp::GC::collect();
+            gcpp::GC::collect();
+            ASSERT_FALSE(weak.expired());
+            for (int i = 0; i < 100; ++i) {
+                ASSERT_EQ(*vec[static_cast<size_t>(i)], i);
+                ASSERT_EQ(*map.at(i), i);
+            }
+        }
+        gcpp::GC::collect();
+        gcpp::GC::collect();
+        ASSERT_TRUE(weak.expired());
+    }).join();
+}
+
+struct TreeNode {
+    int val;
+    gcpp::SafePtr<TreeNode> parent;
+    std::vector<gcpp::SafePtr<TreeNode>,
+                gcpp::GCAllocator<gcpp::SafePtr<TreeNode>>>
+        children;
+};
+
+TEST(GCAllocator, HeldByObject)
+{
+    std::thread([]() {
+        gcpp::RootScope scope;
+        gcpp::WeakSafePtr<TreeNode> weak;
+        {
+            // the children point back to the parent holding their storage
+            gcpp::Root<TreeNode> root = gcpp::make_safe<TreeNode>();
+            for (int i = 0; i < 20; ++i) {
+                root->children.push_back(
+                    gcpp::make_safe<TreeNode>(TreeNode{i, root, {}}));
+            }
+            weak = root->children.back();
+            for (int gc = 0; gc < 3; ++gc) {
+                gcpp::GC::collect();
+            }
+            ASSERT_FALSE(weak.expired());
+            for (int i = 0; i < 20; ++i) {
+                const auto& child = root->children[static_cast<size_t>(i)];
+                ASSERT_EQ(child->val, i);
+                ASSERT_EQ(child->parent.get(), root.get());
+            }
+        }
+        gcpp::GC::collect();
+        gcpp::GC::collect();
+        ASSERT_TRUE(weak.expired());
+    }).join();
+}
+
+TEST(GCAllocator, LargeStorage)
+{
+    std::thread([]() {
+        gcpp::RootScope scope;
+        gcpp::WeakSafePtr<int> weak;
+        {
+            // larger than half of a heap, so the storage is a large object
+            std::vector<int, gcpp::GCAllocator<int>> ints;
+            for (int i = 0; i < 20000; ++i) {
+                ints.push_back(i);
+            }
+            std::vector<gcpp::SafePtr<int>,
+                        gcpp::GCAllocator<gcpp::SafePtr<int>>>
+                ptrs;
+            ptrs.reserve(gcpp::LargeObjectSpace::min_size /
+                         sizeof(gcpp::SafePtr<int>));
+            for (int i = 0; i < 100; ++i) {
+                ptrs.push_back(gcpp::make_safe<int>(i));
+            }
+            weak = ptrs.back();
+            gcpp::GC::collect();
+            gcpp::GC::collect();
+            ASSERT_FALSE(weak.expired());
+            for (int i = 0; i < 20000; ++i) {
+                ASSERT_EQ(ints[static_cast<size_t>(i)], i);
+            }
+            for (int i = 0; i < 100; ++i) {
+                ASSERT_EQ(*ptrs[static_cast<size_t>(i)], i);
+            }
+        }
+        gcpp::GC::collect();
+        gcpp::GC::collect();
+        ASSERT_TRUE(weak.expired());
+    }).join();
+}
+
+TEST(LargeObject, CopyOnWriteClone)
+{
+    std::thread([]() {
+        // the stack isn't scanned, so only the roots keep the arrays alive
+        gcpp::RootScope scope;
+        auto& space = gcpp::LargeObjectSpace::get_instance();
+        const auto objects = space.object_count();
+        constexpr size_t len = 3 * gcpp::LargeObjectSpace::min_size;
+        {
+            gcpp::Root<int[]> original = gcpp::make_safe<int[]>(len);
+            ASSERT_TRUE(space.contains(original.get()));
+            for (size_t i = 0; i < len; ++i) {
+                original[i] = static_cast<int>(i);
+            }
+            gcpp::Root<int[]> copy = original.clone();
+            gcpp::Root<int[]> copy_of_copy = nullptr;
+            ASSERT_NE(copy.get(), original.get());
+            ASSERT_EQ(space.object_count(), objects + 2);
+            // writes to either are private to it
+            copy[0] = -1;
+            original[len - 1] = -2;
+            ASSERT_EQ(original[0], 0);
+            ASSERT_EQ(copy[len - 1], static_cast<int>(len - 1));
+            // a written clone, and an original whose file is shared
+            copy_of_copy = copy.clone();
+            auto copy_of_original = original.clone();
+            for (size_t i = 1; i + 1 < len; ++i) {
+                ASSERT_EQ(copy[i], static_cast<int>(i));
+                ASSERT_EQ(copy_of_copy[i], static_cast<int>(i));
+                ASSERT_EQ(copy_of_original[i], static_cast<int>(i));
+            }
+            ASSERT_EQ(copy_of_copy[0], -1);
+            ASSERT_EQ(copy_of_original[len - 1], -2);
+            copy_of_original = nullptr;
+            gcpp::GC::collect();
+            gcpp::GC::collect();
+            ASSERT_EQ(space.object_count(), objects + 3);
+            ASSERT_EQ(original[1], 1);
+            ASSERT_EQ(copy_of_copy[0], -1);
+        }
+        gcpp::GC::collect();
+        ASSERT_EQ(space.object_count(), objects);
+    }).join();
+}
+
+TEST(LargeObject, HeapRoots)
+{
+    std::thread([]() {
+        gcpp::RootScope scope;
+        constexpr size_t len =
+            gcpp::LargeObjectSpace::min_size / sizeof(gcpp::SafePtr<int>);
+        gcpp::Root<gcpp::SafePtr<int>[]> array =
+            gcpp::make_safe<gcpp::SafePtr<int>[]>(len);
+        ASSERT_TRUE(gcpp::LargeObjectSpace::get_instance().contains(
+            array.get()));
+        for (size_t i = 0; i < len; i += 64) {
+            array[i] = gcpp::make_safe<int>(static_cast<int>(i));
+        }
+        // the elements are only referenced by the array, and move
+        gcpp::GC::collect();
+        gcpp::GC::collect();
+        for (size_t i = 0; i < len; i += 64) {
+            ASSERT_EQ(*array[i], static_cast<int>(i));
+        }
+    }).join();
+}
+
+/** Large object whose pointers all point to the same heap object */
+struct PointerBlock {
+    std::array<gcpp::SafePtr<int>, 1200> ptrs;
+
+    explicit PointerBlock(const gcpp::SafePtr<int>& target)
+    {
+        ptrs.fill(target);
+    }
+};
+
+TEST(LargeObject, SweepHeapPointers)
+{
+    std::thread([]() {
+        gcpp::RootScope scope;
+        auto& space = gcpp::LargeObjectSpace::get_instance();
+        const auto objects = space.object_count();
+        gcpp::Root<int> target = gcpp::make_safe<int>(42);
+        for (int round = 0; round < 8; ++round) {
+            for (int i = 0; i < 64; ++i) {
+                (void)gcpp::make_safe<PointerBlock>(target);
+            }
+            // the heap collection forwards the pointers in the dead blocks,
+            // which the sweep then unmaps
+            gcpp::GC::collect();
+            ASSERT_EQ(*target, 42);
+            // earlier tests may have left garbage which is swept too
+            ASSERT_LE(space.object_count(), objects);
+        }
+    }).join();
+}
+
+struct CycleNode {
+    gcpp::SafePtr<gcpp::SafePtr<CycleNode>[]> block;
+};
+
+TEST(LargeObject, HeapCycle)
+{
+    std::thread([]() {
+        gcpp::RootScope scope;
+        auto& space = gcpp::LargeObjectSpace::get_instance();
+        const auto objects = space.object_count();
+        constexpr size_t len =
+            gcpp::LargeObjectSpace::min_size / sizeof(gcpp::SafePtr<int>);
+        gcpp::WeakSafePtr<CycleNode> weak;
+        {
+            gcpp::Root<CycleNode> node = gcpp::make_safe<CycleNode>();
+            node->block = gcpp::make_safe<gcpp::SafePtr<CycleNode>[]>(len);
+            node->block[len - 1] = node;
+            weak = node;
+        }
+        // the sweep frees the large object, then a collection the heap one
+        for (int gc = 0; gc < 3; ++gc) {
+            gcpp::GC::collect();
+        }
+        ASSERT_TRUE(weak.expired());
+        ASSERT_LE(space.object_count(), objects);
+    }).join();
+}
+
+TEST(LargeObject, ManyClones)
+{
+    std::thread([]() {
+        gcpp::RootScope scope;
+        auto& space = gcpp::LargeObjectSpace::get_instance();
+        const auto objects = space.object_count();
+        constexpr size_t len = gcpp::LargeObjectSpace::min_size;
+        // fewer files than are open before a sweep is due, so that clones
+        // run out of them
+        rlimit limit{};
+        ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &limit), 0);
+        const auto old_limit = limit;
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_cur, 128);
+        ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &limit), 0);
+        {
+            gcpp::Root<char[]> original = gcpp::make_safe<char[]>(len);
+            original[0] = 'a';
+            for (int i = 0; i < 1024; ++i) {
+                gcpp::Root<char[]> copy = original.clone();
+                EXPECT_EQ(copy[0], 'a');
+            }
+        }
+        ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &old_limit), 0);
+        gcpp::GC::collect();
+        ASSERT_LE(space.object_count(), objects);
+    }).join();
+}
+
+TEST(LargeObject, ProfileAndDump)
+{
+    std::thread([]() {
+        gcpp::RootScope scope;
+        constexpr size_t len =
+            gcpp::LargeObjectSpace::min_size / sizeof(gcpp::SafePtr<int>);
+        constexpr size_t bytes = len * sizeof(gcpp::SafePtr<int>);
+        auto& profiler = gcpp::AllocProfiler::get_instance();
+        // sample every allocation
+        profiler.start(1);
+        gcpp::Root<gcpp::SafePtr<int>[]> array =
+            gcpp::make_safe<gcpp::SafePtr<int>[]>(len);
+        gcpp::Root<int> elem = gcpp::make_safe<int>(1);
+        array[0] = elem;
+        (void)gcpp::make_safe<gcpp::SafePtr<int>[]>(len);
+        gcpp::GC::collect();
+        profiler.stop();
+        std::stringstream profile;
+        profiler.write_profile(profile);
+        size_t live_count = 0;
+        size_t live_bytes = 0;
+        size_t alloc_count = 0;
+        size_t alloc_bytes = 0;
+        ASSERT_EQ(sscanf(profile.str().c_str(),
+                         "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/1",
+                         &live_count, &live_bytes, &alloc_count, &alloc_bytes),
+                  4);
+        // the swept array is no longer live
+        ASSERT_GE(live_bytes, bytes);
+        ASSERT_GE(alloc_bytes, 2 * bytes);
+        ASSERT_GE(alloc_bytes - live_bytes, bytes);
+
+        const auto path =
+            std::filesystem::temp_directory_path() / "gcpp_large_dump.bin";
+        gcpp::dump_heap(path.string());
+        std::ifstream file(path, std::ios::binary);
+        gcpp::HeapDumpReader reader(file);
+        const auto addr = reinterpret_cast<uintptr_t>(array.get());
+        bool rooted = false;
+        std::optional<gcpp::HeapDumpObject> large;
+        while (auto record = reader.next()) {
+            if (const auto* root = std::get_if<gcpp::HeapDumpRoot>(&*record)) {
+                rooted = rooted || root->target == addr;
+            } else if (auto& obj = std::get<gcpp::HeapDumpObject>(*record);
+                       obj.address == addr) {
+                large = std::move(obj);
+            }
+        }
+        std::filesystem::remove(path);
+        ASSERT_TRUE(rooted);
+        ASSERT_TRUE(large.has_value());
+        ASSERT_EQ(large->size, bytes);
+        // null elements are edges to 0, as on the heaps
+        ASSERT_EQ(large->edges.size(), len);
+        ASSERT_EQ(large->edges[0], reinterpret_cast<uintptr_t>(elem.get()));
+    }).join();
+}
+
+/** Overwrites the stack below the caller to remove stale GC pointers */
+__attribute__((noinline)) void clobber_stack()
+{
+    volatile std::array<std::byte, 4096> buf{};
+    (void)buf;
+}
+
+struct LargeHolder {
+    int64_t val;
+    gcpp::SafePtr<char[]> block;
+};
+
+// interior pointers can't be disabled again, so this runs after the others
+TEST(LargeObject, InteriorPointers)
+{
+    std::thread([]() {
+        // the words of the stack are scanned from here
+        GC_UPDATE_STACK_RANGE();
+        gcpp::GC::enable_interior_pointers();
+        gcpp::ThreadLocalGC::enable_interior_pointers();
+        constexpr size_t len = gcpp::LargeObjectSpace::min_size;
+        // only raw pointers into the middle of the objects are kept: one
+        // into a large object, one into a heap object holding another, and
+        // one into an object on the thread's heap
+        char* volatile interior = nullptr;
+        gcpp::SafePtr<char[]>* volatile held = nullptr;
+        int* volatile local = nullptr;
+        [&]() {
+            auto block = gcpp::make_safe<char[]>(len);
+            memset(block.get(), 7, len);
+            interior = block.get() + len / 2;
+            auto holder = gcpp::make_safe<LargeHolder>();
+            holder->val = 1;
+            holder->block = gcpp::make_safe<char[]>(len);
+            memset(holder->block.get(), 9, len);
+            held = &holder->block;
+            auto node = gcpp::make_local<LocalList>(5, nullptr);
+            local = &node->val;
+        }();
+        clobber_stack();
+        auto& space = gcpp::LargeObjectSpace::get_instance();
+        for (int gc = 0; gc < 3; ++gc) {
+            gcpp::GC::collect();
+            gcpp::ThreadLocalGC::collect();
+            ASSERT_TRUE(space.contains(interior));
+            ASSERT_EQ(interior[0], 7);
+            ASSERT_EQ(interior[len / 2 - 1], 7);
+            ASSERT_TRUE(space.contains(held->get()));
+            ASSERT_EQ(held->get()[len - 1], 9);
+            ASSERT_EQ(*local, 5);
+        }
+    }).join();
+}
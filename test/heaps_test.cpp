@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <thread>
+
+#include "gc_scan.h"
+#include "safe_alloc.h"
+#include "safe_ptr.h"
+
+struct Node {
+    int val;
+    gcpp::SafePtr<Node> next;
+};
+
+// the heaps are created on first use, so this must be the first test
+TEST(NodeHeaps, CrossHeapPointers)
+{
+    gcpp::GC::set_heap_count(2);
+    GC_UPDATE_STACK_RANGE();
+    gcpp::SafePtr<Node> a;
+    gcpp::SafePtr<Node> b;
+    // threads take the heaps of their node in turn
+    std::thread([&a]() { a = gcpp::make_safe<Node>(1, nullptr); }).join();
+    std::thread([&a, &b]() { b = gcpp::make_safe<Node>(2, a); }).join();
+    ASSERT_THROW(gcpp::GC::set_heap_count(1), std::logic_error);
+
+    // `a` is only referenced from the other heap
+    a = nullptr;
+    gcpp::GC::collect();
+    gcpp::GC::collect();
+    ASSERT_EQ(b->val, 2);
+    ASSERT_EQ(b->next->val, 1);
+
+    // a collection of one heap when it is full marks for itself. This thread
+    // is the third to pick a heap, so it fills the heap of `a`.
+    for (int i = 0; i < 10000; ++i) {
+        (void)gcpp::make_safe<Node>(i, nullptr);
+    }
+    ASSERT_EQ(b->next->val, 1);
+
+    // a cycle between the heaps is freed once it is unreachable
+    gcpp::WeakSafePtr<Node> weak_a = b->next;
+    gcpp::WeakSafePtr<Node> weak_b = b;
+    b->next->next = b;
+    b = nullptr;
+    gcpp::GC::collect();
+    gcpp::GC::collect();
+    ASSERT_TRUE(weak_a.expired());
+    ASSERT_TRUE(weak_b.expired());
+}
@@ -0,0 +1,246 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "concurrent_gc.h"
+#include "gc_base.h"
+#include "gc_scan.h"
+#include "region_collector.h"
+#include "weak_ref.h"
+
+template <typename T>
+class RegionTest : public testing::Test
+{
+};
+
+template <typename T>
+using Regions = gcpp::RegionCollector<T, gcpp::FinalGenerationPolicy>;
+
+using TypeParams =
+    testing::Types<gcpp::SerialGCPolicy, gcpp::ConcurrentGCPolicy>;
+TYPED_TEST_SUITE(RegionTest, TypeParams);
+
+constexpr size_t region_size = 4096;
+/** 16 regions, 2 of which are reserved for evacuation */
+constexpr size_t heap_size = 16 * region_size;
+
+/** Overwrites the stack below the caller to remove stale GC pointers */
+__attribute__((noinline)) void clobber_stack()
+{
+    volatile std::array<std::byte, 4096> buf{};
+    (void)buf;
+}
+
+template <typename T>
+__attribute__((noinline)) void alloc_garbage(Regions<T>& collector, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        auto ptr = collector.alloc(16);
+        memset(ptr.as_ptr(), 10 + i, 16);
+    }
+}
+
+template <typename T>
+void collect(Regions<T>& collector, const std::vector<FatPtr*>& extra = {})
+{
+    clobber_stack();
+    std::vector<FatPtr*> roots;
+    GC_GET_ROOTS(roots);
+    roots.insert(roots.end(), extra.begin(), extra.end());
+    (void)collector.async_collect(roots).get();
+}
+
+TYPED_TEST(RegionTest, Alloc)
+{
+    auto collector = Regions<TypeParam>{heap_size, region_size};
+    ASSERT_EQ(collector.free_space(), heap_size - 2 * region_size);
+    std::vector<std::pair<FatPtr, std::byte>> ptrs;
+    for (int i = 0; i < 16; ++i) {
+        auto ptr = collector.alloc(100);
+        memset(ptr.as_ptr(), i, 100);
+        ptrs.emplace_back(ptr, static_cast<std::byte>(i));
+    }
+    for (auto [ptr, data] : ptrs) {
+        for (int j = 0; j < 100; ++j) {
+            ASSERT_EQ(ptr.as_ptr()[j], data);
+        }
+    }
+    ASSERT_EQ(collector.free_space(), heap_size - 2 * region_size - 1600);
+    ASSERT_THROW((void)collector.alloc(region_size + 1), std::bad_alloc);
+}
+
+TYPED_TEST(RegionTest, Collect)
+{
+    auto collector = Regions<TypeParam>{heap_size, region_size};
+    alloc_garbage(collector, 10);
+    auto persist1 = collector.alloc(16);
+    const auto data1 = persist1.as_ptr();
+    memset(persist1.as_ptr(), 1, 16);
+    alloc_garbage(collector, 10);
+    auto persist2 = collector.alloc(16);
+    memset(persist2.as_ptr(), 2, 16);
+    collect(collector);
+    const auto stats = collector.last_collection();
+    ASSERT_EQ(stats.regions_evacuated, 1);
+    ASSERT_EQ(stats.bytes_copied, 32);
+    // survivors are copied to a new region in address order
+    ASSERT_NE(persist1.as_ptr(), data1);
+    ASSERT_EQ(persist1.as_ptr() + 16, persist2.as_ptr());
+    ASSERT_EQ(collector.free_space(), heap_size - 2 * region_size - 32);
+    for (int i = 0; i < 16; ++i) {
+        ASSERT_EQ(persist1.as_ptr()[i], std::byte{1});
+        ASSERT_EQ(persist2.as_ptr()[i], std::byte{2});
+    }
+}
+
+TYPED_TEST(RegionTest, PauseBudget)
+{
+    auto collector =
+        Regions<TypeParam>{heap_size, region_size, std::chrono::nanoseconds{0}};
+    constexpr size_t objs_per_region = region_size / 16;
+    // the first region is all garbage but one object
+    auto sparse = collector.alloc(16);
+    memset(sparse.as_ptr(), 1, 16);
+    const auto sparse_data = sparse.as_ptr();
+    alloc_garbage(collector, objs_per_region - 1);
+    // the second is mostly live
+    std::vector<FatPtr> dense;
+    for (size_t i = 0; i < objs_per_region; ++i) {
+        dense.push_back(collector.alloc(16));
+        memset(dense.back().as_ptr(), 2, 16);
+    }
+    std::vector<FatPtr*> dense_roots;
+    for (size_t i = 0; i < objs_per_region / 2; ++i) {
+        dense_roots.push_back(&dense[i]);
+    }
+    const auto dense_data = dense.front().as_ptr();
+    // with no budget, only the region with the most garbage is evacuated
+    collect(collector, dense_roots);
+    ASSERT_EQ(collector.last_collection().regions_evacuated, 1);
+    ASSERT_NE(sparse.as_ptr(), sparse_data);
+    ASSERT_EQ(dense.front().as_ptr(), dense_data);
+
+    // the dense region is the only one left with garbage
+    collector.set_pause_budget(std::chrono::seconds{1});
+    collect(collector, dense_roots);
+    ASSERT_EQ(collector.last_collection().regions_evacuated, 1);
+    // stale copies of dense pointers on the stack may keep a few more alive
+    ASSERT_GE(collector.last_collection().bytes_copied, region_size / 2);
+    ASSERT_LT(collector.last_collection().bytes_copied, region_size);
+    ASSERT_NE(dense.front().as_ptr(), dense_data);
+    ASSERT_EQ(sparse.as_ptr()[0], std::byte{1});
+    for (const auto* root : dense_roots) {
+        ASSERT_EQ(root->as_ptr()[15], std::byte{2});
+    }
+}
+
+TYPED_TEST(RegionTest, RepeatedCollectLinkedList)
+{
+    // a small budget so that references between evacuated and remaining
+    // regions are exercised
+    auto collector = Regions<TypeParam>{heap_size, region_size,
+                                        std::chrono::microseconds{1}};
+    constexpr auto size = sizeof(FatPtr) + sizeof(int);
+    constexpr int len = 300;
+    auto node = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+    const auto head = node;
+    for (int i = 0; i < len; ++i) {
+        alloc_garbage(collector, 2);
+        auto next = collector.alloc(size, std::align_val_t{alignof(FatPtr)});
+        memcpy(node.as_ptr(), &next, sizeof(next));
+        memcpy(node.as_ptr() + sizeof(next), &i, sizeof(i));
+        node = next;
+    }
+    const auto null = FatPtr{0};
+    memcpy(node.as_ptr(), &null, sizeof(node));
+    int num = len;
+    memcpy(node.as_ptr() + sizeof(node), &num, sizeof(num));
+    node = null;
+    for (int gc = 0; gc < 6; ++gc) {
+        collect(collector);
+        alloc_garbage(collector, 8);
+    }
+    int i = 0;
+    node = head;
+    while (node != null) {
+        ASSERT_TRUE(collector.contains(node.as_ptr()));
+        memcpy(&num, node.as_ptr() + sizeof(node), sizeof(num));
+        memcpy(&node, node.as_ptr(), sizeof(node));
+        ASSERT_EQ(num, i++);
+    }
+    ASSERT_EQ(i, len + 1);
+}
+
+TYPED_TEST(RegionTest, AutoCollect)
+{
+    auto collector = Regions<TypeParam>{heap_size, region_size};
+    auto ptr = collector.alloc(100);
+    memset(ptr.as_ptr(), 7, 100);
+    // only possible if regions are reused
+    for (int i = 0; i < 64; ++i) {
+        alloc_garbage(collector, 100);
+    }
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(ptr.as_ptr()[i], std::byte{7});
+    }
+}
+
+template <typename T>
+__attribute__((noinline)) auto make_garbage_cell(Regions<T>& collector)
+{
+    auto ptr = collector.alloc(16);
+    memset(ptr.as_ptr(), 0, 16);
+    return gcpp::WeakRefs::get_instance().make_cell(
+        static_cast<uintptr_t>(ptr));
+}
+
+TYPED_TEST(RegionTest, WeakRefs)
+{
+    auto collector = Regions<TypeParam>{heap_size, region_size};
+    auto live = collector.alloc(16);
+    memset(live.as_ptr(), 1, 16);
+    const auto live_cell = gcpp::WeakRefs::get_instance().make_cell(
+        static_cast<uintptr_t>(live));
+    const auto dead_cell = make_garbage_cell(collector);
+    collect(collector);
+    ASSERT_EQ(gcpp::WeakRefs::get_instance().load(*live_cell),
+              static_cast<uintptr_t>(live));
+    ASSERT_EQ(gcpp::WeakRefs::get_instance().load(*dead_cell), 0);
+}
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<int> g_finalized = 0;
+
+template <typename T>
+__attribute__((noinline)) void alloc_finalized_garbage(Regions<T>& collector)
+{
+    auto ptr = collector.alloc(16, std::align_val_t{1},
+                               [](void* obj, size_t size) {
+                                   ASSERT_EQ(size, 16);
+                                   ASSERT_EQ(static_cast<std::byte*>(obj)[0],
+                                             std::byte{5});
+                                   ++g_finalized;
+                               });
+    memset(ptr.as_ptr(), 5, 16);
+}
+
+TYPED_TEST(RegionTest, Finalization)
+{
+    g_finalized = 0;
+    auto collector = Regions<TypeParam>{heap_size, region_size};
+    alloc_garbage(collector, 4);
+    alloc_finalized_garbage(collector);
+    auto live = collector.alloc(16, std::align_val_t{1},
+                                [](void*, size_t) { ++g_finalized; });
+    memset(live.as_ptr(), 1, 16);
+    collect(collector);
+    // the next collection waits for the finalizers of the last one
+    collect(collector);
+    ASSERT_EQ(g_finalized, 1);
+    ASSERT_EQ(live.as_ptr()[0], std::byte{1});
+}
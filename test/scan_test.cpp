@@ -16,15 +16,23 @@ const auto not_ptr = 0x1000;
 // NOLINTNEXTLINE
 auto not_ptr_2 = 0x2000;
 
+// slots which stopped holding a pointer since they were scanned (such as
+// those below the stack pointer) are skipped, like the collectors do. The
+// values are read without copying a FatPtr so no stale copies are left on the
+// stack to be found by the next scan
 // NOLINTNEXTLINE(cppcoreguidelines-macro-usage)
 #define GC_GET_ROOT_VALS(out_vec)                                       \
     {                                                                   \
         std::vector<FatPtr*> root_addrs;                                \
         GC_GET_ROOTS(root_addrs);                                       \
-        (out_vec).resize(root_addrs.size());                            \
-        std::transform(root_addrs.begin(), root_addrs.end(),            \
-                       (out_vec).begin(),                               \
-                       [](auto ptr) { return ptr->get_gc_ptr().ptr; }); \
+        (out_vec).clear();                                              \
+        for (auto* root_addr : root_addrs) {                            \
+            auto* const words = reinterpret_cast<uintptr_t*>(root_addr); \
+            if (FatPtr::maybe_ptr(words)) {                             \
+                (out_vec).push_back(words[gc_ptr_size / ptr_size - 1] & \
+                                    ptr_mask);                          \
+            }                                                           \
+        }                                                               \
     }
 
 TEST(ScanTest, GlobalTest)
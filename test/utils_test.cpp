@@ -1,5 +1,13 @@
 #include <concurrent_gc.h>
+#include <dirty_tracker.h>
 #include <gtest/gtest.h>
+#include <mem_prot.h>
+#include <numa.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 struct Foo {
     int a;
@@ -22,4 +30,109 @@ TEST(AtomicUtils, SeqCstCpy)
     ASSERT_EQ(a.b, b.b);
     ASSERT_EQ(a.c, b.c);
     ASSERT_EQ(a.next, b.next);
-}
\ No newline at end of file
+}
+TEST(Numa, NodeDetection)
+{
+    const auto& nodes = gcpp::numa_nodes();
+    ASSERT_GE(gcpp::numa_node_count(), 1u);
+    ASSERT_EQ(nodes.size(), gcpp::numa_node_count());
+    ASSERT_TRUE(std::ranges::is_sorted(nodes));
+    ASSERT_TRUE(std::ranges::binary_search(nodes, gcpp::current_numa_node()));
+    std::jthread([&nodes]() {
+        ASSERT_TRUE(gcpp::pin_to_numa_node(gcpp::current_numa_node()));
+        ASSERT_TRUE(
+            std::ranges::binary_search(nodes, gcpp::current_numa_node()));
+    }).join();
+}
+
+TEST(MemProt, PageProtectionCoalesces)
+{
+    const auto page = static_cast<size_t>(gcpp::page_size());
+    constexpr size_t pages = 8;
+    auto* const region = static_cast<std::byte*>(
+        mmap(nullptr, pages * page, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(region, MAP_FAILED);
+    gcpp::PageProtection protection(region, pages * page);
+    protection.protect(region, pages * page, gcpp::ProtectionMode::None);
+    ASSERT_EQ(protection.commit(), 1u);
+    protection.protect(region + page, 2 * page,
+                       gcpp::ProtectionMode::ReadWrite);
+    protection.protect(region + 4 * page, page,
+                       gcpp::ProtectionMode::ReadWrite);
+    ASSERT_EQ(protection.commit(), 2u);
+    ASSERT_EQ(protection.protection(region + 3 * page),
+              gcpp::ProtectionMode::None);
+    // page 4 already has the protection, so pages 3-5 change at once
+    protection.protect(region + 3 * page, page,
+                       gcpp::ProtectionMode::ReadWrite);
+    protection.protect(region + 5 * page, page,
+                       gcpp::ProtectionMode::ReadWrite);
+    ASSERT_EQ(protection.commit(), 1u);
+    ASSERT_EQ(protection.commit(), 0u);
+    for (size_t i = 1; i < 6; ++i) {
+        region[i * page] = std::byte{1};
+        ASSERT_EQ(protection.protection(region + i * page),
+                  gcpp::ProtectionMode::ReadWrite);
+    }
+    ASSERT_TRUE(protection.protect_now(region, page,
+                                       gcpp::ProtectionMode::ReadWrite));
+    region[0] = std::byte{1};
+    munmap(region, pages * page);
+}
+
+TEST(MemProt, FaultHandlers)
+{
+    const auto page = static_cast<size_t>(gcpp::page_size());
+    // more heaps than fit in a fixed size table
+    std::vector<std::unique_ptr<std::byte[]>> heaps;
+    for (int i = 0; i < 512; ++i) {
+        heaps.emplace_back(std::make_unique<std::byte[]>(64));
+        gcpp::register_heap(heaps.back().get(), 64);
+    }
+    auto* const region = static_cast<std::byte*>(mmap(
+        nullptr, page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(region, MAP_FAILED);
+    static int faults = 0;
+    const auto id = gcpp::register_fault_handler(
+        region, page,
+        [](void* ctx, void*) {
+            ++faults;
+            return mprotect(ctx, static_cast<size_t>(gcpp::page_size()),
+                            PROT_READ | PROT_WRITE) == 0;
+        },
+        region);
+    region[10] = std::byte{1};
+    ASSERT_EQ(faults, 1);
+    ASSERT_EQ(region[10], std::byte{1});
+    gcpp::unregister_fault_handler(id);
+    for (const auto& heap : heaps) {
+        gcpp::unregister_heap(heap.get(), 64);
+    }
+    munmap(region, page);
+}
+
+TEST(MemProt, DirtyPageTracking)
+{
+    const auto page = static_cast<size_t>(gcpp::page_size());
+    constexpr size_t pages = 4;
+    auto* const region = static_cast<std::byte*>(
+        mmap(nullptr, pages * page, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(region, MAP_FAILED);
+    region[0] = std::byte{1};
+    gcpp::DirtyPageTracker tracker(region, pages * page,
+                                   gcpp::DirtyTracking::WriteProtect);
+    tracker.start();
+    ASSERT_EQ(region[0], std::byte{1});
+    region[page + 1] = std::byte{2};
+    region[3 * page] = std::byte{3};
+    region[3 * page + 1] = std::byte{3};
+    const auto dirty = tracker.stop();
+    ASSERT_EQ(dirty, std::vector<bool>({false, true, false, true}));
+    // writes after stopping are not tracked
+    region[2 * page] = std::byte{4};
+    tracker.start();
+    ASSERT_EQ(tracker.stop(), std::vector<bool>(pages, false));
+    munmap(region, pages * page);
+}
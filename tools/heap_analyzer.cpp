@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "heap_dump.h"
+
+/*
+Computes the dominator tree and the retained size of every object of a heap
+dump written by `gcpp::dump_heap`.
+
+The retained size of an object is the number of bytes which would be freed if
+the object were freed: its own size plus the retained sizes of the objects it
+dominates, i.e. those which are only reachable through it.
+
+The dump is streamed twice instead of being loaded: once to collect the
+address, size and age of each object, and once to resolve the edges into
+indices of the sorted objects. Only compact arrays indexed by object are kept
+in memory: a few dozen bytes per object and 8 bytes per edge.
+
+Usage: heap_analyzer <dump> [--top N] [--depth D]
+    --top N    objects to list, and children to list per dominator (10)
+    --depth D  levels of the dominator tree to print (3)
+*/
+
+namespace
+{
+/** Index of a node. Node 0 is a virtual root whose edges are the roots */
+using Node = uint32_t;
+constexpr auto no_node = std::numeric_limits<Node>::max();
+
+struct Options {
+    std::string path;
+    size_t top = 10;
+    size_t depth = 3;
+};
+
+/** An object of the dump, from the first pass */
+struct Object {
+    uint64_t address;
+    uint64_t size;
+    uint32_t age;
+    uint32_t edge_count;
+};
+
+/** Objects and edges of a dump, with edges stored in CSR form */
+struct HeapGraph {
+    /** Objects sorted by address. Object `i` is node `i + 1` */
+    std::vector<Object> objects;
+    /** Edges of node `n` are `edges[offsets[n], offsets[n + 1])` */
+    std::vector<uint64_t> offsets;
+    std::vector<Node> edges;
+
+    [[nodiscard]] size_t node_count() const { return objects.size() + 1; }
+
+    [[nodiscard]] uint64_t size(Node node) const
+    {
+        return node == 0 ? 0 : objects[node - 1].size;
+    }
+
+    /** Gets the node of the object containing `addr`, or `no_node` */
+    [[nodiscard]] Node find(uint64_t addr) const
+    {
+        auto it = std::upper_bound(
+            objects.begin(), objects.end(), addr,
+            [](uint64_t a, const Object& obj) { return a < obj.address; });
+        if (it == objects.begin()) {
+            return no_node;
+        }
+        --it;
+        if (addr != it->address && addr >= it->address + it->size) {
+            return no_node;
+        }
+        return static_cast<Node>(it - objects.begin() + 1);
+    }
+};
+
+Options parse_args(int argc, char** argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if ((arg == "--top" || arg == "--depth") && i + 1 < argc) {
+            (arg == "--top" ? opts.top : opts.depth) =
+                std::stoull(argv[++i]);
+        } else if (opts.path.empty()) {
+            opts.path = arg;
+        } else {
+            throw std::invalid_argument("Unexpected argument " + arg);
+        }
+    }
+    if (opts.path.empty()) {
+        throw std::invalid_argument(
+            "Usage: heap_analyzer <dump> [--top N] [--depth D]");
+    }
+    return opts;
+}
+
+/** Calls `on_root` and `on_object` for each record of the dump at `path` */
+template <typename RootFn, typename ObjectFn>
+void read_dump(const std::string& path, RootFn on_root, ObjectFn on_object)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    gcpp::HeapDumpReader reader(file);
+    while (auto record = reader.next()) {
+        if (auto* root = std::get_if<gcpp::HeapDumpRoot>(&*record)) {
+            on_root(*root);
+        } else {
+            on_object(std::get<gcpp::HeapDumpObject>(*record));
+        }
+    }
+}
+
+HeapGraph load_graph(const std::string& path)
+{
+    HeapGraph graph;
+    uint64_t root_count = 0;
+    read_dump(
+        path, [&root_count](const auto&) { ++root_count; },
+        [&graph](const gcpp::HeapDumpObject& obj) {
+            graph.objects.push_back({obj.address, obj.size, obj.age,
+                                     static_cast<uint32_t>(obj.edges.size())});
+        });
+    if (graph.objects.size() >= no_node) {
+        throw std::runtime_error("Too many objects");
+    }
+    std::sort(graph.objects.begin(), graph.objects.end(),
+              [](const auto& a, const auto& b) {
+                  return a.address < b.address;
+              });
+    graph.offsets.resize(graph.node_count() + 1);
+    graph.offsets[1] = root_count;
+    for (size_t i = 0; i < graph.objects.size(); ++i) {
+        graph.offsets[i + 2] =
+            graph.offsets[i + 1] + graph.objects[i].edge_count;
+    }
+    graph.edges.resize(graph.offsets.back(), no_node);
+
+    auto next_root = graph.offsets[0];
+    read_dump(
+        path,
+        [&graph, &next_root](const gcpp::HeapDumpRoot& root) {
+            graph.edges[next_root++] = graph.find(root.target);
+        },
+        [&graph](const gcpp::HeapDumpObject& obj) {
+            const auto node = graph.find(obj.address);
+            auto next = graph.offsets[node];
+            for (const auto edge : obj.edges) {
+                graph.edges[next++] = graph.find(edge);
+            }
+        });
+    return graph;
+}
+
+/** Dominator tree of a heap graph */
+struct Dominators {
+    /** Immediate dominator of each node, `no_node` if unreachable */
+    std::vector<Node> idom;
+    /** Reachable nodes in DFS postorder, ending with the virtual root */
+    std::vector<Node> postorder;
+    /** Retained size of each node */
+    std::vector<uint64_t> retained;
+};
+
+std::vector<Node> dfs_postorder(const HeapGraph& graph)
+{
+    std::vector<Node> postorder;
+    std::vector<bool> seen(graph.node_count());
+    // (node, index of the next edge to visit)
+    std::vector<std::pair<Node, uint64_t>> stack = {{0, graph.offsets[0]}};
+    seen[0] = true;
+    while (!stack.empty()) {
+        auto& [node, next] = stack.back();
+        if (next == graph.offsets[node + 1]) {
+            postorder.push_back(node);
+            stack.pop_back();
+            continue;
+        }
+        const auto succ = graph.edges[next++];
+        if (succ != no_node && !seen[succ]) {
+            seen[succ] = true;
+            stack.emplace_back(succ, graph.offsets[succ]);
+        }
+    }
+    return postorder;
+}
+
+/**
+ * Computes dominators with the iterative algorithm of Cooper, Harvey and
+ * Kennedy, which is simple and fast enough for heap graphs.
+ */
+Dominators dominators(const HeapGraph& graph)
+{
+    const auto count = graph.node_count();
+    Dominators doms;
+    doms.postorder = dfs_postorder(graph);
+    std::vector<Node> order(count, no_node);
+    for (size_t i = 0; i < doms.postorder.size(); ++i) {
+        order[doms.postorder[i]] = static_cast<Node>(i);
+    }
+
+    // predecessors of the reachable nodes, in CSR form
+    std::vector<uint64_t> pred_offsets(count + 1);
+    for (const auto succ : graph.edges) {
+        if (succ != no_node) {
+            ++pred_offsets[succ + 1];
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        pred_offsets[i + 1] += pred_offsets[i];
+    }
+    std::vector<Node> preds(pred_offsets.back());
+    auto fill = pred_offsets;
+    for (Node node = 0; node < count; ++node) {
+        for (auto e = graph.offsets[node]; e < graph.offsets[node + 1]; ++e) {
+            if (const auto succ = graph.edges[e]; succ != no_node) {
+                preds[fill[succ]++] = node;
+            }
+        }
+    }
+
+    auto& idom = doms.idom;
+    idom.assign(count, no_node);
+    idom[0] = 0;
+    const auto intersect = [&idom, &order](Node a, Node b) {
+        while (a != b) {
+            while (order[a] < order[b]) {
+                a = idom[a];
+            }
+            while (order[b] < order[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+    for (auto changed = true; changed;) {
+        changed = false;
+        // reverse postorder, skipping the virtual root
+        for (auto it = doms.postorder.rbegin() + 1;
+             it != doms.postorder.rend(); ++it) {
+            auto new_idom = no_node;
+            for (auto p = pred_offsets[*it]; p < pred_offsets[*it + 1]; ++p) {
+                const auto pred = preds[p];
+                if (idom[pred] == no_node) {
+                    continue;
+                }
+                new_idom =
+                    new_idom == no_node ? pred : intersect(pred, new_idom);
+            }
+            if (idom[*it] != new_idom) {
+                idom[*it] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    // a node is dominated by its DFS ancestors so it precedes its dominators
+    // in postorder
+    doms.retained.resize(count);
+    for (const auto node : doms.postorder) {
+        doms.retained[node] += graph.size(node);
+        if (node != 0) {
+            doms.retained[idom[node]] += doms.retained[node];
+        }
+    }
+    return doms;
+}
+
+void print_node(const HeapGraph& graph, const Dominators& doms, Node node)
+{
+    const auto& obj = graph.objects[node - 1];
+    std::cout << "0x" << std::hex << obj.address << std::dec
+              << " size=" << obj.size << " age=" << obj.age
+              << " retained=" << doms.retained[node];
+}
+
+void print_tree(const HeapGraph& graph, const Dominators& doms,
+                const Options& opts)
+{
+    const auto count = graph.node_count();
+    std::vector<uint64_t> child_offsets(count + 1);
+    for (const auto node : doms.postorder) {
+        if (node != 0) {
+            ++child_offsets[doms.idom[node] + 1];
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        child_offsets[i + 1] += child_offsets[i];
+    }
+    std::vector<Node> children(child_offsets.back());
+    auto fill = child_offsets;
+    for (const auto node : doms.postorder) {
+        if (node != 0) {
+            children[fill[doms.idom[node]]++] = node;
+        }
+    }
+
+    const auto print = [&](const auto& self, Node node, size_t depth) -> void {
+        if (depth == opts.depth) {
+            return;
+        }
+        const auto begin = children.begin() +
+                           static_cast<std::ptrdiff_t>(child_offsets[node]);
+        const auto end = children.begin() +
+                         static_cast<std::ptrdiff_t>(child_offsets[node + 1]);
+        const auto shown = std::min(opts.top, static_cast<size_t>(end - begin));
+        std::partial_sort(begin, begin + static_cast<std::ptrdiff_t>(shown),
+                          end, [&doms](Node a, Node b) {
+                              return doms.retained[a] > doms.retained[b];
+                          });
+        for (auto it = begin; it != begin + static_cast<std::ptrdiff_t>(shown);
+             ++it) {
+            std::cout << std::string(2 * (depth + 1), ' ');
+            print_node(graph, doms, *it);
+            std::cout << '\n';
+            self(self, *it, depth + 1);
+        }
+        if (static_cast<size_t>(end - begin) > shown) {
+            std::cout << std::string(2 * (depth + 1), ' ') << "... "
+                      << static_cast<size_t>(end - begin) - shown << " more\n";
+        }
+    };
+    std::cout << "dominator tree:\n<roots> retained=" << doms.retained[0]
+              << '\n';
+    print(print, 0, 0);
+}
+
+void report(const HeapGraph& graph, const Dominators& doms,
+            const Options& opts)
+{
+    uint64_t total_bytes = 0;
+    for (const auto& obj : graph.objects) {
+        total_bytes += obj.size;
+    }
+    const auto reachable = doms.postorder.size() - 1;
+    std::cout << "objects: " << graph.objects.size() << " (" << total_bytes
+              << " bytes)\n"
+              << "roots: " << graph.offsets[1] << '\n'
+              << "reachable: " << reachable << " (" << doms.retained[0]
+              << " bytes)\n"
+              << "unreachable: " << graph.objects.size() - reachable << " ("
+              << total_bytes - doms.retained[0] << " bytes)\n\n";
+
+    std::vector<Node> largest(doms.postorder.begin(),
+                              doms.postorder.end() - 1);
+    const auto shown = std::min(opts.top, largest.size());
+    std::partial_sort(largest.begin(),
+                      largest.begin() + static_cast<std::ptrdiff_t>(shown),
+                      largest.end(), [&doms](Node a, Node b) {
+                          return doms.retained[a] > doms.retained[b];
+                      });
+    std::cout << "largest retained sizes:\n";
+    for (size_t i = 0; i < shown; ++i) {
+        std::cout << "  ";
+        print_node(graph, doms, largest[i]);
+        std::cout << '\n';
+    }
+    std::cout << '\n';
+    print_tree(graph, doms, opts);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    try {
+        const auto opts = parse_args(argc, argv);
+        const auto graph = load_graph(opts.path);
+        const auto doms = dominators(graph);
+        report(graph, doms, opts);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}